@@ -179,6 +179,7 @@ enc_x264_ENABLED        = DEFAULT and pkg_config_ok("--exists", "x264")
 enc_x265_ENABLED        = (not WIN32) and pkg_config_ok("--exists", "x265")
 pillow_ENABLED          = DEFAULT
 webp_ENABLED            = DEFAULT and pkg_config_version("0.5", "libwebp")
+palette_ENABLED         = DEFAULT
 jpeg_encoder_ENABLED    = DEFAULT and pkg_config_version("1.2", "libturbojpeg")
 jpeg_decoder_ENABLED    = DEFAULT and pkg_config_version("1.4", "libturbojpeg")
 vpx_ENABLED             = DEFAULT and pkg_config_version("1.4", "vpx")
@@ -217,7 +218,7 @@ SWITCHES = [
     "cython", "modules", "data",
     "enc_x264", "enc_x265", "enc_ffmpeg",
     "nvenc", "cuda_kernels", "cuda_rebuild", "nvfbc",
-    "vpx", "webp", "pillow", "jpeg_encoder", "jpeg_decoder",
+    "vpx", "webp", "pillow", "jpeg_encoder", "jpeg_decoder", "palette",
     "nvjpeg",
     "v4l2",
     "dec_avcodec2", "csc_swscale",
@@ -306,6 +307,7 @@ if "clean" not in sys.argv:
         csc_swscale_ENABLED = csc_libyuv_ENABLED = csc_cython_ENABLED = False
         vpx_ENABLED = nvfbc_ENABLED = dec_avcodec2_ENABLED = False
         webp_ENABLED = jpeg_encoder_ENABLED = jpeg_decoder_ENABLED = False
+        palette_ENABLED = False
         server_ENABLED = client_ENABLED = shadow_ENABLED = False
         cython_bencode_ENABLED = False
         gtk3_ENABLED = False
@@ -969,6 +971,8 @@ def clean():
                    "xpra/codecs/libav_common/av_log.c",
                    "xpra/codecs/webp/encoder.c",
                    "xpra/codecs/webp/decoder.c",
+                   "xpra/codecs/palette/encoder.c",
+                   "xpra/codecs/palette/decoder.c",
                    "xpra/codecs/dec_avcodec2/decoder.c",
                    "xpra/codecs/csc_libyuv/colorspace_converter.cpp",
                    "xpra/codecs/csc_swscale/colorspace_converter.c",
@@ -980,6 +984,8 @@ def clean():
                    "xpra/server/cystats.c",
                    "xpra/rectangle.c",
                    "xpra/server/window/motion.c",
+                   "xpra/server/window/damage_heatmap.c",
+                   "xpra/server/window/content_classifier.c",
                    "xpra/server/pam.c",
                    "fs/etc/xpra/xpra.conf",
                    #special case for the generated xpra conf files in build (see #891):
@@ -2022,6 +2028,12 @@ if server_ENABLED or shadow_ENABLED:
     cython_add(Extension("xpra.server.window.motion",
                 ["xpra/server/window/motion.pyx"],
                 **O3_pkgconfig))
+    cython_add(Extension("xpra.server.window.damage_heatmap",
+                ["xpra/server/window/damage_heatmap.pyx"],
+                **O3_pkgconfig))
+    cython_add(Extension("xpra.server.window.content_classifier",
+                ["xpra/server/window/content_classifier.pyx"],
+                **O3_pkgconfig))
 
 if sd_listen_ENABLED:
     sdp = pkgconfig("libsystemd")
@@ -2241,6 +2253,15 @@ if webp_ENABLED:
                 ["xpra/codecs/webp/decoder.pyx"],
                 **webp_pkgconfig))
 
+toggle_packages(palette_ENABLED, "xpra.codecs.palette")
+if palette_ENABLED:
+    cython_add(Extension("xpra.codecs.palette.encoder",
+                ["xpra/codecs/palette/encoder.pyx"],
+                **pkgconfig(optimize=3)))
+    cython_add(Extension("xpra.codecs.palette.decoder",
+                ["xpra/codecs/palette/decoder.pyx"],
+                **pkgconfig(optimize=3)))
+
 toggle_packages(nvjpeg_ENABLED, "xpra.codecs.nvjpeg")
 if nvjpeg_ENABLED:
     if WIN32:
@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+# Headless benchmark suite:
+# synthetic workloads are fed through the server's damage pipeline
+# (see tests/unittests/unit/server/window/headless_pipeline.py),
+# and the packets generated are then sent through a pair of Protocol instances
+# connected with a socketpair.
+# No display, client or external application is needed,
+# and the results are written as JSON so they can be compared between runs:
+#
+# ./benchmark.py --duration=10 --output=results.json
+# ./benchmark.py --scenario=terminal,video --encoding=png
+# ./benchmark.py --scenario=idle --trace=/tmp/xpra-damage-1234.trace
+
+import os
+import sys
+import json
+import socket
+import argparse
+from random import Random
+from time import process_time
+
+from xpra.os_util import monotonic_time, bytestostr
+from xpra.util import AtomicInteger
+#the headless pipeline is shared with the unit tests:
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "unittests"))
+from unit.server.window.headless_pipeline import (  #pylint: disable=wrong-import-position
+    SyntheticWindowModel, HeadlessPipeline, EventLoop,
+    block_pixels,
+    )
+
+
+WHITE = b"\xff\xff\xff\x00"
+BLACK = b"\x00\x00\x00\x00"
+
+
+class Scenario:
+    name = ""
+    width, height = 1024, 768
+    content_type = ""
+    #how often the application updates the window, in milliseconds:
+    interval = 100
+
+    def __init__(self, seed=0):
+        self.rng = Random(seed)
+        self.count = 0
+
+    def tick(self, model, damage):
+        raise NotImplementedError()
+
+
+class TextScenario(Scenario):
+    line_height = 16
+
+    def __init__(self, seed=0):
+        super().__init__(seed)
+        #a small font of random 8x16 glyphs, one bytestring per glyph row:
+        self.glyphs = []
+        for _ in range(64):
+            self.glyphs.append(tuple(b"".join(BLACK if self.rng.random()<0.3 else WHITE for _ in range(8))
+                                     for _ in range(self.line_height)))
+
+    def text(self, chars, width):
+        """ renders the glyphs on a white background of the given width """
+        padding = WHITE*(width-len(chars)*8)
+        return b"".join(b"".join(glyph[row] for glyph in chars)+padding for row in range(self.line_height))
+
+    def random_chars(self, n):
+        return [self.rng.choice(self.glyphs) for _ in range(n)]
+
+
+class TerminalScrolling(TextScenario):
+    """ a terminal scrolling up one line of text at a time """
+    name = "terminal"
+    width, height = 800, 600
+    content_type = "text"
+    interval = 20
+
+    def text_line(self):
+        return self.text(self.random_chars(self.rng.randint(0, self.width//8)), self.width)
+
+    def tick(self, model, damage):
+        lh = self.line_height
+        model.scroll(lh)
+        model.paint(0, self.height-lh, self.width, lh, self.text_line())
+        damage(0, 0, self.width, self.height)
+
+
+class Video(Scenario):
+    """ a video playing in part of the window """
+    name = "video"
+    content_type = "video"
+    interval = 40
+    video_size = 640, 360
+
+    def __init__(self, seed=0):
+        super().__init__(seed)
+        w, h = self.video_size
+        self.frames = tuple(block_pixels(self.rng, w, h, 16) for _ in range(8))
+
+    def tick(self, model, damage):
+        w, h = self.video_size
+        x, y = (self.width-w)//2, (self.height-h)//2
+        model.paint(x, y, w, h, self.frames[self.count % len(self.frames)])
+        self.count += 1
+        damage(x, y, w, h)
+
+
+class Browser(Scenario):
+    """ page scrolling with small animated areas """
+    name = "browser"
+    width, height = 1280, 800
+    content_type = "browser"
+    interval = 50
+    scroll_step = 48
+
+    def tick(self, model, damage):
+        self.count += 1
+        if self.count % 10 < 3:
+            s = self.scroll_step
+            model.scroll(s)
+            model.paint(0, self.height-s, self.width, s, block_pixels(self.rng, self.width, s))
+            damage(0, 0, self.width, self.height)
+            return
+        for _ in range(self.rng.randint(1, 3)):
+            w = self.rng.randint(16, 300)
+            h = self.rng.randint(16, 250)
+            x = self.rng.randint(0, self.width-w)
+            y = self.rng.randint(0, self.height-h)
+            model.paint(x, y, w, h, block_pixels(self.rng, w, h, 4))
+            damage(x, y, w, h)
+
+
+class Spreadsheet(TextScenario):
+    """
+        a few cells are recalculated at a time,
+        and the application repaints the whole sheet
+    """
+    name = "spreadsheet"
+    content_type = "text"
+    interval = 100
+    cell_size = 80, 20
+    sheet = 0, 40, 1024, 700
+
+    def tick(self, model, damage):
+        if self.count==0:
+            #draw the grid:
+            sx, sy, sw, sh = self.sheet
+            cw, ch = self.cell_size
+            row = b"".join((BLACK if x%cw==0 else WHITE) for x in range(sw))
+            model.paint(sx, sy, sw, sh, b"".join((BLACK*sw if y%ch==0 else row) for y in range(sh)))
+        self.count += 1
+        sx, sy, sw, sh = self.sheet
+        cw, ch = self.cell_size
+        for _ in range(self.rng.randint(1, 3)):
+            x = sx+self.rng.randrange(sw//cw)*cw+2
+            y = sy+self.rng.randrange(sh//ch)*ch+2
+            model.paint(x, y, cw-4, self.line_height, self.text(self.random_chars(self.rng.randint(1, 8)), cw-4))
+        damage(*self.sheet)
+
+
+class IDE(TextScenario):
+    """
+        typing in an editor: the current line and the status bar are repainted
+        after each keystroke
+    """
+    name = "ide"
+    content_type = "text"
+    interval = 50
+    status_height = 20
+
+    def __init__(self, seed=0):
+        super().__init__(seed)
+        self.line = []
+        self.y = 0
+
+    def tick(self, model, damage):
+        self.count += 1
+        lh = self.line_height
+        if len(self.line)>=self.rng.randint(20, 100):
+            self.line = []
+            self.y = (self.y+lh) % (self.height-self.status_height-lh)
+        self.line += self.random_chars(1)
+        model.paint(0, self.y, self.width, lh, self.text(self.line, self.width))
+        damage(0, self.y, self.width, lh)
+        #the cursor position:
+        sy = self.height-self.status_height
+        status = self.text(self.random_chars(12), self.width)
+        model.paint(0, sy+2, self.width, lh, status)
+        damage(0, sy, self.width, self.status_height)
+
+
+class Idle(Scenario):
+    """ a blinking cursor """
+    name = "idle"
+    content_type = "text"
+    interval = 500
+
+    def tick(self, model, damage):
+        self.count += 1
+        model.paint(100, 100, 2, 16, (BLACK if self.count%2 else WHITE)*32)
+        damage(100, 100, 2, 16)
+
+
+SCENARIOS = dict((c.name, c) for c in (TerminalScrolling, Video, Browser, Spreadsheet, IDE, Idle))
+
+
+def run_scenario(scenario_class, duration, encoding="auto", ack_delay=0, packets=None):
+    scenario = scenario_class()
+    model = SyntheticWindowModel(scenario.width, scenario.height, scenario.content_type)
+    packet_cb = packets.append if packets is not None else None
+    pipeline = HeadlessPipeline(model, encoding, ack_delay=ack_delay, packet_cb=packet_cb)
+    def tick():
+        scenario.tick(model, pipeline.damage)
+        return True
+    pipeline.loop.timeout_add(scenario.interval, tick)
+    start = monotonic_time()
+    pipeline.run(duration)
+    result = pipeline.get_results(monotonic_time()-start)
+    pipeline.cleanup()
+    return result
+
+
+def run_protocol(packets, repeat=10, timeout=60):
+    """
+        sends the packets through a pair of Protocol instances connected with a socketpair,
+        and measures the time it takes for each packet to be received
+    """
+    from xpra.net import packet_encoding, compression
+    from xpra.net.protocol import Protocol
+    from xpra.net.bytestreams import SocketConnection
+    from xpra.server.cystats import LatencyHistogram   #@UnresolvedImport
+    packet_encoding.init_all()
+    compression.init_all()
+    loop = EventLoop()
+    total = len(packets)*repeat
+    sent_at = {}
+    latency = LatencyHistogram()
+    received = AtomicInteger()
+    received_bytes = AtomicInteger()
+    index = AtomicInteger()
+    def get_packet():
+        i = index.increase()-1
+        packet = list(packets[i % len(packets)])
+        #use the packet sequence number to match the packets:
+        packet[8] = i
+        sent_at[i] = monotonic_time()
+        return (packet, None, None, None, True, i+1<total)
+    def process_packet(_proto, packet):
+        if bytestostr(packet[0])!="draw":
+            return
+        latency.record(monotonic_time()-sent_at.pop(packet[8], 0))
+        received_bytes.increase(len(packet[7]))
+        received.increase()
+    sockets = socket.socketpair()
+    protocols = []
+    for i, sock in enumerate(sockets):
+        conn = SocketConnection(sock, "", "", "benchmark", "socket")
+        p = Protocol(loop, conn, process_packet, get_packet if i==0 else None)
+        p.enable_default_encoder()
+        p.enable_default_compressor()
+        protocols.append(p)
+        p.start()
+    start = monotonic_time()
+    cpu_start = process_time()
+    loop.idle_add(protocols[0].source_has_more)
+    while received.get()<total and monotonic_time()-start<timeout:
+        loop.run(0.01)
+    elapsed = monotonic_time()-start
+    cpu = process_time()-cpu_start
+    for p in protocols:
+        p.close()
+    loop.run(0.1)
+    count = received.get()
+    return {
+        "packets"           : count,
+        "bytes"             : received_bytes.get(),
+        "duration"          : round(elapsed, 3),
+        "packets-per-second": round(count/elapsed, 1),
+        "MBps"              : round(received_bytes.get()/elapsed/1024/1024, 2),
+        #in microseconds:
+        "latency"           : latency.get_info(),
+        "cpu"               : round(cpu, 3),
+        "cpu-per-packet-ms" : round(cpu*1000/max(1, count), 3),
+        }
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="headless xpra benchmark")
+    parser.add_argument("--scenario", default=",".join(SCENARIOS.keys()),
+                        help="comma separated list of scenarios: %s" % ", ".join(SCENARIOS.keys()))
+    parser.add_argument("--duration", type=float, default=5, help="duration of each scenario, in seconds")
+    parser.add_argument("--encoding", default="auto", help="the encoding to use")
+    parser.add_argument("--ack-delay", type=int, default=0, help="simulated client latency, in milliseconds")
+    parser.add_argument("--protocol-repeat", type=int, default=10,
+                        help="how many times to send the packets through the network layer (0 to skip)")
+    parser.add_argument("--trace", action="append", default=[],
+                        help="damage trace file to replay (see the 'damage-trace' control command)")
+    parser.add_argument("--output", default=None, help="JSON output file (defaults to stdout)")
+    args = parser.parse_args(argv[1:])
+    from xpra.version_util import full_version_str
+    results = {
+        "version"   : full_version_str(),
+        "python"    : sys.version.split(" ")[0],
+        "encoding"  : args.encoding,
+        "scenarios" : {},
+        }
+    packets = []
+    for name in filter(None, args.scenario.split(",")):
+        scenario_class = SCENARIOS.get(name)
+        if not scenario_class:
+            raise ValueError("invalid scenario '%s'" % name)
+        results["scenarios"][name] = run_scenario(scenario_class, args.duration,
+                                                  args.encoding, args.ack_delay, packets)
+    if args.trace:
+        from unit.server.window.headless_pipeline import replay
+        results["traces"] = dict((trace, replay(trace, encoding=args.encoding, ack_delay=args.ack_delay))
+                                 for trace in args.trace)
+    if packets and args.protocol_repeat>0:
+        results["protocol"] = run_protocol(packets, args.protocol_repeat)
+    data = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(data)
+    else:
+        print(data)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+# Compares the encodings chosen by the content classifier
+# with the ones chosen from the region size, speed and quality alone:
+# each image of the corpus is compressed with both choices
+# and we record the compressed size and the time it took.
+# Lossy encodings are followed by a lossless auto-refresh,
+# which is included in the totals.
+# The corpus is made of synthetic images,
+# and of any image files found in the directories specified:
+#
+# ./content_classifier_eval.py
+# ./content_classifier_eval.py --corpus=~/screenshots --output=results.json
+
+import os
+import sys
+import json
+import math
+import argparse
+from random import Random
+from time import perf_counter
+
+from xpra.codecs.image_wrapper import ImageWrapper
+from xpra.server.window.content_classifier import classify, CLASS_NAMES    #@UnresolvedImport
+#the headless pipeline is shared with the unit tests:
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "unittests"))
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, block_pixels  #pylint: disable=wrong-import-position
+
+
+WHITE = b"\xff\xff\xff\x00"
+BLACK = b"\x00\x00\x00\x00"
+
+LOSSY = ("jpeg", "webp")
+CLASSIFY_RUNS = 100
+
+#(name, speed, quality):
+SETTINGS = (
+    ("default", 40, 65),
+    ("fast", 90, 30),
+    ("quality", 20, 90),
+    )
+
+
+def text_image(rng, w, h):
+    glyphs = tuple(tuple(b"".join(BLACK if rng.random()<0.3 else WHITE for _ in range(8)) for _ in range(16))
+                   for _ in range(64))
+    rows = []
+    for _ in range(h//16):
+        chars = [rng.choice(glyphs) for _ in range(rng.randint(w//32, w//8))]
+        padding = WHITE*(w-len(chars)*8)
+        rows += [b"".join(glyph[row] for glyph in chars)+padding for row in range(16)]
+    rows += [WHITE*w]*(h-len(rows))
+    return b"".join(rows)
+
+def flat_image(_rng, w, h):
+    return b"\xee\xee\xee\x00"*(w*h)
+
+def photo_image(rng, w, h):
+    data = bytearray(w*h*4)
+    i = 0
+    for y in range(h):
+        for x in range(w):
+            v = int(128+60*math.sin(x/37)+40*math.cos(y/23))+rng.randint(-6, 6)
+            data[i:i+3] = bytes((v&0xff, (v+40)&0xff, (255-v)&0xff))
+            i += 4
+    return bytes(data)
+
+def gradient_image(_rng, w, h):
+    return b"".join(bytes((x*255//w, y*255//h, 128, 0)) for y in range(h) for x in range(w))
+
+def ui_image(rng, w, h):
+    return block_pixels(rng, w, h, 32)
+
+def noise_image(rng, w, h):
+    return block_pixels(rng, w, h, 1)
+
+SYNTHETIC = {
+    "text"      : text_image,
+    "flat"      : flat_image,
+    "photo"     : photo_image,
+    "gradient"  : gradient_image,
+    "ui"        : ui_image,
+    "noise"     : noise_image,
+    }
+
+
+def load_corpus(dirs):
+    from PIL import Image
+    for d in dirs:
+        d = os.path.expanduser(d)
+        for filename in sorted(os.listdir(d)):
+            try:
+                img = Image.open(os.path.join(d, filename))
+            except Exception:
+                continue
+            w, h = img.size
+            yield filename, w, h, img.convert("RGBA").tobytes("raw", "BGRX")
+
+
+def make_image(w, h, pixels):
+    return ImageWrapper(0, 0, w, h, pixels, "BGRX", 24, w*4, planes=ImageWrapper.PACKED)
+
+
+def compress(ws, coding, w, h, pixels, speed, quality):
+    image = make_image(w, h, pixels)
+    start = perf_counter()
+    ret = ws._encoders[coding](coding, image, {"speed" : speed, "quality" : quality})
+    elapsed = perf_counter()-start
+    return len(ret[1]), elapsed, ret[2].get("quality", 100)
+
+
+def evaluate(name, w, h, pixels):
+    model = SyntheticWindowModel(w, h)
+    pipeline = HeadlessPipeline(model, "auto", video=False)
+    ws = pipeline.window_source
+    start = perf_counter()
+    for _ in range(CLASSIFY_RUNS):
+        content_class = classify(pixels, w, h, w*4)[0]
+    classify_time = (perf_counter()-start)/CLASSIFY_RUNS
+    result = {
+        "size"          : (w, h),
+        "class"         : CLASS_NAMES[content_class],
+        "classify-us"   : round(classify_time*1000*1000, 1),
+        }
+    refresh_encoding = ws.get_refresh_encoding(w, h, ws.refresh_speed, ws.refresh_quality, "auto")
+    for setting, speed, quality in SETTINGS:
+        current = ws.get_best_encoding(w, h, speed, quality, "auto")
+        classified = ws.get_content_encoding(content_class, w, h, speed, quality, current)
+        r = {}
+        for label, coding in (("current", current), ("classifier", classified)):
+            size, elapsed, actual_quality = compress(ws, coding, w, h, pixels, speed, quality)
+            v = r[label] = {
+                "encoding"  : coding,
+                "bytes"     : size,
+                "ms"        : round(elapsed*1000, 2),
+                }
+            if coding in LOSSY and actual_quality<ws.refresh_quality:
+                rsize, relapsed = compress(ws, refresh_encoding, w, h, pixels,
+                                           ws.refresh_speed, ws.refresh_quality)[:2]
+                v["refresh"] = refresh_encoding
+                size += rsize
+                elapsed += relapsed
+            v["total-bytes"] = size
+            v["total-ms"] = round(elapsed*1000, 2)
+        result[setting] = r
+    pipeline.cleanup()
+    return result
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="content classifier evaluation")
+    parser.add_argument("--corpus", action="append", default=[], help="directory containing images to add to the corpus")
+    parser.add_argument("--size", default="512x384", help="size of the synthetic images")
+    parser.add_argument("--output", default=None, help="JSON output file (defaults to stdout)")
+    args = parser.parse_args(argv[1:])
+    w, h = (int(x) for x in args.size.split("x"))
+    rng = Random(0)
+    images = [(name, w, h, fn(rng, w, h)) for name, fn in SYNTHETIC.items()]
+    images += list(load_corpus(args.corpus))
+    results = {"images" : {}}
+    totals = {}
+    for name, iw, ih, pixels in images:
+        r = results["images"][name] = evaluate(name, iw, ih, pixels)
+        for setting, _, _ in SETTINGS:
+            for label, v in r[setting].items():
+                t = totals.setdefault(setting, {}).setdefault(label, {"bytes" : 0, "ms" : 0})
+                t["bytes"] += v["total-bytes"]
+                t["ms"] = round(t["ms"]+v["total-ms"], 2)
+    results["totals"] = totals
+    data = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(data)
+    else:
+        print(data)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+# Compares the network threads of each connection with the shared epoll reactor:
+# many pairs of Protocol instances connected with socketpairs exchange ping / pong packets,
+# and we measure the number of threads, the context switches, the cpu usage and the latency:
+#
+# ./reactor_benchmark.py --connections=100 --pings=100
+
+import os
+import sys
+import socket
+import argparse
+import threading
+from collections import deque
+from resource import getrusage, RUSAGE_SELF
+from time import process_time
+
+from xpra.os_util import monotonic_time, bytestostr
+from xpra.util import AtomicInteger
+#the headless pipeline is shared with the unit tests:
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "unittests"))
+from unit.server.window.headless_pipeline import EventLoop  #pylint: disable=wrong-import-position
+
+
+class Endpoint:
+
+    def __init__(self, loop, sock, pings, done):
+        from xpra.net.protocol import Protocol
+        from xpra.net.bytestreams import SocketConnection
+        self.queue = deque()
+        self.pings = pings
+        self.done = done
+        self.latency = []
+        self.sent_at = 0
+        conn = SocketConnection(sock, "", "", "benchmark", "socket")
+        self.protocol = Protocol(loop, conn, self.process_packet, self.get_packet)
+        self.protocol.enable_default_encoder()
+        self.protocol.enable_default_compressor()
+
+    def get_packet(self):
+        try:
+            packet = self.queue.popleft()
+        except IndexError:
+            return (None, )
+        return (packet, None, None, None, True, bool(self.queue))
+
+    def send(self, packet):
+        self.queue.append(packet)
+        self.protocol.source_has_more()
+
+    def ping(self):
+        self.sent_at = monotonic_time()
+        self.send(["ping", len(self.latency), b"x"*128])
+
+    def process_packet(self, _proto, packet):
+        packet_type = bytestostr(packet[0])
+        if packet_type=="ping":
+            self.send(["pong"]+list(packet[1:]))
+        elif packet_type=="pong":
+            self.latency.append(monotonic_time()-self.sent_at)
+            if len(self.latency)<self.pings:
+                self.ping()
+            else:
+                self.done.increase()
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    return values[min(len(values)-1, int(len(values)*p/100))]
+
+
+def run(connections, pings, use_reactor, timeout=60):
+    from xpra.net import protocol, packet_encoding, compression
+    packet_encoding.init_all()
+    compression.init_all()
+    protocol.REACTOR = use_reactor
+    loop = EventLoop()
+    done = AtomicInteger()
+    threads_before = threading.active_count()
+    clients = []
+    servers = []
+    for _ in range(connections):
+        s1, s2 = socket.socketpair()
+        clients.append(Endpoint(loop, s1, pings, done))
+        servers.append(Endpoint(loop, s2, pings, done))
+    endpoints = clients+servers
+    for e in endpoints:
+        e.protocol.start()
+        #start the format threads (if any) from this thread:
+        e.protocol.source_has_more()
+    loop.run(0.1)
+    threads = threading.active_count()-threads_before
+    ru_start = getrusage(RUSAGE_SELF)
+    cpu_start = process_time()
+    start = monotonic_time()
+    for c in clients:
+        c.ping()
+    while done.get()<connections and monotonic_time()-start<timeout:
+        loop.run(0.01)
+    elapsed = monotonic_time()-start
+    cpu = process_time()-cpu_start
+    ru_end = getrusage(RUSAGE_SELF)
+    for e in endpoints:
+        e.protocol.close()
+    loop.run(0.1)
+    latency = sorted(sum((c.latency for c in clients), []))
+    def ms(v):
+        return round(v*1000, 3)
+    return {
+        "threads"               : threads,
+        "completed"             : done.get(),
+        "round-trips"           : len(latency),
+        "round-trips-per-second": round(len(latency)/elapsed),
+        "cpu"                   : round(cpu/elapsed, 2),
+        "voluntary-switches"    : ru_end.ru_nvcsw-ru_start.ru_nvcsw,
+        "involuntary-switches"  : ru_end.ru_nivcsw-ru_start.ru_nivcsw,
+        "latency-ms"            : {
+            "avg"   : ms(sum(latency)/max(1, len(latency))),
+            "50p"   : ms(percentile(latency, 50)),
+            "90p"   : ms(percentile(latency, 90)),
+            "99p"   : ms(percentile(latency, 99)),
+            },
+        }
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="network reactor benchmark")
+    parser.add_argument("--connections", type=int, default=100, help="number of connections")
+    parser.add_argument("--pings", type=int, default=100, help="number of round trips for each connection")
+    args = parser.parse_args(argv[1:])
+    for use_reactor in (False, True):
+        r = run(args.connections, args.pings, use_reactor)
+        print("%-8s : %s" % (["threads", "reactor"][use_reactor], r))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
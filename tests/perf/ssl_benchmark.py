@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+# Measures the throughput and cpu usage of SSL connections over loopback,
+# with and without kernel TLS offload:
+#
+# ./ssl_benchmark.py --size=1024 --chunk=262144
+
+import os
+import sys
+import socket
+import argparse
+import tempfile
+import datetime
+from threading import Thread
+from time import process_time
+
+from xpra.os_util import monotonic_time
+from xpra.net import socket_util
+from xpra.net.bytestreams import is_ktls
+
+
+def make_certificate(dirname):
+    from cryptography import x509
+    from cryptography.x509.oid import NameOID
+    from cryptography.hazmat.primitives import hashes, serialization
+    from cryptography.hazmat.primitives.asymmetric import ec
+    key = ec.generate_private_key(ec.SECP256R1())
+    name = x509.Name([x509.NameAttribute(NameOID.COMMON_NAME, "localhost")])
+    now = datetime.datetime.now(datetime.timezone.utc)
+    cert = x509.CertificateBuilder().subject_name(name).issuer_name(name).public_key(
+        key.public_key()).serial_number(x509.random_serial_number()).not_valid_before(
+        now).not_valid_after(now+datetime.timedelta(days=1)).sign(key, hashes.SHA256())
+    cert_file = os.path.join(dirname, "cert.pem")
+    key_file = os.path.join(dirname, "key.pem")
+    with open(cert_file, "wb") as f:
+        f.write(cert.public_bytes(serialization.Encoding.PEM))
+    with open(key_file, "wb") as f:
+        f.write(key.private_bytes(serialization.Encoding.PEM,
+                                  serialization.PrivateFormat.TraditionalOpenSSL,
+                                  serialization.NoEncryption()))
+    return cert_file, key_file
+
+
+def run(cert_file, key_file, size, chunk):
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(1)
+    server_wrap = socket_util.get_ssl_wrap_socket_fn(cert=cert_file, key=key_file,
+                                                     client_verify_mode="none", server_side=True)
+    client_wrap = socket_util.get_ssl_wrap_socket_fn(server_verify_mode="none", server_side=False)
+    result = {}
+    def serve():
+        sock = server_wrap(listener.accept()[0])
+        sock.do_handshake()
+        result["server-ktls"] = is_ktls(sock)
+        data = os.urandom(chunk)
+        sent = 0
+        while sent<size:
+            sock.sendall(data)
+            sent += len(data)
+        sock.close()
+    t = Thread(target=serve, daemon=True)
+    t.start()
+    client = socket.create_connection(listener.getsockname())
+    sock = client_wrap(client)
+    result["client-ktls"] = is_ktls(sock)
+    start = monotonic_time()
+    cpu_start = process_time()
+    received = 0
+    while received<size:
+        data = sock.recv(chunk)
+        if not data:
+            break
+        received += len(data)
+    elapsed = monotonic_time()-start
+    cpu = process_time()-cpu_start
+    t.join()
+    sock.close()
+    listener.close()
+    result.update({
+        "received"  : received,
+        "MB/s"      : round(received/elapsed/1024/1024),
+        "cpu"       : round(cpu/elapsed, 2),
+        })
+    return result
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="SSL loopback throughput benchmark")
+    parser.add_argument("--size", type=int, default=1024, help="amount of data to send, in MB")
+    parser.add_argument("--chunk", type=int, default=256*1024, help="size of each write, in bytes")
+    args = parser.parse_args(argv[1:])
+    with tempfile.TemporaryDirectory() as tmpdir:
+        cert_file, key_file = make_certificate(tmpdir)
+        for ktls in (False, True):
+            socket_util.SSL_KTLS = ktls
+            r = run(cert_file, key_file, args.size*1024*1024, args.chunk)
+            print("ktls option %-5s : %s" % (ktls, r))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -9,9 +9,9 @@ import binascii
 
 from xpra.os_util import strtobytes, monotonic_time
 try:
-    from xpra.buffers.cyxor import xor_str       #@UnresolvedImport
+    from xpra.buffers.cyxor import xor_str, xor_delta, and_mask     #@UnresolvedImport
 except ImportError:
-    xor_str = None
+    xor_str = xor_delta = and_mask = None
 def h(v):
     return binascii.hexlify(v)
 
@@ -52,6 +52,31 @@ class TestHMAC(unittest.TestCase):
             self.fail_xor(lstr, ff)
             self.fail_xor(bool, int)
 
+    def test_xor_delta(self):
+        for l in (0, 1, 7, 8, 9, 64, 1001):
+            a = bytes(i & 0xff for i in range(l))
+            out, changed = xor_delta(a, a)
+            self.assertEqual(bytes(out), b"\0"*l)
+            self.assertEqual(changed, 0)
+            if not l:
+                continue
+            b = bytearray(a)
+            b[0] ^= 0x10
+            b[-1] ^= 0x01
+            out, changed = xor_delta(b, a)
+            self.assertEqual(bytes(out), bytes(xor_str(b, a)))
+            #two bytes in the same word only count once,
+            #the bytes which do not fill a word are counted individually:
+            self.assertEqual(changed, 1 if l in (1, 8) else 2)
+        self.assertRaises(Exception, xor_delta, b"\0"*8, b"\0"*9)
+
+    def test_and_mask(self):
+        for l in (0, 1, 7, 8, 9, 1001):
+            a = bytes(i & 0xff for i in range(l))
+            self.assertEqual(bytes(and_mask(a, 0xff)), a)
+            self.assertEqual(bytes(and_mask(a, 0xf8)), bytes(v & 0xf8 for v in a))
+            #the residual restores the original:
+            self.assertEqual(bytes(xor_str(and_mask(a, 0xf8), and_mask(a, 0x07))), a)
 
     def test_large_xor_speed(self):
         start = monotonic_time()
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+from threading import Lock
+
+from xpra.util import AdHocStruct, typedict
+from xpra.client import client_window_base
+from xpra.client.client_window_base import ClientWindowBase
+
+
+SCROLLS = ((0, 10, 100, 90, 0, -10), )
+
+
+class FakeBacking:
+    def __init__(self):
+        self.draw_needs_refresh = False
+        self.repaint_all = False
+        self.scrolled = []
+        self.painted = []
+    def paint_scroll(self, scrolls, _options, callbacks):
+        self.scrolled.append(scrolls)
+        for cb in callbacks:
+            cb(True)
+    def draw_region(self, x, y, width, height, coding, img_data, rowstride, options, callbacks):
+        if coding=="scroll":
+            self.paint_scroll(img_data, options, callbacks)
+        else:
+            self.painted.append((x, y, width, height))
+
+
+class FakeWindow(ClientWindowBase):
+    def __init__(self):     #pylint: disable=super-init-not-called
+        self._id = 1
+        self._backing = FakeBacking()
+        self.refreshes = []
+        self._client = AdHocStruct()
+        self._client.send_refresh = self.refreshes.append
+        self.pending_refresh = []
+        self.scroll_lock = Lock()
+        self.scroll_learned = {}
+        self.scroll_wheel = None
+        self.scroll_predicted = None
+        self.scroll_predicted_paint = False
+        self.scroll_prediction_timer = None
+        self.scroll_prediction_hits = 0
+        self.scroll_prediction_misses = 0
+        self.timers = []
+    def timeout_add(self, _delay, fn, *args):
+        self.timers.append((fn, args))
+        return len(self.timers)
+    def source_remove(self, timer):
+        self.timers[timer-1] = None
+    def idle_add(self, fn, *args):
+        fn(*args)
+    def fire_timers(self):
+        timers = self.timers
+        self.timers = []
+        for t in timers:
+            if t:
+                t[0](*t[1])
+
+    def draw(self, coding="scroll", img_data=SCROLLS):
+        self.draw_region(0, 0, 100, 100, coding, img_data, 0, 0, typedict(), [])
+
+    def learn(self, button=5):
+        for _ in range(client_window_base.SCROLL_PREDICTION_CONFIDENCE):
+            self.predict_scroll(button)
+            assert not self.scroll_predicted
+            self.draw()
+
+
+class ScrollPredictionTest(unittest.TestCase):
+
+    def setUp(self):
+        self.saved = client_window_base.SCROLL_PREDICTION
+        client_window_base.SCROLL_PREDICTION = True
+
+    def tearDown(self):
+        client_window_base.SCROLL_PREDICTION = self.saved
+
+    def test_learn(self):
+        window = FakeWindow()
+        window.learn()
+        self.assertEqual(window.scroll_learned.get(5), (SCROLLS, client_window_base.SCROLL_PREDICTION_CONFIDENCE))
+        self.assertEqual(len(window._backing.scrolled), client_window_base.SCROLL_PREDICTION_CONFIDENCE)
+        #a different scroll resets the count:
+        window.predict_scroll(5)
+        window.draw(img_data=((0, 0, 100, 90, 0, 10), ))
+        self.assertEqual(window.scroll_learned[5][1], 1)
+
+    def test_confirm(self):
+        window = FakeWindow()
+        window.learn()
+        n = len(window._backing.scrolled)
+        window.predict_scroll(5)
+        assert window.scroll_predicted
+        #the scroll is applied straight away:
+        self.assertEqual(len(window._backing.scrolled), n+1)
+        #and not again when the server confirms it:
+        window.draw()
+        self.assertEqual(len(window._backing.scrolled), n+1)
+        self.assertEqual(window.scroll_prediction_hits, 1)
+        assert not window.scroll_predicted
+        assert not window.refreshes
+        #the timer has been cancelled:
+        window.fire_timers()
+        self.assertEqual(window.scroll_prediction_misses, 0)
+
+    def test_mismatch(self):
+        window = FakeWindow()
+        window.learn()
+        window.predict_scroll(5)
+        window.draw(img_data=((0, 0, 100, 90, 0, 10), ))
+        self.assertEqual(window.scroll_prediction_misses, 1)
+        self.assertEqual(window.refreshes, [1])
+
+    def test_paint_before_confirmation(self):
+        window = FakeWindow()
+        window.learn()
+        window.predict_scroll(5)
+        #a paint generated before the server scrolled the window:
+        window.draw("rgb32", b"")
+        window.draw()
+        self.assertEqual(window.scroll_prediction_hits, 0)
+        self.assertEqual(window.scroll_prediction_misses, 1)
+        self.assertEqual(window.refreshes, [1])
+        #the next prediction starts clean:
+        window.predict_scroll(5)
+        window.draw()
+        self.assertEqual(window.scroll_prediction_hits, 1)
+
+    def test_timeout(self):
+        window = FakeWindow()
+        window.learn()
+        window.predict_scroll(5)
+        window.fire_timers()
+        self.assertEqual(window.scroll_prediction_misses, 1)
+        self.assertEqual(window.refreshes, [1])
+        assert not window.scroll_predicted
+        #we have to learn again:
+        assert 5 not in window.scroll_learned
+        window.predict_scroll(5)
+        assert not window.scroll_predicted
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
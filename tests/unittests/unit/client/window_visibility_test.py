@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.util import AdHocStruct
+from xpra.client.mixins.window_manager import WindowClient
+
+
+class FakeWindow:
+    def __init__(self, x, y, w, h, opaque=True):
+        self.geometry = x, y, w, h
+        self.opaque = opaque
+    def is_tray(self):
+        return False
+    def is_OR(self):
+        return False
+    def get_visible_geometry(self):
+        return self.geometry
+    def is_opaque(self):
+        return self.opaque
+
+
+def update_visibility(*windows):
+    """ the windows are given from bottom to top """
+    client = AdHocStruct()
+    client._id_to_window = dict((i+1, w) for i, w in enumerate(windows))
+    client._window_to_id = dict((w, i+1) for i, w in enumerate(windows))
+    client._window_visibility = {}
+    client.get_window_stacking_order = lambda : list(windows)
+    client.cx = client.cy = lambda v : v
+    sent = {}
+    def send(packet_type, wid, regions):
+        assert packet_type=="window-visibility"
+        sent[wid] = regions
+    client.send = send
+    WindowClient.update_window_visibility(client)
+    return sent
+
+
+class TestWindowVisibility(unittest.TestCase):
+
+    def test_opaque(self):
+        sent = update_visibility(FakeWindow(0, 0, 200, 100), FakeWindow(100, 0, 100, 100))
+        self.assertEqual(sent[1], ((0, 0, 100, 100), ))
+        assert sent.get(2) is None, "window 2 should be fully visible"
+
+    def test_transparent(self):
+        #windows with an alpha channel or a shape don't hide the ones below them:
+        sent = update_visibility(FakeWindow(0, 0, 200, 100), FakeWindow(100, 0, 100, 100, False))
+        assert sent.get(1) is None, "window 1 should be fully visible"
+        assert sent.get(2) is None, "window 2 should be fully visible"
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
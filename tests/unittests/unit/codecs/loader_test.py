@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import json
+import tempfile
+import unittest
+
+from xpra.codecs import loader
+from unit.test_util import silence_error
+
+
+class TestLoader(unittest.TestCase):
+
+    def setUp(self):
+        self.saved = loader.PROBE_CACHE, dict(loader.codecs), dict(loader.codec_errors)
+        self.tmpdir = tempfile.mkdtemp()
+        loader.PROBE_CACHE = os.path.join(self.tmpdir, "probe.json")
+        self.reset()
+
+    def tearDown(self):
+        loader.PROBE_CACHE, codecs, codec_errors = self.saved
+        self.reset()
+        loader.codecs.update(codecs)
+        loader.codec_errors.update(codec_errors)
+        for f in os.listdir(self.tmpdir):
+            os.unlink(os.path.join(self.tmpdir, f))
+        os.rmdir(self.tmpdir)
+
+    def reset(self):
+        loader.codecs.clear()
+        loader.codec_errors.clear()
+        loader.probe_cache.clear()
+        loader.probe_cache_loaded = False
+
+    def count_selftests(self, *modules):
+        calls = []
+        for module in modules:
+            selftest = module.selftest
+            def counting_selftest(full=False, selftest=selftest, module=module):
+                calls.append(module)
+                return selftest(full)
+            module.selftest = counting_selftest
+            self.addCleanup(setattr, module, "selftest", selftest)
+        return calls
+
+    def test_probe_cache(self):
+        try:
+            from xpra.codecs.palette import encoder, decoder   #@UnresolvedImport
+        except ImportError:
+            print("palette codec not found, test skipped")
+            return
+        calls = self.count_selftests(encoder, decoder)
+        loader.load_codec_list("enc_palette", "dec_palette")
+        assert loader.has_codec("enc_palette") and loader.has_codec("dec_palette")
+        self.assertEqual(len(calls), 2)
+        with open(loader.PROBE_CACHE, "r") as f:
+            cached = json.load(f)
+        assert "enc_palette" in cached and "dec_palette" in cached
+        timings = loader.get_codec_timings()
+        assert not timings["enc_palette"].get("cached")
+        #warm start, the self tests are skipped:
+        self.reset()
+        loader.load_codec_list("enc_palette", "dec_palette")
+        assert loader.has_codec("enc_palette") and loader.has_codec("dec_palette")
+        self.assertEqual(len(calls), 2)
+        assert loader.get_codec_timings()["dec_palette"].get("cached")
+        #a different version invalidates the cache entry:
+        self.reset()
+        cached["enc_palette"][-1] = "some other version"
+        with open(loader.PROBE_CACHE, "w") as f:
+            json.dump(cached, f)
+        loader.load_codec("enc_palette")
+        self.assertEqual(len(calls), 3)
+
+    def test_failures(self):
+        with silence_error(loader.log):
+            loader.load_codec_list("invalid-codec")
+        assert not loader.has_codec("invalid-codec")
+        try:
+            loader.CODEC_FAIL_IMPORT.append("enc_palette")
+            loader.load_codec_list("enc_palette")
+        finally:
+            loader.CODEC_FAIL_IMPORT.remove("enc_palette")
+        assert not loader.has_codec("enc_palette")
+        assert loader.get_codec_error("enc_palette")
+        #failed codecs are not retried:
+        loader.load_codec("enc_palette")
+        assert not loader.has_codec("enc_palette")
+
+    def test_clone_lazy_csc(self):
+        from xpra.codecs import video_helper
+        calls = []
+        def init_csc_options(vh):
+            calls.append(vh)
+            vh.add_csc_spec("BGRX", "YUV420P", "spec")
+        saved = video_helper.VideoHelper.init_csc_options
+        video_helper.VideoHelper.init_csc_options = init_csc_options
+        try:
+            vh = video_helper.VideoHelper(init=True)
+            vh._csc_initialized = False
+            clone = vh.clone()
+            assert not calls, "clone() should not load the csc modules"
+            assert clone.get_csc_specs("BGRX")=={"YUV420P" : ["spec"]}
+            assert calls==[clone]
+            #once loaded, the clones get a copy of the csc specs:
+            vh.init_csc()
+            clone = vh.clone()
+            assert clone.get_csc_specs("BGRX")=={"YUV420P" : ["spec"]}
+            assert len(calls)==2
+        finally:
+            video_helper.VideoHelper.init_csc_options = saved
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
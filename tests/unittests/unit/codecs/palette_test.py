@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+from random import Random
+
+from xpra.codecs.image_wrapper import ImageWrapper
+from xpra.codecs.palette import encoder, decoder   #@UnresolvedImport
+
+
+def make_image(w, h, pixels, pixel_format="BGRX", rowstride=0):
+    return ImageWrapper(0, 0, w, h, pixels, pixel_format, 32, rowstride or w*4, planes=ImageWrapper.PACKED)
+
+def colour_pixels(rng, w, h, ncolours, runs=True):
+    colours = [bytes((rng.randint(0, 255), rng.randint(0, 255), rng.randint(0, 255), 0)) for _ in range(ncolours)]
+    pixels = []
+    c = colours[0]
+    for _ in range(w*h):
+        if not runs or rng.random()<0.2:
+            c = rng.choice(colours)
+        pixels.append(c)
+    return b"".join(pixels)
+
+def strip_padding(pixels):
+    return b"".join(bytes(pixels[i:i+3]) for i in range(0, len(pixels), 4))
+
+
+class TestPalette(unittest.TestCase):
+
+    def test_selftest(self):
+        encoder.selftest()
+        decoder.selftest()
+
+    def test_module_functions(self):
+        for m in (encoder, decoder):
+            assert m.get_type()=="palette"
+            assert "palette" in m.get_encodings()
+            assert m.get_info()
+
+    def test_roundtrip(self):
+        rng = Random(0)
+        for w, h in ((1, 1), (3, 1), (1, 5), (64, 48), (333, 17)):
+            for ncolours in (1, 2, 16, 256):
+                for runs in (True, False):
+                    pixels = colour_pixels(rng, w, h, ncolours, runs)
+                    data = encoder.encode(make_image(w, h, pixels))[0]
+                    decoded = decoder.decompress(data, w, h)
+                    self.assertEqual(strip_padding(decoded), strip_padding(pixels))
+
+    def test_rowstride(self):
+        w, h = 10, 10
+        pixels = b"\x01\x02\x03\x04"*(w*h)
+        padded = b"".join(pixels[y*w*4:(y+1)*w*4]+b"\xff"*8 for y in range(h))
+        data = encoder.encode(make_image(w, h, padded, "BGRA", w*4+8))[0]
+        self.assertEqual(decoder.decompress(data, w, h), pixels)
+
+    def test_rgb_format(self):
+        w, h = 4, 4
+        pixels = b"\x01\x02\x03\x04"*(w*h)
+        for pixel_format, rgb_format, expected in (
+            ("BGRX", "RGBX", b"\x03\x02\x01"),
+            ("BGRA", "RGBA", b"\x03\x02\x01\x04"),
+            ("BGRX", "RGBA", b"\x03\x02\x01\xff"),
+            ("XRGB", "BGRX", b"\x04\x03\x02"),
+            ):
+            data, options = encoder.encode(make_image(w, h, pixels, pixel_format), None, rgb_format)
+            self.assertEqual(options.get("rgb_format"), rgb_format)
+            decoded = decoder.decompress(data, w, h)
+            self.assertEqual(decoded[:len(expected)], expected)
+
+    def test_too_many_colours(self):
+        w, h = 32, 32
+        pixels = b"".join(bytes((i & 0xff, i >> 8, 0, 0)) for i in range(w*h))
+        assert encoder.encode(make_image(w, h, pixels)) is None
+
+    def test_persistent(self):
+        rng = Random(1)
+        w, h = 64, 32
+        epalette = encoder.Palette()
+        dpalette = decoder.Palette()
+        sizes = []
+        for _ in range(2):
+            pixels = colour_pixels(Random(2), w, h, 200)
+            data = encoder.encode(make_image(w, h, pixels), epalette)[0]
+            self.assertEqual(strip_padding(decoder.decompress(data, w, h, dpalette)), strip_padding(pixels))
+            sizes.append(len(data))
+        #the second frame re-uses all the entries:
+        self.assertEqual(sizes[0]-sizes[1], epalette.count*4)
+        self.assertEqual(epalette.count, dpalette.count)
+        #more colours than we have room for, so the encoder starts a new palette:
+        palette_id = epalette.id
+        pixels = colour_pixels(rng, w, h, 100)
+        data = encoder.encode(make_image(w, h, pixels), epalette)[0]
+        assert epalette.id!=palette_id
+        self.assertEqual(strip_padding(decoder.decompress(data, w, h, dpalette)), strip_padding(pixels))
+        #the decoder must have seen the previous frames:
+        pixels = colour_pixels(rng, w, h, 10)
+        data = encoder.encode(make_image(w, h, pixels), epalette)[0]
+        with self.assertRaises(ValueError):
+            decoder.decompress(data, w, h, decoder.Palette())
+
+    def test_invalid(self):
+        w, h = 16, 16
+        data = encoder.encode(make_image(w, h, b"\0\0\0\0"*(w*h)))[0]
+        for bad in (b"", data[:4], b"\x02"+data[1:], data[:-1]):
+            with self.assertRaises(ValueError):
+                decoder.decompress(bad, w, h)
+        #copy from above on the first row:
+        with self.assertRaises(ValueError):
+            decoder.decompress(data[:8]+b"\x00\x00\x00\x00\x81", w, h)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -60,6 +60,37 @@ class RGBTransformTest(unittest.TestCase):
                     r = rgb_reformat(img, (), transparency)
                     assert r is False
 
+    def test_rgb_downscale(self):
+        buf = bytes(i%251 for i in range(W*H*4))
+        img = self.make_test_image("BGRX", buf)
+        img.set_target_x(10)
+        scaled = rgb_transform.rgb_downscale(img, W//2, H//4)
+        if scaled is None:
+            #no argb module
+            return
+        self.assertEqual((scaled.get_width(), scaled.get_height()), (W//2, H//4))
+        self.assertEqual(scaled.get_rowstride(), W//2*4)
+        self.assertEqual(len(scaled.get_pixels()), W//2*H//4*4)
+        self.assertEqual(scaled.get_pixel_format(), "BGRX")
+        self.assertEqual(scaled.get_target_x(), 10)
+        #each pixel is the average of the 2x4 source pixels:
+        for c in range(4):
+            values = [buf[y*W*4+x*4+c] for y in range(4) for x in range(2)]
+            self.assertEqual(scaled.get_pixels()[c], (sum(values)+4)//8)
+        #only packed 32-bit pixels:
+        assert rgb_transform.rgb_downscale(self.make_test_image("BGR565", buf), W//2, H//2) is None
+
+    def test_downscale_ratio(self):
+        try:
+            from xpra.codecs.argb.argb import downscale #@UnresolvedImport
+        except ImportError:
+            return
+        #enough source pixels in the same destination pixel to overflow 32-bit sums:
+        w, h = 4096, 4200
+        pixels = downscale(b"\xff"*w*h*4, w, h, w*4, 1, 1)
+        self.assertEqual(bytes(pixels[:4]), b"\xff"*4)
+
+
 def main():
     unittest.main()
 
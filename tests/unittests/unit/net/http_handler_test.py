@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import gzip
+import shutil
+import socket
+import tempfile
+import unittest
+from threading import Thread
+
+from xpra.net import http_handler
+from xpra.net.http_handler import HTTPRequestHandler, CompressedCache
+
+
+def http_request(web_root, path, *headers):
+    server_sock, client_sock = socket.socketpair()
+    t = Thread(target=HTTPRequestHandler, args=(server_sock, ("127.0.0.1", 0), web_root, ()), daemon=True)
+    t.start()
+    request = "GET %s HTTP/1.0\r\n" % path + "".join("%s\r\n" % h for h in headers) + "\r\n"
+    client_sock.sendall(request.encode("latin1"))
+    #the handler does not close the socket, the server does that:
+    t.join(5)
+    server_sock.close()
+    response = b""
+    while True:
+        data = client_sock.recv(65536)
+        if not data:
+            break
+        response += data
+    client_sock.close()
+    head, body = response.split(b"\r\n\r\n", 1)
+    lines = head.decode("latin1").split("\r\n")
+    status = int(lines[0].split(" ")[1])
+    response_headers = dict((k.lower(), v.strip()) for k, v in (line.split(":", 1) for line in lines[1:]))
+    return status, response_headers, body
+
+
+class HTTPHandlerTest(unittest.TestCase):
+
+    def setUp(self):
+        self.web_root = tempfile.mkdtemp()
+        self.js = b"var x = 1;\n"*1000
+        with open(os.path.join(self.web_root, "index.js"), "wb") as f:
+            f.write(self.js)
+        http_handler.compressed_cache = CompressedCache(1024*1024)
+
+    def tearDown(self):
+        shutil.rmtree(self.web_root)
+
+    def test_plain(self):
+        status, headers, body = http_request(self.web_root, "/index.js")
+        self.assertEqual(status, 200)
+        self.assertEqual(body, self.js)
+        self.assertEqual(int(headers["content-length"]), len(self.js))
+        assert headers.get("etag")
+        assert "content-encoding" not in headers
+        status = http_request(self.web_root, "/missing.js")[0]
+        self.assertEqual(status, 404)
+
+    def test_gzip_cache(self):
+        cache = http_handler.compressed_cache
+        for i in range(3):
+            status, headers, body = http_request(self.web_root, "/index.js", "Accept-Encoding: gzip")
+            self.assertEqual(status, 200)
+            self.assertEqual(headers.get("content-encoding"), "gzip")
+            self.assertEqual(gzip.decompress(body), self.js)
+            self.assertEqual(cache.misses, 1)
+            self.assertEqual(cache.hits, i)
+        #modifying the file invalidates the cache entry:
+        self.js = b"var y = 2;\n"*1000
+        path = os.path.join(self.web_root, "index.js")
+        with open(path, "wb") as f:
+            f.write(self.js)
+        st = os.stat(path)
+        os.utime(path, ns=(st.st_atime_ns, st.st_mtime_ns+1000000000))
+        body = http_request(self.web_root, "/index.js", "Accept-Encoding: gzip")[2]
+        self.assertEqual(gzip.decompress(body), self.js)
+        self.assertEqual(cache.misses, 2)
+
+    def test_precompressed(self):
+        data = gzip.compress(self.js)
+        with open(os.path.join(self.web_root, "index.js.gzip"), "wb") as f:
+            f.write(data)
+        status, headers, body = http_request(self.web_root, "/index.js", "Accept-Encoding: gzip")
+        self.assertEqual(status, 200)
+        self.assertEqual(body, data)
+        self.assertEqual(http_handler.compressed_cache.misses, 0)
+
+    def test_etag(self):
+        for accept in ("", "gzip"):
+            extra = ("Accept-Encoding: %s" % accept, ) if accept else ()
+            status, headers = http_request(self.web_root, "/index.js", *extra)[:2]
+            etag = headers["etag"]
+            status, headers, body = http_request(self.web_root, "/index.js", "If-None-Match: %s" % etag, *extra)
+            self.assertEqual(status, 304)
+            self.assertEqual(body, b"")
+            self.assertEqual(headers["etag"], etag)
+        #the compressed and uncompressed representations have different etags:
+        etag = http_request(self.web_root, "/index.js")[1]["etag"]
+        status = http_request(self.web_root, "/index.js", "If-None-Match: %s" % etag, "Accept-Encoding: gzip")[0]
+        self.assertEqual(status, 200)
+
+    def test_cache_limits(self):
+        cache = CompressedCache(100)
+        cache.set("a", b"0"*40)
+        cache.set("b", b"1"*20)
+        self.assertEqual(cache.size, 20)
+        cache.set("c", b"2"*30)
+        #too big:
+        assert cache.get("c") is None
+        for k in "defgh":
+            cache.set(k, b"3"*20)
+        assert cache.get("b") is None
+        assert cache.get("h")
+        assert cache.size<=100
+        assert cache.get_info()
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
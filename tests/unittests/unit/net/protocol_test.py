@@ -10,7 +10,7 @@ import unittest
 from gi.repository import GLib
 
 from xpra.util import csv, envint, envbool
-from xpra.os_util import monotonic_time
+from xpra.os_util import monotonic_time, bytestostr
 from xpra.net.protocol import Protocol, verify_packet, log
 from xpra.net.bytestreams import Connection
 from xpra.net.compression import Compressed
@@ -198,6 +198,50 @@ class ProtocolTest(unittest.TestCase):
         log("do_test_read_speed(%i) %iMB in %ims", pixel_data_size, total_size, elapsed*1000)
         return N*len(packets), total_size, elapsed
 
+    def do_test_cipher(self, cipher, corrupt=False):
+        from xpra.net.crypto import crypto_backend_init, ENCRYPTION_CIPHERS
+        crypto_backend_init()
+        if cipher not in ENCRYPTION_CIPHERS:
+            return None
+        cipher_args = (cipher, "0123456789abcdef", "some secret", "some salt", 1000, "PKCS#7")
+        p = self.make_memory_protocol()
+        p.set_cipher_out(*cipher_args)
+        data = []
+        def raw_write(_packet_type, items, *_args):
+            for item in items:
+                data.append(item)
+        p.raw_write = raw_write
+        packets = self.make_test_packets(2**12)
+        for packet in packets:
+            p._add_packet_to_queue(packet)
+        if corrupt:
+            last = bytearray(data[-1])
+            last[-1] ^= 0xff
+            data[-1] = last
+        parsed_packets = []
+        def process_packet_cb(proto, packet):
+            if packet[0]==Protocol.CONNECTION_LOST:
+                loop.quit()
+            else:
+                parsed_packets.append(bytestostr(packet[0]))
+        loop = GLib.MainLoop()
+        GLib.timeout_add(TIMEOUT*1000, loop.quit)
+        protocol = self.make_memory_protocol(data, read_buffer_size=65536, process_packet_cb=process_packet_cb)
+        protocol.set_cipher_in(*cipher_args)
+        protocol.start()
+        loop.run()
+        return parsed_packets
+
+    def test_cipher(self):
+        for cipher in ("AES", "AES-GCM"):
+            parsed = self.do_test_cipher(cipher)
+            if parsed is not None:
+                self.assertEqual(parsed, ["test", "ping", "draw"])
+        with silence_error(log):
+            parsed = self.do_test_cipher("AES-GCM", True)
+        if parsed is not None:
+            self.assertEqual(parsed, ["test", "ping"])
+
     def make_test_packets(self, pixel_data_size=2**18):
         pixel_data = os.urandom(pixel_data_size)
         return (
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import time
+import socket
+import unittest
+from threading import Lock
+from gi.repository import GLib
+
+from xpra.os_util import bytestostr
+from xpra.net import protocol, reactor
+from xpra.net.protocol import Protocol
+from xpra.net.bytestreams import SocketConnection
+
+N = 200
+
+
+def noop(*_args):
+    pass
+
+
+@unittest.skipUnless(hasattr(reactor.select, "epoll"), "no epoll on this platform")
+class ReactorTest(unittest.TestCase):
+
+    def setUp(self):
+        self.saved = protocol.REACTOR
+        protocol.REACTOR = True
+
+    def tearDown(self):
+        protocol.REACTOR = self.saved
+
+    def test_lane_order(self):
+        pool = reactor.WorkerPool(4)
+        lanes = [reactor.Lane(pool, "test-%i" % i) for i in range(4)]
+        results = dict((lane.name, []) for lane in lanes)
+        lock = Lock()
+        running = set()
+        def task(lane, i):
+            #tasks from the same lane never run concurrently:
+            with lock:
+                assert lane.name not in running
+                running.add(lane.name)
+            time.sleep(0)
+            results[lane.name].append(i)
+            with lock:
+                running.discard(lane.name)
+        for i in range(N):
+            for lane in lanes:
+                lane.put(task, lane, i)
+        for lane in lanes:
+            assert lane.wait(10)
+            self.assertEqual(results[lane.name], list(range(N)))
+            self.assertEqual(lane.get_info()["tasks"], N)
+        lanes[0].close()
+        lanes[0].put(task, lanes[0], N)
+        assert lanes[0].wait(1)
+        self.assertEqual(len(results[lanes[0].name]), N)
+        pool.stop()
+
+    def test_protocol(self):
+        s1, s2 = socket.socketpair()
+        conn1 = SocketConnection(s1, "local", "remote", "test", "socket")
+        conn2 = SocketConnection(s2, "remote", "local", "test", "socket")
+        received = []
+        loop = GLib.MainLoop()
+        def process_packet_cb(_proto, packet):
+            if bytestostr(packet[0])=="test":
+                received.append(packet[1])
+                if len(received)==N:
+                    GLib.idle_add(loop.quit)
+        sender = Protocol(GLib, conn1, noop)
+        receiver = Protocol(GLib, conn2, process_packet_cb)
+        protocols = (sender, receiver)
+        for p in protocols:
+            assert p._reactor
+            p.enable_encoder("bencode")
+            p.enable_compressor("none")
+            #the parser must be able to pause the socket:
+            p.read_buffer_size = 64
+            p.start()
+        packets = [["test", i, b"x"*(i*10)] for i in range(N)]
+        def get_packet():
+            packet = packets.pop(0)
+            return (packet, None, None, None, True, bool(packets))
+        sender.set_packet_source(get_packet)
+        sender.source_has_more()
+        GLib.timeout_add(10*1000, loop.quit)
+        loop.run()
+        self.assertEqual(received, list(range(N)))
+        for p in protocols:
+            #no per-connection threads:
+            self.assertEqual(p.get_threads(), ())
+            assert p.get_info()["reactor"]
+        r = reactor.get_reactor()
+        assert r.get_info()["connections"]>=2
+        for p in protocols:
+            p.close()
+        assert sender.wait_for_io_threads_exit(1)
+        assert reactor.get_reactor_info()
+
+    def test_slow_reader(self):
+        #a client that does not read must not stall the other connections:
+        s1, s2 = socket.socketpair()
+        slow = Protocol(GLib, SocketConnection(s1, "local", "remote", "test", "socket"), noop)
+        slow.enable_encoder("bencode")
+        slow.enable_compressor("none")
+        slow.start()
+        slow.send_now(["big", b"x"*(4*1024*1024)])
+        #wait for the socket buffer to fill up:
+        loop = GLib.MainLoop()
+        def check_sent():
+            if slow.write_queue_empty() or not slow._conn.output_bytecount:
+                GLib.timeout_add(10, check_sent)
+            else:
+                loop.quit()
+            return False
+        check_sent()
+        timer = GLib.timeout_add(10*1000, loop.quit)
+        loop.run()
+        GLib.source_remove(timer)
+        assert slow._conn.output_bytecount, "the packet was not sent"
+        s3, s4 = socket.socketpair()
+        received = []
+        def process_packet_cb(_proto, packet):
+            if bytestostr(packet[0])=="test":
+                received.append(packet[1])
+                if len(received)==N:
+                    GLib.idle_add(loop.quit)
+        sender = Protocol(GLib, SocketConnection(s3, "local", "remote", "test", "socket"), noop)
+        receiver = Protocol(GLib, SocketConnection(s4, "remote", "local", "test", "socket"), process_packet_cb)
+        protocols = (slow, sender, receiver)
+        for p in (sender, receiver):
+            p.enable_encoder("bencode")
+            p.enable_compressor("none")
+            p.start()
+        packets = [["test", i] for i in range(N)]
+        def get_packet():
+            packet = packets.pop(0)
+            return (packet, None, None, None, True, bool(packets))
+        sender.set_packet_source(get_packet)
+        sender.source_has_more()
+        GLib.timeout_add(10*1000, loop.quit)
+        loop.run()
+        self.assertEqual(received, list(range(N)))
+        #the big packet is still waiting for the socket:
+        assert not slow.write_queue_empty()
+        assert slow.get_info()["reactor"]["output"]==1
+        for p in protocols:
+            p.close()
+        s2.close()
+
+    def test_cleanup(self):
+        r = reactor.Reactor(1)
+        s1, s2 = socket.socketpair()
+        r.register(s1.fileno(), noop)
+        r.want_write(s1.fileno())
+        self.assertEqual(r.get_info()["writing"], 1)
+        thread = r.thread
+        r.cleanup()
+        thread.join(1)
+        assert not thread.is_alive()
+        assert r.epoll.closed
+        for fd in (r.wake_read, r.wake_write):
+            with self.assertRaises(OSError):
+                os.fstat(fd)
+        #calling it again is harmless:
+        r.cleanup()
+        s1.close()
+        s2.close()
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -110,6 +110,122 @@ class TestCystats(unittest.TestCase):
             v = cystats.logp(x)
             assert 0<=v<=1
 
+    def test_time_series(self):
+        ts = cystats.TimeSeries(10, ("wid", "time", "coding", "pixels", "latency"), labels=("coding", ))
+        assert not ts and len(ts)==0
+        now = monotonic_time()
+        records = []
+        for i in range(25):
+            r = (i%2, now-25+i, ("png", "jpeg")[i%3==0], 1000+i, random.random())
+            records.append(r)
+            ts.append(r)
+        #only the last 10 records are kept:
+        self.assertEqual(len(ts), 10)
+        self.assertEqual(tuple(ts), tuple(records[-10:]))
+        self.assertEqual(ts[-1], records[-1])
+        self.assertEqual(ts[0], records[-10])
+        for i in (10, -11):
+            try:
+                ts[i]
+            except IndexError:
+                pass
+            else:
+                raise Exception("index %i should be out of range" % i)
+        #the running sums must match the records we still have:
+        self.assertAlmostEqual(ts.sum("pixels"), sum(r[3] for r in records[-10:]))
+        self.assertAlmostEqual(ts.mean("latency"), sum(r[4] for r in records[-10:])/10)
+        self.assertEqual(ts.min("pixels"), 1015)
+        self.assertEqual(ts.max("pixels"), 1024)
+        self.assertEqual(ts.sum_product("wid", "pixels"), sum(r[0]*r[3] for r in records[-10:]))
+        self.assertEqual(ts.count_since(now-5), 5)
+        self.assertEqual(ts.values("pixels", now-2), (1023, 1024))
+        self.assertEqual(ts.filter("wid", 1, "pixels"), [(r[1], r[3]) for r in records[-10:] if r[0]==1])
+        #same results as the functions operating on tuples:
+        data = tuple((r[1], r[4]) for r in records[-10:])
+        a, ra = ts.time_weighted_average("latency")
+        ea, era = cystats.calculate_time_weighted_average(data)
+        self.assertAlmostEqual(a, ea, places=4)
+        self.assertAlmostEqual(ra, era, places=4)
+        data = tuple((r[1], r[3], r[4]) for r in records[-10:])
+        a, ra = ts.size_weighted_average("pixels", "latency")
+        ea, era = cystats.calculate_size_weighted_average(data)
+        self.assertAlmostEqual(a, ea, places=4)
+        self.assertAlmostEqual(ra, era, places=4)
+        a, ra = ts.size_weighted_rate("pixels", "latency", 1000)
+        ea, era = cystats.calculate_timesize_weighted_average(data, 1000)
+        self.assertAlmostEqual(a/ea, 1, places=4)
+        self.assertAlmostEqual(ra/era, 1, places=4)
+        from xpra.simple_stats import get_list_stats
+        self.assertEqual(ts.list_stats("latency", 1000), get_list_stats(r[4]*1000 for r in records[-10:]))
+        ts.clear()
+        self.assertEqual(len(ts), 0)
+        self.assertEqual(ts.list_stats("latency"), {})
+
+    def test_time_series_ewma(self):
+        ts = cystats.TimeSeries(4, alpha=0.5)
+        for v in (10, 20, 20, 20, 20, 20, 20):
+            ts.append((monotonic_time(), v))
+        self.assertAlmostEqual(ts.ewma("value"), 20-10/2**6)
+        self.assertEqual(ts.mean("value"), 20)
+        self.assertEqual(ts.percentile("value", 50), 20)
+        #the cached sorted values are refreshed when records are added:
+        for v in (30, 30, 30):
+            ts.append((monotonic_time(), v))
+        self.assertEqual(ts.percentile("value", 50), 30)
+        self.assertEqual(ts.list_stats("value")["max"], 30)
+
+    def test_time_series_non_finite(self):
+        ts = cystats.TimeSeries(4)
+        for v in (float("nan"), float("inf"), 1e30, 2.0):
+            ts.append((1, v))
+        values = [r[1] for r in ts]
+        assert values[0]!=values[0]
+        self.assertEqual(values[1:], [float("inf"), 1e30, 2])
+        assert isinstance(values[3], int)
+
+    def test_time_series_buckets(self):
+        ts = cystats.TimeSeries(100, columns=("time", "w", "h"))
+        now = monotonic_time()
+        for i in range(50):
+            ts.append((now-i*0.25, i, 2))
+        expected = tuple(ts.sum_product("w", "h", now-lim)-ts.sum_product("w", "h", now-lim+1) for lim in range(1, 11))
+        buckets = ts.sum_product_buckets("w", "h", now, 10)
+        self.assertEqual(len(buckets), 10)
+        for b, e in zip(buckets, expected):
+            self.assertAlmostEqual(b, e)
+
+    def test_latency_histogram(self):
+        h = cystats.LatencyHistogram()
+        self.assertEqual(h.get_info(), {"count" : 0})
+        self.assertEqual(h.percentile(50), 0)
+        values = [random.randint(0, 1000*1000) for _ in range(10000)]
+        for v in values:
+            h.record_us(v)
+        svalues = sorted(values)
+        for pct in (10, 50, 90, 99):
+            expected = svalues[len(values)*pct//100]
+            #the relative error is bounded by the sub-bucket resolution:
+            self.assertLess(abs(h.percentile(pct)-expected), expected/16+2)
+        info = h.get_info()
+        self.assertEqual(info["count"], len(values))
+        self.assertEqual(info["min"], min(values))
+        self.assertEqual(info["max"], max(values))
+        self.assertEqual(info["avg"], sum(values)//len(values))
+        #small values are exact:
+        h2 = cystats.LatencyHistogram()
+        for v in range(16):
+            h2.record_us(v)
+        for pct in range(0, 100, 10):
+            self.assertEqual(h2.percentile(pct), 16*pct//100)
+        #seconds:
+        h2.record(0.5)
+        self.assertEqual(h2.get_info()["max"], 500*1000)
+        h.merge(h2)
+        self.assertEqual(h.count, len(values)+17)
+        self.assertEqual(h.get_info()["min"], 0)
+        h.reset()
+        self.assertEqual(h.count, 0)
+
 
 def main():
     if cystats:
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import time
+import unittest
+from threading import Event
+
+from xpra.server.info_snapshot import InfoSnapshot, diff_info
+
+
+class TestInfoSnapshot(unittest.TestCase):
+
+    def test_diff(self):
+        old = {"a" : {"b" : 1, "c" : 2}, "d" : 3}
+        self.assertEqual(diff_info(old, old), ({}, []))
+        new = {"a" : {"b" : 1, "c" : 4}, "e" : 5}
+        changed, removed = diff_info(old, new)
+        self.assertEqual(changed, {"a" : {"c" : 4}, "e" : 5})
+        self.assertEqual(removed, [("d", )])
+        changed, removed = diff_info({}, new)
+        self.assertEqual(changed, new)
+        assert not removed
+
+    def test_snapshot(self):
+        counts = {"ui" : 0, "info" : 0}
+        ui_calls = []
+        def idle_add(fn, *args):
+            ui_calls.append(fn)
+            fn(*args)
+        def collect_ui():
+            counts["ui"] += 1
+            return {"server" : {"ui" : counts["ui"]}}
+        def collect_info():
+            counts["info"] += 1
+            return {"server" : {"info" : counts["info"]}, "static" : True}
+        snapshot = InfoSnapshot(idle_add)
+        snapshot.add_section("ui", collect_ui, 1000, True)
+        snapshot.add_section("info", collect_info, 100, False)
+        results = []
+        got = Event()
+        def callback(info):
+            results.append(info)
+            got.set()
+        try:
+            #the first request has to wait for the collection:
+            snapshot.get(callback)
+            assert got.wait(2)
+            first = results[0]
+            self.assertEqual(first, {"server" : {"ui" : 1, "info" : 1}, "static" : True})
+            self.assertEqual(len(ui_calls), 1)
+            #the next ones are answered straight away:
+            snapshot.get(callback)
+            self.assertEqual(len(results), 2)
+            assert results[1] is first
+            #the sections with a short ttl are refreshed more often:
+            time.sleep(0.5)
+            snapshot.get(callback)
+            last = results[-1]
+            assert last["server"]["info"]>1
+            self.assertEqual(last["server"]["ui"], 1)
+            #subscribers only get the changes:
+            changed, removed = snapshot.get_delta("sub", first)
+            self.assertEqual(changed, first)
+            changed, removed = snapshot.get_delta("sub", last)
+            self.assertEqual(changed, {"server" : {"info" : last["server"]["info"]}})
+            assert not removed
+            info = snapshot.get_info()
+            self.assertEqual(info["subscribers"], 1)
+            self.assertEqual(info["ui"]["count"], 1)
+        finally:
+            snapshot.cleanup()
+
+    def test_keepalive(self):
+        count = []
+        def collect():
+            count.append(True)
+            return {"count" : len(count)}
+        snapshot = InfoSnapshot(None, keepalive=100)
+        snapshot.add_section("info", collect, 10)
+        got = Event()
+        try:
+            snapshot.get(lambda info : got.set())
+            assert got.wait(2)
+            #once no-one is asking, the worker stops refreshing:
+            time.sleep(0.3)
+            n = len(count)
+            time.sleep(0.3)
+            self.assertEqual(len(count), n)
+        finally:
+            snapshot.cleanup()
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.util import AdHocStruct
+from xpra.os_util import monotonic_time
+from xpra.server import metrics
+from xpra.server.window.window_stats import WindowPerformanceStatistics
+from xpra.server.source.source_stats import GlobalPerformanceStatistics
+
+
+def make_source(counter, encodings=("png", "h264")):
+    ss = AdHocStruct()
+    ss.counter = counter
+    ss.statistics = GlobalPerformanceStatistics()
+    now = monotonic_time()
+    ss.statistics.bytes_sent.append((now-2, 1000))
+    ss.statistics.bytes_sent.append((now, 3000))
+    ss.packet_queue = [1, 2]
+    ss.encode_queue_size = lambda : 3
+    ss.bandwidth_limit = 8*1000
+    ws = AdHocStruct()
+    ws.statistics = WindowPerformanceStatistics()
+    ws.batch_config = AdHocStruct()
+    ws.batch_config.delay = 20
+    for encoding in encodings:
+        ws.statistics.encoding_stats.append((now, encoding, 100, 24, 50, 0.001))
+    ws.statistics.stage_latency["encode"].record(0.002)
+    ss.window_sources = {1 : ws}
+    return ss
+
+
+class TestMetrics(unittest.TestCase):
+
+    def test_render(self):
+        m = metrics.Metrics()
+        m.gauge("test_gauge", "a gauge", 1, client="1")
+        m.gauge("test_gauge", "a gauge", 2, client="1")
+        m.counter("test_counter", "a counter", 5, encoding="p\"ng")
+        text = m.render(True)
+        assert 'test_gauge{client="1"} 3' in text
+        assert "# TYPE test_counter counter" in text
+        assert 'test_counter_total{encoding="p\\"ng"} 5' in text
+        assert text.endswith("# EOF\n")
+        text = m.render(False)
+        assert "# TYPE test_counter_total counter" in text
+        assert "# EOF" not in text
+
+    def test_client_metrics(self):
+        sources = [make_source(i, ("png", "h264", "invalid-%i" % i)) for i in range(metrics.MAX_CLIENTS+4)]
+        m = metrics.Metrics()
+        metrics.add_client_metrics(m, sources)
+        text = m.render()
+        #cardinality is bounded:
+        clients = set(dict(k)["client"] for k in m.families["xpra_windows"][2].keys())
+        assert len(clients)==metrics.MAX_CLIENTS+1, "got %i clients" % len(clients)
+        assert 'xpra_packet_queue_depth{client="other"} 8' in text
+        assert 'xpra_batch_delay_seconds{client="0"} 0.02' in text
+        assert 'xpra_pipeline_latency_seconds_count{client="0",stage="encode"} 1' in text
+        assert 'xpra_bandwidth_bytes_per_second{client="0"} 1000.0' in text
+        assert 'xpra_clients %i' % len(sources) in text
+
+    def test_encoder_metrics(self):
+        totals = metrics.EncoderTotals()
+        for encoding in ("png", "h264", "invalid-1", "invalid-2"):
+            for _ in range(10):
+                totals.add(encoding, 100, 40)
+        m = metrics.Metrics()
+        metrics.add_encoder_metrics(m, totals)
+        text = m.render()
+        encodings = set(dict(k)["encoding"] for k in m.families["xpra_encoder_frames"][2].keys())
+        assert encodings==set(("png", "h264", "other")), "unexpected encodings: %s" % (encodings,)
+        assert 'xpra_encoder_frames_total{encoding="png"} 10' in text
+        assert 'xpra_encoder_frames_total{encoding="other"} 20' in text
+        assert 'xpra_compression_ratio{encoding="png"} 0.1' in text
+        #the counters never go down:
+        totals.add("png", 100, 40)
+        m = metrics.Metrics()
+        metrics.add_encoder_metrics(m, totals)
+        assert 'xpra_encoder_frames_total{encoding="png"} 11' in m.render()
+
+    def test_exporter_cache(self):
+        calls = []
+        def collect(m):
+            calls.append(m)
+            m.gauge("test", "test", len(calls))
+        exporter = metrics.MetricsExporter(collect)
+        a = exporter.get_metrics()
+        b = exporter.get_metrics()
+        assert a==b and len(calls)==1
+        exporter.get_metrics(False)
+        assert len(calls)==2
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
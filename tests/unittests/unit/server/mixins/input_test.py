@@ -20,6 +20,80 @@ class InputMixinTest(ServerMixinTest):
             opts = AdHocStruct()
             self._test_mixin_class(InputServer, opts, {}, InputMixin)
 
+    def test_pointer_coalescing(self):
+        from xpra.server.mixins.input_server import InputServer
+        class TestInputServer(InputServer):
+            def __init__(self):
+                super().__init__()
+                self.readonly = False
+                self.ui_driver = None
+                self._id_to_window = {}
+                self._server_sources = {}
+                self.idle_callbacks = []
+                self.injected = []
+            def idle_add(self, fn):
+                self.idle_callbacks.append(fn)
+                return len(self.idle_callbacks)
+            def source_remove(self, source_id):
+                self.idle_callbacks[source_id-1] = None
+            def get_server_source(self, proto):
+                return self._server_sources.get(proto)
+            def set_ui_driver(self, _ss):
+                pass
+            def do_process_mouse_common(self, proto, wid, pointer, *args):
+                self.injected.append((proto, pointer)+args)
+                return pointer
+            def do_process_button_action(self, proto, wid, button, pressed, pointer, *args):
+                self.injected.append((proto, "click", button))
+            def do_process_wheel_motion(self, proto, wid, button, distance, *args):
+                self.injected.append((proto, "wheel", distance))
+            def run_idle(self):
+                callbacks = self.idle_callbacks
+                self.idle_callbacks = []
+                for fn in callbacks:
+                    if fn:
+                        fn()
+        server = TestInputServer()
+        protos = ("proto1", "proto2")
+        for proto in protos:
+            ss = AdHocStruct()
+            ss.pointer_relative = False
+            ss.uuid = proto
+            ss.user_event = lambda : None
+            server._server_sources[proto] = ss
+        #only the last position is injected for each client and device:
+        for i in range(10):
+            for proto in protos:
+                server._process_pointer_position(proto, ("pointer-position", 1, (i, i), (), (), 2))
+        server._process_pointer_position("proto1", ("pointer-position", 1, (5, 5), (), (), 3))
+        assert not server.injected
+        server.run_idle()
+        self.assertEqual(sorted(server.injected), [("proto1", (5, 5), 3), ("proto1", (9, 9), 2), ("proto2", (9, 9), 2)])
+        #button events flush the pending motion first:
+        server.injected = []
+        server._process_pointer_position("proto1", ("pointer-position", 1, (20, 20), (), (), 2))
+        server._process_button_action("proto1", ("button-action", 1, 1, True, (20, 20), ()))
+        self.assertEqual(server.injected, [("proto1", (20, 20), 2), ("proto1", "click", 1)])
+        server.run_idle()
+        self.assertEqual(len(server.injected), 2)
+        #and so do wheel events:
+        server.injected = []
+        server._process_pointer_position("proto1", ("pointer-position", 1, (25, 25), (), (), 2))
+        server._process_wheel_motion("proto1", ("wheel-motion", 1, 5, 500, (25, 25), (), ()))
+        self.assertEqual(server.injected, [("proto1", (25, 25), 2), ("proto1", "wheel", 500)])
+        server.run_idle()
+        self.assertEqual(len(server.injected), 2)
+        #events from clients that have disconnected are dropped:
+        server._process_pointer_position("proto2", ("pointer-position", 1, (30, 30), (), (), 2))
+        del server._server_sources["proto2"]
+        server.run_idle()
+        self.assertEqual(len(server.injected), 2)
+        info = server.get_pointer_info()
+        self.assertEqual(info["received"], 24)
+        self.assertEqual(info["injected"], 5)
+        server.record_input_damage()
+        assert server.get_pointer_info().get("damage-latency")
+
 def main():
     unittest.main()
 
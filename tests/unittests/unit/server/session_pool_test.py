@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import time
+import unittest
+
+from unit.test_util import silence_error
+from xpra.server.proxy.session_pool import SessionPool, log
+
+
+class FakeProcess:
+    def __init__(self, pid):
+        self.pid = pid
+        self.returncode = None
+    def poll(self):
+        return self.returncode
+    def terminate(self):
+        self.returncode = -15
+
+
+class SessionPoolTest(unittest.TestCase):
+
+    def setUp(self):
+        self.started = []
+        self.fail = False
+
+    def start_session(self, username, uid, gid):
+        if self.fail:
+            raise Exception("test failure")
+        proc = FakeProcess(len(self.started)+1)
+        self.started.append((username, uid, gid, proc))
+        return proc, "/tmp/socket-%i" % proc.pid, ":%i" % (100+proc.pid)
+
+    def wait_for(self, pool, key, count):
+        for _ in range(100):
+            with pool.lock:
+                if len(pool.spares.get(key, ()))>=count and not pool.starting.get(key, 0):
+                    return
+            time.sleep(0.01)
+        raise Exception("timeout waiting for %i spare sessions" % count)
+
+    def test_take(self):
+        pool = SessionPool(2, self.start_session)
+        assert repr(pool)
+        #nothing started yet:
+        assert pool.take("foo", 1000, 1000) is None
+        self.wait_for(pool, (1000, 1000), 2)
+        self.assertEqual(len(self.started), 2)
+        proc, socket_path, display = pool.take("foo", 1000, 1000)
+        assert proc.poll() is None and socket_path and display
+        #other users get their own sessions:
+        assert pool.take("bar", 1001, 1001) is None
+        self.wait_for(pool, (1000, 1000), 2)
+        self.wait_for(pool, (1001, 1001), 2)
+        for username, uid, gid, _ in self.started:
+            self.assertEqual(username=="foo", uid==1000 and gid==1000)
+        info = pool.get_info()
+        self.assertEqual(info["hits"], 1)
+        self.assertEqual(info["misses"], 2)
+        self.assertEqual(len(info["users"]["1000:1000"]["displays"]), 2)
+        #dead sessions are skipped:
+        for spare in pool.spares[(1000, 1000)]:
+            spare.proc.terminate()
+        assert pool.take("foo", 1000, 1000) is None
+        self.wait_for(pool, (1000, 1000), 2)
+        spares = sum(pool.spares.values(), [])
+        pool.cleanup()
+        assert all(not spare.is_alive() for spare in spares)
+        #the session we handed out is left alone:
+        assert proc.poll() is None
+        assert pool.take("foo", 1000, 1000) is None
+
+    def test_can_use(self):
+        pool = SessionPool(1, self.start_session)
+        assert pool.can_use("start", {})
+        assert not pool.can_use("start-desktop", {})
+        assert not pool.can_use("start", {"display" : ":10"})
+        assert not SessionPool(0, self.start_session).can_use("start", {})
+        #the client's working directory does not prevent the use of the pool:
+        assert pool.can_use("start", {"chdir" : "/tmp"})
+        assert not pool.can_use("start", {"chdir" : "/tmp", "start" : ["xterm"]})
+
+    def test_client_options(self):
+        #the start-new-session options a client sends with the default settings:
+        from xpra.scripts.main import get_start_new_session_dict
+        from xpra.scripts.config import make_defaults_struct, fixup_options
+        opts = make_defaults_struct()
+        fixup_options(opts)
+        sns = get_start_new_session_dict(opts, "start", [])
+        overrides = dict((k, v) for k, v in sns.items() if k!="mode")
+        assert SessionPool(1, self.start_session).can_use(sns["mode"], overrides), "overrides: %s" % (overrides,)
+
+    def test_failure(self):
+        pool = SessionPool(1, self.start_session)
+        self.fail = True
+        with silence_error(log):
+            assert pool.take("foo", 1000, 1000) is None
+            for _ in range(100):
+                if pool.failures:
+                    break
+                time.sleep(0.01)
+        self.assertEqual(pool.failures, 1)
+        self.assertEqual(pool.starting.get((1000, 1000)), 0)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -215,6 +215,36 @@ class SourceMixinsTest(unittest.TestCase):
         from xpra.server.source.windows_mixin import WindowsMixin
         self._test_mixin_class(WindowsMixin, self._get_window_mixin_server_attributes())
 
+    def test_window_metadata(self):
+        from xpra.server.source.windows_mixin import WindowsMixin
+        values = {"title" : "foo", "iconic" : False}
+        window = AdHocStruct()
+        window.is_tray = lambda : False
+        window.get_property_names = lambda : tuple(values.keys())
+        def test_metadata(_c, m):
+            packets = []
+            m.hello_sent = True
+            #duplicated from encodings:
+            m.calculate_window_pixels = {}
+            m.send = m.send_async = lambda *args : packets.append(args)
+            m._make_metadata = lambda _window, prop, **_kwargs : {prop : values[prop]}
+            m.new_window("new-window", 1, window, 0, 0, 100, 100, {})
+            self.assertEqual(packets[-1][6], values)
+            #unchanged values are not sent again:
+            m.window_metadata(1, window, "title")
+            assert len(packets)==1
+            values["title"] = "bar"
+            m.window_metadata(1, window, "title")
+            self.assertEqual(packets[-1], ("window-metadata", 1, {"title" : "bar"}))
+            m.window_metadata(1, window, "title")
+            assert len(packets)==2
+            self.assertEqual(m.metadata_counts, {"sent" : 1, "unchanged" : 2})
+            #a new window starts from scratch:
+            m.remove_window(1, window)
+            m.window_metadata(1, window, "title")
+            assert len(packets)==3
+        self._test_mixin_class(WindowsMixin, self._get_window_mixin_server_attributes(), test_fn=test_metadata)
+
 
     def test_clientinfo(self):
         from xpra.server.source.clientinfo_mixin import ClientInfoMixin
@@ -97,7 +97,9 @@ class TestVideoSubregion(unittest.TestCase):
             last_damage_events.append(v1)
             last_damage_events.append(v2)
         r.identify_video_subregion(ww, wh, 100, last_damage_events)
-        assert r.rectangle is None
+        expected = set((rectangle.rectangle(*v1[1:]), rectangle.rectangle(*v2[1:])))
+        assert set(r.rectangles)==expected, "expected %s but got %s" % (expected, r.rectangles)
+        assert r.rectangle in expected
 
         log("* checking that two video regions close to each other can be merged")
         for N1, N2 in ((50, 50), (60, 40), (50, 30)):
@@ -116,6 +118,33 @@ class TestVideoSubregion(unittest.TestCase):
         r.remove_refresh_region(rectangle.rectangle(0, 0, 10, 10))
         r.cleanup()
 
+    def test_keep_score(self):
+        r = video_subregion.VideoSubregion(GLib.timeout_add, GLib.source_remove, lambda *_args : None, 150, True)
+        r.set_detection(True)
+        ww, wh = 1024, 768
+        saved = video_subregion.KEEP_SCORE
+        try:
+            v1 = (monotonic_time(), 100, 100, 320, 240)
+            v2 = (monotonic_time(), 500, 500, 320, 240)
+            last_damage_events = deque(maxlen=150)
+            for _ in range(50):
+                last_damage_events.append(v1)
+            r.identify_video_subregion(ww, wh, 50, last_damage_events)
+            assert r.rectangle==rectangle.rectangle(*v1[1:])
+            #the current region scores well enough to be kept:
+            video_subregion.KEEP_SCORE = 0
+            for _ in range(50):
+                last_damage_events.append(v2)
+            r.identify_video_subregion(ww, wh, 100, last_damage_events)
+            assert r.rectangles==[rectangle.rectangle(*v1[1:])], "got %s" % (r.rectangles,)
+            #otherwise the new region is found:
+            video_subregion.KEEP_SCORE = 1000
+            r.identify_video_subregion(ww, wh, 150, last_damage_events)
+            assert rectangle.rectangle(*v2[1:]) in r.rectangles, "got %s" % (r.rectangles,)
+        finally:
+            video_subregion.KEEP_SCORE = saved
+        r.cleanup()
+
     def test_cases(self):
         from xpra.server.window.video_subregion import scoreinout   #, sslog
         #sslog.enable_debug()
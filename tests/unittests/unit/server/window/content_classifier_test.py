@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+from random import Random
+
+from xpra.server.window.content_classifier import (    #@UnresolvedImport
+    classify, ContentModel,
+    UNKNOWN, FLAT, TEXT, GRAPHICS, PHOTO,
+    )
+
+WHITE = b"\xff\xff\xff\x00"
+BLACK = b"\x00\x00\x00\x00"
+
+
+def text_pixels(rng, w, h):
+    glyphs = tuple(tuple(b"".join(BLACK if rng.random()<0.3 else WHITE for _ in range(8)) for _ in range(16))
+                   for _ in range(32))
+    rows = []
+    for _ in range(h//16):
+        chars = [rng.choice(glyphs) for _ in range(w//8)]
+        rows += [b"".join(glyph[row] for glyph in chars) for row in range(16)]
+    return b"".join(rows)
+
+def gradient_pixels(w, h):
+    return b"".join(bytes((x*255//w, y*255//h, (x+y)%256, 0)) for y in range(h) for x in range(w))
+
+def block_pixels(rng, w, h, block):
+    rows = []
+    for _ in range(h//block):
+        row = b"".join(bytes((rng.randint(0, 255), rng.randint(0, 255), rng.randint(0, 255), 0))*block
+                       for _ in range(w//block))
+        rows += [row]*block
+    return b"".join(rows)
+
+
+class TestContentClassifier(unittest.TestCase):
+
+    def test_classify(self):
+        rng = Random(0)
+        w, h = 256, 128
+        def c(pixels, bpp=4):
+            return classify(pixels, w, h, w*bpp, bpp)[0]
+        self.assertEqual(c(WHITE*(w*h)), FLAT)
+        self.assertEqual(c(b"\x10\x20\x30"*(w*h), 3), FLAT)
+        self.assertEqual(c(text_pixels(rng, w, h)), TEXT)
+        self.assertEqual(c(gradient_pixels(w, h)), PHOTO)
+        self.assertEqual(c(block_pixels(rng, w, h, 1)), PHOTO)
+        self.assertEqual(c(block_pixels(rng, w, h, 32)), GRAPHICS)
+
+    def test_small(self):
+        for w, h in ((1, 1), (1, 100), (100, 1), (3, 3)):
+            cls = classify(WHITE*(w*h), w, h, w*4)[0]
+            assert cls in (UNKNOWN, FLAT)
+
+    def test_invalid(self):
+        with self.assertRaises(AssertionError):
+            classify(WHITE*10, 10, 10, 40)
+        with self.assertRaises(AssertionError):
+            classify(WHITE*100, 10, 10, 40, 2)
+
+    def test_model(self):
+        m = ContentModel(1000, 500)
+        assert m.cols*m.rows<=1024
+        self.assertEqual(m.get_class(0, 0, 1000, 500), UNKNOWN)
+        for _ in range(4):
+            m.update(0, 0, 600, 500, TEXT)
+        self.assertEqual(m.get_class(0, 0, 1000, 500), TEXT)
+        self.assertEqual(m.get_class(700, 0, 300, 500), UNKNOWN)
+        #a single conflicting update does not change the class:
+        m.update(0, 0, 600, 500, PHOTO)
+        self.assertEqual(m.get_class(0, 0, 600, 500), TEXT)
+        for _ in range(8):
+            m.update(0, 0, 600, 500, PHOTO)
+        self.assertEqual(m.get_class(0, 0, 600, 500), PHOTO)
+        #out of bounds:
+        self.assertEqual(m.get_class(2000, 0, 10, 10), UNKNOWN)
+        m.update(-10, -10, 5, 5, TEXT)
+        assert m.get_info()["cells"]
+        m.reset()
+        self.assertEqual(m.get_class(0, 0, 1000, 500), UNKNOWN)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
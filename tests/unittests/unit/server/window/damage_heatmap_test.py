@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.os_util import monotonic_time
+from xpra.rectangle import rectangle    #@UnresolvedImport
+from xpra.server.window.damage_heatmap import DamageHeatmap  #@UnresolvedImport
+
+
+class TestDamageHeatmap(unittest.TestCase):
+
+    def test_grid(self):
+        hm = DamageHeatmap(1024, 768)
+        assert hm.cell_size==16 and hm.cols==64 and hm.rows==48
+        #large windows use larger cells:
+        hm = DamageHeatmap(8192, 4096)
+        assert hm.cols*hm.rows<=4096
+        assert hm.cols*hm.cell_size>=8192 and hm.rows*hm.cell_size>=4096
+
+    def test_decay(self):
+        hm = DamageHeatmap(640, 480, 1)
+        now = monotonic_time()
+        for _ in range(10):
+            hm.add(now, 0, 0, 320, 240)
+        assert hm.get_event_count(now)==10
+        assert abs(hm.get_rate(now, 0, 0, 320, 240)-10)<0.001
+        assert hm.get_rate(now, 320, 240, 320, 240)==0
+        assert abs(hm.get_event_count(now+1)-10/2.718281828)<0.01
+        #events from long ago do not count:
+        hm.add(now+1000, 0, 0, 10, 10)
+        assert abs(hm.get_event_count(now+1000)-1)<0.001
+        hm.reset()
+        assert hm.get_event_count(now)==0
+        assert hm.get_regions(now)==[]
+
+    def test_clipping(self):
+        hm = DamageHeatmap(100, 100)
+        now = monotonic_time()
+        hm.add(now, -50, -50, 100, 100)
+        hm.add(now, 90, 90, 100, 100)
+        hm.add(now, 200, 200, 10, 10)
+        assert hm.get_event_count(now)==2
+        assert hm.get_damaged_ratio(now, 0, 0, 50, 50)==1
+        assert hm.get_damaged_ratio(now, 0, 0, 100, 100)==(50*50+10*10)/(100*100)
+
+    def test_regions(self):
+        hm = DamageHeatmap(1024, 768)
+        now = monotonic_time()
+        for _ in range(50):
+            hm.add(now, 100, 100, 320, 240)
+            hm.add(now, 500, 500, 320, 240)
+            #small and infrequent updates elsewhere:
+            hm.add(now, 900, 10, 20, 20)
+        for _ in range(5):
+            hm.add(now, 10, 700, 200, 50)
+        regions = hm.get_regions(now, min_w=128, min_h=96)
+        assert regions==[rectangle(100, 100, 320, 240), rectangle(500, 500, 320, 240)], "got %s" % (regions,)
+        assert hm.get_regions(now, min_w=128, min_h=96, max_regions=1)==regions[:1]
+        incount, outcount = hm.get_in_out(now, regions)
+        assert incount==2*50*320*240
+        assert outcount==50*20*20+5*200*50
+        #close regions are merged:
+        hm.reset()
+        for _ in range(10):
+            hm.add(now, 100, 100, 320, 240)
+            hm.add(now, 460, 120, 320, 240)
+        assert hm.get_regions(now)==[rectangle(100, 100, 680, 260)]
+        assert hm.get_regions(now, merge_distance=0)==[rectangle(100, 100, 320, 240), rectangle(460, 120, 320, 240)]
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
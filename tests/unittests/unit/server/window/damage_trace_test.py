@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import shutil
+import tempfile
+import unittest
+from queue import Queue
+
+from xpra.server.window.damage_trace import (
+    DamageTraceRecorder, read_trace, get_damage_trace,
+    DAMAGE, REGION, PIXELS, FLAG_PIXELS,
+    )
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, replay
+
+
+class TestDamageTrace(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp(prefix="damage-trace")
+        self.filename = os.path.join(self.tmpdir, "test.trace")
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_records(self):
+        recorder = DamageTraceRecorder()
+        assert recorder.stop() is None
+        assert recorder.start(self.filename, pixels=True)==self.filename
+        assert recorder.get_info().get("filename")==self.filename
+        model = SyntheticWindowModel(16, 8)
+        source, other = object(), object()
+        recorder.damage(source, 5, 1, 2, 3, 4, 16, 8)
+        recorder.region(source, 5, 0, 0, 16, 8, "png", model.get_image(0, 0, 16, 8))
+        #another client showing the same window does not record it again:
+        recorder.damage(other, 5, 1, 2, 3, 4, 16, 8)
+        recorder.region(other, 5, 0, 0, 16, 8, "jpeg", model.get_image(0, 0, 16, 8))
+        assert recorder.stop(True)==self.filename
+        flags, records = read_trace(self.filename)
+        assert flags==FLAG_PIXELS
+        records = list(records)
+        assert [r[0] for r in records]==[DAMAGE, REGION, PIXELS]
+        assert all(r[1]==5 for r in records)
+        assert records[0][3]==(1, 2, 3, 4, 16, 8)
+        assert records[1][3]==(0, 0, 16, 8, "png")
+        assert records[2][3]==(0, 0, 16, 8, 64, "BGRX")
+        assert records[2][4]==b"\xff"*16*8*4
+
+    def test_owner(self):
+        recorder = DamageTraceRecorder()
+        recorder.start(self.filename)
+        source, other = object(), object()
+        recorder.damage(source, 1, 0, 0, 1, 1, 16, 8)
+        recorder.damage(other, 1, 0, 0, 1, 1, 16, 8)
+        recorder.damage(other, 2, 0, 0, 1, 1, 16, 8)
+        #the other source takes over once the first one goes away:
+        recorder.remove_source(source)
+        recorder.damage(other, 1, 0, 0, 1, 1, 16, 8)
+        recorder.stop(True)
+        records = list(read_trace(self.filename)[1])
+        assert [r[1] for r in records]==[1, 2, 1]
+
+    def test_bounded_queue(self):
+        recorder = DamageTraceRecorder()
+        recorder.start(self.filename, pixels=True)
+        #use a queue that the write thread is not consuming:
+        queue = recorder.queue
+        recorder.queue = Queue(maxsize=1)
+        model = SyntheticWindowModel(16, 8)
+        source = object()
+        recorder.damage(source, 1, 0, 0, 1, 1, 16, 8)
+        recorder.region(source, 1, 0, 0, 16, 8, "png", model.get_image(0, 0, 16, 8))
+        assert recorder.dropped==1
+        assert recorder.get_info().get("dropped")==1
+        recorder.queue = queue
+        recorder.stop(True)
+
+    def test_exclusive(self):
+        recorder = DamageTraceRecorder()
+        #existing files and symlinks are not overwritten:
+        with open(self.filename, "wb") as f:
+            f.write(b"existing")
+        link = os.path.join(self.tmpdir, "link.trace")
+        os.symlink(self.filename, link)
+        for filename in (self.filename, link):
+            try:
+                recorder.start(filename)
+            except OSError:
+                pass
+            else:
+                recorder.stop(True)
+                raise Exception("'%s' should have been rejected" % filename)
+        with open(self.filename, "rb") as f:
+            assert f.read()==b"existing"
+        #the default filename is unique:
+        default_filename = recorder.start()
+        try:
+            assert os.path.exists(default_filename)
+        finally:
+            recorder.stop(True)
+            os.unlink(default_filename)
+
+    def test_record_and_replay(self):
+        recorder = get_damage_trace()
+        recorder.start(self.filename)
+        try:
+            model = SyntheticWindowModel(320, 240, "text")
+            pipeline = HeadlessPipeline(model, wid=7)
+            for i in range(5):
+                model.paint(10*i, 10, 10, 10, b"\0"*400)
+                pipeline.damage(10*i, 10, 10, 10)
+                pipeline.run(0.05)
+            pipeline.cleanup()
+        finally:
+            recorder.stop(True)
+        flags, records = read_trace(self.filename)
+        assert flags==0
+        records = list(records)
+        assert len([r for r in records if r[0]==DAMAGE])==5
+        assert [r for r in records if r[0]==REGION]
+        results = replay(self.filename)
+        assert list(results.keys())==[7]
+        assert results[7]["damage-events"]==5
+        assert results[7]["frames"]>0
+        assert results[7]["recorded-regions"]
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.buffers.cyxor import xor_str  #@UnresolvedImport
+from xpra.server.window.delta_store import DeltaStore
+
+
+class ClientBuckets:
+    """ applies the deltas the same way the client does """
+    def __init__(self, n):
+        self.buckets = [None]*n
+
+    def apply(self, data, options):
+        delta = options.get("delta", -1)
+        if delta>=0:
+            ref = self.buckets[options["bucket"]]
+            assert ref and ref[0]==delta, "missing reference %i, found %s" % (delta, ref)
+            data = bytes(xor_str(data, ref[1]))
+        if options.get("store", 0)>0:
+            self.buckets[options["bucket"]] = (options["store"], bytes(data))
+        return bytes(data)
+
+
+class TestDeltaStore(unittest.TestCase):
+
+    def test_roundtrip(self):
+        store = DeltaStore(2, 1024*1024)
+        client = ClientBuckets(2)
+        key = (0, 0, 16, 16, "BGRX", 64)
+        pixels = bytearray(1024)
+        for i in range(10):
+            pixels[i*8] = i+1
+            data, options = store.delta(key, bytes(pixels))
+            if i==0:
+                assert "delta" not in options
+            else:
+                self.assertEqual(options.get("delta"), i)
+            self.assertEqual(client.apply(data, options), bytes(pixels))
+        info = store.get_info()
+        self.assertEqual(info["hits"], 9)
+        self.assertEqual(info["misses"], 1)
+        self.assertEqual(info["used"], 1)
+
+    def test_too_many_changes(self):
+        store = DeltaStore(1, 1024*1024, max_changed=50)
+        key = (0, 0, 8, 8, "BGRX", 32)
+        store.delta(key, b"\0"*256)
+        data, options = store.delta(key, b"\1"*256)
+        assert "delta" not in options
+        self.assertEqual(bytes(data), b"\1"*256)
+        self.assertEqual(store.skipped, 1)
+        #the new pixels are still stored:
+        options = store.delta(key, b"\1"*256)[1]
+        self.assertEqual(options.get("delta"), 2)
+        #unless the caller always wants the delta:
+        data, options = store.delta(key, b"\2"*256, max_changed=100)
+        self.assertEqual(options.get("delta"), 3)
+        self.assertEqual(bytes(data), b"\3"*256)
+
+    def test_lru(self):
+        store = DeltaStore(2, 1024*1024)
+        keys = [(0, i, 8, 8, "BGRX", 32) for i in range(3)]
+        pixels = b"\0"*256
+        store.delta(keys[0], pixels)
+        store.delta(keys[1], pixels)
+        store.delta(keys[0], pixels)
+        #evicts keys[1], the least recently used:
+        self.assertEqual(store.delta(keys[2], pixels)[1]["bucket"], 1)
+        assert "delta" in store.delta(keys[0], pixels)[1]
+        assert "delta" not in store.delta(keys[1], pixels)[1]
+
+    def test_limits_and_reset(self):
+        store = DeltaStore(1, 100)
+        key = (0, 0, 8, 8, "BGRX", 32)
+        self.assertEqual(store.delta(key, b"\0"*256)[1], {})
+        store.max_bytes = 1024
+        store.delta(key, b"\0"*256)
+        store.reset()
+        assert "delta" not in store.delta(key, b"\0"*256)[1]
+        self.assertEqual(store.get_info()["resets"], 1)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import random
+import unittest
+from io import BytesIO
+
+from xpra.util import typedict
+from xpra.net import compression
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, block_pixels
+
+W, H = 320, 240
+
+
+class TestDownscale(unittest.TestCase):
+
+    def setUp(self):
+        compression.init_all()
+
+    def encode(self, encoding, display_size, options=None):
+        model = SyntheticWindowModel(W, H)
+        packets = []
+        pipeline = HeadlessPipeline(model, encoding, video=False, packet_cb=packets.append)
+        ws = pipeline.window_source
+        ws.strict = True
+        ws.assign_encoding_getter()
+        ws.set_auto_refresh_delay(0)
+        ws.client_display_size = display_size
+        model.paint(0, 0, W, H, block_pixels(random.Random(0), W, H))
+        pipeline.damage(0, 0, W, H, options)
+        pipeline.run(0.2)
+        pipeline.cleanup()
+        self.assertEqual(len(packets), 1)
+        return ws, packets[0]
+
+    def test_rgb(self):
+        ws, packet = self.encode("rgb24", (W//2, H//2))
+        #the client paints the full window area:
+        self.assertEqual(packet[4:6], (W, H))
+        self.assertEqual(packet[6], "rgb24")
+        options = typedict(packet[10])
+        self.assertEqual(options.intpair("scaled-size"), (W//2, H//2))
+        data = packet[7].data
+        for algo in compression.ALL_COMPRESSORS:
+            if options.intget(algo, 0):
+                data = compression.decompress_by_name(data, algo=algo)
+        self.assertEqual(len(data), packet[9]*H//2)
+        self.assertEqual(ws.downscaled, 1)
+
+    def test_png(self):
+        from PIL import Image
+        _, packet = self.encode("png", (W//2, H//2))
+        self.assertEqual(packet[4:6], (W, H))
+        img = Image.open(BytesIO(packet[7].data))
+        self.assertEqual(img.size, (W//2, H//2))
+        #unless the client asks for a full size refresh:
+        _, packet = self.encode("png", (W//2, H//2), {"full-size" : True})
+        img = Image.open(BytesIO(packet[7].data))
+        self.assertEqual(img.size, (W, H))
+
+    def test_threshold(self):
+        #not worth downscaling:
+        ws, packet = self.encode("rgb24", (W-10, H-10))
+        assert "scaled-size" not in packet[10]
+        self.assertEqual(ws.downscaled, 0)
+        ws, packet = self.encode("rgb24", None)
+        assert "scaled-size" not in packet[10]
+        self.assertEqual(ws.downscaled, 0)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,402 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+"""
+Runs the server side damage pipeline without a display, a client or a main loop:
+the window contents come from a SyntheticWindowModel,
+timers are dispatched by a minimal EventLoop,
+the 'encode' thread work is done synchronously
+and the client acknowledges every packet it receives.
+This is used by the unit tests, the benchmarks (see tests/perf)
+and for replaying damage traces.
+"""
+
+import sys
+import heapq
+from time import sleep, thread_time
+from threading import Lock
+
+from xpra.util import typedict, AtomicInteger
+from xpra.os_util import monotonic_time
+from xpra.codecs.image_wrapper import ImageWrapper
+from xpra.server.shadow.root_window_model import RootWindowModel
+from xpra.server.window.batch_config import DamageBatchConfig
+from xpra.server.window.damage_trace import read_trace, DAMAGE, REGION, PIXELS, FLAG_PIXELS
+from xpra.server.source.source_stats import GlobalPerformanceStatistics
+from xpra.log import Logger
+
+log = Logger("encoding")
+
+
+def block_pixels(rng, width, height, block=8):
+    """ BGRX pixels made of random colour blocks, compressible but not trivially so """
+    rows = []
+    for _ in range((height+block-1)//block):
+        row = b"".join(rng.getrandbits(24).to_bytes(3, "little")+b"\0" for _ in range((width+block-1)//block))
+        #expand each pixel to the block width:
+        row = b"".join(row[i:i+4]*block for i in range(0, len(row), 4))[:width*4]
+        rows += [row]*block
+    return b"".join(rows[:height])
+
+
+class SyntheticWindowModel(RootWindowModel):
+    """
+        A window model backed by a BGRX pixel buffer that the caller modifies
+    """
+
+    def __init__(self, width, height, content_type=""):  #pylint: disable=super-init-not-called
+        self.geometry = (0, 0, width, height)
+        self.content_type = content_type
+        self.property_names = ["depth"]
+        self.dynamic_property_names = []
+        self.internal_property_names = ["content-type"]
+        self.stride = width*4
+        self.pixels = bytearray(b"\xff"*(self.stride*height))
+
+    def __repr__(self):
+        return "SyntheticWindowModel(%ix%i)" % self.geometry[2:4]
+
+    def is_shadow(self):
+        return False
+
+    def get_property(self, prop):
+        if prop=="window-type":
+            return ["NORMAL"]
+        return super().get_property(prop)
+
+    def get_image(self, x, y, width, height):
+        stride = self.stride
+        if x==0 and width*4==stride:
+            data = bytes(self.pixels[y*stride:(y+height)*stride])
+        else:
+            mv = memoryview(self.pixels)
+            data = b"".join(mv[(y+i)*stride+x*4:(y+i)*stride+(x+width)*4] for i in range(height))
+        return ImageWrapper(x, y, width, height, data, "BGRX", 24, width*4, planes=ImageWrapper.PACKED)
+
+    def paint(self, x, y, width, height, data):
+        """ copies BGRX pixel data (with a rowstride of width*4) into the window """
+        stride = self.stride
+        rowstride = width*4
+        for i in range(height):
+            pos = (y+i)*stride+x*4
+            self.pixels[pos:pos+rowstride] = data[i*rowstride:(i+1)*rowstride]
+
+    def scroll(self, dy):
+        """ moves the contents up by dy pixels, the bottom rows are left unchanged """
+        if dy<=0:
+            return
+        offset = dy*self.stride
+        self.pixels[:-offset] = self.pixels[offset:]
+
+
+class EventLoop:
+    """
+        Implements the idle_add, timeout_add and source_remove
+        scheduling functions used by the window sources and the network protocol,
+        the callbacks are dispatched by run() in the calling thread.
+        As with GLib, callbacks which return True are called again.
+    """
+
+    def __init__(self):
+        self.lock = Lock()
+        self.timers = []
+        self.cancelled = set()
+        self.counter = AtomicInteger()
+
+    def timeout_add(self, delay, fn, *args):
+        tid = self.counter.increase()
+        self.schedule(tid, delay, fn, args)
+        return tid
+
+    def schedule(self, tid, delay, fn, args):
+        with self.lock:
+            heapq.heappush(self.timers, (monotonic_time()+delay/1000, tid, delay, fn, args))
+
+    def idle_add(self, fn, *args):
+        return self.timeout_add(0, fn, *args)
+
+    def source_remove(self, tid):
+        with self.lock:
+            self.cancelled.add(tid)
+
+    def clear(self):
+        """ drops all the pending callbacks """
+        with self.lock:
+            self.timers = []
+            self.cancelled = set()
+
+    def run_pending(self):
+        """ runs the callbacks that are due, returns the time of the next one (or 0) """
+        while True:
+            with self.lock:
+                if not self.timers:
+                    return 0
+                due, tid, delay, fn, args = self.timers[0]
+                if due>monotonic_time():
+                    return due
+                heapq.heappop(self.timers)
+                if tid in self.cancelled:
+                    self.cancelled.discard(tid)
+                    continue
+            if fn(*args) is True:
+                self.schedule(tid, delay, fn, args)
+
+    def run(self, duration):
+        end = monotonic_time()+duration
+        while True:
+            due = self.run_pending() or end
+            now = monotonic_time()
+            if now>=end:
+                return
+            sleep(max(0, min(due, end)-now))
+
+
+def init_encodings():
+    """
+        loads the encoders and returns the encodings and core encodings available,
+        using the same rules as the encoding server
+    """
+    from xpra.codecs.loader import load_codecs, get_codec, has_codec
+    from xpra.codecs.video_helper import getVideoHelper
+    load_codecs(decoders=False)
+    vh = getVideoHelper()
+    vh.init()
+    core_encodings = ["rgb24", "rgb32", "scroll"]+list(vh.get_encodings())
+    enc_pillow = get_codec("enc_pillow")
+    if enc_pillow:
+        core_encodings += [x for x in enc_pillow.get_encodings() if x!="webp"]
+        if has_codec("enc_webp"):
+            core_encodings.append("webp")
+    if has_codec("enc_palette"):
+        core_encodings.append("palette")
+    encodings = []
+    for ce in core_encodings:
+        e = {"rgb32" : "rgb", "rgb24" : "rgb"}.get(ce, ce)
+        if e not in encodings:
+            encodings.append(e)
+    return encodings, core_encodings
+
+
+class HeadlessPipeline:
+    """
+        Feeds the damage events for a single window through a WindowVideoSource (or WindowSource),
+        the simulated client acknowledges each packet after 'ack_delay' milliseconds
+        and decodes at 'decode_speed' megapixels per second.
+        The CPU time used is recorded for each stage:
+        damage (processing the damage requests), process (batching and capture),
+        encode (compression) and send (packet handling and acks).
+    """
+
+    def __init__(self, model, encoding="auto", video=True, ack_delay=0, decode_speed=100,
+                 encoding_options=None, packet_cb=None, loop=None, wid=1):
+        self.model = model
+        self.own_loop = loop is None
+        self.loop = loop or EventLoop()
+        self.closed = False
+        self.ack_delay = ack_delay
+        self.decode_speed = decode_speed
+        self.packet_cb = packet_cb
+        self.cpu = {"damage" : 0, "process" : 0, "encode" : 0, "send" : 0}
+        self.damage_count = 0
+        self.packet_count = 0
+        self.packet_bytes = 0
+        self.statistics = GlobalPerformanceStatistics()
+        encodings, core_encodings = init_encodings()
+        from xpra.codecs.video_helper import getVideoHelper
+        if video:
+            from xpra.server.window.window_video_source import WindowVideoSource as source_class
+        else:
+            from xpra.server.window.window_source import WindowSource as source_class
+        eo = {"rgb_lz4" : True, "transparency" : False, "delta_buckets" : 5}
+        eo.update(encoding_options or {})
+        ww, wh = model.get_dimensions()
+        self.window_source = source_class(
+            self.idle_add, self.timeout_add, self.loop.source_remove,
+            ww, wh,
+            self.record_congestion_event, self.encode_queue_size,
+            self.call_in_encode_thread, self.queue_packet,
+            self.statistics,
+            wid, model, DamageBatchConfig(), 0,
+            False, 0,
+            getVideoHelper(),
+            None,
+            core_encodings, encodings,
+            encoding, encodings, core_encodings,
+            (), typedict(eo), typedict(),
+            ("RGB", "RGBX", "RGBA"),
+            typedict(),
+            None, 0, 0, 0)
+
+    def __repr__(self):
+        return "HeadlessPipeline(%s)" % self.model
+
+    def timed(self, stage, fn, *args):
+        if self.closed:
+            #the window source has been cleaned up, drop the callback:
+            return None
+        start = thread_time()
+        try:
+            return fn(*args)
+        finally:
+            self.cpu[stage] += thread_time()-start
+
+    def timeout_add(self, delay, fn, *args):
+        return self.loop.timeout_add(delay, self.timed, "process", fn, *args)
+
+    def idle_add(self, fn, *args):
+        return self.loop.idle_add(self.timed, "process", fn, *args)
+
+    def call_in_encode_thread(self, _optional, fn, *args):
+        self.timed("encode", fn, *args)
+
+    def encode_queue_size(self):
+        return 0
+
+    def record_congestion_event(self, source, late_pct=0, send_speed=0):
+        log("record_congestion_event(%s, %i, %i)", source, late_pct, send_speed)
+
+    def damage(self, x, y, w, h, options=None):
+        self.damage_count += 1
+        #flag it as a real damage event, like the X11 server does,
+        #so it is recorded in the statistics used for video region detection:
+        options = dict(options or {})
+        options["damage"] = True
+        self.timed("damage", self.window_source.damage, x, y, w, h, options)
+
+    def queue_packet(self, packet, _wid, pixels, start_send_cb, end_send_cb, _fail_cb, _wait_for_more):
+        start = thread_time()
+        size = len(packet[7])
+        self.packet_count += 1
+        self.packet_bytes += size
+        start_send_cb(self.packet_bytes-size)
+        end_send_cb(self.packet_bytes)
+        if self.packet_cb:
+            self.packet_cb(packet)
+        decode_time = max(1, pixels//max(1, self.decode_speed))
+        self.cpu["send"] += thread_time()-start
+        ack = (self.timed, "send", self.window_source.damage_packet_acked,
+               packet[8], packet[4], packet[5], decode_time, "")
+        #the client acknowledges the packet after 'ack_delay':
+        self.loop.timeout_add(self.ack_delay, *ack)
+
+    def run(self, duration):
+        self.loop.run(duration)
+
+    def get_results(self, elapsed) -> dict:
+        stats = self.window_source.statistics
+        frames = self.packet_count
+        return {
+            "window"            : self.model.get_dimensions(),
+            "duration"          : round(elapsed, 3),
+            "damage-events"     : self.damage_count,
+            "frames"            : frames,
+            "fps"               : round(frames/max(0.001, elapsed), 1),
+            "bytes"             : self.packet_bytes,
+            "bytes-per-frame"   : self.packet_bytes//max(1, frames),
+            "encodings"         : dict((enc, {
+                "frames"    : totals[0],
+                "pixels"    : totals[1],
+                "bytes"     : totals[2],
+                }) for enc, totals in stats.encoding_totals.items()),
+            #in microseconds:
+            "latency"           : dict((stage, h.get_info()) for stage, h in stats.stage_latency.items()),
+            #in seconds:
+            "cpu"               : dict((k, round(v, 3)) for k, v in self.cpu.items()),
+            "cpu-per-frame-ms"  : round(sum(self.cpu.values())*1000/max(1, frames), 3),
+            }
+
+    def cleanup(self):
+        #the callbacks still pending would use the window source after its cleanup,
+        #so they are dropped rather than run:
+        self.closed = True
+        self.window_source.cleanup()
+        if self.own_loop:
+            self.loop.clear()
+
+
+def to_bgrx(w, h, rowstride, pixel_format, pixels):
+    """ converts the pixel snapshot to the BGRX format used by SyntheticWindowModel """
+    if pixel_format not in ("BGRX", "BGRA"):
+        return None
+    if rowstride==w*4:
+        return pixels[:w*h*4]
+    return b"".join(pixels[i*rowstride:i*rowstride+w*4] for i in range(h))
+
+
+def replay(filename, realtime=False, encoding="auto", video=True, ack_delay=0):
+    """
+        feeds the damage events from the trace to a headless encoding pipeline for each window,
+        either at the recorded pace or as fast as possible,
+        and returns the results for each window.
+        Without pixel snapshots in the trace, the damaged areas are filled with synthetic content.
+    """
+    from random import Random
+    flags, records = read_trace(filename)
+    has_pixels = bool(flags & FLAG_PIXELS)
+    rng = Random(0)
+    loop = EventLoop()
+    pipelines = {}
+    regions = {}
+    start = monotonic_time()
+    for rtype, wid, t, fields, pixels in records:
+        if realtime:
+            loop.run(max(0, start+t-monotonic_time()))
+        else:
+            loop.run_pending()
+        if rtype==DAMAGE:
+            x, y, w, h, ww, wh = fields
+            pipeline = pipelines.get(wid)
+            if not pipeline:
+                model = SyntheticWindowModel(ww, wh)
+                pipeline = pipelines[wid] = HeadlessPipeline(model, encoding, video, ack_delay, loop=loop, wid=wid)
+            #clip to the window size we started with:
+            ww, wh = pipeline.model.get_dimensions()
+            w = min(w, ww-x)
+            h = min(h, wh-y)
+            if w<=0 or h<=0 or x<0 or y<0:
+                continue
+            if not has_pixels:
+                pipeline.model.paint(x, y, w, h, block_pixels(rng, w, h))
+            pipeline.damage(x, y, w, h)
+        elif rtype==REGION:
+            coding = fields[4]
+            counts = regions.setdefault(wid, {})
+            counts[coding] = counts.get(coding, 0)+1
+        elif rtype==PIXELS:
+            pipeline = pipelines.get(wid)
+            x, y, w, h, rowstride, pixel_format = fields
+            data = to_bgrx(w, h, rowstride, pixel_format, pixels)
+            if pipeline and data:
+                ww, wh = pipeline.model.get_dimensions()
+                if x+w<=ww and y+h<=wh:
+                    pipeline.model.paint(x, y, w, h, data)
+    #let the pipelines flush the last damage events:
+    loop.run(1)
+    elapsed = monotonic_time()-start
+    results = {}
+    for wid, pipeline in pipelines.items():
+        results[wid] = pipeline.get_results(elapsed)
+        results[wid]["recorded-regions"] = regions.get(wid, {})
+        pipeline.cleanup()
+    return results
+
+
+def main(argv):
+    import json
+    import argparse
+    parser = argparse.ArgumentParser(description="replay a damage trace through the encoding pipeline")
+    parser.add_argument("filename", help="the damage trace file")
+    parser.add_argument("--realtime", action="store_true", help="replay at the recorded pace")
+    parser.add_argument("--encoding", default="auto", help="the encoding to use")
+    parser.add_argument("--ack-delay", type=int, default=0, help="simulated client latency, in milliseconds")
+    args = parser.parse_args(argv[1:])
+    results = replay(args.filename, args.realtime, args.encoding, ack_delay=args.ack_delay)
+    print(json.dumps(results, indent=2, sort_keys=True))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
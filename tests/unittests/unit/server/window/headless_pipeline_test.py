@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.server.window.content_classifier import FLAT  #@UnresolvedImport
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, EventLoop
+
+
+class TestHeadlessPipeline(unittest.TestCase):
+
+    def test_event_loop(self):
+        loop = EventLoop()
+        calls = []
+        def repeat():
+            calls.append("repeat")
+            return calls.count("repeat")<3
+        loop.timeout_add(10, repeat)
+        tid = loop.timeout_add(0, calls.append, "cancelled")
+        loop.source_remove(tid)
+        loop.idle_add(calls.append, "idle")
+        loop.run(0.2)
+        assert calls==["idle", "repeat", "repeat", "repeat"], "unexpected calls: %s" % (calls,)
+
+    def test_model(self):
+        model = SyntheticWindowModel(8, 4)
+        model.paint(2, 1, 2, 2, b"\x01\x02\x03\x04"*4)
+        image = model.get_image(2, 1, 2, 2)
+        assert image.get_pixels()==b"\x01\x02\x03\x04"*4
+        model.scroll(1)
+        assert model.get_image(2, 0, 2, 2).get_pixels()==b"\x01\x02\x03\x04"*4
+        size = len(model.pixels)
+        model.scroll(0)
+        assert len(model.pixels)==size
+        assert model.get_image(2, 0, 2, 2).get_pixels()==b"\x01\x02\x03\x04"*4
+
+    def test_pipeline(self):
+        model = SyntheticWindowModel(320, 240, "text")
+        packets = []
+        pipeline = HeadlessPipeline(model, packet_cb=packets.append)
+        for i in range(5):
+            model.paint(10*i, 10, 10, 10, b"\0"*400)
+            pipeline.damage(10*i, 10, 10, 10)
+            pipeline.run(0.1)
+        assert pipeline.damage_count==5
+        assert packets and pipeline.packet_count==len(packets)
+        assert all(packet[0]=="draw" for packet in packets)
+        assert not pipeline.window_source.statistics.damage_ack_pending, "all the packets should have been acked"
+        assert pipeline.cpu["encode"]>0
+        pipeline.cleanup()
+
+    def test_content_selection(self):
+        model = SyntheticWindowModel(320, 240)
+        pipeline = HeadlessPipeline(model, video=False)
+        ws = pipeline.window_source
+        model.paint(0, 0, 320, 240, b"\x80"*320*240*4)
+        def select():
+            return ws.select_encoding(ws.get_best_encoding, 0, 0, 320, 240, 50, 50, ws.encoding, {})
+        #nothing is known about the content yet:
+        encoding = select()
+        assert encoding==ws.get_best_encoding(320, 240, 50, 50, ws.encoding)
+        for _ in range(3):
+            pipeline.damage(0, 0, 320, 240)
+            pipeline.run(0.1)
+        assert ws.get_content_class(0, 0, 320, 240)==FLAT
+        assert ws.get_update_rate(0, 0, 320, 240)>0
+        #flat content is sent losslessly:
+        assert select() in ("palette", "rgb24", "png"), "got %s" % select()
+        #unless the encoding is forced:
+        assert ws.select_encoding(ws.get_best_encoding, 0, 0, 320, 240, 50, 50, ws.encoding, {"encoding" : encoding})==encoding
+        pipeline.cleanup()
+
+    def test_cleanup_pending(self):
+        model = SyntheticWindowModel(320, 240)
+        loop = EventLoop()
+        pipeline = HeadlessPipeline(model, video=False, loop=loop)
+        #leave the damage batching and refresh timers pending:
+        pipeline.damage(0, 0, 320, 240, {"quality" : 30})
+        pipeline.window_source.set_auto_refresh_delay(100)
+        pipeline.damage(0, 0, 10, 10)
+        assert loop.timers
+        pipeline.cleanup()
+        #the callbacks that were pending must not use the window source:
+        loop.run(0.3)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
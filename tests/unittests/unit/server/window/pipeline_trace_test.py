@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import json
+import shutil
+import tempfile
+import unittest
+
+from xpra.os_util import monotonic_time
+from xpra.server.window.pipeline_trace import PipelineTrace, PIPELINE_STAGES
+
+
+class TestPipelineTrace(unittest.TestCase):
+
+    def test_trace(self):
+        pt = PipelineTrace()
+        assert not pt.is_active()
+        now = monotonic_time()
+        #ignored when inactive:
+        pt.add(1, "encode", now, now+0.01)
+        tmpdir = tempfile.mkdtemp(prefix="pipeline-trace")
+        filename = os.path.join(tmpdir, "trace.json")
+        try:
+            assert pt.start(10, filename)==filename
+            assert pt.is_active()
+            assert pt.get_info().get("filename")==filename
+            for wid in (1, 2):
+                for i, stage in enumerate(PIPELINE_STAGES):
+                    pt.add(wid, stage, now+i*0.01, now+(i+1)*0.01, sequence=1)
+            #too late, outside the trace window:
+            pt.add(1, "encode", now, now+20)
+            assert pt.stop(True)==filename
+            assert not pt.is_active()
+            assert pt.stop() is None
+            with open(filename, "r") as f:
+                trace = json.load(f)
+            events = trace["traceEvents"]
+            complete = [e for e in events if e["ph"]=="X"]
+            assert len(complete)==2*len(PIPELINE_STAGES)
+            assert all(9000<=e["dur"]<=11000 for e in complete)
+            names = [e for e in events if e["ph"]=="M"]
+            assert sorted(e["tid"] for e in names)==[1, 2]
+            #existing files are never overwritten:
+            with self.assertRaises(OSError):
+                pt.start(10, filename)
+            link = os.path.join(tmpdir, "link.json")
+            os.symlink(os.path.join(tmpdir, "target.json"), link)
+            with self.assertRaises(OSError):
+                pt.start(10, link)
+            assert not os.path.exists(os.path.join(tmpdir, "target.json"))
+            #the default filename is unique:
+            default_filename = pt.start(10)
+            try:
+                assert os.path.exists(default_filename)
+                assert pt.stop(True)==default_filename
+            finally:
+                os.unlink(default_filename)
+        finally:
+            shutil.rmtree(tmpdir)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import random
+import unittest
+
+from xpra.util import typedict
+from xpra.os_util import monotonic_time
+from xpra.net import compression
+from xpra.rectangle import rectangle     #@UnresolvedImport
+from xpra.buffers.cyxor import xor_str, and_mask     #@UnresolvedImport
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, block_pixels
+from xpra.server.window.window_source import REFINE_MASKS
+
+W, H = 320, 240
+
+
+def decompress(packet):
+    options = typedict(packet[10])
+    data = packet[7].data
+    for algo in compression.ALL_COMPRESSORS:
+        if options.intget(algo, 0):
+            return compression.decompress_by_name(data, algo=algo)
+    return data
+
+def paint_rgb(packet, buckets):
+    """ applies the delta buckets like the client does """
+    options = typedict(packet[10])
+    data = bytes(decompress(packet))
+    bucket = options.intget("bucket", 0)
+    delta = options.intget("delta", -1)
+    if delta>=0:
+        assert buckets[bucket][0]==delta
+        data = bytes(xor_str(data, buckets[bucket][1]))
+    store = options.intget("store", 0)
+    if store>0:
+        buckets[bucket] = (store, data)
+    return data
+
+def bgrx_to_rgb(pixels):
+    rgb = bytearray(len(pixels)*3//4)
+    rgb[0::3] = pixels[2::4]
+    rgb[1::3] = pixels[1::4]
+    rgb[2::3] = pixels[0::4]
+    return bytes(rgb)
+
+
+class TestProgressiveRefresh(unittest.TestCase):
+
+    def setUp(self):
+        compression.init_all()
+        self.model = SyntheticWindowModel(W, H)
+        self.packets = []
+        def packet_cb(packet):
+            self.packets.append((monotonic_time(), packet))
+        self.pipeline = HeadlessPipeline(self.model, "jpeg", video=False, packet_cb=packet_cb)
+        ws = self.ws = self.pipeline.window_source
+        if "jpeg" not in ws._encoders:
+            self.skipTest("no jpeg encoder")
+        ws.strict = True
+        ws.assign_encoding_getter()
+        ws.set_auto_refresh_delay(100)
+        ws.update_refresh_attributes()
+        #1Mbps:
+        ws.bandwidth_limit = 1000*1000
+
+    def tearDown(self):
+        self.pipeline.cleanup()
+
+    def paint(self, seed=0):
+        pixels = block_pixels(random.Random(seed), W, H, 2)
+        self.model.paint(0, 0, W, H, pixels)
+        self.pipeline.damage(0, 0, W, H, {"quality" : 30})
+        return pixels
+
+    def run_until(self, count, timeout=5):
+        start = monotonic_time()
+        while len(self.packets)<count and monotonic_time()-start<timeout:
+            self.pipeline.run(0.02)
+
+    def test_layers(self):
+        ws = self.ws
+        assert ws.use_progressive_refresh([rectangle(0, 0, W, H)])
+        assert not ws.use_progressive_refresh([rectangle(0, 0, 10, 10)])
+        pixels = bgrx_to_rgb(self.paint())
+        self.run_until(3)
+        codings = [p[6] for _, p in self.packets]
+        self.assertEqual(codings, ["jpeg", "rgb24", "rgb24"])
+        layer1, layer2 = (p for _, p in self.packets[1:])
+        self.assertEqual(layer1[10]["refine"], 1)
+        self.assertEqual(layer2[10]["refine"], 0)
+        #the client applies the second layer as a residual using the delta buckets:
+        assert layer2[10]["delta"]==layer1[10]["store"]
+        assert layer2[10]["bucket"]==layer1[10]["bucket"]
+        self.assertEqual(layer1[10]["rgb_format"], "RGB")
+        buckets = {}
+        stage1 = paint_rgb(layer1, buckets)
+        self.assertEqual(stage1, bytes(and_mask(pixels, REFINE_MASKS[0])))
+        self.assertEqual(paint_rgb(layer2, buckets), pixels)
+        #the residual is smaller than the lossless pixels:
+        assert len(layer2[7].data)<len(compression.compressed_wrapper("rgb24", pixels, lz4=True, level=1).data)
+        #the second layer waited for the bandwidth budget:
+        elapsed = self.packets[2][0]-self.packets[1][0]
+        assert elapsed>=len(layer1[7].data)/ws.get_refine_budget()*0.9
+        self.pipeline.run(0.5)
+        self.assertEqual(len(self.packets), 3)
+        self.assertEqual(ws.progressive_counts, {"started" : 1, "layers" : 2})
+
+    def test_damage(self):
+        ws = self.ws
+        self.paint()
+        self.run_until(2)
+        assert ws.refine_regions
+        #the new content gets its own lossy update and refresh:
+        pixels = bgrx_to_rgb(self.paint(1))
+        assert not ws.refine_regions
+        self.run_until(5)
+        self.assertEqual([p[6] for _, p in self.packets], ["jpeg", "rgb24", "jpeg", "rgb24", "rgb24"])
+        buckets = {}
+        for _, packet in self.packets:
+            if packet[6]=="rgb24":
+                data = paint_rgb(packet, buckets)
+        self.assertEqual(data, pixels)
+
+    def test_unlimited(self):
+        self.ws.bandwidth_limit = None
+        assert not self.ws.use_progressive_refresh([rectangle(0, 0, W, H)])
+        self.ws.bandwidth_limit = 0
+        self.paint()
+        self.run_until(2)
+        self.pipeline.run(0.2)
+        self.assertEqual(len(self.packets), 2)
+        assert self.packets[1][1][6]!="jpeg" and "refine" not in self.packets[1][1][10]
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
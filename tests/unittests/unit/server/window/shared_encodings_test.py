@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import time
+import unittest
+from threading import Thread
+
+from xpra.server.window.shared_encodings import SharedEncodings, shared_encodings
+
+
+def encoded(data=b"1234", options=None):
+    return ("webp", data, options or {}, 10, 10, 40, 32)
+
+
+class SharedEncodingsTest(unittest.TestCase):
+
+    def test_sources(self):
+        se = SharedEncodings()
+        assert repr(se)
+        se.add_source(1)
+        assert not se.is_shared(1)
+        se.add_source(1)
+        assert se.is_shared(1)
+        key = (1, "frame")
+        assert se.get(key) is None
+        se.set(key, encoded())
+        self.assertEqual(se.get_info()["windows"], 1)
+        se.remove_source(1)
+        assert not se.is_shared(1)
+        assert se.get(key)
+        se.remove_source(1)
+        #the entries for this window are gone:
+        self.assertEqual(se.size, 0)
+        assert not se.entries
+
+    def test_get_set(self):
+        se = SharedEncodings()
+        key = (1, "frame")
+        assert se.get(key) is None
+        se.set(key, encoded(options={"quality" : 50}))
+        ret = se.get(key)
+        self.assertEqual(ret[1], b"1234")
+        #each window source gets its own copy of the client options:
+        ret[2]["flush"] = 1
+        self.assertEqual(se.get(key)[2], {"quality" : 50})
+        info = se.get_info()
+        self.assertEqual(info["hits"], 2)
+        self.assertEqual(info["misses"], 1)
+        self.assertEqual(info["saved-bytes"], 8)
+
+    def test_failure(self):
+        se = SharedEncodings()
+        key = (1, "frame")
+        assert se.get(key) is None
+        se.set(key, None)
+        #the next one has to encode it:
+        assert se.get(key) is None
+        self.assertEqual(se.misses, 2)
+
+    def test_wait(self):
+        se = SharedEncodings()
+        key = (1, "frame")
+        assert se.get(key) is None
+        results = []
+        def other_client():
+            results.append(se.get(key))
+        t = Thread(target=other_client, daemon=True)
+        t.start()
+        time.sleep(0.05)
+        se.set(key, encoded())
+        t.join(5)
+        self.assertEqual(len(results), 1)
+        self.assertEqual(results[0][1], b"1234")
+        self.assertEqual(se.waits, 1)
+
+    def test_limits(self):
+        se = SharedEncodings(max_size=10, ttl=100)
+        for i in range(4):
+            se.get((1, i))
+            se.set((1, i), encoded())
+        assert se.size<=10
+        assert (1, 3) in se.entries and (1, 0) not in se.entries
+        time.sleep(0.15)
+        #expired:
+        assert se.get((1, 3)) is None
+        self.assertEqual(len(se.entries), 1)
+
+    def test_pipelines(self):
+        from xpra.codecs.loader import load_codec, has_codec
+        from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, EventLoop
+        load_codec("enc_pillow")
+        if not has_codec("enc_pillow"):
+            raise unittest.SkipTest("no pillow encoder")
+        model = SyntheticWindowModel(320, 240, "text")
+        loop = EventLoop()
+        packets = ([], [])
+        pipelines = tuple(HeadlessPipeline(model, "png", video=False, loop=loop, wid=100,
+                                           packet_cb=packets[i].append) for i in range(2))
+        for pipeline in pipelines:
+            #don't use 'rgb' for small areas:
+            pipeline.window_source.strict = True
+            pipeline.window_source.assign_encoding_getter()
+        hits = shared_encodings.hits
+        for i in range(5):
+            #large enough to not be sent as plain rgb:
+            model.paint(10*i, 10, 80, 80, bytes(range(256))*100)
+            for pipeline in pipelines:
+                pipeline.damage(10*i, 10, 80, 80)
+            loop.run(0.1)
+        assert packets[0] and len(packets[0])==len(packets[1])
+        for p0, p1 in zip(*packets):
+            self.assertEqual(p0[6], "png")
+            self.assertEqual(p0[7].data, p1[7].data)
+        assert shared_encodings.hits>hits
+        for pipeline in pipelines:
+            pipeline.cleanup()
+        assert not shared_encodings.is_shared(100)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import random
+import unittest
+
+from xpra.os_util import monotonic_time
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline, block_pixels
+from xpra.server.window.window_source import SpeculativeRefresh
+
+W, H = 160, 120
+
+
+class TestSpeculativeRefresh(unittest.TestCase):
+
+    def test_state(self):
+        spec = SpeculativeRefresh([])
+        assert not spec.add((("draw", 1, 0, 0, 10, 10, "png"), 0, 0, {}))
+        #all the regions were encoded before we knew how many there were:
+        assert spec.set_expected(1)
+        assert spec.is_complete()
+        assert not spec.uses_client_references()
+        spec = SpeculativeRefresh([])
+        spec.set_expected(2)
+        assert not spec.add((("draw", 1, 0, 0, 10, 10, "rgb24"), 0, 0, {}))
+        assert spec.add(None)
+        assert not spec.is_complete()
+        assert spec.uses_client_references()
+
+    def make_pipeline(self):
+        model = SyntheticWindowModel(W, H)
+        self.packets = []
+        def packet_cb(packet):
+            self.packets.append((monotonic_time(), packet[6], packet[10].get("quality", 100)))
+        pipeline = HeadlessPipeline(model, "jpeg", video=False, packet_cb=packet_cb)
+        ws = pipeline.window_source
+        if "jpeg" not in ws._encoders:
+            self.skipTest("no jpeg encoder")
+        #always use jpeg for the screen updates:
+        ws.strict = True
+        ws.assign_encoding_getter()
+        ws.set_auto_refresh_delay(300)
+        ws.update_refresh_attributes()
+        return model, pipeline, ws
+
+    def lossy_update(self, model, pipeline):
+        model.paint(0, 0, W, H, block_pixels(random.Random(len(self.packets)), W, H))
+        pipeline.damage(0, 0, W, H, {"quality" : 30})
+
+    def run_until(self, pipeline, condition, timeout=2):
+        start = monotonic_time()
+        while not condition() and monotonic_time()-start<timeout:
+            pipeline.run(0.01)
+
+    def test_refresh_sent_early(self):
+        model, pipeline, ws = self.make_pipeline()
+        self.lossy_update(model, pipeline)
+        self.run_until(pipeline, lambda: len(self.packets)>=2)
+        assert len(self.packets)==2, "expected a lossy update and a refresh, got %s" % (self.packets,)
+        lossy, refresh = self.packets
+        assert lossy[2]<ws.refresh_quality
+        assert refresh[2]>=ws.refresh_quality
+        self.assertEqual(ws.speculative_counts["sent"], 1)
+        #sent without waiting for the refresh timer:
+        elapsed = refresh[0]-lossy[0]
+        assert elapsed<ws.min_auto_refresh_delay/1000, "refresh took %ims" % (elapsed*1000)
+        assert not ws.refresh_timer and not ws.refresh_regions
+        #nothing more to send:
+        pipeline.run(0.5)
+        self.assertEqual(len(self.packets), 2)
+        pipeline.cleanup()
+
+    def test_cancel(self):
+        model, pipeline, ws = self.make_pipeline()
+        gs = pipeline.statistics
+        #congestion prevents sending the refresh before the timer fires:
+        gs.last_congestion_time = monotonic_time()+10
+        self.lossy_update(model, pipeline)
+        self.run_until(pipeline, lambda: ws.speculative_counts["started"]>0)
+        assert ws.speculative and ws.speculative.is_complete()
+        self.assertEqual(len(self.packets), 1)
+        #new damage makes it stale:
+        self.lossy_update(model, pipeline)
+        assert ws.speculative is None
+        self.assertEqual(ws.speculative_counts["cancelled"], 1)
+        gs.last_congestion_time = 0
+        self.run_until(pipeline, lambda: len(self.packets)>=3)
+        #the new lossy update, then its refresh:
+        self.assertEqual([p[2]>=ws.refresh_quality for p in self.packets], [False, False, True])
+        pipeline.run(0.5)
+        self.assertEqual(len(self.packets), 3)
+        pipeline.cleanup()
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from xpra.rectangle import rectangle    #@UnresolvedImport
+from xpra.server.window.video_stream import VideoStream
+
+
+class FakeEncoder:
+    def __init__(self, encoding="h264", width=320, height=240, src_format="YUV420P"):
+        self.encoding = encoding
+        self.width = width
+        self.height = height
+        self.src_format = src_format
+        self.closed = False
+    def get_encoding(self):
+        return self.encoding
+    def get_width(self):
+        return self.width
+    def get_height(self):
+        return self.height
+    def get_src_format(self):
+        return self.src_format
+    def get_type(self):
+        return "fake"
+    def get_info(self):
+        return {}
+    def is_closed(self):
+        return self.closed
+    def clean(self):
+        self.closed = True
+    def compress_image(self, image, _quality, _speed, _options):
+        return b"data-%s" % image, {"frame" : 0}
+
+
+class TestVideoStream(unittest.TestCase):
+
+    def test_masked_rectangle(self):
+        vs = VideoStream(1, rectangle(10, 20, 301, 201))
+        self.assertEqual(vs.get_masked_rectangle(), (10, 20, 300, 200))
+        vs.set_pipeline(None, FakeEncoder(), (1, 1), 0xFFF0, 0xFFFF)
+        self.assertEqual(vs.get_masked_rectangle(), (10, 20, 288, 201))
+
+    def test_check(self):
+        vs = VideoStream(1, rectangle(0, 0, 320, 240))
+        assert not vs.check(("h264", ), 320, 240, "YUV420P")
+        ve = FakeEncoder()
+        vs.set_pipeline(None, ve, (1, 1), 0xFFFE, 0xFFFE)
+        assert vs.check(("h264", ), 320, 240, "YUV420P")
+        assert not vs.check(("vp8", ), 320, 240, "YUV420P")
+        assert not vs.check(("h264", ), 640, 240, "YUV420P")
+        assert not vs.check(("h264", ), 320, 240, "BGRX")
+        ve.closed = True
+        assert not vs.check(("h264", ), 320, 240, "YUV420P")
+
+    def test_compress(self):
+        vs = VideoStream(2, rectangle(0, 0, 320, 240))
+        vs.set_pipeline(None, FakeEncoder(), (1, 1), 0xFFFE, 0xFFFE)
+        data, client_options = vs.compress(b"image", 320, 240, 50, 50, {})
+        self.assertEqual(data, b"data-image")
+        self.assertEqual(client_options.get("stream"), 2)
+        self.assertEqual(vs.frames, 1)
+        assert vs.get_info()["frames"]==1
+        assert vs.clean()
+        assert not vs.clean()
+
+    def test_stale_stream(self):
+        from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline
+        model = SyntheticWindowModel(640, 480)
+        pipeline = HeadlessPipeline(model, video=True)
+        ws = pipeline.window_source
+        try:
+            ws.max_video_streams = 3
+            r1 = rectangle(0, 0, 320, 240)
+            r2 = rectangle(320, 240, 320, 240)
+            ws.update_video_streams([r1])
+            self.assertEqual(list(ws.video_streams.keys()), [1])
+            ws.update_video_streams([])
+            ws.update_video_streams([r2])
+            #the stream number is not re-used:
+            self.assertEqual(list(ws.video_streams.keys()), [2])
+            #a frame queued for the stream that has gone away:
+            fallback = []
+            def video_fallback(image, options, *_args):
+                fallback.append(options.get("video-stream"))
+            ws.video_fallback = video_fallback
+            ws.pixel_format = "BGRX"
+            image = model.get_image(0, 0, 320, 240)
+            assert ws.do_video_encode("h264", image, {"video-stream" : 1}) is None
+            self.assertEqual(fallback, [1])
+        finally:
+            pipeline.cleanup()
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
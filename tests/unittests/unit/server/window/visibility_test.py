@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import unittest
+
+from unit.server.window.headless_pipeline import SyntheticWindowModel, HeadlessPipeline
+
+W, H = 200, 100
+
+
+class TestVisibility(unittest.TestCase):
+
+    def setUp(self):
+        self.model = SyntheticWindowModel(W, H)
+        self.packets = []
+        def packet_cb(packet):
+            self.packets.append(packet)
+        self.pipeline = HeadlessPipeline(self.model, "png", video=False, packet_cb=packet_cb)
+        self.ws = self.pipeline.window_source
+        self.ws.set_auto_refresh_delay(0)
+        #record the areas that get through to the batching code:
+        self.damaged = []
+        do_damage = self.ws.do_damage
+        def record_damage(ww, wh, x, y, w, h, options):
+            self.damaged.append((x, y, w, h))
+            do_damage(ww, wh, x, y, w, h, options)
+        self.ws.do_damage = record_damage
+
+    def tearDown(self):
+        self.pipeline.cleanup()
+
+    def sent(self):
+        self.pipeline.run(0.1)
+        pixels = sum(w*h for _, _, w, h in self.damaged)
+        self.damaged = []
+        return pixels
+
+    def test_visible(self):
+        self.pipeline.damage(0, 0, W, H)
+        self.assertEqual(self.sent(), W*H)
+        assert self.packets
+        self.ws.set_visibility(None)
+        self.pipeline.damage(0, 0, W, H)
+        self.assertEqual(self.sent(), W*H)
+        assert not self.ws.hidden_damage
+
+    def test_hidden(self):
+        ws = self.ws
+        #another window covers the right half of this one:
+        ws.set_visibility([(0, 0, W//2, H)])
+        self.pipeline.damage(0, 0, W, H)
+        for x, _, w, _ in self.damaged:
+            assert x+w<=W//2
+        self.assertEqual(self.sent(), W*H//2)
+        self.assertEqual(ws.get_visibility_info()["hidden-pixels"], W*H//2)
+        #damage in the hidden area is not sent:
+        self.pipeline.damage(W//2, 0, 10, 10)
+        self.assertEqual(self.sent(), 0)
+        #moved to another workspace:
+        ws.set_visibility([])
+        self.pipeline.damage(0, 0, W, H)
+        self.assertEqual(self.sent(), 0)
+        self.assertEqual(ws.get_visibility_info()["hidden-pixels"], W*H)
+        #exposing part of the window sends just that part:
+        ws.set_visibility([(0, 0, W//4, H)])
+        self.assertEqual(self.sent(), W*H//4)
+        #and the rest when it is all visible again:
+        ws.set_visibility(None)
+        self.assertEqual(self.sent(), W*H*3//4)
+        assert not ws.hidden_damage
+        self.pipeline.damage(0, 0, W, H)
+        self.assertEqual(self.sent(), W*H)
+        self.assertEqual(ws.hidden_counts["exposed"], W*H)
+
+    def test_overlapping(self):
+        ws = self.ws
+        ws.set_visibility([(0, 0, 100, 50), (50, 0, 100, 100)])
+        #the overlapping area is only sent once:
+        regions = ws.visible_regions
+        self.assertEqual(sum(r.width*r.height for r in regions), 100*50+100*100-50*50)
+        for r in regions:
+            assert not any(r.intersects_rect(o) for o in regions if o is not r)
+        self.pipeline.damage(0, 0, W, H)
+        self.sent()
+        self.assertEqual(ws.get_visibility_info()["hidden-pixels"], W*H-12500)
+
+    def test_full_frames_only(self):
+        ws = self.ws
+        ws.full_frames_only = True
+        ws.set_visibility([(0, 0, 10, 10)])
+        self.pipeline.damage(50, 50, 10, 10)
+        self.assertEqual(self.sent(), W*H)
+        ws.set_visibility([])
+        self.pipeline.damage(50, 50, 10, 10)
+        self.assertEqual(self.sent(), 0)
+        ws.set_visibility(None)
+        self.assertEqual(self.sent(), W*H)
+
+
+def main():
+    unittest.main()
+
+if __name__ == '__main__':
+    main()
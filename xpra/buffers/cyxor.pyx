@@ -5,7 +5,7 @@
 
 #cython: wraparound=False, boundscheck=False, language_level=3
 
-from libc.stdint cimport uint32_t, uintptr_t  #pylint: disable=syntax-error
+from libc.stdint cimport uint32_t, uint64_t, uintptr_t  #pylint: disable=syntax-error
 from xpra.buffers.membuf cimport getbuf, object_as_buffer, MemBuf
 from libc.string cimport memcpy
 
@@ -48,6 +48,62 @@ def xor_str(a, b):
     return memoryview(out_buf)
 
 
+def xor_delta(a, b):
+    """
+        Returns the xor of the two buffers,
+        and the number of 8-byte words which differ between the two,
+        so the caller can tell if the delta is worth sending.
+        The loop is simple enough for the compiler to vectorize it.
+    """
+    cdef Py_ssize_t alen = 0, blen = 0
+    cdef const unsigned char *abuf
+    cdef const unsigned char *bbuf
+    assert object_as_buffer(a, <const void **> &abuf, &alen)==0, "cannot get buffer pointer for %s" % type(a)
+    assert object_as_buffer(b, <const void **> &bbuf, &blen)==0, "cannot get buffer pointer for %s" % type(b)
+    assert alen==blen, "cyxor cannot xor buffers of different lengths (%i vs %i)" % (alen, blen)
+    cdef MemBuf out_buf = getbuf(alen)
+    cdef unsigned char *obuf = <unsigned char *> out_buf.get_mem()
+    cdef Py_ssize_t i, steps = alen // 8
+    cdef uint64_t va, vb, vo
+    cdef Py_ssize_t changed = 0
+    with nogil:
+        for i in range(steps):
+            #memcpy is the portable way of doing unaligned loads and stores:
+            memcpy(&va, abuf+i*8, 8)
+            memcpy(&vb, bbuf+i*8, 8)
+            vo = va ^ vb
+            memcpy(obuf+i*8, &vo, 8)
+            changed += vo!=0
+        for i in range(steps*8, alen):
+            obuf[i] = abuf[i] ^ bbuf[i]
+            if obuf[i]:
+                changed += 1
+    return memoryview(out_buf), changed
+
+
+def and_mask(a, unsigned char mask):
+    """
+        Returns a copy of the buffer with the mask applied to every byte,
+        used for sending the most significant bits of the pixels first.
+    """
+    cdef Py_ssize_t alen = 0
+    cdef const unsigned char *abuf
+    assert object_as_buffer(a, <const void **> &abuf, &alen)==0, "cannot get buffer pointer for %s" % type(a)
+    cdef MemBuf out_buf = getbuf(alen)
+    cdef unsigned char *obuf = <unsigned char *> out_buf.get_mem()
+    cdef Py_ssize_t i, steps = alen // 8
+    cdef uint64_t m = (<uint64_t> mask) * 0x0101010101010101
+    cdef uint64_t v
+    with nogil:
+        for i in range(steps):
+            memcpy(&v, abuf+i*8, 8)
+            v &= m
+            memcpy(obuf+i*8, &v, 8)
+        for i in range(steps*8, alen):
+            obuf[i] = abuf[i] & mask
+    return memoryview(out_buf)
+
+
 def hybi_unmask(data, unsigned int offset, unsigned int datalen):
     cdef Py_ssize_t mlen = 0, dlen = 0
     cdef uintptr_t mp, dp, op
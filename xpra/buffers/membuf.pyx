@@ -116,3 +116,13 @@ cdef unsigned long long xxh64(const void* input, size_t length, unsigned long lo
 
 cdef unsigned long long xxh3(const void* input, size_t length) nogil:
     return XXH3_64bits(input, length)
+
+def xxh3_hash(buf) -> int:
+    """ fast non-cryptographic hash of the contents of a buffer """
+    cdef const void *p = NULL
+    cdef Py_ssize_t l = 0
+    assert object_as_buffer(buf, &p, &l)==0, "cannot convert %s to a readable buffer" % type(buf)
+    cdef unsigned long long h
+    with nogil:
+        h = XXH3_64bits(p, l)
+    return h
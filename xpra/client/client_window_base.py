@@ -7,9 +7,10 @@
 
 import os
 import re
+from threading import Lock
 
 from xpra.client.client_widget_base import ClientWidgetBase
-from xpra.os_util import bytestostr, OSX, WIN32, is_Wayland
+from xpra.os_util import bytestostr, monotonic_time, OSX, WIN32, is_Wayland
 from xpra.common import GRAVITY_STR
 from xpra.util import typedict, envbool, envint, WORKSPACE_UNSET, WORKSPACE_NAMES
 from xpra.log import Logger
@@ -24,6 +25,7 @@ metalog = Logger("metadata")
 geomlog = Logger("geometry")
 iconlog = Logger("icon")
 alphalog = Logger("alpha")
+scrolllog = Logger("scroll")
 
 
 SIMULATE_MOUSE_DOWN = envbool("XPRA_SIMULATE_MOUSE_DOWN", True)
@@ -31,6 +33,13 @@ PROPERTIES_DEBUG = [x.strip() for x in os.environ.get("XPRA_WINDOW_PROPERTIES_DE
 SET_SIZE_CONSTRAINTS = envbool("XPRA_SET_SIZE_CONSTRAINTS", True)
 DEFAULT_GRAVITY = envint("XPRA_DEFAULT_GRAVITY", 0)
 OVERRIDE_GRAVITY = envint("XPRA_OVERRIDE_GRAVITY", 0)
+#scroll the window contents locally when the mouse wheel is used,
+#without waiting for the server:
+SCROLL_PREDICTION = envbool("XPRA_SCROLL_PREDICTION", False)
+#how long to wait for the server to confirm a predicted scroll, in milliseconds:
+SCROLL_PREDICTION_TIMEOUT = envint("XPRA_SCROLL_PREDICTION_TIMEOUT", 1000)
+#how many times the server must have scrolled the same way before we start predicting:
+SCROLL_PREDICTION_CONFIDENCE = envint("XPRA_SCROLL_PREDICTION_CONFIDENCE", 2)
 
 
 class ClientWindowBase(ClientWidgetBase):
@@ -79,6 +88,18 @@ class ClientWindowBase(ClientWidgetBase):
         self.window_offset = None
         self.pending_refresh = []
         self.headerbar = headerbar
+        self.scroll_lock = Lock()
+        #wheel button -> (scrolls, number of times the server has sent the same scrolls)
+        self.scroll_learned = {}
+        #the last wheel event sent: (button, time)
+        self.scroll_wheel = None
+        #the scroll we have applied locally: (button, scrolls)
+        self.scroll_predicted = None
+        #set when a paint is drawn after the local scroll but before the server's scroll:
+        self.scroll_predicted_paint = False
+        self.scroll_prediction_timer = None
+        self.scroll_prediction_hits = 0
+        self.scroll_prediction_misses = 0
 
         self.init_window(metadata)
         self.setup_window(bw, bh)
@@ -154,6 +175,11 @@ class ClientWindowBase(ClientWidgetBase):
             "button-state"          : self.button_state,
             "offset"                : self.window_offset,
             })
+        if SCROLL_PREDICTION:
+            info["scroll-prediction"] = {
+                "hits"      : self.scroll_prediction_hits,
+                "misses"    : self.scroll_prediction_misses,
+                }
         return info
 
     def get_desktop_workspace(self):
@@ -162,6 +188,19 @@ class ClientWindowBase(ClientWidgetBase):
     def get_window_workspace(self):
         return None
 
+    def get_visible_geometry(self):
+        """ the area of the screen where this window is shown, or None if it is not shown """
+        if self._iconified:
+            return None
+        return self._pos+self._size
+
+    def is_opaque(self):
+        """ whether this window hides the windows stacked below it """
+        if self._has_alpha or self.is_OR():
+            return False
+        #shaped windows may not cover their whole area:
+        return not self._metadata.rawget("shape")
+
 
     def new_backing(self, bw, bh):
         backing_class = self.get_backing_class()
@@ -172,10 +211,13 @@ class ClientWindowBase(ClientWidgetBase):
         self._backing.border = self.border
         self._backing.default_cursor_data = self.default_cursor_data
         self._backing.gravity = self.window_gravity
+        with self.scroll_lock:
+            self.scroll_learned = {}
         return self._backing._backing
 
 
     def destroy(self):
+        self.cancel_scroll_prediction_timer()
         #ensure we clear reference to other windows:
         self.group_leader = None
         self._override_redirect_windows = []
@@ -738,8 +780,109 @@ class ClientWindowBase(ClientWidgetBase):
         if coding=="void":
             fire_paint_callbacks(callbacks)
             return
+        if SCROLL_PREDICTION and coding!="scroll" and self.scroll_predicted:
+            with self.scroll_lock:
+                #this paint was generated before the server scrolled the window,
+                #so it does not match the contents we have scrolled locally:
+                self.scroll_predicted_paint = bool(self.scroll_predicted)
+        if SCROLL_PREDICTION and coding=="scroll" and self.reconcile_scroll(img_data):
+            #we have already scrolled the backing:
+            from xpra.client.window_backing_base import fire_paint_callbacks
+            fire_paint_callbacks(callbacks)
+            return
         backing.draw_region(x, y, width, height, coding, img_data, rowstride, options, callbacks)
 
+    def predict_scroll(self, button):
+        """
+            Called when we send a mouse wheel event to the server.
+            Once the server has responded to the same wheel button
+            with the same scroll paint a few times in a row,
+            we can apply it immediately without waiting for the round trip.
+        """
+        backing = self._backing
+        if not SCROLL_PREDICTION or not backing:
+            return
+        now = monotonic_time()
+        with self.scroll_lock:
+            if self.scroll_predicted:
+                #wait for the server to catch up:
+                #we can't tell how it will merge the wheel events
+                return
+            wheel = self.scroll_wheel
+            if wheel and now-wheel[1]<SCROLL_PREDICTION_TIMEOUT/1000:
+                #the next scroll paint may include both wheel events,
+                #so don't learn from it:
+                self.scroll_wheel = (0, now)
+                return
+            self.scroll_wheel = (button, now)
+            scrolls, count = self.scroll_learned.get(button, ((), 0))
+            if count<SCROLL_PREDICTION_CONFIDENCE:
+                return
+            self.scroll_predicted = (button, scrolls)
+            self.scroll_predicted_paint = False
+        scrolllog("predict_scroll(%i) %s", button, scrolls)
+        self.cancel_scroll_prediction_timer()
+        self.scroll_prediction_timer = self.timeout_add(SCROLL_PREDICTION_TIMEOUT, self.scroll_prediction_timeout)
+        callbacks = []
+        if backing.draw_needs_refresh:
+            if not backing.repaint_all:
+                for x, y, w, h, dx, dy in scrolls:
+                    self.pending_refresh.append((x+dx, y+dy, w, h))
+            callbacks.append(self.after_draw_refresh)
+        backing.paint_scroll(scrolls, typedict(), callbacks)
+
+    def reconcile_scroll(self, scrolls):
+        """
+            Note: this runs from the draw thread (not UI thread)
+            Returns True if we have already applied these scrolls locally.
+        """
+        scrolls = tuple(tuple(scroll) for scroll in scrolls)
+        now = monotonic_time()
+        with self.scroll_lock:
+            predicted = self.scroll_predicted
+            painted = self.scroll_predicted_paint
+            wheel = self.scroll_wheel
+            self.scroll_predicted = None
+            self.scroll_predicted_paint = False
+            self.scroll_wheel = None
+            if wheel and wheel[0] and now-wheel[1]<SCROLL_PREDICTION_TIMEOUT/1000:
+                learned, count = self.scroll_learned.get(wheel[0], ((), 0))
+                count = count+1 if learned==scrolls else 1
+                self.scroll_learned[wheel[0]] = (scrolls, count)
+        if not predicted:
+            return False
+        self.cancel_scroll_prediction_timer()
+        if predicted[1]==scrolls and not painted:
+            self.scroll_prediction_hits += 1
+            return True
+        self.scroll_prediction_misses += 1
+        scrolllog("reconcile_scroll(%s) predicted %s, painted=%s", scrolls, predicted, painted)
+        #we can't undo the local scroll, so get the server to repaint everything:
+        self.idle_add(self._client.send_refresh, self._id)
+        return True
+
+    def cancel_scroll_prediction_timer(self):
+        spt = self.scroll_prediction_timer
+        if spt:
+            self.scroll_prediction_timer = None
+            self.source_remove(spt)
+
+    def scroll_prediction_timeout(self):
+        self.scroll_prediction_timer = None
+        with self.scroll_lock:
+            predicted = self.scroll_predicted
+            if not predicted:
+                return False
+            self.scroll_predicted = None
+            self.scroll_predicted_paint = False
+            self.scroll_wheel = None
+            #ie: we have reached the end of the document:
+            self.scroll_learned.pop(predicted[0], None)
+        self.scroll_prediction_misses += 1
+        scrolllog("scroll_prediction_timeout() predicted %s", predicted)
+        self._client.send_refresh(self._id)
+        return False
+
     def after_draw_refresh(self, success, message=""):
         plog("after_draw_refresh(%s, %s) pending_refresh=%s",
              success, message, self.pending_refresh)
@@ -760,11 +903,11 @@ class ClientWindowBase(ClientWidgetBase):
                 ry += self.window_offset[1]
             self.idle_add(self.repaint, rx, ry, rw, rh)
 
-    def eos(self):
+    def eos(self, stream=0):
         """ Note: this runs from the draw thread (not UI thread) """
         backing = self._backing
         if backing:
-            backing.eos()
+            backing.eos(stream)
 
     def spinner(self, _ok):
         if not self.can_have_spinner():
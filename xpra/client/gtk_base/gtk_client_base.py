@@ -761,6 +761,18 @@ class GTKXpraClient(GObjectXpraClient, UIXpraClient):
         framelog("get_frame_extents(%s)=%s", window.get_title(), v)
         return v
 
+    def get_window_stacking_order(self):
+        #only available with X11 window managers that support _NET_CLIENT_LIST_STACKING:
+        stack = Gdk.Screen.get_default().get_window_stack()
+        if not stack:
+            return None
+        gdk_windows = {}
+        for window in self._id_to_window.values():
+            gdkwin = window.get_window()
+            if gdkwin:
+                gdk_windows[gdkwin] = window
+        return tuple(gdk_windows[gdkwin] for gdkwin in stack if gdkwin in gdk_windows)
+
     def get_window_frame_sizes(self):
         wfs = get_window_frame_sizes()
         if self.frame_request_window:
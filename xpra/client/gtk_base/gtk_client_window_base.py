@@ -865,6 +865,7 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
                 if not self._override_redirect and not self.send_iconify_timer:
                     #tell server, but wait a bit to try to prevent races:
                     self.schedule_send_iconify()
+                self._client.schedule_window_visibility()
             else:
                 self.cancel_send_iconifiy_timer()
                 self._frozen = False
@@ -1272,6 +1273,7 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
             suspend_resume = False
         self._window_workspace = window_workspace
         self._desktop_workspace = desktop_workspace
+        self._client.schedule_window_visibility()
         client_properties = {}
         if window_workspace is not None:
             client_properties["workspace"] = window_workspace
@@ -1284,6 +1286,18 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
         options = {"refresh-now" : refresh}            #no need to refresh it
         self._client.control_refresh(self._id, suspend_resume, refresh=refresh, options=options, client_properties=client_properties)
 
+    def get_visible_geometry(self):
+        if not self.get_mapped() or self._iconified:
+            return None
+        window_workspace = self._window_workspace
+        desktop_workspace = self._desktop_workspace
+        if desktop_workspace is not None and desktop_workspace>=0 and \
+            window_workspace not in (None, WORKSPACE_UNSET, WORKSPACE_ALL) and \
+            window_workspace!=desktop_workspace:
+            #on a different workspace:
+            return None
+        return self._pos+self._size
+
     def get_workspace_count(self):
         if not self._can_set_workspace:
             return None
@@ -1833,6 +1847,7 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
             focuslog("mapped: has-toplevel-focus=%s", htf)
             if htf:
                 self._client.update_focus(self._id, htf)
+            self._client.schedule_window_visibility()
 
     def get_window_frame_size(self):
         frame = self._client.get_frame_extents(self)
@@ -1875,6 +1890,8 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
         if self._backing and not self._iconified:
             geomlog("configure event: size unchanged, queueing redraw")
             self.repaint(0, 0, w, h)
+        if not self._override_redirect:
+            self._client.schedule_window_visibility()
 
     def send_configure_event(self, skip_geometry=False):
         assert skip_geometry or not self.is_OR()
@@ -2062,6 +2079,7 @@ class GTKClientWindowBase(ClientWindowBase, Gtk.Window):
         self._unfocus()
         if not self._override_redirect:
             self.send("unmap-window", self._id, False)
+            self._client.schedule_window_visibility()
 
     def do_delete_event(self, event):
         #Gtk.Window.do_delete_event(self, event)
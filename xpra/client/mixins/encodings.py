@@ -7,7 +7,7 @@
 import os
 
 from xpra.codecs.codec_constants import PREFERRED_ENCODING_ORDER
-from xpra.codecs.loader import load_codec, codec_versions, has_codec, get_codec
+from xpra.codecs.loader import load_codec_list, codec_versions, has_codec, get_codec
 from xpra.codecs.video_helper import getVideoHelper, NO_GFX_CSC_OPTIONS
 from xpra.scripts.config import parse_bool_or_int
 from xpra.net import compression
@@ -23,6 +23,9 @@ MAX_SOFT_EXPIRED = envint("XPRA_MAX_SOFT_EXPIRED", 5)
 SEND_TIMESTAMPS = envbool("XPRA_SEND_TIMESTAMPS", False)
 VIDEO_MAX_SIZE = tuple(int(x) for x in os.environ.get("XPRA_VIDEO_MAX_SIZE", "4096,4096").replace("x", ",").split(","))
 SCROLL_ENCODING = envbool("XPRA_SCROLL_ENCODING", True)
+VIDEO_STREAMS = envint("XPRA_VIDEO_STREAMS", 4)
+#how many rgb reference buffers we keep for applying deltas:
+DELTA_BUCKETS = envint("XPRA_DELTA_BUCKETS", 5)
 
 #we assume that any server will support at least those:
 DEFAULT_ENCODINGS = os.environ.get("XPRA_DEFAULT_ENCODINGS", "rgb32,rgb24,jpeg,png").split(",")
@@ -38,7 +41,7 @@ def get_core_encodings():
     """
     #we always support rgb:
     core_encodings = ["rgb24", "rgb32"]
-    for codec in ("dec_pillow", "dec_webp", "dec_jpeg"):
+    for codec in ("dec_pillow", "dec_webp", "dec_jpeg", "dec_palette"):
         if has_codec(codec):
             c = get_codec(codec)
             encs = c.get_encodings()
@@ -96,16 +99,20 @@ class Encodings(StubClientMixin):
         self.min_quality = opts.min_quality
         self.speed = opts.speed
         self.min_speed = opts.min_speed
-        load_codec("dec_pillow")
+        names = ["dec_pillow"]
         ae = self.allowed_encodings
         if "jpeg" in ae:
             #try to load the fast jpeg encoder:
-            load_codec("dec_jpeg")
+            names.append("dec_jpeg")
         if "webp" in ae:
             #try to load the fast webp encoder:
-            load_codec("dec_webp")
+            names.append("dec_webp")
+        if "palette" in ae:
+            names.append("dec_palette")
         vh = getVideoHelper()
         vh.set_modules(video_decoders=opts.video_decoders, csc_modules=opts.csc_modules or NO_GFX_CSC_OPTIONS)
+        #load the picture and video decoders together, so the self tests can run in parallel:
+        load_codec_list(*(names+vh.get_decoder_codec_names()))
         vh.init()
 
 
@@ -198,6 +205,8 @@ class Encodings(StubClientMixin):
             "video_scaling"             : True,             #v4 servers assume this is available
             "video_b_frames"            : video_b_frames,
             "video_max_size"            : self.video_max_size,
+            "video_streams"             : VIDEO_STREAMS,
+            "delta_buckets"             : DELTA_BUCKETS,
             "max-soft-expired"          : MAX_SOFT_EXPIRED,
             "send-timestamps"           : SEND_TIMESTAMPS,
             }
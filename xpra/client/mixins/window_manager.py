@@ -77,6 +77,9 @@ SIGNAL_WATCHER = envbool("XPRA_SIGNAL_WATCHER", True)
 
 FAKE_SUSPEND_RESUME = envint("XPRA_FAKE_SUSPEND_RESUME", 0)
 
+WINDOW_VISIBILITY = envbool("XPRA_WINDOW_VISIBILITY", True)
+WINDOW_VISIBILITY_DELAY = envint("XPRA_WINDOW_VISIBILITY_DELAY", 250)
+
 
 DRAW_TYPES = {bytes : "bytes", str : "bytes", tuple : "arrays", list : "arrays"}
 
@@ -109,6 +112,7 @@ class WindowClient(StubClientMixin):
         self.pixel_depth = 0
 
         self.server_window_frame_extents = False
+        self.server_window_visibility = False
         self.server_is_desktop = False
         self.server_window_states = []
         self.server_window_signals = ()
@@ -143,6 +147,8 @@ class WindowClient(StubClientMixin):
 
         #state:
         self.lost_focus_timer = None
+        self.window_visibility_timer = None
+        self._window_visibility = {}
         self._focused = None
         self._window_with_grab = None
         self._suspended_at = 0
@@ -255,6 +261,7 @@ class WindowClient(StubClientMixin):
         #(cleaner and needed when we run embedded in the client launcher)
         self.destroy_all_windows()
         self.cancel_lost_focus_timer()
+        self.cancel_window_visibility_timer()
         if dq:
             dq.put(None)
         log("WindowClient.cleanup() done")
@@ -332,6 +339,7 @@ class WindowClient(StubClientMixin):
 
     def parse_server_capabilities(self, c : typedict) -> bool:
         self.server_window_frame_extents = c.boolget("window.frame-extents")
+        self.server_window_visibility = c.boolget("window.visibility")
         self.server_cursors = c.boolget("cursors", True)    #added in 0.5, default to True!
         self.cursors_enabled = self.server_cursors and self.client_supports_cursors
         self.default_cursor_data = c.tupleget("cursor.default", None)
@@ -437,6 +445,10 @@ class WindowClient(StubClientMixin):
                    pointer, modifiers, buttons] + list(args)
         mouselog("button packet: %s", packet)
         self.send_positional(packet)
+        if pressed and button in (4, 5, 6, 7):
+            window = self._id_to_window.get(wid)
+            if window:
+                window.predict_scroll(button)
 
     def scale_pointer(self, pointer):
         #subclass may scale this:
@@ -893,6 +905,78 @@ class WindowClient(StubClientMixin):
             window.unfreeze()
 
 
+    ######################################################################
+    # visibility:
+    def get_window_stacking_order(self):
+        """ the windows from bottom to top, or None if the toolkit cannot tell us """
+        return None
+
+    def schedule_window_visibility(self):
+        if not WINDOW_VISIBILITY or not self.server_window_visibility or self.readonly:
+            return
+        if not self.window_visibility_timer:
+            self.window_visibility_timer = self.timeout_add(WINDOW_VISIBILITY_DELAY, self.update_window_visibility)
+
+    def cancel_window_visibility_timer(self):
+        wvt = self.window_visibility_timer
+        if wvt:
+            self.window_visibility_timer = None
+            self.source_remove(wvt)
+
+    def update_window_visibility(self):
+        """
+            Tells the server which parts of each window can be seen,
+            so it does not waste time encoding the others:
+            iconified windows and windows on other workspaces cannot be seen at all,
+            and windows can be covered by the windows stacked above them.
+        """
+        self.window_visibility_timer = None
+        from xpra.rectangle import rectangle  #@UnresolvedImport
+        windows = tuple(w for w in self._id_to_window.values() if not (w.is_tray() or w.is_OR()))
+        stacking = self.get_window_stacking_order()
+        if stacking is None:
+            #no occlusion information:
+            top_down = windows
+        else:
+            top_down = tuple(w for w in reversed(stacking) if w in windows)
+            #windows we can't find in the stacking order can't be used to clip the others:
+            top_down += tuple(w for w in windows if w not in top_down)
+        above = []
+        for window in top_down:
+            wid = self._window_to_id.get(window)
+            if wid is None:
+                continue
+            geometry = window.get_visible_geometry()
+            if not geometry:
+                regions = ()
+            else:
+                x, y, w, h = geometry
+                visible = [rectangle(x, y, w, h)]
+                for r in above:
+                    visible = [p for v in visible for p in v.substract_rect(r)]
+                #transparent and shaped windows don't hide what is below them:
+                if stacking is not None and window in stacking and window.is_opaque():
+                    above.append(rectangle(x, y, w, h))
+                if len(visible)==1 and visible[0].width==w and visible[0].height==h:
+                    regions = None
+                else:
+                    #convert to window relative server coordinates:
+                    cx, cy = self.cx, self.cy
+                    regions = []
+                    for r in visible:
+                        sx, sy = cx(r.x-x), cy(r.y-y)
+                        regions.append((sx, sy, cx(r.x-x+r.width)-sx, cy(r.y-y+r.height)-sy))
+                    regions = tuple(sorted(regions))
+            if self._window_visibility.get(wid)!=regions:
+                log("window %i visible regions: %s", wid, regions)
+                self._window_visibility[wid] = regions
+                self.send("window-visibility", wid, regions)
+        for wid in tuple(self._window_visibility.keys()):
+            if wid not in self._id_to_window:
+                del self._window_visibility[wid]
+        return False
+
+
     def deiconify_windows(self):
         log("deiconify_windows()")
         for window in self._id_to_window.values():
@@ -958,16 +1042,24 @@ class WindowClient(StubClientMixin):
         backing = window._backing
         current_icon = window._current_icon
         video_decoder, csc_decoder, decoder_lock = None, None, None
+        stream_decoders = {}
+        palette, delta_pixel_data = None, {}
         try:
             if backing:
+                #the server may still reference the palette and the delta buckets:
+                palette = backing.palette
+                delta_pixel_data = backing._delta_pixel_data
                 video_decoder = backing._video_decoder
                 csc_decoder = backing._csc_decoder
+                stream_decoders = backing._stream_decoders
                 decoder_lock = backing._decoder_lock
                 if decoder_lock:
                     decoder_lock.acquire()
-                    log("reinit_windows() will preserve video=%s and csc=%s for %s", video_decoder, csc_decoder, wid)
+                    log("reinit_windows() will preserve video=%s, csc=%s and streams=%s for %s",
+                        video_decoder, csc_decoder, tuple(stream_decoders.keys()), wid)
                     backing._video_decoder = None
                     backing._csc_decoder = None
+                    backing._stream_decoders = {}
                     backing._decoder_lock = None
                     backing.close()
 
@@ -990,7 +1082,10 @@ class WindowClient(StubClientMixin):
                 backing = window._backing
                 backing._video_decoder = video_decoder
                 backing._csc_decoder = csc_decoder
+                backing._stream_decoders = stream_decoders
                 backing._decoder_lock = decoder_lock
+                backing.palette = palette
+                backing._delta_pixel_data = delta_pixel_data
             if current_icon:
                 window.update_icon(current_icon)
         finally:
@@ -1152,6 +1247,8 @@ class WindowClient(StubClientMixin):
             del self._id_to_window[wid]
             del self._window_to_id[window]
             self.destroy_window(wid, window)
+            #this may uncover other windows:
+            self.schedule_window_visibility()
         self.set_tray_icon()
 
     def may_reenable_modal_windows(self, window):
@@ -1366,7 +1463,9 @@ class WindowClient(StubClientMixin):
         #also force a reset of batch configs:
                        {
                        "refresh-now"    : True,
-                       "batch"          : {"reset" : True}
+                       "batch"          : {"reset" : True},
+                       #at full resolution, even if the window is downscaled:
+                       "full-size"      : True,
                        },
                        {}   #no client_properties
                  ]
@@ -1411,7 +1510,9 @@ class WindowClient(StubClientMixin):
         window = self._id_to_window.get(wid)
         if bytestostr(packet[0])=="eos":
             if window:
-                window.eos()
+                #the stream number is only sent for the secondary video regions:
+                stream = packet[2] if len(packet)>2 else 0
+                window.eos(stream)
             return
         x, y, width, height, coding, data, packet_sequence, rowstride = packet[2:10]
         coding = bytestostr(coding)
@@ -11,7 +11,7 @@ from subprocess import Popen, PIPE, DEVNULL
 from datetime import datetime, timedelta
 
 from xpra.version_util import caps_to_version
-from xpra.util import typedict, std, envint, csv, engs, repr_ellipsized
+from xpra.util import typedict, std, envint, envbool, csv, engs, repr_ellipsized, merge_dicts
 from xpra.os_util import (
     platform_name, get_machine_id,
     bytestostr, monotonic_time,
@@ -30,6 +30,7 @@ from xpra.log import Logger
 log = Logger("gobject", "client")
 
 REFRESH_RATE = envint("XPRA_REFRESH_RATE", 1)
+INFO_DELTA = envbool("XPRA_INFO_DELTA", True)
 CURSES_LOG = os.environ.get("XPRA_CURSES_LOG")
 
 WHITE = 0
@@ -357,6 +358,8 @@ class TopSessionClient(MonitorXpraClient):
         if CURSES_LOG:
             self.log_file = open(CURSES_LOG, "ab")
         self.info_request_pending = False
+        self.info_delta = False
+        self.server_info = {}
         self.server_last_info = typedict()
         self.server_last_info_time = 0
         self.info_timer = 0
@@ -811,6 +814,8 @@ class TopSessionClient(MonitorXpraClient):
 
 
     def do_command(self, caps : typedict):
+        #only ask for the changes since the last update:
+        self.info_delta = INFO_DELTA and caps.boolget("info-snapshot")
         self.send_info_request()
         self.timeout_add(REFRESH_RATE*1000, self.send_info_request)
 
@@ -820,7 +825,10 @@ class TopSessionClient(MonitorXpraClient):
         if not self.info_request_pending:
             self.info_request_pending = True
             window_ids = ()    #no longer used or supported by servers
-            self.send("info-request", [self.uuid], window_ids, categories)
+            if self.info_delta:
+                self.send("info-request", [self.uuid], window_ids, categories, {"delta" : True})
+            else:
+                self.send("info-request", [self.uuid], window_ids, categories)
         if not self.info_timer:
             self.info_timer = self.timeout_add((REFRESH_RATE+2)*1000, self.info_timeout)
         return True
@@ -838,7 +846,17 @@ class TopSessionClient(MonitorXpraClient):
         self.log("info response: %s" % repr_ellipsized(packet))
         self.cancel_info_timer()
         self.info_request_pending = False
-        self.server_last_info = typedict(packet[1])
+        options = typedict(packet[2] if len(packet)>=3 else {})
+        if options.boolget("delta"):
+            merge_dicts(self.server_info, packet[1])
+            for path in options.tupleget("removed"):
+                d = self.server_info
+                for k in path[:-1]:
+                    d = d.get(k, {})
+                d.pop(path[-1], None)
+            self.server_last_info = typedict(self.server_info)
+        else:
+            self.server_last_info = typedict(packet[1])
         self.server_last_info_time = monotonic_time()
         #log.info("server_last_info=%s", self.server_last_info)
         self.update_screen()
@@ -12,7 +12,8 @@ from xpra.net import compression
 from xpra.util import typedict, csv, envint, envbool, first_time
 from xpra.codecs.loader import get_codec
 from xpra.codecs.video_helper import getVideoHelper
-from xpra.os_util import bytestostr
+from xpra.os_util import bytestostr, memoryview_to_bytes
+from xpra.buffers.cyxor import xor_str      #@UnresolvedImport
 from xpra.common import (
     NorthWestGravity,
     NorthGravity,
@@ -116,6 +117,9 @@ class WindowBackingBase:
         self._backing = None
         self._video_decoder = None
         self._csc_decoder = None
+        #the decoders for the secondary video streams, indexed by stream number:
+        #(each one is a list: [video decoder, csc decoder])
+        self._stream_decoders = {}
         self._decoder_lock = Lock()
         self._PIL_encodings = []
         self.default_paint_box_line_width = PAINT_BOX or 1
@@ -130,6 +134,11 @@ class WindowBackingBase:
             self._PIL_encodings = self.pil_decoder.get_encodings()
         self.jpeg_decoder = get_codec("dec_jpeg")
         self.webp_decoder = get_codec("dec_webp")
+        self.palette_decoder = get_codec("dec_palette")
+        #our copy of the server's palette for this window:
+        self.palette = None
+        #the last rgb pixels received for each delta bucket: (store number, pixels)
+        self._delta_pixel_data = {}
         self.draw_needs_refresh = True
         self.repaint_all = REPAINT_ALL
         self.mmap = None
@@ -153,6 +162,9 @@ class WindowBackingBase:
         csc = self._csc_decoder
         if csc:
             info["csc"] = self._csc_decoder
+        for stream, (vd, csc) in tuple(self._stream_decoders.items()):
+            if vd:
+                info.setdefault("video-stream", {})[stream] = vd.get_info()
         return info
 
 
@@ -295,19 +307,48 @@ class WindowBackingBase:
         try:
             self.do_clean_video_decoder()
             self.do_clean_csc_decoder()
+            for stream in tuple(self._stream_decoders.keys()):
+                self.do_clean_video_decoder(stream)
+                self.do_clean_csc_decoder(stream)
             return True
         finally:
             dl.release()
 
-    def do_clean_video_decoder(self):
-        if self._video_decoder:
-            self._video_decoder.clean()
-            self._video_decoder = None
+    def get_video_decoder(self, stream=0):
+        if stream:
+            return self._stream_decoders.get(stream, (None, None))[0]
+        return self._video_decoder
+
+    def get_csc_decoder(self, stream=0):
+        if stream:
+            return self._stream_decoders.get(stream, (None, None))[1]
+        return self._csc_decoder
+
+    def set_video_decoder(self, vd, stream=0):
+        if stream:
+            self._stream_decoders.setdefault(stream, [None, None])[0] = vd
+        else:
+            self._video_decoder = vd
+
+    def set_csc_decoder(self, cd, stream=0):
+        if stream:
+            self._stream_decoders.setdefault(stream, [None, None])[1] = cd
+        else:
+            self._csc_decoder = cd
+
+    def do_clean_video_decoder(self, stream=0):
+        vd = self.get_video_decoder(stream)
+        if vd:
+            vd.clean()
+            self.set_video_decoder(None, stream)
 
-    def do_clean_csc_decoder(self):
-        if self._csc_decoder:
-            self._csc_decoder.clean()
-            self._csc_decoder = None
+    def do_clean_csc_decoder(self, stream=0):
+        cd = self.get_csc_decoder(stream)
+        if cd:
+            cd.clean()
+            self.set_csc_decoder(None, stream)
+        if stream and self._stream_decoders.get(stream)==[None, None]:
+            del self._stream_decoders[stream]
 
 
     def get_encoding_properties(self):
@@ -399,6 +440,20 @@ class WindowBackingBase:
         self.idle_add(self.do_paint_rgb, rgb_format, data,
                                  x, y, iwidth, iheight, width, height, stride, options, callbacks)
 
+    def paint_palette(self, img_data, x, y, width, height, options, callbacks):
+        """ can be called from a non-UI thread """
+        comp = tuple(x for x in compression.ALL_COMPRESSORS if options.intget(x, 0))
+        if comp:
+            assert len(comp)==1, "more than one compressor specified: %s" % str(comp)
+            img_data = compression.decompress_by_name(img_data, algo=comp[0])
+        palette = self.palette
+        if palette is None:
+            palette = self.palette = self.palette_decoder.Palette()
+        rgb_data = self.palette_decoder.decompress(img_data, width, height, palette)
+        rgb_format = options.strget("rgb_format", "BGRX")
+        self.idle_add(self.do_paint_rgb, rgb_format, rgb_data,
+                      x, y, width, height, width, height, width*4, options, callbacks)
+
     def paint_rgb(self, rgb_format, raw_data, x, y, width, height, rowstride, options, callbacks):
         """ can be called from a non-UI thread """
         iwidth, iheight = options.intpair("scaled-size", (width, height))
@@ -409,6 +464,18 @@ class WindowBackingBase:
             rgb_data = compression.decompress_by_name(raw_data, algo=comp[0])
         else:
             rgb_data = raw_data
+        delta = options.intget("delta", -1)
+        bucket = options.intget("bucket", 0)
+        if delta>=0:
+            #the server sent the xor of the new pixels with the ones we stored:
+            ref = self._delta_pixel_data.get(bucket)
+            if not ref or ref[0]!=delta:
+                raise Exception("delta reference %i not found in bucket %i, found %s" % (
+                    delta, bucket, ref[0] if ref else None))
+            rgb_data = xor_str(rgb_data, ref[1])
+        store = options.intget("store", 0)
+        if store>0:
+            self._delta_pixel_data[bucket] = (store, memoryview_to_bytes(rgb_data))
         self.idle_add(self.do_paint_rgb, rgb_format, rgb_data,
                       x, y, iwidth, iheight, width, height, rowstride, options, callbacks)
 
@@ -466,11 +533,11 @@ class WindowBackingBase:
         raise Exception("override me!")
 
 
-    def eos(self):
+    def eos(self, stream=0):
         dl = self._decoder_lock
         with dl:
-            self.do_clean_csc_decoder()
-            self.do_clean_video_decoder()
+            self.do_clean_video_decoder(stream)
+            self.do_clean_csc_decoder(stream)
 
 
     def make_csc(self, src_width, src_height, src_format,
@@ -568,29 +635,32 @@ class WindowBackingBase:
             assert input_colorspace in decoder_colorspaces, "decoder %s does not support %s for %s" % (
                 decoder_module.get_type(), input_colorspace, coding)
 
-            vd = self._video_decoder
+            #secondary video regions use their own decoders:
+            stream = options.intget("stream", 0)
+            vd = self.get_video_decoder(stream)
             if vd:
                 if options.intget("frame", -1)==0:
                     videolog("paint_with_video_decoder: first frame of new stream")
-                    self.do_clean_video_decoder()
+                    self.do_clean_video_decoder(stream)
                 elif vd.get_encoding()!=coding:
                     videolog("paint_with_video_decoder: encoding changed from %s to %s", vd.get_encoding(), coding)
-                    self.do_clean_video_decoder()
+                    self.do_clean_video_decoder(stream)
                 elif vd.get_width()!=enc_width or vd.get_height()!=enc_height:
                     videolog("paint_with_video_decoder: video dimensions have changed from %s to %s",
                         (vd.get_width(), vd.get_height()), (enc_width, enc_height))
-                    self.do_clean_video_decoder()
+                    self.do_clean_video_decoder(stream)
                 elif vd.get_colorspace()!=input_colorspace:
                     #this should only happen on encoder restart, which means this should be the first frame:
                     videolog.warn("Warning: colorspace unexpectedly changed from %s to %s",
                              vd.get_colorspace(), input_colorspace)
-                    self.do_clean_video_decoder()
-            if self._video_decoder is None:
-                videolog("paint_with_video_decoder: new %s(%s,%s,%s)",
-                    decoder_module.Decoder, width, height, input_colorspace)
+                    self.do_clean_video_decoder(stream)
+            vd = self.get_video_decoder(stream)
+            if vd is None:
+                videolog("paint_with_video_decoder: new %s(%s,%s,%s) for stream %i",
+                    decoder_module.Decoder, width, height, input_colorspace, stream)
                 vd = decoder_module.Decoder()
                 vd.init_context(coding, enc_width, enc_height, input_colorspace)
-                self._video_decoder = vd
+                self.set_video_decoder(vd, stream)
                 videolog("paint_with_video_decoder: info=%s", vd.get_info())
 
             img = vd.decompress_image(img_data, options)
@@ -622,23 +692,25 @@ class WindowBackingBase:
         #as some video formats like vpx can forward transparency
         #also we could skip the csc step in some cases:
         pixel_format = img.get_pixel_format()
-        cd = self._csc_decoder
+        stream = options.intget("stream", 0)
+        cd = self.get_csc_decoder(stream)
         if cd is not None:
             if cd.get_src_format()!=pixel_format:
                 videolog("do_video_paint csc: switching src format from %s to %s", cd.get_src_format(), pixel_format)
-                self.do_clean_csc_decoder()
+                self.do_clean_csc_decoder(stream)
             elif cd.get_dst_format() not in target_rgb_formats:
                 videolog("do_video_paint csc: switching dst format from %s to %s", cd.get_dst_format(), target_rgb_formats)
-                self.do_clean_csc_decoder()
+                self.do_clean_csc_decoder(stream)
             elif cd.get_src_width()!=enc_width or cd.get_src_height()!=enc_height:
                 videolog("do_video_paint csc: switching src size from %sx%s to %sx%s",
                          enc_width, enc_height, cd.get_src_width(), cd.get_src_height())
-                self.do_clean_csc_decoder()
+                self.do_clean_csc_decoder(stream)
             elif cd.get_dst_width()!=width or cd.get_dst_height()!=height:
                 videolog("do_video_paint csc: switching src size from %sx%s to %sx%s",
                          width, height, cd.get_dst_width(), cd.get_dst_height())
-                self.do_clean_csc_decoder()
-        if self._csc_decoder is None:
+                self.do_clean_csc_decoder(stream)
+        cd = self.get_csc_decoder(stream)
+        if cd is None:
             #use higher quality csc to compensate for lower quality source
             #(which generally means that we downscaled via YUV422P or lower)
             #or when upscaling the video:
@@ -647,7 +719,7 @@ class WindowBackingBase:
             cd = self.make_csc(enc_width, enc_height, pixel_format,
                                            width, height, target_rgb_formats, csc_speed)
             videolog("do_video_paint new csc decoder: %s", cd)
-            self._csc_decoder = cd
+            self.set_csc_decoder(cd, stream)
         rgb_format = cd.get_dst_format()
         rgb = cd.convert_image(img)
         videolog("do_video_paint rgb using %s.convert_image(%s)=%s", cd, img, rgb)
@@ -716,6 +788,8 @@ class WindowBackingBase:
                 self.paint_image(coding, img_data, x, y, width, height, options, callbacks)
             elif coding == "scroll":
                 self.paint_scroll(img_data, options, callbacks)
+            elif self.palette_decoder and coding=="palette":
+                self.paint_palette(img_data, x, y, width, height, options, callbacks)
             else:
                 self.do_draw_region(x, y, width, height, coding, img_data, rowstride, options, callbacks)
         except Exception:
@@ -10,7 +10,9 @@ from xpra.util import first_time
 from xpra.buffers.membuf cimport getbuf, padbuf, MemBuf #pylint: disable=syntax-error
 from xpra.buffers.membuf cimport object_as_buffer, object_as_write_buffer
 
-from libc.stdint cimport uintptr_t, uint32_t, uint16_t, uint8_t
+from libc.stdint cimport uintptr_t, uint64_t, uint32_t, uint16_t, uint8_t
+from libc.stdlib cimport malloc, free
+from libc.string cimport memset
 
 import struct
 from xpra.log import Logger
@@ -458,6 +460,73 @@ cdef do_unpremultiply_argb(unsigned int * argb_in, Py_ssize_t argb_len):
     return memoryview(output_buf)
 
 
+def downscale(buf, const int width, const int height, const int rowstride,
+              const int dst_width, const int dst_height):
+    """
+        Downscales packed 32-bit pixels by averaging the source pixels
+        that fall in each destination pixel (box filter),
+        this works for any byte order since all 4 channels are averaged.
+        The rowstride of the pixels returned is dst_width*4.
+    """
+    assert 0<dst_width<=width and 0<dst_height<=height, "invalid downscaling from %ix%i to %ix%i" % (
+        width, height, dst_width, dst_height)
+    assert rowstride>=width*4, "invalid rowstride %i for width %i" % (rowstride, width)
+    cdef const unsigned char *src = NULL
+    cdef Py_ssize_t src_len = 0
+    assert as_buffer(buf, <const void**> &src, &src_len)==0, "cannot convert %s to a readable buffer" % type(buf)
+    assert src_len>=(height-1)*rowstride+width*4, "buffer is too small: %i bytes for %ix%i with rowstride=%i" % (
+        src_len, width, height, rowstride)
+    cdef MemBuf output_buf = padbuf(dst_width*dst_height*4, dst_width*4)
+    cdef unsigned char *dst = <unsigned char*> output_buf.get_mem()
+    #the destination column of each source column, and how many source columns each one gets:
+    cdef int *xmap = <int*> malloc(width*sizeof(int))
+    cdef int *xcount = <int*> malloc(dst_width*sizeof(int))
+    #64-bit sums: a destination pixel may average more than 2**32/255 source pixels
+    cdef uint64_t *sums = <uint64_t*> malloc(dst_width*4*sizeof(uint64_t))
+    if xmap==NULL or xcount==NULL or sums==NULL:
+        free(xmap)
+        free(xcount)
+        free(sums)
+        raise MemoryError("failed to allocate downscaling buffers")
+    cdef int x, y, dx, dy, sy = 0, i
+    cdef uint64_t n
+    cdef uint64_t *s
+    cdef const unsigned char *p
+    cdef unsigned char *d
+    with nogil:
+        memset(xcount, 0, dst_width*sizeof(int))
+        for x in range(width):
+            dx = x*dst_width//width
+            xmap[x] = dx
+            xcount[dx] += 1
+        for dy in range(dst_height):
+            memset(sums, 0, dst_width*4*sizeof(uint64_t))
+            y = sy
+            #add up all the source rows for this destination row:
+            while sy<height and sy*dst_height//height==dy:
+                p = src + sy*rowstride
+                for x in range(width):
+                    s = sums + xmap[x]*4
+                    s[0] += p[0]
+                    s[1] += p[1]
+                    s[2] += p[2]
+                    s[3] += p[3]
+                    p += 4
+                sy += 1
+            d = dst + dy*dst_width*4
+            for dx in range(dst_width):
+                n = (<uint64_t> xcount[dx])*(sy-y)
+                s = sums + dx*4
+                for i in range(4):
+                    d[i] = (s[i]+n//2)//n
+                d += 4
+    free(xmap)
+    free(xcount)
+    free(sums)
+    return memoryview(output_buf)
+
+
+
 def argb_swap(image, rgb_formats, supports_transparency=False):
     """ use the argb codec to do the RGB byte swapping """
     pixel_format = image.get_pixel_format()
@@ -16,6 +16,7 @@ PREFERRED_ENCODING_ORDER = (
     "rgb", "rgb24", "rgb32", "jpeg",
     "h265", "mpeg1", "mpeg2",
     "scroll",
+    "palette",
     "grayscale",
     )
 #encoding order for edges (usually one pixel high or wide):
@@ -31,7 +32,7 @@ HELP_ORDER = (
     "h264", "h265", "vp8", "vp9", "mpeg4",
     "png", "png/P", "png/L", "webp",
     "rgb", "jpeg",
-    "scroll",
+    "scroll", "palette",
     )
 
 
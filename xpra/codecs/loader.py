@@ -5,9 +5,12 @@
 # later version. See the file COPYING for details.
 
 import sys
+import json
 import os.path
+from threading import Lock
 
-from xpra.util import envbool, csv
+from xpra.util import envbool, envint, csv
+from xpra.os_util import monotonic_time
 from xpra.log import Logger
 log = Logger("codec", "loader")
 
@@ -19,17 +22,29 @@ NOWARN = ["nvenc", "enc_nvjpeg", "enc_x265", "enc_ffmpeg"]
 SELFTEST = envbool("XPRA_CODEC_SELFTEST", True)
 FULL_SELFTEST = envbool("XPRA_CODEC_FULL_SELFTEST", False)
 
+#run the self tests of the codecs using this many threads:
+SELFTEST_THREADS = envint("XPRA_CODEC_SELFTEST_THREADS", min(4, os.cpu_count() or 1))
+PROBE_CACHE = os.environ.get("XPRA_CODEC_PROBE_CACHE", "~/.xpra/codec-probe.json")
+#these codecs probe the hardware, so we can't cache their self test results:
+NOCACHE = ("nvenc", "enc_nvjpeg")
+
 CODEC_FAIL_IMPORT = os.environ.get("XPRA_CODEC_FAIL_IMPORT", "").split(",")
 CODEC_FAIL_SELFTEST = os.environ.get("XPRA_CODEC_FAIL_SELFTEST", "").split(",")
 
-log("codec loader settings: SELFTEST=%s, FULL_SELFTEST=%s, CODEC_FAIL_IMPORT=%s, CODEC_FAIL_SELFTEST=%s",
-        SELFTEST, FULL_SELFTEST, CODEC_FAIL_IMPORT, CODEC_FAIL_SELFTEST)
+log("codec loader settings: SELFTEST=%s, FULL_SELFTEST=%s, SELFTEST_THREADS=%s, PROBE_CACHE=%s",
+        SELFTEST, FULL_SELFTEST, SELFTEST_THREADS, PROBE_CACHE)
+log(" CODEC_FAIL_IMPORT=%s, CODEC_FAIL_SELFTEST=%s", CODEC_FAIL_IMPORT, CODEC_FAIL_SELFTEST)
 
 codec_errors = {}
 codecs = {}
-def codec_import_check(name, description, top_module, class_module, classnames):
+#how long it took to import and check each codec, in milliseconds:
+codec_timings = {}
+
+def codec_import(name, description, top_module, class_module):
+    """ imports the codec's module, returns None if that fails """
     log("%s:", name)
-    log(" codec_import_check%s", (name, description, top_module, class_module, classnames))
+    log(" codec_import%s", (name, description, top_module, class_module))
+    start = monotonic_time()
     try:
         try:
             if name in CODEC_FAIL_IMPORT:
@@ -40,33 +55,55 @@ def codec_import_check(name, description, top_module, class_module, classnames):
             log("", exc_info=True)
             codec_errors[name] = str(e)
             return None
+        #module is present
+        log(" %s found, will check %s", top_module, class_module)
+        try:
+            return __import__(class_module, {}, {}, ["selftest"])
+        except ImportError as e:
+            codec_errors[name] = str(e)
+            l = log.error
+            if name in NOWARN:
+                l = log.debug
+            l("Error importing %s (%s)", description, name)
+            l(" %s", e)
+            log("", exc_info=True)
     except Exception as e:
         log.warn(" cannot load %s (%s):", name, description, exc_info=True)
         codec_errors[name] = str(e)
-        return None
+    finally:
+        codec_timings.setdefault(name, {})["import"] = int(1000*(monotonic_time()-start))
+    return None
+
+def codec_check(name, description, class_module, classnames, ic):
+    """
+        initializes the codec module and runs its self test,
+        unless the probe cache already has a result for this exact version of the codec
+    """
+    start = monotonic_time()
     classname = None
     try:
-        #module is present
         try:
-            log(" %s found, will check for %s in %s", top_module, classnames, class_module)
-            ic =  __import__(class_module, {}, {}, classnames)
-            try:
-                #run init_module?
-                init_module = getattr(ic, "init_module", None)
-                log("%s: init_module=%s", class_module, init_module)
-                if init_module:
-                    init_module()
-
-                if classnames:
-                    for classname in classnames:
-                        clazz = getattr(ic, classname)
-                        log("%s: %s=%s", class_module, classname, clazz)
-
-                selftest = getattr(ic, "selftest", None)
-                log("%s.selftest=%s", name, selftest)
-                if SELFTEST and selftest:
-                    if name in CODEC_FAIL_SELFTEST:
-                        raise ImportError("codec found in fail selftest list")
+            #run init_module?
+            init_module = getattr(ic, "init_module", None)
+            log("%s: init_module=%s", class_module, init_module)
+            if init_module:
+                init_module()
+
+            if classnames:
+                for classname in classnames:
+                    clazz = getattr(ic, classname)
+                    log("%s: %s=%s", class_module, classname, clazz)
+
+            selftest = getattr(ic, "selftest", None)
+            log("%s.selftest=%s", name, selftest)
+            if SELFTEST and selftest:
+                if name in CODEC_FAIL_SELFTEST:
+                    raise ImportError("codec found in fail selftest list")
+                probe_key = get_probe_key(name, ic)
+                if probe_key and probe_cache.get(name)==probe_key:
+                    log("%s self test skipped, found in the probe cache", name)
+                    codec_timings[name]["cached"] = True
+                else:
                     try:
                         selftest(FULL_SELFTEST)
                     except Exception as e:
@@ -74,24 +111,18 @@ def codec_import_check(name, description, top_module, class_module, classnames):
                         for x in str(e).splitlines():
                             log.warn(" %s", x)
                         log("%s failed", selftest, exc_info=True)
+                        codec_errors[name] = str(e)
                         return None
-            finally:
-                cleanup_module = getattr(ic, "cleanup_module", None)
-                log("%s: cleanup_module=%s", class_module, cleanup_module)
-                if cleanup_module:
-                    cleanup_module()
-            #log.warn("codec_import_check(%s, ..)=%s" % (name, ic))
-            log(" found %s : %s", name, ic)
-            codecs[name] = ic
-            return ic
-        except ImportError as e:
-            codec_errors[name] = str(e)
-            l = log.error
-            if name in NOWARN:
-                l = log.debug
-            l("Error importing %s (%s)", description, name)
-            l(" %s", e)
-            log("", exc_info=True)
+                    if probe_key:
+                        update_probe_cache(name, probe_key)
+        finally:
+            cleanup_module = getattr(ic, "cleanup_module", None)
+            log("%s: cleanup_module=%s", class_module, cleanup_module)
+            if cleanup_module:
+                cleanup_module()
+        log(" found %s : %s", name, ic)
+        codecs[name] = ic
+        return ic
     except Exception as e:
         codec_errors[name] = str(e)
         if classname:
@@ -100,7 +131,86 @@ def codec_import_check(name, description, top_module, class_module, classnames):
         else:
             log.warn(" cannot load %s (%s)",
                      name, description, exc_info=True)
+    finally:
+        codec_timings[name]["check"] = int(1000*(monotonic_time()-start))
     return None
+
+def codec_import_check(name, description, top_module, class_module, classnames):
+    ic = codec_import(name, description, top_module, class_module)
+    if not ic:
+        return None
+    return codec_check(name, description, class_module, classnames, ic)
+
+
+#the results of the self tests which have succeeded, keyed by codec version,
+#so that we don't need to run them again when the server is restarted:
+probe_cache = {}
+probe_cache_lock = Lock()
+
+def get_probe_cache_filename():
+    if not PROBE_CACHE:
+        return None
+    return os.path.expanduser(PROBE_CACHE)
+
+def load_probe_cache():
+    filename = get_probe_cache_filename()
+    if not filename or not os.path.exists(filename):
+        return
+    try:
+        with open(filename, "r") as f:
+            data = json.load(f)
+        if isinstance(data, dict):
+            probe_cache.update(data)
+        log("loaded %i probe results from %r", len(probe_cache), filename)
+    except Exception as e:
+        log("load_probe_cache()", exc_info=True)
+        log.warn("Warning: failed to load the codec probe cache from %r", filename)
+        log.warn(" %s", e)
+
+def update_probe_cache(name, probe_key):
+    filename = get_probe_cache_filename()
+    if not filename:
+        return
+    with probe_cache_lock:
+        probe_cache[name] = probe_key
+        try:
+            dirname = os.path.dirname(filename)
+            if dirname and not os.path.exists(dirname):
+                os.makedirs(dirname, 0o700)
+            #other instances may be starting at the same time,
+            #so write to a temporary file and rename it:
+            tmp = "%s.%i" % (filename, os.getpid())
+            with open(tmp, "w") as f:
+                json.dump(probe_cache, f)
+            os.replace(tmp, filename)
+        except Exception as e:
+            log("update_probe_cache(%s, %s)", name, probe_key, exc_info=True)
+            log.warn("Warning: failed to save the codec probe cache to %r", filename)
+            log.warn(" %s", e)
+
+def get_probe_key(name, module):
+    """
+        The self test results depend on the xpra version, the codec module file
+        and the version of the library it uses, which may change without rebuilding the module.
+        Codecs which probe the hardware are not cached.
+    """
+    if name in NOCACHE or not get_probe_cache_filename():
+        return None
+    filename = getattr(module, "__file__", None)
+    if not filename:
+        return None
+    try:
+        from xpra import __version__
+        stat = os.stat(filename)
+        version = getattr(module, "get_version", None)
+        if version:
+            version = version()
+        return [__version__, filename, int(stat.st_mtime), stat.st_size, str(version)]
+    except Exception:
+        log("get_probe_key(%s, %s)", name, module, exc_info=True)
+        return None
+
+
 codec_versions = {}
 def add_codec_version(name, top_module, version="get_version()", alt_version="__version__"):
     try:
@@ -135,14 +245,11 @@ def add_codec_version(name, top_module, version="get_version()", alt_version="__
         log.warn("", exc_info=True)
     return None
 
-def xpra_codec_import(name, description, top_module, class_module, classname):
-    xpra_top_module = "xpra.codecs.%s" % top_module
-    xpra_class_module = "%s.%s" % (xpra_top_module, class_module)
-    if codec_import_check(name, description, xpra_top_module, xpra_class_module, classname):
-        version_name = name
-        if name.startswith("enc_") or name.startswith("dec_") or name.startswith("csc_"):
-            version_name = name[4:]
-        add_codec_version(version_name, xpra_class_module)
+def xpra_codec_version(name, xpra_class_module):
+    version_name = name
+    if name.startswith("enc_") or name.startswith("dec_") or name.startswith("csc_"):
+        version_name = name[4:]
+    add_codec_version(version_name, xpra_class_module)
 
 
 CODEC_OPTIONS = {
@@ -151,6 +258,7 @@ CODEC_OPTIONS = {
     "enc_webp"      : ("webp encoder",      "webp",         "encoder", "encode"),
     "enc_jpeg"      : ("JPEG encoder",      "jpeg",         "encoder", "encode"),
     "enc_nvjpeg"    : ("nvjpeg encoder",    "nvjpeg",       "encoder", "encode"),
+    "enc_palette"   : ("palette encoder",   "palette",      "encoder", "encode"),
     #video encoders:
     "enc_vpx"       : ("vpx encoder",       "vpx",          "encoder", "Encoder"),
     "enc_x264"      : ("x264 encoder",      "enc_x264",     "encoder", "Encoder"),
@@ -165,48 +273,90 @@ CODEC_OPTIONS = {
     "dec_pillow"    : ("Pillow decoder",    "pillow",       "decoder", "decompress"),
     "dec_webp"      : ("webp decoder",      "webp",         "decoder", "decompress"),
     "dec_jpeg"      : ("JPEG decoder",      "jpeg",         "decoder", "decompress_to_rgb", "decompress_to_yuv"),
+    "dec_palette"   : ("palette decoder",   "palette",      "decoder", "decompress"),
     #video decoders:
     "dec_vpx"       : ("vpx decoder",       "vpx",          "decoder", "Decoder"),
     "dec_avcodec2"  : ("avcodec2 decoder",  "dec_avcodec2", "decoder", "Decoder"),
     }
 
-def load_codec(name):
-    if has_codec(name):
-        return
+def get_codec_option(name):
     try:
         option = CODEC_OPTIONS[name]
-        description, top_module, class_module = option[:3]
-        classnames = option[3:]
     except KeyError:
-        log("load_codec(%s)", name, exc_info=True)
+        log("get_codec_option(%s)", name, exc_info=True)
         log.error("Error: invalid codec name '%s'", name)
+        return None
+    description, top_module, class_module = option[:3]
+    classnames = option[3:]
+    return description, "xpra.codecs.%s" % top_module, "xpra.codecs.%s.%s" % (top_module, class_module), classnames
+
+def load_codec(name):
+    if has_codec(name) or name in codec_errors:
+        #already loaded, or failed to load
+        return
+    load_probe_cache_once()
+    option = get_codec_option(name)
+    if option:
+        description, top_module, class_module, classnames = option
+        if codec_import_check(name, description, top_module, class_module, classnames):
+            xpra_codec_version(name, class_module)
+
+def load_codec_list(*names):
+    """
+        Imports the codecs one after the other,
+        then runs all the self tests in parallel:
+        most codecs release the GIL whilst compressing.
+    """
+    start = monotonic_time()
+    load_probe_cache_once()
+    imported = []
+    for name in names:
+        if has_codec(name) or name in codec_errors or any(name==x[0] for x in imported):
+            continue
+        option = get_codec_option(name)
+        if not option:
+            continue
+        description, top_module, class_module, classnames = option
+        ic = codec_import(name, description, top_module, class_module)
+        if ic:
+            imported.append((name, description, class_module, classnames, ic))
+    def check(args):
+        return codec_check(*args)
+    if SELFTEST_THREADS>1 and len(imported)>1:
+        from concurrent.futures import ThreadPoolExecutor
+        with ThreadPoolExecutor(max_workers=SELFTEST_THREADS, thread_name_prefix="codec-check") as executor:
+            results = tuple(executor.map(check, imported))
     else:
-        xpra_codec_import(name, description, top_module, class_module, classnames)
+        results = tuple(check(args) for args in imported)
+    for args, ic in zip(imported, results):
+        if ic:
+            xpra_codec_version(args[0], args[2])
+    log("load_codec_list%s took %ims", names, 1000*(monotonic_time()-start))
+
+probe_cache_loaded = False
+def load_probe_cache_once():
+    global probe_cache_loaded
+    with probe_cache_lock:
+        if probe_cache_loaded:
+            return
+        probe_cache_loaded = True
+    load_probe_cache()
 
 
 def load_codecs(encoders=True, decoders=True, csc=True, video=True):
-    show = []
     log("loading codecs")
-
-    def load(*names):
-        for name in names:
-            load_codec(name)
-
+    names = []
     if encoders:
-        show += list(ENCODER_CODECS)
-        load(*ENCODER_CODECS)
+        names += list(ENCODER_CODECS)
         if video:
-            show += list(ENCODER_VIDEO_CODECS)
-            load(*ENCODER_VIDEO_CODECS)
+            names += list(ENCODER_VIDEO_CODECS)
     if csc and video:
-        show += list(CSC_CODECS)
-        load(*CSC_CODECS)
+        names += list(CSC_CODECS)
     if decoders:
-        show += list(DECODER_CODECS)
-        load(*DECODER_CODECS)
+        names += list(DECODER_CODECS)
         if video:
-            show += list(DECODER_VIDEO_CODECS)
-            load(*DECODER_VIDEO_CODECS)
+            names += list(DECODER_VIDEO_CODECS)
+    load_codec_list(*names)
     log("done loading codecs")
     show_codecs()
 
@@ -228,14 +378,17 @@ def get_codec(name):
 def get_codec_version(name):
     return codec_versions.get(name)
 
+def get_codec_timings() -> dict:
+    return dict((name, dict(timings)) for name, timings in codec_timings.items())
+
 def has_codec(name) -> bool:
     return name in codecs
 
 
 CSC_CODECS = "csc_swscale", "csc_cython", "csc_libyuv"
-ENCODER_CODECS = "enc_pillow", "enc_webp", "enc_jpeg", "enc_nvjpeg"
+ENCODER_CODECS = "enc_pillow", "enc_webp", "enc_jpeg", "enc_nvjpeg", "enc_palette"
 ENCODER_VIDEO_CODECS = "enc_vpx", "enc_x264", "enc_x265", "nvenc", "enc_ffmpeg"
-DECODER_CODECS = "dec_pillow", "dec_webp", "dec_jpeg"
+DECODER_CODECS = "dec_pillow", "dec_webp", "dec_jpeg", "dec_palette"
 DECODER_VIDEO_CODECS = "dec_vpx", "dec_avcodec2"
 
 ALL_CODECS = tuple(set(CSC_CODECS + ENCODER_CODECS + ENCODER_VIDEO_CODECS + DECODER_CODECS + DECODER_VIDEO_CODECS))
@@ -263,6 +416,7 @@ def get_encoding_name(encoding):
           "png/P"   : "PNG (8bpp colour)",
           "png/L"   : "PNG (8bpp grayscale)",
           "jpeg"    : "JPEG",
+          "palette" : "Palette (lossless, up to 256 colours)",
           "rgb"     : " + ".join(get_rgb_compression_options()) + " (24/32bpp)",
         }
     return ENCODINGS_TO_NAME.get(encoding, encoding)
@@ -287,6 +441,7 @@ def get_encoding_help(encoding):
           "rgb"     : "Raw RGB pixels, lossless,"
                       +" compressed using %s (24bpp or 32bpp for transparency)" % (" or ".join(compressors)),
           "scroll"  : "motion vectors, supplemented with picture codecs",
+          "palette" : "Indexed colours, lossless, for windows with few colours (text, user interfaces)",
           }.get(encoding)
 
 
@@ -0,0 +1,192 @@
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+#cython: auto_pickle=False, boundscheck=False, wraparound=False, cdivision=True, language_level=3
+
+from xpra.log import Logger
+log = Logger("decoder", "palette")
+
+from libc.stdint cimport uint8_t, uint32_t     #pylint: disable=syntax-error
+from libc.stdlib cimport malloc, free
+from libc.string cimport memcpy
+
+from xpra.buffers.membuf cimport object_as_buffer
+
+#see encoder.pyx for a description of the bitstream:
+DEF VERSION = 1
+DEF HEADER_SIZE = 8
+DEF MAX_COLOURS = 256
+
+#flags:
+DEF FLAG_PERSISTENT = 1
+
+#token types:
+#the indexes follow:
+DEF OP_LITERAL = 0
+#a run of the same index, which follows:
+DEF OP_RUN = 1
+#copy the indexes from the row above:
+DEF OP_ABOVE = 2
+#repeat the index of the previous pixel:
+DEF OP_REPEAT = 3
+
+DEF LENGTH_MASK = 0x3f
+DEF LONG_LENGTH = 63
+
+
+def get_version():
+    return (VERSION, 0)
+
+def get_type():
+    return "palette"
+
+def get_encodings():
+    return ("palette", )
+
+def get_info():
+    return {
+        "version"       : get_version(),
+        "encodings"     : get_encodings(),
+        }
+
+
+cdef class Palette:
+    """
+        The client's copy of a window's persistent palette.
+    """
+    cdef readonly int id
+    cdef readonly int count
+    cdef uint32_t entries[MAX_COLOURS]
+
+    def __init__(self):
+        self.id = -1
+        self.count = 0
+
+    def __repr__(self):
+        return "Palette(%i : %i colours)" % (self.id, self.count)
+
+
+cdef inline int read_length(uint8_t op, uint8_t *buf, Py_ssize_t buf_len, Py_ssize_t *pos, uint32_t *length) nogil:
+    cdef uint32_t v = op & LENGTH_MASK
+    cdef uint32_t b
+    cdef int shift = 0
+    if v<LONG_LENGTH:
+        length[0] = v+1
+        return 0
+    v = 0
+    while True:
+        if pos[0]>=buf_len or shift>28:
+            return -1
+        b = buf[pos[0]]
+        pos[0] += 1
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if not (b & 0x80):
+            break
+    length[0] = v+LONG_LENGTH+1
+    return 0
+
+cdef int decode_tokens(uint8_t *buf, Py_ssize_t buf_len, Py_ssize_t pos,
+                       uint32_t *entries, int count, uint32_t width, uint32_t size, uint32_t *out) nogil:
+    """ returns 0 on success, or the position of the first invalid token plus one """
+    cdef uint32_t i = 0, j, length, colour
+    cdef Py_ssize_t start
+    cdef uint8_t op, index
+    while i<size:
+        start = pos
+        if pos>=buf_len:
+            return start+1
+        op = buf[pos]
+        pos += 1
+        if read_length(op, buf, buf_len, &pos, &length)<0 or length>size-i:
+            return start+1
+        op >>= 6
+        if op==OP_LITERAL:
+            if pos+length>buf_len:
+                return start+1
+            for j in range(length):
+                index = buf[pos+j]
+                if index>=count:
+                    return start+1
+                out[i+j] = entries[index]
+            pos += length
+        elif op==OP_RUN:
+            if pos>=buf_len or buf[pos]>=count:
+                return start+1
+            colour = entries[buf[pos]]
+            pos += 1
+            for j in range(length):
+                out[i+j] = colour
+        elif op==OP_ABOVE:
+            if i<width:
+                return start+1
+            for j in range(length):
+                out[i+j] = out[i+j-width]
+        else:
+            if i==0:
+                return start+1
+            colour = out[i-1]
+            for j in range(length):
+                out[i+j] = colour
+        i += length
+    return 0
+
+
+def decompress(data, int width, int height, Palette palette=None):
+    """
+        Returns the pixels in the same rgb format as the encoder's input,
+        using 4 bytes per pixel and a rowstride of width*4.
+        The persistent palette is updated with the new entries.
+    """
+    assert width>0 and height>0, "invalid dimensions %ix%i" % (width, height)
+    cdef uint8_t *buf = NULL
+    cdef Py_ssize_t buf_len = 0
+    assert object_as_buffer(data, <const void**> &buf, &buf_len)==0, "cannot get buffer from %s" % type(data)
+    if buf_len<HEADER_SIZE:
+        raise ValueError("palette data is too short: %i bytes" % buf_len)
+    if buf[0]!=VERSION:
+        raise ValueError("unsupported palette bitstream version %i" % buf[0])
+    cdef int persistent = buf[1] & FLAG_PERSISTENT
+    cdef int palette_id = buf[2] | (buf[3]<<8)
+    cdef int base = buf[4] | (buf[5]<<8)
+    cdef int new = buf[6] | (buf[7]<<8)
+    if base+new>MAX_COLOURS:
+        raise ValueError("too many palette entries: %i+%i" % (base, new))
+    if buf_len<HEADER_SIZE+new*4:
+        raise ValueError("palette data is too short for %i entries: %i bytes" % (new, buf_len))
+    cdef uint32_t entries[MAX_COLOURS]
+    if base>0:
+        if not persistent or palette is None or palette.id!=palette_id or palette.count<base:
+            raise ValueError("missing palette %i with %i entries, found %s" % (palette_id, base, palette))
+        memcpy(entries, palette.entries, base*4)
+    memcpy(entries+base, buf+HEADER_SIZE, new*4)
+    cdef int count = base+new
+    cdef uint32_t size = width*height
+    cdef uint32_t *out = <uint32_t*> malloc(size*4)
+    if out==NULL:
+        raise MemoryError()
+    cdef Py_ssize_t r
+    try:
+        with nogil:
+            r = decode_tokens(buf, buf_len, HEADER_SIZE+new*4, entries, count, width, size, out)
+        if r:
+            raise ValueError("invalid palette token at offset %i" % (r-1))
+        pixels = (<uint8_t*> out)[:size*4]
+    finally:
+        free(out)
+    if persistent and palette is not None:
+        memcpy(palette.entries, entries, count*4)
+        palette.id = palette_id
+        palette.count = count
+    return pixels
+
+
+def selftest(full=False):
+    from xpra.codecs.palette.encoder import encode    #@UnresolvedImport
+    from xpra.codecs.codec_checks import make_test_image
+    img = make_test_image("BGRX", 24, 16)
+    r = encode(img)
+    if r:
+        decompress(r[0], 24, 16)
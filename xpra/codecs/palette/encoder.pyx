@@ -0,0 +1,336 @@
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+#cython: auto_pickle=False, boundscheck=False, wraparound=False, cdivision=True, language_level=3
+
+from xpra.log import Logger
+log = Logger("encoder", "palette")
+
+from libc.stdint cimport uint8_t, uint16_t, uint32_t, int16_t     #pylint: disable=syntax-error
+from libc.stdlib cimport malloc, free
+from libc.string cimport memset, memcpy
+
+from xpra.buffers.membuf cimport object_as_buffer
+
+# The "palette" bitstream, all values are little endian:
+# header:
+#  * u8  : version
+#  * u8  : flags
+#  * u16 : palette id
+#  * u16 : number of entries re-used from the client's copy of the palette
+#  * u16 : number of new entries
+#  * new entries, 4 bytes each, in the byte order of the rgb_format
+# followed by the tokens describing the indexes of all the pixels,
+# scanning the rows from left to right and from top to bottom.
+# Each token starts with an op byte:
+# the top 2 bits are the token type, the low 6 bits the length minus one,
+# 63 means that the length is 64 plus a LEB128 varint which follows.
+
+DEF VERSION = 1
+DEF HEADER_SIZE = 8
+DEF MAX_COLOURS = 256
+
+#flags:
+DEF FLAG_PERSISTENT = 1
+
+#token types:
+#the indexes follow:
+DEF OP_LITERAL = 0
+#a run of the same index, which follows:
+DEF OP_RUN = 1
+#copy the indexes from the row above:
+DEF OP_ABOVE = 2
+#repeat the index of the previous pixel:
+DEF OP_REPEAT = 3
+
+DEF LENGTH_MASK = 0x3f
+DEF LONG_LENGTH = 63
+
+#open addressing hash table for looking up the palette index of a pixel value,
+#must be a power of 2 and larger than MAX_COLOURS:
+DEF HASH_SIZE = 1024
+cdef uint32_t HASH_MULTIPLIER = 2654435761
+#shorter matches are emitted as literals:
+cdef uint32_t MIN_RUN = 3
+cdef uint32_t MIN_ABOVE = 2
+
+#each window using a persistent palette gets its own id:
+cdef uint16_t palette_counter = 0
+
+
+def get_version():
+    return (VERSION, 0)
+
+def get_type():
+    return "palette"
+
+def get_encodings():
+    return ("palette", )
+
+def get_info():
+    return {
+        "version"       : get_version(),
+        "encodings"     : get_encodings(),
+        "max-colours"   : MAX_COLOURS,
+        }
+
+
+cdef class Palette:
+    """
+        The palette shared with the client across frames,
+        so that we only send the colours it has not seen yet.
+        Once it is full, the next frame starts a new palette with a new id.
+    """
+    cdef readonly uint16_t id
+    cdef readonly int count
+    cdef readonly unsigned long frames
+    cdef readonly unsigned long resets
+    cdef readonly object pixel_format
+    cdef uint32_t entries[MAX_COLOURS]
+
+    def __init__(self):
+        self.reset()
+
+    def __repr__(self):
+        return "Palette(%i : %i colours)" % (self.id, self.count)
+
+    def reset(self):
+        global palette_counter
+        palette_counter = (palette_counter+1) & 0xffff
+        self.id = palette_counter
+        self.count = 0
+        self.pixel_format = None
+        self.resets += 1
+
+    def get_info(self) -> dict:
+        return {
+            "id"        : self.id,
+            "colours"   : self.count,
+            "frames"    : self.frames,
+            "resets"    : self.resets,
+            "format"    : self.pixel_format or "",
+            }
+
+
+cdef inline int lookup(uint32_t *keys, int16_t *values, uint32_t key) nogil:
+    cdef uint32_t h = (key*HASH_MULTIPLIER) & (HASH_SIZE-1)
+    while values[h]>=0:
+        if keys[h]==key:
+            return values[h]
+        h = (h+1) & (HASH_SIZE-1)
+    return -1-h
+
+cdef inline int insert(uint32_t *keys, int16_t *values, uint32_t key, int index) nogil:
+    cdef int h = -1-lookup(keys, values, key)
+    keys[h] = key
+    values[h] = index
+    return h
+
+cdef int index_pixels(uint8_t *buf, int width, int height, int rowstride, uint32_t mask,
+                      uint32_t *entries, int count, uint8_t *indexes) nogil:
+    """
+        finds the palette index of each pixel, adding new colours to the entries,
+        returns the new number of entries or -1 if there are too many colours
+    """
+    cdef uint32_t keys[HASH_SIZE]
+    cdef int16_t values[HASH_SIZE]
+    memset(values, 0xff, sizeof(values))
+    cdef int i
+    for i in range(count):
+        insert(keys, values, entries[i], i)
+    cdef int x, y, index = -1
+    cdef uint32_t pixel, last = 0
+    cdef uint32_t *row
+    for y in range(height):
+        row = <uint32_t*> (buf+y*rowstride)
+        for x in range(width):
+            pixel = row[x] & mask
+            if pixel!=last or index<0:
+                index = lookup(keys, values, pixel)
+                if index<0:
+                    if count==MAX_COLOURS:
+                        return -1
+                    insert(keys, values, pixel, count)
+                    entries[count] = pixel
+                    index = count
+                    count += 1
+                last = pixel
+            indexes[0] = index
+            indexes += 1
+    return count
+
+
+cdef inline uint8_t *write_op(uint8_t *out, uint8_t op, uint32_t length) nogil:
+    if length<=LONG_LENGTH:
+        out[0] = (op<<6) | (length-1)
+        return out+1
+    out[0] = (op<<6) | LONG_LENGTH
+    out += 1
+    length -= LONG_LENGTH+1
+    while length>=0x80:
+        out[0] = (length & 0x7f) | 0x80
+        length >>= 7
+        out += 1
+    out[0] = length
+    return out+1
+
+cdef inline uint8_t *flush_literals(uint8_t *out, uint8_t *indexes, uint32_t start, uint32_t end) nogil:
+    if end>start:
+        out = write_op(out, OP_LITERAL, end-start)
+        memcpy(out, indexes+start, end-start)
+        out += end-start
+    return out
+
+cdef uint8_t *tokenize(uint8_t *indexes, uint32_t width, uint32_t size, uint8_t *out) nogil:
+    """
+        greedy choice between a run of the same index,
+        a copy from the row above and literals
+    """
+    cdef uint32_t i = 0, literal = 0, run, above
+    cdef uint8_t v
+    while i<size:
+        v = indexes[i]
+        run = 1
+        while i+run<size and indexes[i+run]==v:
+            run += 1
+        above = 0
+        if i>=width:
+            while i+above<size and indexes[i+above]==indexes[i+above-width]:
+                above += 1
+        if above>=MIN_ABOVE and above>=run:
+            out = flush_literals(out, indexes, literal, i)
+            out = write_op(out, OP_ABOVE, above)
+            i += above
+            literal = i
+        elif run>=MIN_RUN:
+            out = flush_literals(out, indexes, literal, i)
+            if i>0 and indexes[i-1]==v:
+                out = write_op(out, OP_REPEAT, run)
+            else:
+                out = write_op(out, OP_RUN, run)
+                out[0] = v
+                out += 1
+            i += run
+            literal = i
+        else:
+            i += 1
+    return flush_literals(out, indexes, literal, size)
+
+
+cdef int get_byte_order(src_format, dst_format, uint8_t *order) except -1:
+    """
+        where to find each byte of the destination format in the source format,
+        255 means that the source has no alpha and the byte will be set to 0xff
+    """
+    assert len(src_format)==4 and len(dst_format)==4, "invalid pixel formats %s to %s" % (src_format, dst_format)
+    cdef int i
+    for i, c in enumerate(dst_format):
+        if c in ("X", "A"):
+            index = src_format.find("A")
+            if index<0 and c=="X":
+                index = src_format.find("X")
+        else:
+            index = src_format.find(c)
+            assert index>=0, "cannot convert %s to %s" % (src_format, dst_format)
+        order[i] = 255 if index<0 else index
+    return 0
+
+
+def encode(image, Palette palette=None, rgb_format=None):
+    """
+        Returns the compressed bytes and the client options,
+        or None if the image has too many colours.
+        Only 32 bits per pixel formats are supported,
+        the unused byte of the "X" formats is ignored.
+        The palette entries are converted to 'rgb_format' if specified,
+        so the pixels never need to be.
+    """
+    pixel_format = image.get_pixel_format()
+    assert len(pixel_format)==4, "invalid pixel format %s" % pixel_format
+    cdef uint8_t order[4]
+    get_byte_order(pixel_format, rgb_format or pixel_format, order)
+    if palette is not None and palette.pixel_format!=pixel_format:
+        if palette.pixel_format:
+            palette.reset()
+        palette.pixel_format = pixel_format
+    cdef int width = image.get_width()
+    cdef int height = image.get_height()
+    cdef int rowstride = image.get_rowstride()
+    #ignore the padding byte:
+    cdef uint32_t mask = 0xffffffff
+    if pixel_format.find("X")>=0:
+        (<uint8_t*> &mask)[pixel_format.find("X")] = 0
+    cdef uint8_t *buf = NULL
+    cdef Py_ssize_t buf_len = 0
+    pixels = image.get_pixels()
+    assert object_as_buffer(pixels, <const void**> &buf, &buf_len)==0, "cannot get buffer from %s" % type(pixels)
+    assert buf_len>=(height-1)*rowstride+width*4, "buffer too small: %i bytes for %ix%i with rowstride=%i" % (
+        buf_len, width, height, rowstride)
+    cdef uint32_t size = width*height
+    cdef uint32_t entries[MAX_COLOURS]
+    cdef int base = 0, count = -1
+    cdef uint8_t *indexes = <uint8_t*> malloc(size)
+    if indexes==NULL:
+        raise MemoryError()
+    #worst case is all literals:
+    cdef uint32_t max_size = HEADER_SIZE+MAX_COLOURS*4+size+(size//64+1)*6
+    cdef uint8_t *out = NULL
+    cdef uint8_t *end
+    cdef uint8_t *entry
+    cdef uint32_t v
+    cdef int i, j
+    try:
+        if palette is not None and palette.count>0:
+            base = palette.count
+            memcpy(entries, palette.entries, base*4)
+            with nogil:
+                count = index_pixels(buf, width, height, rowstride, mask, entries, base, indexes)
+            if count<0:
+                #not enough room left, try with a new palette:
+                palette.reset()
+                base = 0
+        if count<0:
+            with nogil:
+                count = index_pixels(buf, width, height, rowstride, mask, entries, 0, indexes)
+        if count<0:
+            return None
+        out = <uint8_t*> malloc(max_size)
+        if out==NULL:
+            raise MemoryError()
+        out[0] = VERSION
+        out[1] = FLAG_PERSISTENT if palette is not None else 0
+        v = palette.id if palette is not None else 0
+        out[2] = v & 0xff
+        out[3] = v >> 8
+        out[4] = base & 0xff
+        out[5] = base >> 8
+        out[6] = (count-base) & 0xff
+        out[7] = (count-base) >> 8
+        end = out+HEADER_SIZE
+        for i in range(base, count):
+            entry = <uint8_t*> (entries+i)
+            for j in range(4):
+                end[j] = 0xff if order[j]==255 else entry[order[j]]
+            end += 4
+        with nogil:
+            end = tokenize(indexes, width, size, end)
+        data = out[:end-out]
+    finally:
+        free(indexes)
+        free(out)
+    if palette is not None:
+        memcpy(palette.entries, entries, count*4)
+        palette.count = count
+        palette.frames += 1
+    return data, {"colours" : count, "rgb_format" : rgb_format or pixel_format}
+
+
+def selftest(full=False):
+    from xpra.codecs.codec_checks import make_test_image
+    for w, h in ((1, 1), (24, 16), (257, 33)):
+        for pixel_format in ("BGRX", "BGRA", "RGBX"):
+            img = make_test_image(pixel_format, w, h)
+            r = encode(img)
+            assert r is None or len(r[0])>HEADER_SIZE
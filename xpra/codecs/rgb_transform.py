@@ -9,11 +9,12 @@ from PIL import Image
 
 from xpra.os_util import bytestostr, monotonic_time
 from xpra.util import first_time
+from xpra.codecs.image_wrapper import ImageWrapper
 from xpra.log import Logger
 try:
-    from xpra.codecs.argb.argb import argb_swap #@UnresolvedImport
+    from xpra.codecs.argb.argb import argb_swap, downscale #@UnresolvedImport
 except ImportError:     # pragma: no cover
-    argb_swap = None
+    argb_swap = downscale = None
 
 log = Logger("encoding")
 
@@ -82,3 +83,24 @@ def rgb_reformat(image, rgb_formats, supports_transparency) -> bool:
         image, rgb_formats, supports_transparency, pixel_format, len(pixels),
         target_format, len(data), (end-start)*1000.0, rowstride)
     return True
+
+
+def rgb_downscale(image, width : int, height : int):
+    """
+        returns a new image downscaled to the given dimensions,
+        or None if the pixel format is not supported
+    """
+    pixel_format = bytestostr(image.get_pixel_format())
+    if not downscale or image.get_planes()!=ImageWrapper.PACKED or \
+        pixel_format not in ("BGRX", "BGRA", "RGBX", "RGBA", "XRGB", "ARGB"):
+        return None
+    start = monotonic_time()
+    pixels = downscale(image.get_pixels(), image.get_width(), image.get_height(), image.get_rowstride(),
+                       width, height)
+    scaled = ImageWrapper(image.get_x(), image.get_y(), width, height, pixels, pixel_format,
+                          image.get_depth(), width*4, planes=ImageWrapper.PACKED, thread_safe=True)
+    scaled.set_target_x(image.get_target_x())
+    scaled.set_target_y(image.get_target_y())
+    scaled.set_timestamp(image.get_timestamp())
+    log("rgb_downscale(%s, %i, %i) took %.1fms", image, width, height, (monotonic_time()-start)*1000)
+    return scaled
@@ -8,12 +8,15 @@
 import sys
 from threading import Lock
 
-from xpra.codecs.loader import load_codec, get_codec, get_codec_error
-from xpra.util import csv, engs
+from xpra.codecs.loader import load_codec, load_codec_list, get_codec, get_codec_error
+from xpra.util import csv, engs, envbool
 from xpra.log import Logger
 
 log = Logger("codec", "video")
 
+#only load the csc modules when they are first needed:
+LAZY_CSC = envbool("XPRA_LAZY_CSC", True)
+
 #the codec loader uses the names...
 #but we need the module name to be able to probe without loading the codec:
 CODEC_TO_MODULE = {
@@ -131,6 +134,7 @@ class VideoHelper:
         #bits needed to ensure we can initialize just once
         #even when called from multiple threads:
         self._initialized = init
+        self._csc_initialized = init
         self._lock = Lock()
 
     def set_modules(self, video_encoders=(), csc_modules=(), video_decoders=()):
@@ -173,6 +177,7 @@ class VideoHelper:
             self.csc_modules = []
             self.video_decoders = []
             self._initialized = False
+            self._csc_initialized = False
 
     def clone(self):
         if not self._initialized:
@@ -187,11 +192,20 @@ class VideoHelper:
                         outd.setdefault(enc, {}).setdefault(ifmt, []).append(v)
             return outd
         ves = deepish_clone_dict(self._video_encoder_specs)
-        ces = deepish_clone_dict(self._csc_encoder_specs)
         vds = deepish_clone_dict(self._video_decoder_specs)
-        return VideoHelper(ves, ces, vds, True)
+        #don't load the csc modules from here (this runs in the UI thread),
+        #the clone will load them when it first needs them if we haven't done so yet:
+        csc_initialized = self._csc_initialized
+        ces = {}
+        if csc_initialized:
+            ces = deepish_clone_dict(self._csc_encoder_specs)
+        vh = VideoHelper(ves, ces, vds, True)
+        vh.csc_modules = self.csc_modules
+        vh._csc_initialized = csc_initialized
+        return vh
 
     def get_info(self) -> dict:
+        self.init_csc()
         d = {}
         einfo = d.setdefault("encoding", {})
         dinfo = d.setdefault("decoding", {})
@@ -230,12 +244,42 @@ class VideoHelper:
             log("VideoHelper.init() initialized=%s", self._initialized)
             if self._initialized:
                 return
+            #load all the modules first, so their self tests can run in parallel:
+            names = self.get_encoder_codec_names() + self.get_decoder_codec_names()
+            if not LAZY_CSC:
+                names += self.get_csc_codec_names()
+            load_codec_list(*names)
             self.init_video_encoders_options()
-            self.init_csc_options()
             self.init_video_decoders_options()
             self._initialized = True
+        if not LAZY_CSC:
+            self.init_csc()
         log("VideoHelper.init() done")
 
+    def init_csc(self):
+        """
+            The csc modules are only needed once we start encoding or decoding video,
+            or to tell the other end which colorspaces we can handle.
+        """
+        if self._csc_initialized or not self._initialized:
+            return
+        with self._lock:
+            #check again with lock held (in case of race):
+            if self._csc_initialized or not self._initialized:
+                return
+            load_codec_list(*self.get_csc_codec_names())
+            self.init_csc_options()
+            self._csc_initialized = True
+
+    def get_encoder_codec_names(self):
+        return [get_encoder_module_name(x) for x in self.video_encoders]
+
+    def get_decoder_codec_names(self):
+        return [get_decoder_module_name(x) for x in self.video_decoders]
+
+    def get_csc_codec_names(self):
+        return [get_csc_module_name(x) for x in self.csc_modules]
+
     def get_encodings(self):
         return tuple(self._video_encoder_specs.keys())
 
@@ -243,6 +287,7 @@ class VideoHelper:
         return tuple(self._video_decoder_specs.keys())
 
     def get_csc_inputs(self):
+        self.init_csc()
         return tuple(self._csc_encoder_specs.keys())
 
 
@@ -250,6 +295,7 @@ class VideoHelper:
         return self._video_encoder_specs.get(encoding, {})
 
     def get_csc_specs(self, src_format):
+        self.init_csc()
         return self._csc_encoder_specs.get(src_format, {})
 
     def get_decoder_specs(self, encoding):
@@ -414,6 +460,7 @@ class VideoHelper:
             this will include the RGB modes themselves too.
         """
         log("get_server_full_csc_modes_for_rgb%s", target_rgb_modes)
+        self.init_csc()
         supported_csc_modes = list(target_rgb_modes)
         for src_format, specs in self._csc_encoder_specs.items():
             for dst_format, csc_specs in specs.items():
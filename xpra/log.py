@@ -228,6 +228,7 @@ STRUCT_KNOWN_FILTERS = {
                 "scaling"       : "Picture scaling",
                 "scroll"        : "Scrolling detection and compression",
                 "xor"           : "XOR delta pre-compression",
+                "delta"         : "Delta compression against the previous rgb frames",
                 "subregion"     : "Video subregion processing",
                 "regiondetect"  : "Video region detection",
                 "regionrefresh" : "Video region refresh",
@@ -248,6 +249,7 @@ STRUCT_KNOWN_FILTERS = {
                 "ffmpeg"        : "ffmpeg encoder",
                 "pillow"        : "Pillow encoder and decoder",
                 "jpeg"          : "JPEG codec",
+                "palette"       : "palette encoder and decoder",
                 "vpx"           : "libvpx encoder and decoder",
                 "nvjpeg"        : "nvidia nvjpeg hardware encoder",
                 "nvenc"         : "nvidia nvenc video hardware encoder",
@@ -281,6 +283,7 @@ STRUCT_KNOWN_FILTERS = {
                 "rfb"           : "RFB Protocol",
                 "mmap"          : "mmap transfers",
                 "protocol"      : "Packet input and output (formatting, parsing, sending and receiving)",
+                "reactor"       : "Shared epoll network reactor and worker threads",
                 "websocket"     : "WebSocket layer",
                 "named-pipe"    : "Named pipe",
                 "udp"           : "UDP",
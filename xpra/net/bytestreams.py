@@ -563,6 +563,17 @@ class PeekableSocketConnection(SocketConnection):
         self._socket = SocketPeekWrapper(self._socket)
 
 
+#from linux/tcp.h, not exposed by the socket module:
+TCP_ULP = 31
+
+def is_ktls(sock) -> bool:
+    """ True if the kernel handles the TLS records for this socket """
+    try:
+        return sock.getsockopt(socket.IPPROTO_TCP, TCP_ULP, 16).rstrip(b"\0")==b"tls"
+    except OSError:
+        return False
+
+
 class SSLSocketConnection(PeekableSocketConnection):
     SSL_TIMEOUT_MESSAGES = ("The read operation timed out", "The write operation timed out")
 
@@ -582,6 +593,8 @@ class SSLSocketConnection(PeekableSocketConnection):
     def get_info(self) -> dict:
         i = SocketConnection.get_info(self)
         i["ssl"] = True
+        if LINUX:
+            i["ktls"] = is_ktls(self._socket)
         for k,fn in {
                      "compression"      : "compression",
                      "alpn-protocol"    : "selected_alpn_protocol",
@@ -40,6 +40,9 @@ def get_padding_options():
     return options
 PADDING_OPTIONS = get_padding_options()
 
+#authenticated encryption modes, these don't use any padding:
+AEAD_CIPHERS = ("AES-GCM", )
+
 
 ENCRYPTION_CIPHERS = []
 backend = False
@@ -84,6 +87,14 @@ def validate_backend(try_backend):
     dv = dec.decrypt(ev)
     log("validate_backend(%s) decrypted(%s)=%s", try_backend, evs, dv)
     assert dv==message
+    if "AES-GCM" in try_backend.ENCRYPTION_CIPHERS:
+        enc = try_backend.get_aead_encryptor(key, DEFAULT_IV)
+        dec = try_backend.get_aead_decryptor(key, DEFAULT_IV)
+        header = b"P"*8
+        ev = enc.encrypt_chunk(header, message)
+        assert len(ev)==len(header)+len(message)+enc.tag_size
+        dv = dec.decrypt_chunk(header, memoryview(ev)[len(header):])
+        assert dv==message
     log("validate_backend(%s) passed", try_backend)
 
 
@@ -136,27 +147,36 @@ def get_crypto_caps() -> dict:
     return caps
 
 
+def get_cipher_key(ciphername, iv, password, key_salt, iterations):
+    assert iterations>=100
+    assert ciphername in ENCRYPTION_CIPHERS, "unsupported cipher %s" % ciphername
+    assert password and iv
+    if ciphername in AEAD_CIPHERS and iv==DEFAULT_IV and key_salt==DEFAULT_SALT:
+        log.warn("Warning: %s used with the default iv and salt", ciphername)
+        log.warn(" nonces will be re-used across connections")
+    return backend.get_key(password, key_salt, DEFAULT_BLOCKSIZE, iterations)
+
 def get_encryptor(ciphername, iv, password, key_salt, iterations):
+    """
+        Returns the encryptor and its block size,
+        the block size is zero for AEAD ciphers since those don't use padding.
+    """
     log("get_encryptor(%s, %s, %s, %s, %s)", ciphername, iv, password, hexstr(key_salt), iterations)
     if not ciphername:
         return None, 0
-    assert iterations>=100
-    assert ciphername=="AES"
-    assert password and iv
-    block_size = DEFAULT_BLOCKSIZE
-    key = backend.get_key(password, key_salt, block_size, iterations)
-    return backend.get_encryptor(key, iv), block_size
+    key = get_cipher_key(ciphername, iv, password, key_salt, iterations)
+    if ciphername in AEAD_CIPHERS:
+        return backend.get_aead_encryptor(key, iv), 0
+    return backend.get_encryptor(key, iv), DEFAULT_BLOCKSIZE
 
 def get_decryptor(ciphername, iv, password, key_salt, iterations):
     log("get_decryptor(%s, %s, %s, %s, %s)", ciphername, iv, password, hexstr(key_salt), iterations)
     if not ciphername:
         return None, 0
-    assert iterations>=100
-    assert ciphername=="AES"
-    assert password and iv
-    block_size = DEFAULT_BLOCKSIZE
-    key = backend.get_key(password, key_salt, block_size, iterations)
-    return backend.get_decryptor(key, iv), block_size
+    key = get_cipher_key(ciphername, iv, password, key_salt, iterations)
+    if ciphername in AEAD_CIPHERS:
+        return backend.get_aead_decryptor(key, iv), 0
+    return backend.get_decryptor(key, iv), DEFAULT_BLOCKSIZE
 
 
 def main():
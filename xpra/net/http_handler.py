@@ -3,15 +3,18 @@
 # Xpra is released under the terms of the GNU GPL v2, or, at your option, any
 # later version. See the file COPYING for details.
 
+import io
 import os
 import glob
 import posixpath
 import mimetypes
+from threading import Lock
+from collections import OrderedDict
 from urllib.parse import unquote
 from http.server import BaseHTTPRequestHandler, SimpleHTTPRequestHandler
 
 from xpra.common import DEFAULT_XDG_DATA_DIRS
-from xpra.util import envbool, std, csv, AdHocStruct, repr_ellipsized
+from xpra.util import envbool, envint, std, csv, AdHocStruct, repr_ellipsized
 from xpra.platform.paths import get_desktop_background_paths
 from xpra.log import Logger
 
@@ -19,6 +22,9 @@ log = Logger("http")
 
 HTTP_ACCEPT_ENCODING = os.environ.get("XPRA_HTTP_ACCEPT_ENCODING", "br,gzip").split(",")
 DIRECTORY_LISTING = envbool("XPRA_HTTP_DIRECTORY_LISTING", False)
+#maximum size of the files compressed on the fly that we keep in memory, in MB:
+HTTP_CACHE_SIZE = envint("XPRA_HTTP_CACHE_SIZE", 32)
+HTTP_SENDFILE = envbool("XPRA_HTTP_SENDFILE", True)
 
 EXTENSION_TO_MIMETYPE = {
     ".wasm" : "application/wasm",
@@ -27,6 +33,87 @@ EXTENSION_TO_MIMETYPE = {
     }
 
 
+class CompressedCache:
+    """
+        Keeps the files we have compressed on the fly,
+        so that we don't compress the same file again for every request.
+        The entries are keyed by path, modification time, size and encoding,
+        so a file that is modified is compressed again.
+        The least recently used entries are evicted first.
+    """
+
+    def __init__(self, max_size):
+        self.max_size = max_size
+        self.size = 0
+        self.entries = OrderedDict()
+        self.lock = Lock()
+        self.hits = 0
+        self.misses = 0
+
+    def get_info(self) -> dict:
+        with self.lock:
+            return {
+                "entries"   : len(self.entries),
+                "size"      : self.size,
+                "max-size"  : self.max_size,
+                "hits"      : self.hits,
+                "misses"    : self.misses,
+                }
+
+    def get(self, key):
+        with self.lock:
+            if key not in self.entries:
+                self.misses += 1
+                return None
+            self.hits += 1
+            self.entries.move_to_end(key)
+            return self.entries[key]
+
+    def set(self, key, data):
+        #a single file should not be able to flush the whole cache:
+        if len(data)>self.max_size//4:
+            return
+        with self.lock:
+            old = self.entries.pop(key, None)
+            if old is not None:
+                self.size -= len(old)
+            self.entries[key] = data
+            self.size += len(data)
+            while self.size>self.max_size:
+                _, evicted = self.entries.popitem(False)
+                self.size -= len(evicted)
+
+compressed_cache = CompressedCache(HTTP_CACHE_SIZE*1024*1024)
+
+
+def make_etag(st, encoding=""):
+    return '"%x-%x%s"' % (st.st_mtime_ns, st.st_size, ("-"+encoding) if encoding else "")
+
+def gzip_compress(path, st):
+    """
+        Returns the gzip compressed contents of the file,
+        or an empty value if compressing does not make it smaller.
+        Compressing is expensive, so the result is cached.
+    """
+    key = (path, st.st_mtime_ns, st.st_size, "gzip")
+    compressed = compressed_cache.get(key)
+    if compressed is not None:
+        return compressed
+    with open(path, 'rb') as f:
+        content = f.read()
+    assert len(content)==st.st_size, \
+        "expected %s to contain %i bytes but read %i bytes" % (path, st.st_size, len(content))
+    import zlib
+    compressobj = zlib.compressobj(9, zlib.DEFLATED, zlib.MAX_WBITS | 16)
+    compressed = compressobj.compress(content) + compressobj.flush()
+    if len(compressed)<st.st_size:
+        log("gzip compressed '%s': %i down to %i bytes", path, st.st_size, len(compressed))
+    else:
+        compressed = b""
+    compressed_cache.set(key, compressed)
+    return compressed
+
+
 #should be converted to use standard library
 def parse_url(handler):
     try:
@@ -53,6 +140,7 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
     * sets cache headers on responses,
     * supports delegation to external script classes,
     * supports pre-compressed brotli and gzip, can gzip on-the-fly,
+    * caches the files compressed on-the-fly, uses etags and sendfile,
     (subclassed in WebSocketRequestHandler to add WebSocket support)
     """
 
@@ -196,6 +284,9 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
 
     def handle_request(self):
         content = self.send_head()
+        if isinstance(content, io.IOBase):
+            self.send_file(content)
+            return
         if content:
             try:
                 self.wfile.write(content)
@@ -208,8 +299,25 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
                 log.error("Error handling http request")
                 log.error(" for '%s'", self.path, exc_info=True)
 
+    def send_file(self, f):
+        try:
+            #the headers may still be buffered:
+            self.wfile.flush()
+            if HTTP_SENDFILE:
+                #uses zero-copy 'os.sendfile' where the socket supports it:
+                self.request.sendfile(f)
+            else:
+                self.wfile.write(f.read())
+        except Exception:
+            log.error("Error handling http request")
+            log.error(" for '%s'", self.path, exc_info=True)
+        finally:
+            f.close()
+
     def do_HEAD(self):
-        self.send_head()
+        content = self.send_head()
+        if isinstance(content, io.IOBase):
+            content.close()
 
     #code taken from MIT licensed code in GzipSimpleHTTPServer.py
     def send_head(self):
@@ -252,7 +360,6 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
             # transmitted *less* than the content-length!
             f = open(path, 'rb')
             fs = os.fstat(f.fileno())
-            content_length = fs[6]
             headers = {}
             content_type = EXTENSION_TO_MIMETYPE.get(ext)
             if not content_type:
@@ -267,6 +374,8 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
             accept = self.headers.get('accept-encoding', '').split(",")
             accept = tuple(x.split(";")[0].strip() for x in accept)
             content = None
+            content_length = fs.st_size
+            etag = make_etag(fs)
             log("accept-encoding=%s", csv(accept))
             for enc in HTTP_ACCEPT_ENCODING:
                 #find a matching pre-compressed file:
@@ -286,41 +395,48 @@ class HTTPRequestHandler(BaseHTTPRequestHandler):
                     log.warn("Warning: '%s' is empty", compressed_path)
                     continue
                 log("sending pre-compressed file '%s'", compressed_path)
-                #read pre-gzipped file:
+                #send the pre-compressed file instead:
                 f.close()
                 f = None
                 f = open(compressed_path, 'rb')
-                content = f.read()
-                assert content, "no data in %s" % compressed_path
+                content_length = st.st_size
+                etag = make_etag(st, enc)
                 headers["Content-Encoding"] = enc
                 break
-            if not content:
-                content = f.read()
-                assert len(content)==content_length, \
-                    "expected %s to contain %i bytes but read %i bytes" % (path, content_length, len(content))
-                if content_length>128 and \
+            else:
+                if fs.st_size>128 and \
                 ("gzip" in accept) and \
                 ("gzip" in HTTP_ACCEPT_ENCODING) \
                 and (ext not in (".png", )):
                     #gzip it on the fly:
-                    import zlib
-                    assert len(content)==content_length, \
-                        "expected %s to contain %i bytes but read %i bytes" % (path, content_length, len(content))
-                    gzip_compress = zlib.compressobj(9, zlib.DEFLATED, zlib.MAX_WBITS | 16)
-                    compressed_content = gzip_compress.compress(content) + gzip_compress.flush()
-                    if len(compressed_content)<content_length:
-                        log("gzip compressed '%s': %i down to %i bytes", path, content_length, len(compressed_content))
+                    content = gzip_compress(path, fs)
+                    if content:
+                        f.close()
+                        f = None
+                        content_length = len(content)
+                        etag = make_etag(fs, "gzip")
                         headers["Content-Encoding"] = "gzip"
-                        content = compressed_content
-            f.close()
-            f = None
-            headers["Content-Length"] = len(content)
+            headers["Content-Length"] = content_length
             headers["Last-Modified"] = self.date_time_string(fs.st_mtime)
+            headers["ETag"] = etag
+            if HTTP_ACCEPT_ENCODING:
+                headers["Vary"] = "Accept-Encoding"
+            if etag in (x.strip() for x in self.headers.get("if-none-match", "").split(",")):
+                log("etag %s matches, not modified", etag)
+                self.send_response(304)
+                self.send_header("ETag", etag)
+                self.end_headers()
+                return None
             #send back response headers:
             self.send_response(200)
             for k,v in headers.items():
                 self.send_header(k, v)
             self.end_headers()
+            if content:
+                return content
+            #the caller is responsible for sending and closing the file:
+            content = f
+            f = None
         except IOError as e:
             log("send_head()", exc_info=True)
             log.error("Error sending '%s':", path)
@@ -12,6 +12,7 @@ import os
 from socket import error as socket_error
 from threading import Lock, Event
 from queue import Queue
+from collections import deque
 
 from xpra.os_util import memoryview_to_bytes, strtobytes, bytestostr, hexstr, monotonic_time
 from xpra.util import repr_ellipsized, ellipsizer, csv, envint, envbool, typedict
@@ -20,7 +21,7 @@ from xpra.net.common import (
     ConnectionClosedException, may_log_packet,
     MAX_PACKET_SIZE, FLUSH_HEADER,
     )
-from xpra.net.bytestreams import ABORT
+from xpra.net.bytestreams import ABORT, SocketConnection, PeekableSocketConnection
 from xpra.net import compression
 from xpra.net.compression import (
     decompress, sanity_checks as compression_sanity_checks,
@@ -34,6 +35,7 @@ from xpra.net.packet_encoding import (
     )
 from xpra.net.header import unpack_header, pack_header, FLAGS_CIPHER, FLAGS_NOHEADER, FLAGS_FLUSH, HEADER_SIZE
 from xpra.net.crypto import get_encryptor, get_decryptor, pad, INITIAL_PADDING
+from xpra.net.reactor import get_reactor, REACTOR
 from xpra.log import Logger
 
 log = Logger("network", "protocol")
@@ -42,6 +44,7 @@ cryptolog = Logger("network", "crypto")
 
 USE_ALIASES = envbool("XPRA_USE_ALIASES", True)
 READ_BUFFER_SIZE = envint("XPRA_READ_BUFFER_SIZE", 65536)
+READ_QUEUE_SIZE = 20
 #merge header and packet if packet is smaller than:
 PACKET_JOIN_SIZE = envint("XPRA_PACKET_JOIN_SIZE", READ_BUFFER_SIZE)
 LARGE_PACKET_SIZE = envint("XPRA_LARGE_PACKET_SIZE", 4096)
@@ -151,7 +154,7 @@ class Protocol:
         self.make_chunk_header = self.make_xpra_header
         self.make_frame_header = self.noframe_header
         self._write_queue = Queue(1)
-        self._read_queue = Queue(20)
+        self._read_queue = Queue(READ_QUEUE_SIZE)
         self._pre_read = None
         self._process_read = self.read_queue_put
         self._read_queue_put = self.read_queue_put
@@ -192,6 +195,13 @@ class Protocol:
         self._read_parser_thread = None         #started when needed
         self._write_format_thread = None        #started when needed
         self._source_has_more = Event()
+        self._reactor = None
+        self._reactor_fd = -1
+        self._read_lane = None
+        self._format_lane = None
+        self._output = None
+        if REACTOR and type(conn) in (SocketConnection, PeekableSocketConnection):
+            self.init_reactor()
 
     STATE_FIELDS = ("max_packet_size", "large_packets", "send_aliases", "receive_aliases",
                     "cipher_in", "cipher_in_name", "cipher_in_block_size", "cipher_in_padding",
@@ -219,6 +229,7 @@ class Protocol:
 
 
     def wait_for_io_threads_exit(self, timeout=None):
+        #(with the reactor, 'stop_reactor' has already waited for the socket callbacks to return)
         io_threads = [x for x in (self._read_thread, self._write_thread) if x is not None]
         for t in io_threads:
             if t.is_alive():
@@ -323,18 +334,265 @@ class Protocol:
         for t in (self._write_thread, self._read_thread, self._read_parser_thread, self._write_format_thread):
             if t:
                 info.setdefault("thread", {})[t.name] = t.is_alive()
+        if self._reactor:
+            rinfo = info.setdefault("reactor", {})
+            for lane in (self._read_lane, self._format_lane):
+                rinfo[lane.name] = lane.get_info()
+            rinfo["paused"] = self._read_paused
+            rinfo["output"] = len(self._output)
         return info
 
 
     def start(self):
         def start_network_read_thread():
-            if not self._closed:
+            if self._closed:
+                return
+            if self._reactor:
+                self.start_reactor()
+            else:
                 self._read_thread.start()
         self.idle_add(start_network_read_thread)
         if SEND_INVALID_PACKET:
             self.timeout_add(SEND_INVALID_PACKET*1000, self.raw_write, "invalid", SEND_INVALID_PACKET_DATA)
 
 
+    def init_reactor(self):
+        """
+            Use the shared network reactor instead of starting
+            the read, parse, format and write threads for this connection.
+            Only plain sockets can be used: epoll cannot see the data
+            buffered in the SSL or SSH transport layers.
+            The socket is switched to non-blocking mode once the reactor starts,
+            and only the reactor thread reads from it and writes to it.
+        """
+        self._reactor = get_reactor()
+        self._read_thread = None
+        self._read_lane = self._reactor.lane("parse")
+        self._format_lane = self._reactor.lane("format")
+        #the packets waiting to be written by the reactor thread:
+        self._output = deque()
+        self._output_lock = Lock()
+        self._reactor_socket = None
+        self._reactor_timeout = None
+        self._read_paused = False
+        self._read_flow_lock = Lock()
+        self._format_lock = Lock()
+        self._format_scheduled = False
+        self._format_deferred = False
+        self._parser = self.read_parser()
+        next(self._parser)
+        self._process_read = self.process_read
+        self._read_queue_put = self.reactor_parse
+        self.source_has_more = self.reactor_source_has_more
+
+    def start_reactor(self):
+        sock = self._conn.get_raw_socket()
+        #epoll will not tell us about the data we have already taken from the socket:
+        while self._pre_read or getattr(sock, "peeked", None):
+            if self._closed or not self.io_call("read", self._read):
+                return
+        self._reactor_socket = sock
+        self._reactor_timeout = sock.gettimeout()
+        sock.setblocking(False)
+        self._reactor_fd = sock.fileno()
+        self._reactor.register(self._reactor_fd, self.reactor_read, self.reactor_write)
+        with self._output_lock:
+            if self._output:
+                self._reactor.want_write(self._reactor_fd)
+
+    def stop_reactor(self):
+        fd = self._reactor_fd
+        if fd>=0:
+            self._reactor_fd = -1
+            self._reactor.unregister(fd)
+            #the connection may be re-used by a blocking reader (see steal_connection):
+            try:
+                self._reactor_socket.settimeout(self._reactor_timeout)
+            except OSError:
+                log("stop_reactor() cannot restore the socket timeout", exc_info=True)
+        self._reactor_socket = None
+        for lane in (self._read_lane, self._format_lane):
+            lane.close()
+        with self._output_lock:
+            self._output.clear()
+
+    def reactor_read(self) -> bool:
+        #called from the reactor thread when the socket is readable
+        if self._closed:
+            return False
+        buf = self.io_call("read", self.reactor_recv)
+        if buf is False:
+            return False
+        if buf is None:
+            #nothing to read after all
+            return True
+        #'_read' takes care of the end of the stream:
+        self._pre_read = [buf]
+        if not self.io_call("read", self._read):
+            return False
+        self.reactor_flow_control()
+        return True
+
+    def reactor_recv(self):
+        conn = self._conn
+        try:
+            buf = self._reactor_socket.recv(self.read_buffer_size)
+        except BlockingIOError:
+            return None
+        conn.input_bytecount += len(buf)
+        conn.input_readcount += 1
+        return buf
+
+    def reactor_flow_control(self):
+        #stop reading from the socket when the parser falls behind,
+        #just like the read thread blocks when the read queue is full:
+        fd = self._reactor_fd
+        if fd<0:
+            return
+        with self._read_flow_lock:
+            queued = self._read_lane.queued()
+            if self._read_paused:
+                if queued<=READ_QUEUE_SIZE//2:
+                    self._read_paused = False
+                    self._reactor.resume(fd)
+            elif queued>=READ_QUEUE_SIZE:
+                self._read_paused = True
+                self._reactor.pause(fd)
+
+    def reactor_parse(self, buf):
+        self._read_lane.put(self.reactor_parse_task, buf)
+
+    def reactor_parse_task(self, buf):
+        parser = self._parser
+        if parser:
+            try:
+                parser.send(buf)
+            except StopIteration:
+                self._parser = None
+            except Exception as e:
+                self._parser = None
+                if not self._closed:
+                    self._internal_error("error in network packet reading/parsing", e, exc_info=True)
+        self.reactor_flow_control()
+
+    def reactor_source_has_more(self):
+        shm = self._source_has_more
+        if not shm or self._closed:
+            return
+        shm.set()
+        self.schedule_format()
+
+    def schedule_format(self):
+        with self._format_lock:
+            if self._format_scheduled:
+                return
+            self._format_scheduled = True
+        self._format_lane.put(self.reactor_format)
+
+    def reactor_format(self):
+        with self._format_lock:
+            self._format_scheduled = False
+        shm = self._source_has_more
+        gpc = self._get_packet_cb
+        if self._closed or not shm or not shm.is_set() or not gpc:
+            return
+        try:
+            self._add_packet_to_queue(*gpc())
+        except Exception as e:
+            if not self._closed:
+                self._internal_error("error in network packet write/format", e, exc_info=True)
+            return
+        if not shm.is_set():
+            return
+        with self._format_lock:
+            if len(self._output)>1:
+                #don't get ahead of the socket, the next write will schedule us again:
+                self._format_deferred = True
+                return
+        self.schedule_format()
+
+    def reactor_queue_write(self, items, start_cb, end_cb, more):
+        with self._output_lock:
+            if self._closed:
+                return
+            #buffers left to write, callbacks, more, corked, started:
+            self._output.append([deque(items), start_cb, end_cb, more, len(items)>1, False])
+            if len(self._output)==1:
+                self._reactor.want_write(self._reactor_fd)
+
+    def reactor_write(self) -> bool:
+        #called from the reactor thread when the socket can take more data
+        if self._closed:
+            return False
+        return self.io_call("write", self.reactor_flush)
+
+    def reactor_flush(self) -> bool:
+        conn = self._conn
+        sock = self._reactor_socket
+        if not conn or not sock:
+            return False
+        while True:
+            with self._output_lock:
+                if not self._output:
+                    self._reactor.want_write(self._reactor_fd, False)
+                    return True
+                item = self._output[0]
+            buffers, start_cb, end_cb, more, cork, started = item
+            if not started:
+                item[5] = True
+                if more or cork:
+                    conn.set_nodelay(False)
+                if cork:
+                    conn.set_cork(True)
+                if start_cb:
+                    try:
+                        start_cb(conn.output_bytecount)
+                    except Exception:
+                        if not self._closed:
+                            log.error("Error on write start callback %s", start_cb, exc_info=True)
+            while buffers:
+                buf = buffers[0]
+                try:
+                    written = sock.send(buf)
+                except BlockingIOError:
+                    return True
+                conn.output_bytecount += written
+                conn.output_writecount += 1
+                self.output_raw_packetcount += 1
+                if written<len(buf):
+                    #the socket buffer is full, wait until it can take more:
+                    buffers[0] = memoryview(buf)[written:]
+                    return True
+                buffers.popleft()
+            if cork:
+                conn.set_cork(False)
+            if not more:
+                conn.set_nodelay(True)
+            self.output_packetcount += 1
+            with self._output_lock:
+                if self._output and self._output[0] is item:
+                    self._output.popleft()
+                pending = len(self._output)
+            if end_cb:
+                try:
+                    end_cb(conn.output_bytecount)
+                except Exception:
+                    if not self._closed:
+                        log.error("Error on write end callback %s", end_cb, exc_info=True)
+            if pending<=1:
+                with self._format_lock:
+                    deferred = self._format_deferred
+                    self._format_deferred = False
+                if deferred:
+                    self.schedule_format()
+
+    def write_queue_empty(self) -> bool:
+        output = self._output
+        if output is not None:
+            return not output
+        return self._write_queue.empty()
+
+
     def send_disconnect(self, reasons, done_callback=None):
         self.flush_then_close(["disconnect"]+list(reasons), done_callback=done_callback)
 
@@ -407,21 +665,27 @@ class Protocol:
         for proto_flags,index,level,data in chunks:
             payload_size = len(data)
             actual_size = payload_size
+            aead = False
             if self.cipher_out:
                 proto_flags |= FLAGS_CIPHER
-                #note: since we are padding: l!=len(data)
-                padding_size = self.cipher_out_block_size - (payload_size % self.cipher_out_block_size)
-                if padding_size==0:
-                    padded = data
+                if self.cipher_out_block_size==0:
+                    #authenticated encryption without padding,
+                    #this is done once we have the header:
+                    aead = True
                 else:
-                    # pad byte value is number of padding bytes added
-                    padded = memoryview_to_bytes(data) + pad(self.cipher_out_padding, padding_size)
-                    actual_size += padding_size
-                assert len(padded)==actual_size, "expected padded size to be %i, but got %i" % (len(padded), actual_size)
-                data = self.cipher_out.encrypt(padded)
-                assert len(data)==actual_size, "expected encrypted size to be %i, but got %i" % (len(data), actual_size)
-                cryptolog("sending %s bytes %s encrypted with %s padding",
-                          payload_size, self.cipher_out_name, padding_size)
+                    #note: since we are padding: l!=len(data)
+                    padding_size = self.cipher_out_block_size - (payload_size % self.cipher_out_block_size)
+                    if padding_size==0:
+                        padded = data
+                    else:
+                        # pad byte value is number of padding bytes added
+                        padded = memoryview_to_bytes(data) + pad(self.cipher_out_padding, padding_size)
+                        actual_size += padding_size
+                    assert len(padded)==actual_size, "expected padded size to be %i, but got %i" % (len(padded), actual_size)
+                    data = self.cipher_out.encrypt(padded)
+                    assert len(data)==actual_size, "expected encrypted size to be %i, but got %i" % (len(data), actual_size)
+                    cryptolog("sending %s bytes %s encrypted with %s padding",
+                              payload_size, self.cipher_out_name, padding_size)
             if proto_flags & FLAGS_NOHEADER:
                 assert not self.cipher_out
                 #for plain/text packets (ie: gibberish response)
@@ -434,7 +698,12 @@ class Protocol:
                 #the xpra packet header:
                 #(WebSocketProtocol may also add a websocket header too)
                 header = self.make_chunk_header(packet_type, proto_flags, level, index, payload_size)
-                if actual_size<PACKET_JOIN_SIZE:
+                if aead:
+                    #the data is encrypted straight into a buffer which starts with the header,
+                    #the header is authenticated too:
+                    items.append(self.cipher_out.encrypt_chunk(header, data))
+                    cryptolog("sending %s bytes %s encrypted", payload_size, self.cipher_out_name)
+                elif actual_size<PACKET_JOIN_SIZE:
                     if not isinstance(data, bytes):
                         data = memoryview_to_bytes(data)
                     items.append(header+data)
@@ -465,6 +734,9 @@ class Protocol:
 
     def raw_write(self, packet_type, items, start_cb=None, end_cb=None, fail_cb=None, synchronous=True, more=False):
         """ Warning: this bypasses the compression and packet encoder! """
+        if self._reactor:
+            self.reactor_queue_write(items, start_cb, end_cb, more)
+            return
         if self._write_thread is None:
             log("raw_write for %s, starting write thread", packet_type)
             self.start_write_thread()
@@ -635,11 +907,14 @@ class Protocol:
 
 
     def _io_thread_loop(self, name, callback):
+        log("io_thread_loop(%s, %s) loop starting", name, callback)
+        while not self._closed and self.io_call(name, callback):
+            pass
+        log("io_thread_loop(%s, %s) loop ended, closed=%s", name, callback, self._closed)
+
+    def io_call(self, name, callback, *args):
         try:
-            log("io_thread_loop(%s, %s) loop starting", name, callback)
-            while not self._closed and callback():
-                pass
-            log("io_thread_loop(%s, %s) loop ended, closed=%s", name, callback, self._closed)
+            return callback(*args)
         except ConnectionClosedException:
             log("%s closed", self._conn, exc_info=True)
             if not self._closed:
@@ -653,6 +928,7 @@ class Protocol:
             if not self._closed:
                 log.error("Error: %s on %s failed: %s", name, self._conn, type(e), exc_info=True)
                 self.close()
+        return False
 
 
     def _write_thread_loop(self):
@@ -812,15 +1088,25 @@ class Protocol:
             self._internal_error("error in network packet reading/parsing", e, exc_info=True)
 
     def do_read_parse_thread_loop(self):
+        parser = self.read_parser()
+        try:
+            next(parser)
+            while not self._closed:
+                parser.send(self._read_queue.get())
+        except StopIteration:
+            pass
+
+    def read_parser(self):
         """
-            Process the individual network packets placed in _read_queue.
+            A generator which is sent the buffers read from the network,
+            either from the parse thread (via _read_queue) or from the reactor's worker threads.
             Concatenate the raw packet data, then try to parse it.
             Extract the individual packets from the potentially large buffer,
             saving the rest of the buffer for later, and optionally decompress this data
             and re-construct the one python-object-packet from potentially multiple packets (see packet_index).
             The 8 bytes packet header gives us information on the packet index, packet size and compression.
             The actual processing of the packet is done via the callback process_packet_cb,
-            this will be called from this parsing thread so any calls that need to be made
+            this will be called from the parsing thread so any calls that need to be made
             from the UI thread will need to use a callback (usually via 'idle_add')
         """
         header = b""
@@ -831,7 +1117,7 @@ class Protocol:
         compression_level = 0
         raw_packets = {}
         while not self._closed:
-            buf = self._read_queue.get()
+            buf = yield
             if not buf:
                 log("parse thread: empty marker, exiting")
                 self.idle_add(self.close)
@@ -871,14 +1157,19 @@ class Protocol:
                         return
 
                     if protocol_flags & FLAGS_CIPHER:
-                        if self.cipher_in_block_size==0 or not self.cipher_in_name:
+                        if not self.cipher_in or not self.cipher_in_name:
                             cryptolog.warn("Warning: received cipher block,")
                             cryptolog.warn(" but we don't have a cipher to decrypt it with,")
                             cryptolog.warn(" not an xpra client?")
                             self.invalid_header(self, header, "invalid encryption packet flag (no cipher configured)")
                             return
-                        padding_size = self.cipher_in_block_size - (data_size % self.cipher_in_block_size)
-                        payload_size = data_size + padding_size
+                        if self.cipher_in_block_size==0:
+                            #authenticated encryption, no padding but a tag:
+                            padding_size = 0
+                            payload_size = data_size + self.cipher_in.tag_size
+                        else:
+                            padding_size = self.cipher_in_block_size - (data_size % self.cipher_in_block_size)
+                            payload_size = data_size + padding_size
                     else:
                         #no cipher, no padding:
                         padding_size = 0
@@ -933,7 +1224,15 @@ class Protocol:
                         return
                     cryptolog("received %i %s encrypted bytes with %i padding",
                               payload_size, self.cipher_in_name, padding_size)
-                    data = self.cipher_in.decrypt(data)
+                    if self.cipher_in_block_size==0:
+                        try:
+                            data = self.cipher_in.decrypt_chunk(header, data)
+                        except Exception:
+                            cryptolog("%s.decrypt_chunk(%s, %i bytes)", self.cipher_in, hexstr(header), len(data), exc_info=True)
+                            self._internal_error("%s authentication failed - wrong key?" % self.cipher_in_name)
+                            return
+                    else:
+                        data = self.cipher_in.decrypt(data)
                     if padding_size > 0:
                         def debug_str(s):
                             try:
@@ -1060,7 +1359,7 @@ class Protocol:
             return
         def wait_for_queue(timeout=10):
             #IMPORTANT: if we are here, we have the write lock held!
-            if not self._write_queue.empty():
+            if not self.write_queue_empty():
                 #write queue still has stuff in it..
                 if timeout<=0:
                     log("flush_then_close: queue still busy, closing without sending the last packet")
@@ -1086,8 +1385,8 @@ class Protocol:
                     done()
                 def wait_for_packet_sent():
                     log("flush_then_close: wait_for_packet_sent() queue.empty()=%s, closed=%s",
-                        self._write_queue.empty(), self._closed)
-                    if self._write_queue.empty() or self._closed:
+                        self.write_queue_empty(), self._closed)
+                    if self.write_queue_empty() or self._closed:
                         #it got sent, we're done!
                         close_and_release()
                         return False
@@ -1136,6 +1435,8 @@ class Protocol:
         if self._closed:
             return
         self._closed = True
+        if self._reactor:
+            self.stop_reactor()
         self.idle_add(self._process_packet_cb, self, [Protocol.CONNECTION_LOST])
         c = self._conn
         if c:
@@ -1175,6 +1476,8 @@ class Protocol:
         if conn:
             #this ensures that we exit the untilConcludes() read/write loop
             conn.set_active(False)
+        if self._reactor:
+            self.stop_reactor()
         self.terminate_queue_threads()
         return conn
 
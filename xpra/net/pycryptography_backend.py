@@ -4,16 +4,26 @@
 # Xpra is released under the terms of the GNU GPL v2, or, at your option, any
 # later version. See the file COPYING for details.
 
+from struct import pack
+
 from xpra.os_util import strtobytes, memoryview_to_bytes
 from xpra.log import Logger
 
 log = Logger("network", "crypto")
 
-__all__ = ("get_info", "get_key", "get_encryptor", "get_decryptor", "ENCRYPTION_CIPHERS")
+__all__ = (
+    "get_info", "get_key",
+    "get_encryptor", "get_decryptor",
+    "get_aead_encryptor", "get_aead_decryptor",
+    "ENCRYPTION_CIPHERS",
+    )
 
 ENCRYPTION_CIPHERS = []
 backend = None
 
+NONCE_SIZE = 12
+TAG_SIZE = 16
+
 
 def patch_crypto_be_discovery():
     """
@@ -56,7 +66,9 @@ def init():
     from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
     from cryptography.hazmat.primitives import hashes
     assert Cipher and algorithms and modes and hashes
-    ENCRYPTION_CIPHERS[:] = ["AES"]
+    from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+    assert AESGCM
+    ENCRYPTION_CIPHERS[:] = ["AES", "AES-GCM"]
 
 def get_info():
     import cryptography
@@ -64,7 +76,8 @@ def get_info():
             "python-cryptography"           : {
                 ""          : True,
                 "version"   : cryptography.__version__,
-                }
+                },
+            "ciphers"                       : ENCRYPTION_CIPHERS,
             }
 
 def get_key(password, key_salt, block_size, iterations):
@@ -81,10 +94,23 @@ def _get_cipher(key, iv):
     from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
     return Cipher(algorithms.AES(key), modes.CBC(strtobytes(iv)), backend=backend)
 
+class CipherContext:
+    """
+        Newer versions of python-cryptography do not allow us
+        to add attributes to their cipher context objects,
+        so we expose 'encrypt' or 'decrypt' from this wrapper instead.
+    """
+    def __init__(self, context, **methods):
+        self.context = context
+        for k,v in methods.items():
+            setattr(self, k, v)
+
+    def __repr__(self):
+        return "CipherContext(%s)" % self.context
+
 def get_encryptor(key, iv):
     encryptor = _get_cipher(key, iv).encryptor()
-    encryptor.encrypt = encryptor.update
-    return encryptor
+    return CipherContext(encryptor, encrypt=encryptor.update)
 
 def get_decryptor(key, iv):
     decryptor = _get_cipher(key, iv).decryptor()
@@ -99,15 +125,84 @@ def get_decryptor(key, iv):
     log("get_decryptor(..) python-cryptography supports_memoryviews(%s)=%s",
         version, supports_memoryviews)
     if supports_memoryviews:
-        decryptor.decrypt = decryptor.update
-    else:
-        del key, iv
-        #with older versions of python-cryptography,
-        #we have to copy the memoryview to a bytearray:
-        def decrypt(v):
-            return decryptor.update(memoryview_to_bytes(v))
-        decryptor.decrypt = decrypt
-    return decryptor
+        return CipherContext(decryptor, decrypt=decryptor.update)
+    del key, iv
+    #with older versions of python-cryptography,
+    #we have to copy the memoryview to a bytearray:
+    def decrypt(v):
+        return decryptor.update(memoryview_to_bytes(v))
+    return CipherContext(decryptor, decrypt=decrypt)
+
+
+class AEADCipher:
+    """
+        AES-GCM encryption of each chunk using its own nonce:
+        the iv is combined with a chunk counter which both ends increment
+        in the same order, so the nonce never needs to be sent.
+        The chunk header is authenticated as associated data,
+        and since GCM is a stream mode, no padding is needed.
+    """
+    tag_size = TAG_SIZE
+
+    def __init__(self, key, iv):
+        self.key = key
+        iv = strtobytes(iv)
+        assert len(iv)>=NONCE_SIZE, "iv is too short: %i bytes" % len(iv)
+        self.nonce_prefix = iv[:4]
+        self.nonce_base = int.from_bytes(iv[4:NONCE_SIZE], "big")
+        self.counter = 0
+
+    def __repr__(self):
+        return "AEADCipher(%i)" % self.counter
+
+    def next_nonce(self):
+        nonce = self.nonce_prefix + pack(">Q", self.nonce_base ^ self.counter)
+        self.counter += 1
+        return nonce
+
+
+class AEADEncryptor(AEADCipher):
+
+    def encrypt_chunk(self, header, data):
+        """
+            Returns a single buffer containing the header,
+            followed by the encrypted data and the authentication tag.
+            The data is encrypted directly into this buffer.
+        """
+        from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+        hlen = len(header)
+        size = len(data)
+        buf = bytearray(hlen+size+TAG_SIZE)
+        buf[:hlen] = header
+        encryptor = Cipher(algorithms.AES(self.key), modes.GCM(self.next_nonce()), backend=backend).encryptor()
+        encryptor.authenticate_additional_data(header)
+        mv = memoryview(buf)
+        encryptor.update_into(data, mv[hlen:])
+        encryptor.finalize()
+        mv[hlen+size:] = encryptor.tag
+        return buf
+
+
+class AEADDecryptor(AEADCipher):
+
+    def __init__(self, key, iv):
+        super().__init__(key, iv)
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+        self.aesgcm = AESGCM(key)
+
+    def decrypt_chunk(self, header, data):
+        """
+            The data must end with the authentication tag,
+            raises an exception if the data or the header have been tampered with.
+        """
+        return self.aesgcm.decrypt(self.next_nonce(), data, header)
+
+
+def get_aead_encryptor(key, iv):
+    return AEADEncryptor(key, iv)
+
+def get_aead_decryptor(key, iv):
+    return AEADDecryptor(key, iv)
 
 
 def main():
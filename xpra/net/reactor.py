@@ -0,0 +1,318 @@
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+"""
+An alternative to the network threads of each connection:
+a single 'reactor' thread waits for all the non-blocking sockets using epoll,
+it reads from the ones that are readable and flushes the pending output
+of the ones that are writable,
+a shared pool of worker threads does the parsing and formatting.
+Each connection queues its work in 'lanes',
+the tasks of a lane run in order and never on more than one worker at a time,
+so the protocol code sees the same sequencing as it does with dedicated threads.
+"""
+
+import os
+import select
+from collections import deque
+from queue import SimpleQueue
+from threading import Lock, Event, current_thread
+
+from xpra.util import envint, envbool
+from xpra.make_thread import start_thread
+from xpra.log import Logger
+
+log = Logger("network", "reactor")
+
+REACTOR = envbool("XPRA_NETWORK_REACTOR", False) and hasattr(select, "epoll")
+WORKERS = envint("XPRA_NETWORK_REACTOR_WORKERS", min(8, max(2, os.cpu_count() or 2)))
+#how many tasks a lane can run before giving other lanes a chance to use the worker:
+LANE_BATCH = envint("XPRA_NETWORK_REACTOR_LANE_BATCH", 8)
+
+
+class WorkerPool:
+    """
+        A fixed number of daemon threads running the functions submitted,
+        the threads are started the first time they are needed.
+    """
+
+    def __init__(self, size):
+        self.size = size
+        self.queue = SimpleQueue()
+        self.threads = []
+        self.lock = Lock()
+        self.tasks = 0
+
+    def __repr__(self):
+        return "WorkerPool(%i)" % self.size
+
+    def submit(self, fn):
+        if not self.threads:
+            with self.lock:
+                while len(self.threads)<self.size:
+                    name = "network-worker-%i" % len(self.threads)
+                    self.threads.append(start_thread(self.run, name, daemon=True))
+        self.queue.put(fn)
+
+    def run(self):
+        while True:
+            fn = self.queue.get()
+            if fn is None:
+                return
+            self.tasks += 1
+            try:
+                fn()
+            except Exception:
+                log.error("Error: network worker task %s failed", fn, exc_info=True)
+
+    def stop(self):
+        with self.lock:
+            for _ in self.threads:
+                self.queue.put(None)
+            self.threads = []
+
+    def get_info(self) -> dict:
+        return {
+            "size"      : self.size,
+            "threads"   : len(self.threads),
+            "tasks"     : self.tasks,
+            "queued"    : self.queue.qsize(),
+            }
+
+
+class Lane:
+    """
+        Runs the tasks it is given in order, one at a time, on the worker pool.
+    """
+    __slots__ = ("name", "pool", "lock", "tasks", "running", "closed", "count", "idle")
+
+    def __init__(self, pool, name):
+        self.name = name
+        self.pool = pool
+        self.lock = Lock()
+        self.tasks = deque()
+        self.running = False
+        self.closed = False
+        self.count = 0
+        self.idle = Event()
+        self.idle.set()
+
+    def __repr__(self):
+        return "Lane(%s)" % self.name
+
+    def queued(self) -> int:
+        return len(self.tasks)
+
+    def put(self, fn, *args):
+        with self.lock:
+            if self.closed:
+                return
+            self.tasks.append((fn, args))
+            if self.running:
+                return
+            self.running = True
+            self.idle.clear()
+        self.pool.submit(self.run)
+
+    def run(self):
+        for _ in range(LANE_BATCH):
+            with self.lock:
+                if self.closed or not self.tasks:
+                    self.running = False
+                    self.idle.set()
+                    return
+                fn, args = self.tasks.popleft()
+            try:
+                fn(*args)
+            except Exception:
+                log.error("Error: %s task %s failed", self.name, fn, exc_info=True)
+            self.count += 1
+        #more work to do, but let the other lanes use this worker first:
+        self.pool.submit(self.run)
+
+    def wait(self, timeout=None) -> bool:
+        return self.idle.wait(timeout)
+
+    def close(self):
+        with self.lock:
+            self.closed = True
+            self.tasks.clear()
+
+    def get_info(self) -> dict:
+        return {
+            "queued"    : len(self.tasks),
+            "tasks"     : self.count,
+            "busy"      : self.running,
+            }
+
+
+class Reactor:
+    """
+        The callbacks registered are called from the reactor thread
+        when their file descriptor is readable, or writable if 'want_write' has been called,
+        they must not block and they are unregistered if they return False.
+    """
+
+    def __init__(self, workers=WORKERS):
+        self.epoll = select.epoll()
+        self.lock = Lock()
+        #held while dispatching events, so 'unregister' can wait for the callbacks to return:
+        self.dispatch_lock = Lock()
+        self.callbacks = {}
+        self.paused = set()
+        self.writing = set()
+        self.pool = WorkerPool(workers)
+        self.thread = None
+        self.closed = False
+        self.wakeups = 0
+        self.events = 0
+        self.wake_read, self.wake_write = os.pipe()
+        self.epoll.register(self.wake_read, select.EPOLLIN)
+
+    def __repr__(self):
+        return "Reactor(%i connections)" % len(self.callbacks)
+
+    def lane(self, name) -> Lane:
+        return Lane(self.pool, name)
+
+    def register(self, fd, read_callback, write_callback=None):
+        with self.lock:
+            assert not self.closed, "reactor is closed"
+            self.callbacks[fd] = (read_callback, write_callback)
+            self.epoll.register(fd, select.EPOLLIN)
+            if not self.thread:
+                self.thread = start_thread(self.run, "network-reactor", daemon=True)
+        log("register(%i, %s, %s)", fd, read_callback, write_callback)
+
+    def unregister(self, fd):
+        with self.lock:
+            if self.callbacks.pop(fd, None) is None:
+                return
+            self.paused.discard(fd)
+            self.writing.discard(fd)
+            try:
+                self.epoll.unregister(fd)
+            except OSError:
+                log("unregister(%i)", fd, exc_info=True)
+        log("unregister(%i)", fd)
+        if current_thread() is not self.thread:
+            #make sure that the callback is not running:
+            with self.dispatch_lock:
+                pass
+
+    def pause(self, fd):
+        self.set_events(fd, self.paused, True)
+
+    def resume(self, fd):
+        self.set_events(fd, self.paused, False)
+
+    def want_write(self, fd, write=True):
+        self.set_events(fd, self.writing, write)
+
+    def set_events(self, fd, fds, add):
+        with self.lock:
+            if fd not in self.callbacks or (fd in fds)==add:
+                return
+            if add:
+                fds.add(fd)
+            else:
+                fds.discard(fd)
+            events = 0 if fd in self.paused else select.EPOLLIN
+            if fd in self.writing:
+                events |= select.EPOLLOUT
+            self.epoll.modify(fd, events)
+
+    def run(self):
+        log("reactor thread starting")
+        while not self.closed:
+            try:
+                events = self.epoll.poll()
+            except InterruptedError:
+                continue
+            except (OSError, ValueError):
+                #the epoll object is closed by 'cleanup'
+                if self.closed:
+                    break
+                raise
+            self.wakeups += 1
+            with self.dispatch_lock:
+                for fd, event in events:
+                    if fd==self.wake_read:
+                        os.read(fd, 1)
+                        continue
+                    callbacks = self.callbacks.get(fd)
+                    if not callbacks:
+                        continue
+                    self.events += 1
+                    read_callback, write_callback = callbacks
+                    more = True
+                    if event & select.EPOLLOUT and write_callback:
+                        more = self.call(write_callback)
+                    #errors and hangups are reported by the read callback:
+                    if more and event & (select.EPOLLIN | select.EPOLLERR | select.EPOLLHUP):
+                        more = self.call(read_callback)
+                    if not more:
+                        self.unregister(fd)
+        log("reactor thread ended")
+
+    def call(self, callback) -> bool:
+        try:
+            return callback()
+        except Exception:
+            log.error("Error: reactor callback %s failed", callback, exc_info=True)
+            return False
+
+    def cleanup(self):
+        with self.lock:
+            if self.closed:
+                return
+            self.closed = True
+            self.callbacks = {}
+            thread = self.thread
+        os.write(self.wake_write, b"\0")
+        self.pool.stop()
+        if thread and thread is not current_thread():
+            thread.join(1)
+        self.epoll.close()
+        os.close(self.wake_read)
+        os.close(self.wake_write)
+
+    def get_info(self) -> dict:
+        return {
+            "connections"   : len(self.callbacks),
+            "paused"        : len(self.paused),
+            "writing"       : len(self.writing),
+            "wakeups"       : self.wakeups,
+            "events"        : self.events,
+            "workers"       : self.pool.get_info(),
+            }
+
+
+reactor = None
+reactor_lock = Lock()
+def get_reactor() -> Reactor:
+    global reactor
+    with reactor_lock:
+        if reactor is None or reactor.closed:
+            reactor = Reactor()
+        return reactor
+
+def cleanup_reactor():
+    global reactor
+    with reactor_lock:
+        r = reactor
+        reactor = None
+    if r:
+        r.cleanup()
+
+def get_reactor_info() -> dict:
+    r = reactor
+    info = {
+        ""          : REACTOR,
+        "workers"   : WORKERS,
+        }
+    if r:
+        info.update(r.get_info())
+    return info
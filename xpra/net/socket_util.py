@@ -16,7 +16,7 @@ from xpra.exit_codes import (
 from xpra.net.bytestreams import set_socket_timeout, pretty_socket
 from xpra.os_util import (
     getuid, get_username_for_uid, get_groups, get_group_id,
-    path_permission_info, monotonic_time, umask_context, WIN32, OSX, POSIX,
+    path_permission_info, monotonic_time, umask_context, WIN32, OSX, POSIX, LINUX,
     parse_encoded_bin_data,
     )
 from xpra.util import (
@@ -36,6 +36,10 @@ PEEK_SIZE = envint("XPRA_PEEK_SIZE", 8192)
 
 SOCKET_DIR_MODE = num = int(os.environ.get("XPRA_SOCKET_DIR_MODE", "775"), 8)
 SOCKET_DIR_GROUP = os.environ.get("XPRA_SOCKET_DIR_GROUP", GROUP)
+#let the kernel encrypt and decrypt the TLS records once the handshake is done,
+#openssl falls back to doing it in user space if the kernel does not support it
+#(opt-in only for now: not tested yet with the kernel 'tls' module loaded):
+SSL_KTLS = envbool("XPRA_SSL_KTLS", False)
 
 
 network_logger = None
@@ -826,6 +830,14 @@ def get_ssl_attributes(opts, server_side=True, overrides=None):
         args[attr] = v
     return args
 
+def get_ktls_option() -> int:
+    import ssl
+    v = getattr(ssl, "OP_ENABLE_KTLS", None)
+    if v is None and LINUX and ssl.OPENSSL_VERSION_INFO>=(3, 0):
+        #python versions older than 3.12 don't expose SSL_OP_ENABLE_KTLS:
+        v = 1<<3
+    return v or 0
+
 def ssl_wrap_socket(sock, **kwargs):
     fn = get_ssl_wrap_socket_fn(**kwargs)
     return fn(sock)
@@ -898,6 +910,8 @@ def get_ssl_wrap_socket_fn(cert=None, key=None, ca_certs=None, ca_data=None,
         if v is None:
             raise InitException("invalid ssl option: %s" % x)
         ssl_options |= v
+    if SSL_KTLS:
+        ssl_options |= get_ktls_option()
     ssllog(" options=%#x", ssl_options)
 
     context = ssl.SSLContext(proto)
@@ -896,7 +896,7 @@ class ClientExtras:
 
     def do_setup_xprops(self, *args):
         log("do_setup_xprops(%s)", args)
-        ROOT_PROPS = ["RESOURCE_MANAGER", "_NET_WORKAREA", "_NET_CURRENT_DESKTOP"]
+        ROOT_PROPS = ["RESOURCE_MANAGER", "_NET_WORKAREA", "_NET_CURRENT_DESKTOP", "_NET_CLIENT_LIST_STACKING"]
         try:
             self.init_x11_filter()
             from xpra.gtk_common.gtk_util import get_default_root_window
@@ -1007,6 +1007,11 @@ class ClientExtras:
             self.client.screen_size_changed("from %s event" % self._root_props_watcher)
         elif prop=="_NET_CURRENT_DESKTOP":
             self.client.workspace_changed("from %s event" % self._root_props_watcher)
+        elif prop=="_NET_CLIENT_LIST_STACKING":
+            #windows have been raised or lowered:
+            swv = getattr(self.client, "schedule_window_visibility", None)
+            if swv:
+                swv()
         elif prop in ("_NET_DESKTOP_NAMES", "_NET_NUMBER_OF_DESKTOPS"):
             self.client.desktops_changed("from %s event" % self._root_props_watcher)
         else:
@@ -8,9 +8,18 @@
 #cython: boundscheck=False, wraparound=False, cdivision=True, language_level=3
 
 from xpra.monotonic_time cimport monotonic_time  #pylint: disable=syntax-error
+from libc.stdint cimport uint64_t                  #pylint: disable=syntax-error
+from libc.stdlib cimport malloc, free, qsort       #pylint: disable=syntax-error
+from libc.string cimport memset                    #pylint: disable=syntax-error
 
 cdef extern from "math.h":
     double log(double x)
+    double ceil(double x)
+    double fabs(double x)
+    bint isfinite(double x)
+
+#doubles within this range can be converted to a long safely:
+cdef double MAX_LONG_VALUE = 2.0**62
 
 from math import sqrt
 def logp(double x):
@@ -202,6 +211,558 @@ def queue_inspect(metric, time_values, float target=1.0, float div=1.0, smoothin
     #inspect a queue size history: figure out if things are better or worse than before
     if len(time_values)==0:
         return metric, {}, 1.0, 0.0
-    avg, recent = calculate_time_weighted_average(tuple(time_values))
+    if isinstance(time_values, TimeSeries):
+        #the values are in the last column:
+        avg, recent = time_values.time_weighted_average(-1)
+    else:
+        avg, recent = calculate_time_weighted_average(tuple(time_values))
     weight_multiplier = sqrt(max(avg, recent) / div / target)
     return calculate_for_target(metric, target, avg, recent, aim=0.25, div=div, slope=1.0, smoothing=smoothing, weight_multiplier=weight_multiplier)
+
+
+cdef int cmp_double(const void *a, const void *b) noexcept nogil:
+    cdef double da = (<const double*> a)[0]
+    cdef double db = (<const double*> b)[0]
+    return (da>db) - (da<db)
+
+
+cdef class TimeSeries:
+    """
+        A fixed size ring of numeric records, stored as one C array per column.
+        This replaces the `deque(maxlen=N)` of tuples used by the statistics classes:
+        appending a record updates the running sums and the exponentially weighted
+        moving average of each column, so those are available in O(1),
+        and the weighted averages are computed from the C arrays
+        without creating any python objects.
+        Iterating or indexing still returns tuples, oldest record first,
+        so existing consumers can treat it as a deque snapshot.
+        Columns listed in `labels` can hold arbitrary hashable values,
+        (ie: encoding names) which are stored as an index into a lookup table.
+        The sorted values used for the percentiles are cached
+        until the next record is appended.
+    """
+    cdef object __weakref__
+    cdef double *data
+    cdef double *sums
+    cdef double *ewmas
+    cdef double *sorted
+    cdef unsigned int *sorted_at
+    cdef readonly unsigned int maxlen
+    cdef readonly unsigned int ncols
+    cdef readonly object columns
+    cdef readonly double alpha
+    cdef unsigned int start
+    cdef unsigned int count
+    cdef unsigned int appended
+    cdef int time_col
+    cdef object column_index
+    cdef object label_cols
+    cdef object label_values
+    cdef object label_index
+
+    def __cinit__(self, unsigned int maxlen, columns=("time", "value"), labels=(), double alpha=0.1):
+        assert maxlen>0, "invalid maxlen %i" % maxlen
+        assert 0<alpha<=1, "invalid ewma alpha %f" % alpha
+        self.maxlen = maxlen
+        self.columns = tuple(columns)
+        self.ncols = len(self.columns)
+        assert self.ncols>0, "no columns"
+        self.alpha = alpha
+        self.column_index = dict((name, i) for i, name in enumerate(self.columns))
+        self.time_col = self.column_index.get("time", 0)
+        self.label_cols = tuple(self.column_index[name] for name in labels)
+        self.label_values = []
+        self.label_index = {}
+        self.data = <double*> malloc(self.maxlen*self.ncols*sizeof(double))
+        self.sums = <double*> malloc(self.ncols*sizeof(double))
+        self.ewmas = <double*> malloc(self.ncols*sizeof(double))
+        self.sorted = <double*> malloc(self.maxlen*self.ncols*sizeof(double))
+        self.sorted_at = <unsigned int*> malloc(self.ncols*sizeof(unsigned int))
+        assert self.data!=NULL and self.sums!=NULL and self.ewmas!=NULL, "time series memory allocation failed"
+        assert self.sorted!=NULL and self.sorted_at!=NULL, "time series memory allocation failed"
+        self.clear()
+
+    def __dealloc__(self):
+        free(self.data)
+        self.data = NULL
+        free(self.sums)
+        self.sums = NULL
+        free(self.ewmas)
+        self.ewmas = NULL
+        free(self.sorted)
+        self.sorted = NULL
+        free(self.sorted_at)
+        self.sorted_at = NULL
+
+    def __repr__(self):
+        return "TimeSeries(%i/%i: %s)" % (self.count, self.maxlen, self.columns)
+
+    def __len__(self):
+        return self.count
+
+    def __iter__(self):
+        return iter(self.records())
+
+    def __getitem__(self, int index):
+        if index<0:
+            index += self.count
+        if index<0 or index>=<int> self.count:
+            raise IndexError("time series index %i out of range" % index)
+        return self.get_record(index)
+
+    def clear(self):
+        self.start = 0
+        self.count = 0
+        self.appended = 0
+        memset(self.sums, 0, self.ncols*sizeof(double))
+        memset(self.ewmas, 0, self.ncols*sizeof(double))
+        memset(self.sorted_at, 0, self.ncols*sizeof(unsigned int))
+
+    cdef int col(self, col) except -1:
+        cdef int c
+        if isinstance(col, str):
+            c = self.column_index[col]
+        else:
+            c = col
+            if c<0:
+                c += self.ncols
+            if c<0 or c>=<int> self.ncols:
+                raise IndexError("time series column %i out of range" % col)
+        return c
+
+    cdef inline double *column(self, int c):
+        return self.data + c*self.maxlen
+
+    cdef inline unsigned int pos(self, unsigned int index):
+        #ring position of the 'index' oldest record:
+        return (self.start+index) % self.maxlen
+
+    cdef object get_record(self, unsigned int index):
+        cdef unsigned int p = self.pos(index)
+        cdef unsigned int c
+        cdef double v
+        record = []
+        for c in range(self.ncols):
+            v = self.column(c)[p]
+            if c in self.label_cols:
+                record.append(self.label_values[<unsigned int> v])
+            elif isfinite(v) and fabs(v)<MAX_LONG_VALUE and v==<long> v:
+                record.append(<long> v)
+            else:
+                record.append(v)
+        return tuple(record)
+
+    def append(self, record):
+        """
+            Add a record, evicting the oldest one if the ring is full.
+        """
+        assert len(record)==self.ncols, "expected %i values but got %i: %s" % (self.ncols, len(record), record)
+        cdef unsigned int p
+        cdef unsigned int c
+        cdef double v
+        cdef double *col
+        if self.count<self.maxlen:
+            p = self.pos(self.count)
+            self.count += 1
+        else:
+            #evict the oldest record:
+            p = self.start
+            self.start = (self.start+1) % self.maxlen
+            for c in range(self.ncols):
+                self.sums[c] -= self.column(c)[p]
+        for c in range(self.ncols):
+            value = record[c]
+            if c in self.label_cols:
+                i = self.label_index.get(value)
+                if i is None:
+                    i = len(self.label_values)
+                    self.label_values.append(value)
+                    self.label_index[value] = i
+                v = i
+            else:
+                v = value
+            self.column(c)[p] = v
+            self.sums[c] += v
+            if self.appended==0:
+                self.ewmas[c] = v
+            else:
+                self.ewmas[c] += self.alpha*(v-self.ewmas[c])
+        self.appended += 1
+        if self.appended % self.maxlen==0:
+            #avoid accumulating floating point errors in the running sums:
+            for c in range(self.ncols):
+                col = self.column(c)
+                v = 0
+                for p in range(self.count):
+                    v += col[self.pos(p)]
+                self.sums[c] = v
+
+    def records(self, double since=0):
+        """
+            Returns a snapshot of all the records as a tuple of tuples,
+            optionally only those with a time value greater or equal to 'since'.
+        """
+        cdef double *times = self.column(self.time_col)
+        cdef unsigned int i
+        return tuple(self.get_record(i) for i in range(self.count) if times[self.pos(i)]>=since)
+
+    def values(self, col, double since=0):
+        """ Returns the values of a numeric column """
+        cdef double *times = self.column(self.time_col)
+        cdef double *values = self.column(self.col(col))
+        cdef unsigned int i, p
+        r = []
+        for i in range(self.count):
+            p = self.pos(i)
+            if times[p]>=since:
+                r.append(values[p])
+        return tuple(r)
+
+    def last(self, col):
+        assert self.count>0, "no records"
+        return self.column(self.col(col))[self.pos(self.count-1)]
+
+    def count_since(self, double since):
+        cdef double *times = self.column(self.time_col)
+        cdef unsigned int i, n = 0
+        for i in range(self.count):
+            if times[self.pos(i)]>=since:
+                n += 1
+        return n
+
+    def sum(self, col, double since=0):
+        cdef int c = self.col(col)
+        if since<=0:
+            return self.sums[c]
+        cdef double *times = self.column(self.time_col)
+        cdef double *values = self.column(c)
+        cdef double total = 0
+        cdef unsigned int i, p
+        for i in range(self.count):
+            p = self.pos(i)
+            if times[p]>=since:
+                total += values[p]
+        return total
+
+    def sum_product_buckets(self, col1, col2, double now, unsigned int nbuckets):
+        """
+            Sum of col1*col2 for the records of each of the last 'nbuckets' seconds,
+            the first value is for the most recent second: now-1 < time < now.
+        """
+        cdef double *times = self.column(self.time_col)
+        cdef double *values1 = self.column(self.col(col1))
+        cdef double *values2 = self.column(self.col(col2))
+        cdef double age
+        cdef unsigned int i, p, b
+        buckets = [0]*nbuckets
+        for i in range(self.count):
+            p = self.pos(i)
+            age = now-times[p]
+            if age<=0 or age>nbuckets:
+                continue
+            b = <unsigned int> ceil(age)
+            buckets[b-1] += values1[p]*values2[p]
+        return tuple(buckets)
+
+    def sum_product(self, col1, col2, double since=0):
+        """ Sum of col1*col2 for all the records, ie: w*h for damage pixels """
+        cdef double *times = self.column(self.time_col)
+        cdef double *values1 = self.column(self.col(col1))
+        cdef double *values2 = self.column(self.col(col2))
+        cdef double total = 0
+        cdef unsigned int i, p
+        for i in range(self.count):
+            p = self.pos(i)
+            if times[p]>=since:
+                total += values1[p]*values2[p]
+        return total
+
+    def mean(self, col):
+        assert self.count>0, "no records"
+        return self.sums[self.col(col)]/self.count
+
+    def ewma(self, col):
+        """ Exponentially weighted moving average of all the values ever added """
+        assert self.count>0, "no records"
+        return self.ewmas[self.col(col)]
+
+    def min(self, col):
+        assert self.count>0, "no records"
+        cdef double *values = self.column(self.col(col))
+        cdef double v = values[self.start]
+        cdef unsigned int i
+        for i in range(1, self.count):
+            v = min(v, values[self.pos(i)])
+        return v
+
+    def max(self, col):
+        assert self.count>0, "no records"
+        cdef double *values = self.column(self.col(col))
+        cdef double v = values[self.start]
+        cdef unsigned int i
+        for i in range(1, self.count):
+            v = max(v, values[self.pos(i)])
+        return v
+
+    cdef double *sorted_values(self, int c):
+        cdef double *svalues = self.sorted + c*self.maxlen
+        #the values are only sorted again if records have been added since:
+        if self.sorted_at[c]==self.appended+1:
+            return svalues
+        cdef double *values = self.column(c)
+        cdef unsigned int i
+        for i in range(self.count):
+            svalues[i] = values[self.pos(i)]
+        qsort(svalues, self.count, sizeof(double), cmp_double)
+        self.sorted_at[c] = self.appended+1
+        return svalues
+
+    def percentile(self, col, unsigned int pct):
+        assert self.count>0, "no records"
+        assert pct<=100
+        cdef double *svalues = self.sorted_values(self.col(col))
+        return svalues[min(self.count-1, self.count*pct//100)]
+
+    def list_stats(self, col, double scale=1.0, show_percentile=(5, 8, 9)):
+        """
+            Same as simple_stats.get_list_stats(),
+            the values are multiplied by 'scale' first.
+        """
+        if self.count==0:
+            return {}
+        cdef int c = self.col(col)
+        cdef double *svalues = self.sorted_values(c)
+        cdef unsigned int n = self.count
+        stats = {
+            "cur"   : int(self.column(c)[self.pos(n-1)]*scale),
+            "min"   : int(svalues[0]*scale),
+            "max"   : int(svalues[n-1]*scale),
+            "avg"   : int(self.sums[c]*scale/n),
+            }
+        for i in (show_percentile or ()):
+            stats["%ip" % (i*10)] = int(svalues[n*i//10]*scale)
+        return stats
+
+    def filter(self, key_col, key, value_col):
+        """
+            Returns a list of (time, value) for the records
+            where the 'key_col' column matches 'key', ie: a specific window id
+        """
+        cdef double *times = self.column(self.time_col)
+        cdef double *keys = self.column(self.col(key_col))
+        cdef double *values = self.column(self.col(value_col))
+        cdef double k = key
+        cdef unsigned int i, p
+        r = []
+        for i in range(self.count):
+            p = self.pos(i)
+            if keys[p]==k:
+                r.append((times[p], values[p]))
+        return r
+
+    def time_weighted_average(self, col):
+        """
+            Same as calculate_time_weighted_average(),
+            using the 'col' column for the values.
+        """
+        assert self.count>0, "no records"
+        cdef double *times = self.column(self.time_col)
+        cdef double *values = self.column(self.col(col))
+        cdef double now = monotonic_time()
+        cdef double tv = 0.0
+        cdef double tw = 0.0
+        cdef double rv = 0.0
+        cdef double rw = 0.0
+        cdef double delta, w, value
+        cdef unsigned int i, p
+        for i in range(self.count):
+            p = self.pos(i)
+            value = values[p]
+            delta = now-times[p]
+            w = 1.0/(1.0+delta)
+            tv += value*w
+            tw += w
+            w = 1.0/(0.1+delta**2)
+            rv += value*w
+            rw += w
+        return tv / tw, rv / rw
+
+    cdef object do_size_weighted_average(self, int size_col, int value_col, double since, int mode, double unit):
+        cdef double *times = self.column(self.time_col)
+        cdef double *sizes = self.column(size_col)
+        cdef double *values = self.column(value_col)
+        cdef double size_avg = 0
+        cdef unsigned int i, p, n = 0
+        for i in range(self.count):
+            p = self.pos(i)
+            if times[p]>=since:
+                size_avg += sizes[p]
+                n += 1
+        if n==0:
+            return 0.0, 0.0
+        size_avg /= n
+        if size_avg<=0:
+            size_avg = 1
+        cdef double now = monotonic_time()
+        cdef double tv = 0.0
+        cdef double tw = 0.0
+        cdef double rv = 0.0
+        cdef double rw = 0.0
+        cdef double size, value, size_ps, pw, w, delta
+        for i in range(self.count):
+            p = self.pos(i)
+            if times[p]<since:
+                continue
+            size = sizes[p]
+            value = values[p]
+            if value<=0:
+                continue        #invalid record
+            if mode==1:
+                #value is an elapsed time:
+                value = unit/value
+            elif mode==2:
+                #value is the elapsed time for 'size' units:
+                value = size*unit/value
+            delta = now-times[p]
+            pw = clogp(size/size_avg)
+            size_ps = max(1, size*value)
+            w = pw/(1.0+delta)
+            tv += w*size_ps
+            tw += w*size
+            w = pw/(0.1+delta**2)
+            rv += w*size_ps
+            rw += w*size
+        if tw<=0:
+            tw = 1
+        if rw<=0:
+            rw = 1
+        return float(tv / tw), float(rv / rw)
+
+    def size_weighted_average(self, size_col, value_col, double since=0):
+        """ Same as calculate_size_weighted_average() """
+        return self.do_size_weighted_average(self.col(size_col), self.col(value_col), since, 0, 1.0)
+
+    def size_weighted_rate(self, size_col, elapsed_col, double unit=1.0):
+        """ Same as calculate_timesize_weighted_average() """
+        return self.do_size_weighted_average(self.col(size_col), self.col(elapsed_col), 0, 1, unit)
+
+    def size_weighted_speed(self, size_col, elapsed_col, double unit=1.0):
+        """
+            Size weighted average of the speed, in size units per 'unit' of elapsed time.
+        """
+        return self.do_size_weighted_average(self.col(size_col), self.col(elapsed_col), 0, 2, unit)
+
+
+#HDR style histogram:
+#values below 2**SUB_BUCKET_BITS are recorded exactly,
+#above that each power of 2 is split into 2**SUB_BUCKET_BITS linear sub-buckets,
+#which gives a relative precision better than 1/2**SUB_BUCKET_BITS (~6%)
+DEF SUB_BUCKET_BITS = 4
+DEF SUB_BUCKETS = 16
+DEF MAX_VALUE_BITS = 40
+DEF NBUCKETS = SUB_BUCKETS*(MAX_VALUE_BITS-SUB_BUCKET_BITS+1)
+
+cdef inline unsigned int bucket_index(uint64_t v) nogil:
+    if v<SUB_BUCKETS:
+        return <unsigned int> v
+    cdef unsigned int e = 0
+    while (v >> (e+SUB_BUCKET_BITS+1))!=0:
+        e += 1
+    #now: 2**SUB_BUCKET_BITS <= (v >> e) < 2**(SUB_BUCKET_BITS+1)
+    return SUB_BUCKETS + e*SUB_BUCKETS + <unsigned int> ((v >> e) - SUB_BUCKETS)
+
+cdef inline uint64_t bucket_value(unsigned int index) nogil:
+    #the middle of the range of values recorded in this bucket:
+    if index<SUB_BUCKETS:
+        return index
+    cdef unsigned int e = (index-SUB_BUCKETS) // SUB_BUCKETS
+    cdef uint64_t sub = (index-SUB_BUCKETS) % SUB_BUCKETS
+    return ((SUB_BUCKETS+sub) << e) + ((<uint64_t> 1 << e) >> 1)
+
+
+cdef class LatencyHistogram:
+    """
+        Records latency values with a bounded relative error,
+        using a fixed number of buckets: recording a value is O(1)
+        and never allocates memory, so this can be used on every frame.
+        Values are recorded in microseconds.
+    """
+    cdef uint64_t counts[NBUCKETS]
+    cdef readonly uint64_t count
+    cdef readonly uint64_t total
+    cdef uint64_t min_value
+    cdef uint64_t max_value
+
+    def __cinit__(self):
+        self.reset()
+
+    def __repr__(self):
+        return "LatencyHistogram(%i values)" % self.count
+
+    def reset(self):
+        memset(self.counts, 0, NBUCKETS*sizeof(uint64_t))
+        self.count = 0
+        self.total = 0
+        self.min_value = 0
+        self.max_value = 0
+
+    cdef void add(self, uint64_t v) nogil:
+        if v>=(<uint64_t> 1 << MAX_VALUE_BITS):
+            v = (<uint64_t> 1 << MAX_VALUE_BITS)-1
+        self.counts[bucket_index(v)] += 1
+        if self.count==0 or v<self.min_value:
+            self.min_value = v
+        if v>self.max_value:
+            self.max_value = v
+        self.count += 1
+        self.total += v
+
+    def record(self, double elapsed):
+        """ record an elapsed time in seconds """
+        if elapsed<0:
+            elapsed = 0
+        self.add(<uint64_t> (elapsed*1000*1000))
+
+    def record_us(self, uint64_t value):
+        self.add(value)
+
+    def merge(self, LatencyHistogram other not None):
+        cdef unsigned int i
+        if other.count==0:
+            return
+        for i in range(NBUCKETS):
+            self.counts[i] += other.counts[i]
+        if self.count==0 or other.min_value<self.min_value:
+            self.min_value = other.min_value
+        if other.max_value>self.max_value:
+            self.max_value = other.max_value
+        self.count += other.count
+        self.total += other.total
+
+    def percentile(self, double pct):
+        """ returns the value in microseconds """
+        if self.count==0:
+            return 0
+        cdef uint64_t target = <uint64_t> (self.count*pct/100.0)
+        if target>=self.count:
+            target = self.count-1
+        cdef uint64_t seen = 0
+        cdef unsigned int i
+        for i in range(NBUCKETS):
+            seen += self.counts[i]
+            if seen>target:
+                return max(self.min_value, min(self.max_value, bucket_value(i)))
+        return self.max_value
+
+    def get_info(self):
+        if self.count==0:
+            return {"count" : 0}
+        return {
+            "count" : self.count,
+            "min"   : self.min_value,
+            "max"   : self.max_value,
+            "avg"   : self.total//self.count,
+            "50p"   : self.percentile(50),
+            "90p"   : self.percentile(90),
+            "99p"   : self.percentile(99),
+            }
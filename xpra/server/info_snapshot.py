@@ -0,0 +1,242 @@
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import threading
+from copy import deepcopy
+from threading import Lock, Event
+
+from xpra.util import envint, merge_dicts, notypedict
+from xpra.os_util import monotonic_time, LINUX
+from xpra.make_thread import start_thread
+from xpra.log import Logger
+
+log = Logger("server")
+
+#how long the information collected remains valid (in milliseconds):
+INFO_TTL = envint("XPRA_INFO_TTL", 2000)
+#the UI information is collected from the main thread, so we refresh it less often:
+INFO_UI_TTL = envint("XPRA_INFO_UI_TTL", 5000)
+#keep refreshing the snapshot for this long after the last request (in milliseconds):
+INFO_KEEPALIVE = envint("XPRA_INFO_KEEPALIVE", 10000)
+#how long to wait for the main thread to collect the UI information (in milliseconds):
+INFO_UI_WAIT = envint("XPRA_INFO_UI_WAIT", 5000)
+INFO_NICE = envint("XPRA_INFO_NICE", 10)
+
+
+class InfoSection:
+    __slots__ = ("name", "collect", "ttl", "ui", "value", "updated", "elapsed", "count")
+    def __init__(self, name, collect, ttl, ui):
+        self.name = name
+        self.collect = collect
+        self.ttl = ttl/1000
+        self.ui = ui
+        self.value = None
+        self.updated = 0
+        self.elapsed = 0
+        self.count = 0
+
+    def __repr__(self):
+        return "InfoSection(%s)" % self.name
+
+    def is_stale(self, now) -> bool:
+        return self.value is None or now-self.updated>=self.ttl
+
+
+def diff_info(old, new, path=()):
+    """
+        Returns the nested dictionary of the values which have changed,
+        and the paths of the keys which have been removed.
+    """
+    changed = {}
+    removed = []
+    for k, v in new.items():
+        ov = old.get(k, changed)
+        if isinstance(v, dict) and isinstance(ov, dict):
+            sub, subremoved = diff_info(ov, v, path+(k,))
+            if sub:
+                changed[k] = sub
+            removed += subremoved
+        elif ov is changed or ov!=v:
+            changed[k] = v
+    for k in old.keys():
+        if k not in new:
+            removed.append(path+(k,))
+    return changed, removed
+
+
+class InfoSnapshot:
+    """
+        Collecting the server information can take a long time on busy servers,
+        and part of it must be collected from the main thread.
+        Instead of collecting everything for each request,
+        the information is split into sections which are refreshed
+        by a low priority worker thread whenever their time to live expires.
+        Requests are answered straight away using the most recent snapshot,
+        and the worker keeps it up to date for as long as it is being requested.
+        The UI sections are collected using 'idle_add' and the worker waits for them.
+        Subscribers can ask for the changes since the last snapshot they received.
+    """
+
+    def __init__(self, idle_add, keepalive=INFO_KEEPALIVE):
+        self.idle_add = idle_add
+        self.keepalive = keepalive/1000
+        self.sections = []
+        self.lock = Lock()
+        self.wakeup = Event()
+        self.thread = None
+        self.closed = False
+        self.snapshot = None
+        self.snapshot_time = 0
+        self.last_request = 0
+        self.waiting = []
+        self.subscribers = {}
+        self.requests = 0
+        self.refreshes = 0
+
+    def __repr__(self):
+        return "InfoSnapshot(%s)" % self.sections
+
+    def add_section(self, name, collect, ttl=INFO_TTL, ui=False):
+        self.sections.append(InfoSection(name, collect, ttl, ui))
+
+    def get(self, callback):
+        """
+            Calls 'callback' with the most recent snapshot,
+            straight away unless this is the very first request.
+            The snapshot is shared and must not be modified.
+        """
+        with self.lock:
+            self.requests += 1
+            self.last_request = monotonic_time()
+            snapshot = self.snapshot
+            if snapshot is None:
+                self.waiting.append(callback)
+            if not self.thread and not self.closed:
+                self.thread = start_thread(self.run, "info-snapshot", daemon=True)
+        self.wakeup.set()
+        if snapshot is not None:
+            callback(snapshot)
+
+    def get_delta(self, subscriber, snapshot):
+        """
+            Returns the changes since the last snapshot given to this subscriber,
+            the first call returns the whole snapshot.
+        """
+        with self.lock:
+            last = self.subscribers.get(subscriber, {})
+            self.subscribers[subscriber] = snapshot
+        return diff_info(last, snapshot)
+
+    def remove_subscriber(self, subscriber):
+        with self.lock:
+            self.subscribers.pop(subscriber, None)
+
+    def run(self):
+        log("info snapshot thread starting")
+        #on Linux, the priority can be set for each thread:
+        if LINUX and INFO_NICE>0:
+            try:
+                os.setpriority(os.PRIO_PROCESS, threading.get_native_id(), INFO_NICE)
+            except (AttributeError, OSError):
+                log("cannot lower the priority of the info snapshot thread", exc_info=True)
+        while not self.closed:
+            now = monotonic_time()
+            if now-self.last_request>self.keepalive and self.snapshot is not None:
+                #no-one is asking, sleep until the next request:
+                self.wakeup.wait()
+                self.wakeup.clear()
+                continue
+            stale = [s for s in self.sections if s.is_stale(now)]
+            if stale:
+                for section in stale:
+                    if self.closed:
+                        return
+                    self.refresh(section)
+                self.publish()
+            now = monotonic_time()
+            delay = min((s.updated+s.ttl-now for s in self.sections), default=self.keepalive)
+            if delay>0:
+                self.wakeup.wait(delay)
+                self.wakeup.clear()
+        log("info snapshot thread ended")
+
+    def refresh(self, section):
+        start = monotonic_time()
+        try:
+            if section.ui:
+                value = self.collect_ui(section)
+            else:
+                value = section.collect()
+        except Exception:
+            log.error("Error collecting the '%s' information", section.name, exc_info=True)
+            value = None
+        end = monotonic_time()
+        log("refresh(%s) took %ims", section, (end-start)*1000)
+        #keep the previous value if the collection failed:
+        if value is not None:
+            section.value = notypedict(value)
+        elif section.value is None:
+            section.value = {}
+        section.updated = end
+        section.elapsed = end-start
+        section.count += 1
+        self.refreshes += 1
+
+    def collect_ui(self, section):
+        done = Event()
+        result = []
+        def collect():
+            try:
+                result.append(section.collect())
+            except Exception:
+                log.error("Error collecting the '%s' information", section.name, exc_info=True)
+            done.set()
+        self.idle_add(collect)
+        if not done.wait(INFO_UI_WAIT/1000):
+            log.warn("Warning: timeout collecting the '%s' information", section.name)
+            return None
+        return result[0] if result else None
+
+    def publish(self):
+        #the sections may share sub-dictionaries, so we merge copies:
+        snapshot = {}
+        for section in self.sections:
+            if section.value:
+                merge_dicts(snapshot, deepcopy(section.value))
+        with self.lock:
+            self.snapshot = snapshot
+            self.snapshot_time = monotonic_time()
+            waiting = self.waiting
+            self.waiting = []
+        for callback in waiting:
+            try:
+                callback(snapshot)
+            except Exception:
+                log.error("Error sending the info snapshot using %s", callback, exc_info=True)
+
+    def cleanup(self):
+        self.closed = True
+        self.wakeup.set()
+        with self.lock:
+            self.waiting = []
+            self.subscribers = {}
+
+    def get_info(self) -> dict:
+        now = monotonic_time()
+        info = {
+            "requests"      : self.requests,
+            "refreshes"     : self.refreshes,
+            "subscribers"   : len(self.subscribers),
+            "age"           : int(1000*(now-self.snapshot_time)) if self.snapshot_time else -1,
+            }
+        for s in self.sections:
+            info[s.name] = {
+                "ttl"       : int(s.ttl*1000),
+                "ui"        : s.ui,
+                "count"     : s.count,
+                "elapsed"   : int(s.elapsed*1000),
+                }
+        return info
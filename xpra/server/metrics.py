@@ -0,0 +1,291 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+from threading import Lock
+
+from xpra.os_util import monotonic_time
+from xpra.util import envint
+from xpra.codecs.codec_constants import PREFERRED_ENCODING_ORDER
+from xpra.log import Logger
+
+log = Logger("http")
+
+#only this many clients get their own label value, the others are aggregated:
+MAX_CLIENTS = envint("XPRA_METRICS_MAX_CLIENTS", 8)
+#re-use the same snapshot for scrapes arriving within this delay (in milliseconds):
+CACHE_TIME = envint("XPRA_METRICS_CACHE_TIME", 1000)
+#time period used for calculating rates (in seconds):
+RATE_PERIOD = envint("XPRA_METRICS_RATE_PERIOD", 5)
+
+OPENMETRICS_CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8"
+PROMETHEUS_CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8"
+
+#the encoding label is restricted to these values:
+ENCODINGS = frozenset(PREFERRED_ENCODING_ORDER + ("mmap", "void"))
+QUANTILES = (0.5, 0.9, 0.99)
+
+
+def escape_label(value) -> str:
+    return str(value).replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n")
+
+def format_value(value) -> str:
+    if isinstance(value, int):
+        return str(value)
+    return repr(float(value))
+
+def format_labels(labels) -> str:
+    if not labels:
+        return ""
+    return "{%s}" % ",".join("%s=\"%s\"" % (k, escape_label(v)) for k, v in labels)
+
+def encoding_label(encoding) -> str:
+    if encoding in ENCODINGS:
+        return encoding
+    return "other"
+
+
+class EncoderTotals:
+    """
+        The number of frames, pixels, compressed and uncompressed bytes
+        produced by each encoding, for the whole lifetime of the server.
+        Unlike the window statistics, these are never reset
+        or lost when a window or a client goes away,
+        so they can be exported as counters.
+    """
+
+    def __init__(self):
+        self.lock = Lock()
+        self.totals = {}
+
+    def add(self, encoding, pixels, size):
+        with self.lock:
+            totals = self.totals.get(encoding)
+            if totals is None:
+                totals = self.totals[encoding] = [0, 0, 0, 0]
+            totals[0] += 1
+            totals[1] += pixels
+            totals[2] += size
+            totals[3] += pixels*4
+
+    def get(self) -> dict:
+        with self.lock:
+            return dict((encoding, tuple(totals)) for encoding, totals in self.totals.items())
+
+
+encoder_totals = EncoderTotals()
+
+def get_encoder_totals():
+    return encoder_totals
+
+
+class Metrics:
+    """
+        Accumulates metric samples and renders them
+        in the OpenMetrics or Prometheus text exposition format.
+        Samples added more than once with the same labels are summed,
+        so callers can aggregate without keeping their own totals.
+    """
+
+    def __init__(self):
+        #name -> (type, help, {labels : value})
+        self.families = {}
+
+    def add(self, mtype, name, help_text, value, labels=()):
+        family = self.families.get(name)
+        if family is None:
+            family = self.families[name] = (mtype, help_text, {})
+        assert family[0]==mtype, "%s is a %s, not a %s" % (name, family[0], mtype)
+        samples = family[2]
+        key = tuple(labels)
+        samples[key] = samples.get(key, 0) + value
+
+    def gauge(self, name, help_text, value, **labels):
+        self.add("gauge", name, help_text, value, sorted(labels.items()))
+
+    def counter(self, name, help_text, value, **labels):
+        self.add("counter", name, help_text, value, sorted(labels.items()))
+
+    def summary(self, name, help_text, histogram, scale=1, **labels):
+        """
+            exports a LatencyHistogram,
+            the scale converts the histogram units to the metric units
+        """
+        if histogram.count==0:
+            return
+        labels = sorted(labels.items())
+        for q in QUANTILES:
+            qlabels = labels+[("quantile", str(q))]
+            self.add("summary", name, help_text, histogram.percentile(q*100)*scale, qlabels)
+        self.add("summary", name+"_sum", None, histogram.total*scale, labels)
+        self.add("summary", name+"_count", None, histogram.count, labels)
+
+    def render(self, openmetrics=True) -> str:
+        lines = []
+        for name, (mtype, help_text, samples) in self.families.items():
+            if help_text is None:
+                #"_sum" and "_count" belong to the summary family
+                continue
+            family_name = name
+            sample_name = name
+            if mtype=="counter":
+                sample_name = name+"_total"
+                if not openmetrics:
+                    family_name = sample_name
+            lines.append("# TYPE %s %s" % (family_name, mtype))
+            lines.append("# HELP %s %s" % (family_name, help_text))
+            for labels, value in samples.items():
+                lines.append("%s%s %s" % (sample_name, format_labels(labels), format_value(value)))
+            if mtype=="summary":
+                for suffix in ("_sum", "_count"):
+                    family = self.families.get(name+suffix)
+                    if family:
+                        for labels, value in family[2].items():
+                            lines.append("%s%s%s %s" % (name, suffix, format_labels(labels), format_value(value)))
+        if openmetrics:
+            lines.append("# EOF")
+        return "\n".join(lines)+"\n"
+
+
+def get_client_groups(sources) -> dict:
+    """
+        keeps the number of client label values bounded:
+        the oldest MAX_CLIENTS connections are labelled with their connection counter,
+        all the others are grouped under "other"
+    """
+    groups = {}
+    for i, ss in enumerate(sorted(sources, key=lambda ss : ss.counter)):
+        label = str(ss.counter) if i<MAX_CLIENTS else "other"
+        groups.setdefault(label, []).append(ss)
+    return groups
+
+
+def add_client_metrics(metrics, sources):
+    """
+        Reads the statistics directly from the client and window sources,
+        without going through get_info().
+    """
+    from xpra.server.cystats import LatencyHistogram   #@UnresolvedImport
+    from xpra.server.window.pipeline_trace import PIPELINE_STAGES
+    now = monotonic_time()
+    metrics.gauge("xpra_clients", "Number of clients connected", len(sources))
+    for client, group in get_client_groups(sources).items():
+        pipeline = dict((stage, LatencyHistogram()) for stage in PIPELINE_STAGES)
+        delays = []
+        for ss in group:
+            add_connection_metrics(metrics, client, ss, now)
+            window_sources = tuple(getattr(ss, "window_sources", {}).values())
+            metrics.gauge("xpra_windows", "Number of windows forwarded", len(window_sources), client=client)
+            for ws in window_sources:
+                stats = ws.statistics
+                for stage, h in tuple(stats.stage_latency.items()):
+                    pipeline[stage].merge(h)
+                metrics.gauge("xpra_encoder_fps", "Frames encoded during the last second",
+                              stats.encoding_stats.count_since(now-1), client=client)
+                batch_config = getattr(ws, "batch_config", None)
+                if batch_config:
+                    delays.append(batch_config.delay)
+        if delays:
+            metrics.gauge("xpra_batch_delay_seconds", "Average batch delay of all the windows",
+                          sum(delays)/len(delays)/1000, client=client)
+            metrics.gauge("xpra_batch_delay_max_seconds", "Highest batch delay of all the windows",
+                          max(delays)/1000, client=client)
+        for stage, h in pipeline.items():
+            metrics.summary("xpra_pipeline_latency_seconds", "Damage pipeline latency for each stage",
+                            h, scale=1/1000/1000, client=client, stage=stage)
+
+
+def add_encoder_metrics(metrics, totals):
+    """
+        The encoder counters are server wide totals,
+        the window statistics cannot be used for those since they go down
+        whenever a window is reset or closed.
+    """
+    for encoding, values in totals.get().items():
+        encoding = encoding_label(encoding)
+        metrics.counter("xpra_encoder_frames", "Frames encoded",
+                        values[0], encoding=encoding)
+        metrics.counter("xpra_encoder_pixels", "Pixels encoded",
+                        values[1], encoding=encoding)
+        metrics.counter("xpra_encoder_bytes", "Bytes produced by the encoders",
+                        values[2], encoding=encoding)
+        metrics.counter("xpra_encoder_raw_bytes", "Uncompressed bytes submitted to the encoders",
+                        values[3], encoding=encoding)
+    add_compression_ratios(metrics)
+
+
+def add_compression_ratios(metrics):
+    #derived from the per-encoding byte counters, so the labels are the same:
+    family = metrics.families.get("xpra_encoder_raw_bytes")
+    if not family:
+        return
+    compressed = metrics.families["xpra_encoder_bytes"][2]
+    for labels, raw in family[2].items():
+        if raw>0:
+            metrics.add("gauge", "xpra_compression_ratio", "Compressed bytes divided by uncompressed bytes",
+                        compressed.get(labels, 0)/raw, labels)
+
+
+def add_connection_metrics(metrics, client, ss, now):
+    stats = getattr(ss, "statistics", None)
+    conn = getattr(getattr(ss, "protocol", None), "_conn", None)
+    if conn:
+        metrics.counter("xpra_sent_bytes", "Bytes sent to the client",
+                        conn.output_bytecount, client=client)
+        metrics.counter("xpra_received_bytes", "Bytes received from the client",
+                        conn.input_bytecount, client=client)
+    if stats:
+        #the bytes_sent records are cumulative byte counts:
+        records = stats.bytes_sent.records(now-RATE_PERIOD)
+        bandwidth = 0
+        if len(records)>=2 and records[-1][0]>records[0][0]:
+            bandwidth = (records[-1][1]-records[0][1])/(records[-1][0]-records[0][0])
+        metrics.gauge("xpra_bandwidth_bytes_per_second", "Bandwidth used by the client connection",
+                      bandwidth, client=client)
+        metrics.gauge("xpra_mmap_size_bytes", "Size of the mmap area",
+                      stats.mmap_size, client=client)
+        metrics.gauge("xpra_mmap_free_bytes", "Free space in the mmap area",
+                      stats.mmap_free_size, client=client)
+        metrics.counter("xpra_mmap_sent_bytes", "Bytes sent using the mmap area",
+                        stats.mmap_bytes_sent, client=client)
+    bandwidth_limit = getattr(ss, "bandwidth_limit", 0)
+    metrics.gauge("xpra_bandwidth_limit_bytes_per_second", "Bandwidth limit for the client connection (0 for none)",
+                  (bandwidth_limit or 0)//8, client=client)
+    packet_queue = getattr(ss, "packet_queue", None)
+    if packet_queue is not None:
+        metrics.gauge("xpra_packet_queue_depth", "Packets waiting to be sent",
+                      len(packet_queue), client=client)
+    if hasattr(ss, "encode_queue_size"):
+        metrics.gauge("xpra_encode_queue_depth", "Items waiting in the encode queue",
+                      ss.encode_queue_size(), client=client)
+
+
+class MetricsExporter:
+    """
+        Caches the rendered metrics for CACHE_TIME,
+        so that frequent or concurrent scrapes only collect them once.
+    """
+
+    def __init__(self, collect):
+        self.collect = collect
+        self.lock = Lock()
+        self.cache = {}
+
+    def get_metrics(self, openmetrics=True) -> str:
+        with self.lock:
+            now = monotonic_time()
+            cached = self.cache.get(openmetrics)
+            if cached and now-cached[0]<CACHE_TIME/1000:
+                return cached[1]
+            metrics = Metrics()
+            self.collect(metrics)
+            text = metrics.render(openmetrics)
+            self.cache[openmetrics] = (now, text)
+            log("get_metrics(%s) collected %i metric families", openmetrics, len(metrics.families))
+            return text
+
+
+def accepts_openmetrics(accept) -> bool:
+    return "application/openmetrics-text" in (accept or "")
@@ -7,9 +7,11 @@
 
 from xpra.scripts.config import parse_bool_or_int
 from xpra.codecs.codec_constants import PREFERRED_ENCODING_ORDER
-from xpra.codecs.loader import get_codec, has_codec, codec_versions, load_codec
+from xpra.codecs.loader import get_codec, has_codec, codec_versions, load_codec, load_codec_list, get_codec_timings
 from xpra.codecs.video_helper import getVideoHelper
+from xpra.make_thread import start_thread
 from xpra.server.mixins.stub_server_mixin import StubServerMixin
+from xpra.server.window.shared_encodings import shared_encodings
 from xpra.log import Logger
 
 log = Logger("encoding")
@@ -51,19 +53,25 @@ class EncodingServer(StubServerMixin):
         self.init_encodings()
 
     def threaded_setup(self):
-        #load video codecs:
-        getVideoHelper().init()
-        #and load the picture codecs:
-        load_codec("enc_pillow")
+        #load the picture codecs:
+        names = ["enc_pillow"]
         ae = self.allowed_encodings
         if "jpeg" in ae:
             #try to load the fast jpeg encoders:
-            load_codec("enc_jpeg")
-            load_codec("enc_nvjpeg")
+            names += ["enc_jpeg", "enc_nvjpeg"]
         if "webp" in ae:
             #try to load the fast webp encoder:
-            load_codec("enc_webp")
+            names.append("enc_webp")
+        if "palette" in ae:
+            names.append("enc_palette")
+        #and the video encoders at the same time, so the self tests all run in parallel:
+        vh = getVideoHelper()
+        load_codec_list(*(names+vh.get_encoder_codec_names()))
+        vh.init()
         self.init_encodings()
+        #load the csc modules in the background,
+        #so they are ready by the time a client needs a video pipeline:
+        start_thread(vh.init_csc, "init-csc", daemon=True)
 
     def cleanup(self):
         getVideoHelper().cleanup()
@@ -78,6 +86,7 @@ class EncodingServer(StubServerMixin):
         info = {
             "encodings" : self.get_encoding_info(),
             "video"     : getVideoHelper().get_info(),
+            "codec-load": get_codec_timings(),
             }
         for k,v in codec_versions.items():
             info.setdefault("encoding", {}).setdefault(k, {})["version"] = v
@@ -94,10 +103,11 @@ class EncodingServer(StubServerMixin):
                                                     "h264", "vp8", "vp9",
                                                     "rgb24", "rgb32",
                                                     "png", "png/P", "png/L", "webp",
-                                                    "scroll",
+                                                    "scroll", "palette",
                                                     ))),
              "with_quality"         : [x for x in self.core_encodings if x in ("jpeg", "webp", "h264", "vp8", "vp9", "scroll")],
              "with_lossless_mode"   : self.lossless_mode_encodings,
+             "shared"               : shared_encodings.get_info(),
              }
 
     def init_encodings(self):
@@ -139,6 +149,8 @@ class EncodingServer(StubServerMixin):
                 add_encodings(["webp"])
                 if "webp" not in self.lossless_mode_encodings:
                     self.lossless_mode_encodings.append("webp")
+        if has_codec("enc_palette"):
+            add_encodings(["palette"])
         #look for video encodings with lossless mode:
         for e in ve:
             for colorspace,especs in getVideoHelper().get_encoder_specs(e).items():
@@ -153,7 +165,7 @@ class EncodingServer(StubServerMixin):
         self.encodings = encs
         self.core_encodings = core_encs
         self.lossless_encodings = [x for x in self.core_encodings
-                                   if (x.startswith("png") or x.startswith("rgb") or x=="webp")]
+                                   if (x.startswith("png") or x.startswith("rgb") or x in ("webp", "palette"))]
         log("allowed encodings=%s, encodings=%s, core encodings=%s, lossless encodings=%s",
             self.allowed_encodings, encs, core_encs, self.lossless_encodings)
         pref = [x for x in PREFERRED_ENCODING_ORDER if x in self.encodings]
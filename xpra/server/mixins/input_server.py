@@ -6,14 +6,21 @@
 # later version. See the file COPYING for details.
 #pylint: disable-msg=E1101
 
+from collections import deque
+
 from xpra.os_util import monotonic_time, bytestostr
-from xpra.util import typedict
+from xpra.util import typedict, envbool
 from xpra.server.mixins.stub_server_mixin import StubServerMixin
 from xpra.log import Logger
 
 keylog = Logger("keyboard")
 mouselog = Logger("mouse")
 
+#only inject the most recent pointer position received
+#for each device since the last main loop iteration:
+COALESCE_POINTER_MOTION = envbool("XPRA_COALESCE_POINTER_MOTION", True)
+
+
 class InputServer(StubServerMixin):
     """
     Mixin for servers that handle input devices
@@ -38,6 +45,16 @@ class InputServer(StubServerMixin):
         self.keys_timedout = {}
         #timers for cancelling key repeat when we get jitter
         self.key_repeat_timer = None
+        #(proto, deviceid) -> (time received, packet)
+        self.pending_pointer_motion = {}
+        self.pointer_motion_timer = None
+        self.pointer_motion_received = 0
+        self.pointer_motion_injected = 0
+        #the time spent waiting in the queue:
+        self.pointer_motion_delay = deque(maxlen=100)
+        #from the last injection to the first damage event that follows it:
+        self.last_input_injected = 0
+        self.input_damage_latency = deque(maxlen=100)
 
     def setup(self):
         self.watch_keymap_changes()
@@ -45,6 +62,8 @@ class InputServer(StubServerMixin):
     def cleanup(self):
         self.clear_keys_pressed()
         self.keyboard_config = None
+        self.cancel_pointer_motion_timer()
+        self.pending_pointer_motion = {}
 
     def reset_focus(self):
         self.clear_keys_pressed()
@@ -53,7 +72,25 @@ class InputServer(StubServerMixin):
         self.clear_keys_pressed()
 
     def get_info(self, _proto):
-        return {"keyboard" : self.get_keyboard_info()}
+        return {
+            "keyboard"  : self.get_keyboard_info(),
+            "pointer"   : self.get_pointer_info(),
+            }
+
+    def get_pointer_info(self) -> dict:
+        from xpra.simple_stats import get_list_stats
+        info = {
+            "coalesce"  : COALESCE_POINTER_MOTION,
+            "received"  : self.pointer_motion_received,
+            "injected"  : self.pointer_motion_injected,
+            }
+        for k, values in {
+            "queue-delay"       : self.pointer_motion_delay,
+            "damage-latency"    : self.input_damage_latency,
+            }.items():
+            if values:
+                info[k] = get_list_stats(tuple(int(v*1000) for v in values))
+        return info
 
     def get_server_features(self, _source=None):
         return {
@@ -148,6 +185,7 @@ class InputServer(StubServerMixin):
     def _process_key_action(self, proto, packet):
         if self.readonly:
             return
+        self.flush_pointer_motion()
         wid, keyname, pressed, modifiers, keyval, keystr, client_keycode, group = packet[1:9]
         ss = self.get_server_source(proto)
         if ss is None:
@@ -361,11 +399,22 @@ class InputServer(StubServerMixin):
             return
         ss.user_event()
         self.set_ui_driver(ss)
+        #the click must be injected after the motion that preceded it:
+        self.flush_pointer_motion()
         self.do_process_button_action(proto, *packet[1:])
+        self.last_input_injected = monotonic_time()
 
     def do_process_button_action(self, proto, wid, button, pressed, pointer, modifiers, *args):
         pass
 
+    def _process_wheel_motion(self, proto, packet):
+        #the wheel motion must be injected after the pointer motion that preceded it:
+        self.flush_pointer_motion()
+        self.do_process_wheel_motion(proto, *packet[1:7])
+
+    def do_process_wheel_motion(self, proto, wid, button, distance, pointer, modifiers, buttons):
+        pass
+
 
     def _update_modifiers(self, proto, wid, modifiers):
         pass
@@ -386,8 +435,64 @@ class InputServer(StubServerMixin):
         if self.ui_driver and self.ui_driver!=ss.uuid:
             return
         ss.user_event()
-        if self._process_mouse_common(proto, wid, pdata, *packet[5:]):
-            self._update_modifiers(proto, wid, modifiers)
+        self.pointer_motion_received += 1
+        if not COALESCE_POINTER_MOTION:
+            self.inject_pointer_motion(((monotonic_time(), proto, packet), ))
+            return
+        deviceid = packet[5] if len(packet)>=6 else -1
+        key = (proto, deviceid)
+        pending = self.pending_pointer_motion.get(key)
+        #keep the time the first event was received, so the delay accounts for all of them:
+        received = pending[0] if pending else monotonic_time()
+        self.pending_pointer_motion[key] = (received, proto, packet)
+        if not self.pointer_motion_timer:
+            #runs after all the packets already queued in the main loop:
+            self.pointer_motion_timer = self.idle_add(self.pointer_motion_timer_fired)
+
+    def cancel_pointer_motion_timer(self):
+        pmt = self.pointer_motion_timer
+        if pmt:
+            self.pointer_motion_timer = None
+            self.source_remove(pmt)
+
+    def pointer_motion_timer_fired(self):
+        self.pointer_motion_timer = None
+        self.flush_pointer_motion()
+        return False
+
+    def flush_pointer_motion(self):
+        self.cancel_pointer_motion_timer()
+        pending = self.pending_pointer_motion
+        if pending:
+            self.pending_pointer_motion = {}
+            self.inject_pointer_motion(tuple(pending.values()))
+
+    def inject_pointer_motion(self, events):
+        """
+            subclasses may override this method
+            to inject all the events as a single batch
+        """
+        now = monotonic_time()
+        for received, proto, packet in events:
+            #the connection may have gone since:
+            if proto not in self._server_sources:
+                continue
+            self.pointer_motion_delay.append(now-received)
+            self.pointer_motion_injected += 1
+            wid, pdata, modifiers = packet[1:4]
+            if self._process_mouse_common(proto, wid, pdata, *packet[5:]):
+                self._update_modifiers(proto, wid, modifiers)
+        self.last_input_injected = monotonic_time()
+
+    def record_input_damage(self):
+        #measure how long it takes for input to produce screen updates:
+        lii = self.last_input_injected
+        if lii:
+            self.last_input_injected = 0
+            elapsed = monotonic_time()-lii
+            #damage this late is unlikely to have been caused by the input:
+            if elapsed<1:
+                self.input_damage_latency.append(elapsed)
 
 
     ######################################################################
@@ -12,6 +12,8 @@ from xpra.os_util import load_binary_file, bytestostr, strtobytes
 from xpra.simple_stats import std_unit
 from xpra.scripts.config import parse_bool, FALSE_OPTIONS, TRUE_OPTIONS
 from xpra.server.control_command import ArgsControlCommand, ControlError
+from xpra.server.window.pipeline_trace import get_pipeline_trace
+from xpra.server.window.damage_trace import get_damage_trace
 from xpra.server.mixins.stub_server_mixin import StubServerMixin
 from xpra.log import Logger
 
@@ -106,6 +108,8 @@ class ServerBaseControlCommands(StubServerMixin):
             ArgsControlCommand("reset-video-region",    "reset video region heuristics",    min_args=1, max_args=1, validation=[int]),
             ArgsControlCommand("lock-batch-delay",      "set a specific batch delay for a window",       min_args=2, max_args=2, validation=[int, int]),
             ArgsControlCommand("unlock-batch-delay",    "let the heuristics calculate the batch delay again for a window (following a 'lock-batch-delay')",  min_args=1, max_args=1, validation=[int]),
+            ArgsControlCommand("pipeline-trace",        "record the damage pipeline of all windows to a chrome trace file: 'start [SECONDS] [FILENAME]' or 'stop'", min_args=1, max_args=3, validation=[str, int, str]),
+            ArgsControlCommand("damage-trace",          "record the damage events of all windows to a trace file: 'start [FILENAME] [pixels]' or 'stop'", min_args=1, max_args=3, validation=[str, str, str]),
             ArgsControlCommand("remove-window-filters", "remove all window filters",        min_args=0, max_args=0),
             ArgsControlCommand("add-window-filter",     "add a window filter",              min_args=4, max_args=5),
             ):
@@ -575,6 +579,50 @@ class ServerBaseControlCommands(StubServerMixin):
         for ws in self._control_windowsources_from_args(wid).keys():
             ws.unlock_batch_delay()
 
+    def control_command_pipeline_trace(self, action, duration=10, filename=None):
+        pipeline_trace = get_pipeline_trace()
+        if action=="start":
+            if pipeline_trace.is_active():
+                raise ControlError("a pipeline trace is already being recorded to '%s'" % pipeline_trace.filename)
+            if duration<=0:
+                raise ControlError("invalid trace duration: %i" % duration)
+            try:
+                filename = pipeline_trace.start(duration, filename)
+            except OSError as e:
+                raise ControlError("failed to create the trace file: %s" % e) from None
+            started = pipeline_trace.start_time
+            def stop_trace():
+                #unless it has been stopped and restarted since:
+                if pipeline_trace.start_time==started:
+                    pipeline_trace.stop()
+            self.timeout_add(duration*1000, stop_trace)
+            return "recording the damage pipeline for %i seconds to '%s'" % (duration, filename)
+        if action=="stop":
+            filename = pipeline_trace.stop()
+            if not filename:
+                raise ControlError("no pipeline trace is being recorded")
+            return "pipeline trace saved to '%s'" % filename
+        raise ControlError("invalid action '%s', must be 'start' or 'stop'" % action)
+
+    def control_command_damage_trace(self, action, filename=None, pixels=None):
+        damage_trace = get_damage_trace()
+        if action=="start":
+            if damage_trace.recording:
+                raise ControlError("a damage trace is already being recorded to '%s'" % damage_trace.filename)
+            if pixels not in (None, "pixels"):
+                raise ControlError("invalid option '%s', only 'pixels' is supported" % pixels)
+            try:
+                filename = damage_trace.start(filename, pixels=bool(pixels))
+            except OSError as e:
+                raise ControlError("failed to create the trace file: %s" % e) from None
+            return "recording damage events%s to '%s'" % (" and pixels" if pixels else "", filename)
+        if action=="stop":
+            filename = damage_trace.stop()
+            if not filename:
+                raise ControlError("no damage trace is being recorded")
+            return "damage trace saved to '%s'" % filename
+        raise ControlError("invalid action '%s', must be 'start' or 'stop'" % action)
+
     def control_command_set_lock(self, lock):
         self.lock = parse_bool("lock", lock)
         self.setting_changed("lock", lock is not False)
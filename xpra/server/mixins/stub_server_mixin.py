@@ -34,6 +34,12 @@ class StubServerMixin:
         Called when we reset the focus.
         """
 
+    def record_input_damage(self):
+        """
+        Called when the screen contents have changed,
+        so the input latency can be measured.
+        """
+
     def last_client_exited(self):
         """
         Called when the last client has exited,
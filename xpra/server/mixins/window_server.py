@@ -5,9 +5,11 @@
 # later version. See the file COPYING for details.
 #pylint: disable-msg=E1101
 
-from xpra.util import typedict
+from xpra.util import typedict, envint
 from xpra.server.mixins.stub_server_mixin import StubServerMixin
 from xpra.server.source.windows_mixin import WindowsMixin
+from xpra.server.window.pipeline_trace import get_pipeline_trace
+from xpra.server.window.damage_trace import get_damage_trace
 from xpra.log import Logger
 
 log = Logger("window")
@@ -16,6 +18,9 @@ metalog = Logger("metadata")
 geomlog = Logger("geometry")
 eventslog = Logger("events")
 
+#clipping against more visible regions than this costs more than it saves:
+MAX_VISIBLE_REGIONS = envint("XPRA_MAX_VISIBLE_REGIONS", 64)
+
 def noop(*_args):
     pass
 
@@ -70,6 +75,7 @@ class WindowServer(StubServerMixin):
         return {
             "window_refresh_config" : True,     #v4 clients assume this is available
             "window-filters"        : True,     #v4 clients assume this is available
+            "window.visibility"     : True,
             }
 
     def get_info(self, _proto) -> dict:
@@ -78,6 +84,8 @@ class WindowServer(StubServerMixin):
                 "windows" : sum(int(window.is_managed()) for window in tuple(self._id_to_window.values())),
                 },
             "filters" : tuple((uuid,repr(f)) for uuid, f in self.window_filters),
+            "pipeline-trace" : get_pipeline_trace().get_info(),
+            "damage-trace"   : get_damage_trace().get_info(),
             }
 
     def get_ui_info(self, _proto, _client_uuids=None, wids=None, *_args) -> dict:
@@ -284,6 +292,9 @@ class WindowServer(StubServerMixin):
         if options.get("refresh-now", True):
             refresh_opts = {"quality"           : qual,
                             "override_options"  : True}
+            if options.boolget("full-size"):
+                #don't downscale this refresh:
+                refresh_opts["full-size"] = True
             self._refresh_windows(proto, wid_windows, refresh_opts)
 
 
@@ -367,6 +378,21 @@ class WindowServer(StubServerMixin):
         if ss:
             ss.resume(ui, wd)
 
+    def _process_window_visibility(self, proto, packet):
+        wid = packet[1]
+        regions = packet[2]
+        if regions is not None and len(regions)>MAX_VISIBLE_REGIONS:
+            #treat the whole window as visible:
+            eventslog("window-visibility(%i, ..) too many regions: %i", wid, len(regions))
+            regions = None
+        if regions is not None:
+            regions = tuple(tuple(int(v) for v in r[:4]) for r in regions)
+        eventslog("window-visibility(%i, %s)", wid, regions)
+        window = self._id_to_window.get(wid)
+        ss = self.get_server_source(proto)
+        if ss and window:
+            ss.set_window_visibility(wid, window, regions)
+
 
     def send_initial_windows(self, ss, sharing=False):
         raise NotImplementedError()
@@ -415,4 +441,5 @@ class WindowServer(StubServerMixin):
             "buffer-refresh" :      self._process_buffer_refresh,
             "suspend" :             self._process_suspend,
             "resume" :              self._process_resume,
+            "window-visibility" :   self._process_window_visibility,
             })
@@ -8,6 +8,7 @@ from xpra.net import compression
 from xpra.codecs.loader import get_codec
 from xpra.util import envbool, first_time
 from xpra.codecs.rgb_transform import rgb_reformat
+from xpra.buffers.cyxor import and_mask  #@UnresolvedImport
 from xpra.os_util import memoryview_to_bytes, bytestostr, monotonic_time
 from xpra.log import Logger
 
@@ -44,7 +45,8 @@ def webp_encode(image, supports_transparency, quality, speed, content_type):
     raise Exception("BUG: cannot use 'webp' encoding and none of the PIL fallbacks are available!")
 
 
-def rgb_encode(coding, image, rgb_formats, supports_transparency, speed, rgb_zlib=True, rgb_lz4=True, rgb_lzo=False):
+def rgb_encode(coding, image, rgb_formats, supports_transparency, speed, rgb_zlib=True, rgb_lz4=True, rgb_lzo=False,
+               delta_store=None, refine_mask=None):
     pixel_format = bytestostr(image.get_pixel_format())
     #log("rgb_encode%s pixel_format=%s, rgb_formats=%s",
     #    (coding, image, rgb_formats, supports_transparency, speed, rgb_zlib, rgb_lz4), pixel_format, rgb_formats)
@@ -71,6 +73,9 @@ def rgb_encode(coding, image, rgb_formats, supports_transparency, speed, rgb_zli
     #compress here and return a wrapper so network code knows it is already zlib compressed:
     pixels = image.get_pixels()
     assert pixels, "failed to get pixels from %s" % image
+    if refine_mask not in (None, 0xff):
+        #progressive refresh: only send the most significant bits for now
+        pixels = and_mask(pixels, refine_mask)
     width = image.get_width()
     height = image.get_height()
     stride = image.get_rowstride()
@@ -87,6 +92,14 @@ def rgb_encode(coding, image, rgb_formats, supports_transparency, speed, rgb_zli
             #fewer pixels, make it more likely we won't bother compressing
             #and use a lower level (max=5)
             level = max(0, min(5, int(115-speed)//20))
+    if level>0 and delta_store:
+        #xor against the last pixels sent for this region, if we have them:
+        key = (image.get_target_x(), image.get_target_y(), width, height, pixel_format, stride)
+        #the progressive refresh layers must be sent as residuals,
+        #even when all the pixels have changed:
+        max_changed = None if refine_mask is None else 100
+        pixels, delta_options = delta_store.delta(key, pixels, max_changed)
+        options.update(delta_options)
     if level>0:
         cwrapper = compression.compressed_wrapper(coding, pixels, level=level,
                                                   zlib=rgb_zlib, lz4=rgb_lz4, lzo=rgb_lzo,
@@ -118,6 +131,50 @@ def rgb_encode(coding, image, rgb_formats, supports_transparency, speed, rgb_zli
     return coding, cwrapper, options, width, height, stride, bpp
 
 
+def palette_encode(image, palette, rgb_formats, supports_transparency, rgb_lz4=True):
+    """
+        Returns None if the image has too many colours for a palette,
+        or if there is no 32 bits per pixel rgb format we can use.
+    """
+    enc_palette = get_codec("enc_palette")
+    assert enc_palette, "palette encoder is not available"
+    pixel_format = bytestostr(image.get_pixel_format())
+    if len(pixel_format)!=4 or pixel_format.strip("RGBXA")!="":
+        return None
+    #only the palette entries need to be converted to the client's format:
+    rgb_format = pixel_format
+    if pixel_format not in rgb_formats:
+        formats = [x for x in rgb_formats if len(x)==4 and set(x)>=set("RGB")]
+        if supports_transparency and pixel_format.find("A")>=0:
+            formats = sorted(formats, key=lambda x : x.find("A")<0)
+        if not formats:
+            return None
+        rgb_format = formats[0]
+    r = enc_palette.encode(image, palette, rgb_format)
+    if not r:
+        return None
+    data, options = r
+    #the tokens are stored uncompressed:
+    algo = "none"
+    if rgb_lz4 and len(data)>=512:
+        cwrapper = compression.compressed_wrapper("palette", data, level=1,
+                                                  zlib=False, lz4=True, lzo=False,
+                                                  brotli=False, none=True)
+        algo = cwrapper.algorithm
+        if algo!="none" and len(cwrapper)<len(data)-32:
+            options[algo] = 1
+            cwrapper.level = 0
+        else:
+            algo = "none"
+    if algo=="none":
+        cwrapper = compression.Compressed("palette", data, True)
+    width = image.get_width()
+    height = image.get_height()
+    log("palette_encode %4sx%-4s from %s to %s using %s: %i colours, %5i bytes",
+        width, height, pixel_format, rgb_format, algo, options.get("colours"), len(cwrapper.data))
+    return "palette", cwrapper, options, width, height, width*4, 32
+
+
 def mmap_send(mmap, mmap_size, image, rgb_formats, supports_transparency):
     if mmap_write is None:
         if first_time("mmap_write missing"):
@@ -26,6 +26,7 @@ from xpra.child_reaper import getChildReaper
 from xpra.scripts.parsing import parse_bool
 from xpra.scripts.config import make_defaults_struct, PROXY_START_OVERRIDABLE_OPTIONS, OPTION_TYPES
 from xpra.scripts.main import parse_display_name, connect_to, start_server_subprocess
+from xpra.server.proxy.session_pool import SessionPool
 from xpra.make_thread import start_thread
 from xpra.log import Logger
 
@@ -46,6 +47,11 @@ PROXY_INSTANCE_THREADED = envbool("XPRA_PROXY_INSTANCE_THREADED", WIN32)
 PROXY_CLEANUP_GRACE_PERIOD = envfloat("XPRA_PROXY_CLEANUP_GRACE_PERIOD", "0.5")
 
 MAX_CONCURRENT_CONNECTIONS = envint("XPRA_PROXY_MAX_CONCURRENT_CONNECTIONS", 200)
+#number of idle sessions to keep ready for each user:
+SESSION_POOL = envint("XPRA_PROXY_SESSION_POOL", 0)
+SESSION_POOL_MODE = os.environ.get("XPRA_PROXY_SESSION_POOL_MODE", "start")
+#users to start the spare sessions for when the proxy starts, ie: "1000:1000,1001:1001"
+SESSION_POOL_USERS = os.environ.get("XPRA_PROXY_SESSION_POOL_USERS", "")
 if WIN32:
     #DEFAULT_ENV_WHITELIST = "ALLUSERSPROFILE,APPDATA,COMMONPROGRAMFILES,COMMONPROGRAMFILES(X86),COMMONPROGRAMW6432,COMPUTERNAME,COMSPEC,FP_NO_HOST_CHECK,LOCALAPPDATA,NUMBER_OF_PROCESSORS,OS,PATH,PATHEXT,PROCESSOR_ARCHITECTURE,PROCESSOR_ARCHITECTURE,PROCESSOR_IDENTIFIER,PROCESSOR_LEVEL,PROCESSOR_REVISION,PROGRAMDATA,PROGRAMFILES,PROGRAMFILES(X86),PROGRAMW6432,PSMODULEPATH,PUBLIC,SYSTEMDRIVE,SYSTEMROOT,TEMP,TMP,USERDOMAIN,WORKGROUP,USERNAME,USERPROFILE,WINDIR,XPRA_REDIRECT_OUTPUT,XPRA_LOG_FILENAME,XPRA_ALL_DEBUG"
     DEFAULT_ENV_WHITELIST = "*"
@@ -86,6 +92,7 @@ class ProxyServer(ServerCore):
         #the display they're on and the message queue we can
         # use to communicate with them
         self.instances = {}
+        self.session_pool = None
         #connections used exclusively for requests:
         self._requests = set()
         self.idle_add = GLib.idle_add
@@ -106,6 +113,8 @@ class ProxyServer(ServerCore):
         get_platform_info()
         self.child_reaper = getChildReaper()
         self.create_system_dir(opts.system_proxy_socket)
+        if self._start_sessions and SESSION_POOL>0:
+            self.session_pool = SessionPool(SESSION_POOL, self.start_spare_session, SESSION_POOL_MODE)
 
     def create_system_dir(self, sps):
         if not POSIX or OSX or not sps:
@@ -184,6 +193,8 @@ class ProxyServer(ServerCore):
         pass
 
     def do_run(self):
+        if self.session_pool:
+            self.idle_add(self.fill_session_pool)
         self.main_loop = GLib.MainLoop()
         self.main_loop.run()
 
@@ -233,6 +244,10 @@ class ProxyServer(ServerCore):
 
 
     def cleanup(self):
+        sp = self.session_pool
+        if sp:
+            self.session_pool = None
+            sp.cleanup()
         self.stop_all_proxies()
         super().cleanup()
         start = monotonic_time()
@@ -564,16 +579,22 @@ class ProxyServer(ServerCore):
         display = sns.get("display")
         if display in displays:
             raise Exception("display %s is already active!" % display)
+        overrides = dict((bytestostr(k), v) for k,v in sns.items() if bytestostr(k)!="mode")
+        sp = self.session_pool
+        if sp and sp.can_use(mode, overrides):
+            session = sp.take(username, uid, gid)
+            if session:
+                log("start_new_session(..) using spare session %s", session)
+                return session
         log("starting new server subprocess: mode=%s, display=%s", mode, display)
         args = []
         if display:
             args = [display]
         #allow the client to override some options:
         opts = make_defaults_struct(username=username, uid=uid, gid=gid)
-        for k,v in sns.items():
-            k = bytestostr(k)
-            if k in ("mode", "display"):
-                continue    #those special attributes have been consumed already
+        for k,v in overrides.items():
+            if k=="display":
+                continue    #this special attribute has been consumed already
             if k not in PROXY_START_OVERRIDABLE_OPTIONS:
                 log.warn("Warning: ignoring invalid start override")
                 log.warn(" %s=%s", k, v)
@@ -602,6 +623,33 @@ class ProxyServer(ServerCore):
                     log("start override: %24s=%-24s (unchanged)", k, v)
             else:
                 log("start override: %24s=%-24s (invalid, unchanged)", k, v)
+        return self.start_server_subprocess(username, uid, gid, mode, args, opts)
+
+    def start_spare_session(self, username, uid, gid):
+        opts = make_defaults_struct(username=username, uid=uid, gid=gid)
+        return self.start_server_subprocess(username, uid, gid, self.session_pool.mode, [], opts)
+
+    def fill_session_pool(self):
+        users = set()
+        for user in SESSION_POOL_USERS.split(","):
+            if not user:
+                continue
+            try:
+                uid, gid = (int(x) for x in user.split(":", 1))
+            except ValueError:
+                log.warn("Warning: invalid session pool user '%s'", user)
+                log.warn(" use the format uid:gid")
+                continue
+            users.add((uid, gid))
+        if POSIX and getuid()!=0:
+            users = set(((getuid(), getgid()), ))
+        for uid, gid in users:
+            if POSIX and (uid==0 or gid==0):
+                log.warn("Warning: cannot start spare sessions as root")
+                continue
+            self.session_pool.fill(get_username_for_uid(uid), uid, gid)
+
+    def start_server_subprocess(self, username, uid, gid, mode, args, opts):
         opts.attach = False
         opts.start_via_proxy = False
         env = self.get_proxy_env()
@@ -619,7 +667,7 @@ class ProxyServer(ServerCore):
                                                              mode, opts, username, uid, gid, env, cwd)
         if proc:
             self.child_reaper.add_process(proc, "server-%s" % (display or socket_path), "xpra %s" % mode, True, True)
-        log("start_new_session(..) pid=%s, socket_path=%s, display=%s, ", proc.pid, socket_path, display)
+        log("start_server_subprocess(..) pid=%s, socket_path=%s, display=%s, ", proc.pid, socket_path, display)
         return proc, socket_path, display
 
     def get_proxy_env(self):
@@ -684,4 +732,7 @@ class ProxyServer(ServerCore):
                         i += 1
                     info["instances"] = instances_info
                     info["proxies"] = len(instances)
+                    sp = self.session_pool
+                    if sp:
+                        info["session-pool"] = sp.get_info()
         return info
@@ -0,0 +1,170 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+from threading import Lock
+
+from xpra.util import envint
+from xpra.os_util import monotonic_time
+from xpra.make_thread import start_thread
+from xpra.log import Logger
+
+log = Logger("proxy")
+
+#discard spare sessions which have been idle for longer than this (in seconds):
+MAX_IDLE = envint("XPRA_PROXY_SESSION_POOL_MAX_IDLE", 24*3600)
+#the start options which do not prevent the use of a spare session,
+#the client always sends its current directory as "chdir"
+#but the spare sessions keep the directory they were started in:
+IGNORED_OPTIONS = ("chdir", )
+
+
+class SpareSession:
+    __slots__ = ("proc", "socket_path", "display", "started")
+    def __init__(self, proc, socket_path, display):
+        self.proc = proc
+        self.socket_path = socket_path
+        self.display = display
+        self.started = monotonic_time()
+
+    def __repr__(self):
+        return "SpareSession(%s : %s)" % (self.display, self.proc.pid)
+
+    def is_alive(self) -> bool:
+        return self.proc.poll() is None
+
+
+class SessionPool:
+    """
+        Keeps a number of idle sessions ready for each user,
+        started with the default options so that a client requesting
+        a plain new session gets one that has already gone through
+        the whole server startup (virtual display, codecs, etc).
+        The sessions can only be re-used by the same uid and gid,
+        since the display, the socket directories and the server process itself
+        all belong to the user.
+        The 'start_session' function is called from a background thread
+        and must return the same values as 'start_server_subprocess'.
+    """
+
+    def __init__(self, size, start_session, mode="start"):
+        self.size = size
+        self.start_session = start_session
+        self.mode = mode
+        self.lock = Lock()
+        #(uid, gid) -> list of SpareSession:
+        self.spares = {}
+        #(uid, gid) -> number of sessions being started:
+        self.starting = {}
+        self.hits = 0
+        self.misses = 0
+        self.failures = 0
+        self.closed = False
+
+    def __repr__(self):
+        return "SessionPool(%i)" % self.size
+
+    def can_use(self, mode, options) -> bool:
+        """
+            Only sessions started without any option overrides
+            are identical to the ones we have in the pool,
+            the options in IGNORED_OPTIONS are not honoured when using a spare session.
+        """
+        overrides = tuple(k for k in options if k not in IGNORED_OPTIONS)
+        return self.size>0 and not self.closed and mode==self.mode and not overrides
+
+    def get_info(self) -> dict:
+        with self.lock:
+            users = {}
+            for (uid, gid), spares in self.spares.items():
+                users["%i:%i" % (uid, gid)] = {
+                    "displays"  : tuple(spare.display for spare in spares),
+                    "starting"  : self.starting.get((uid, gid), 0),
+                    }
+        return {
+            "size"      : self.size,
+            "mode"      : self.mode,
+            "hits"      : self.hits,
+            "misses"    : self.misses,
+            "failures"  : self.failures,
+            "users"     : users,
+            }
+
+    def take(self, username, uid, gid):
+        """
+            Returns a spare session for this user, or None if none are available.
+            Either way, the pool is refilled in the background.
+        """
+        key = (uid, gid)
+        session = None
+        with self.lock:
+            spares = self.spares.get(key, [])
+            while spares and not session:
+                spare = spares.pop(0)
+                if spare.is_alive() and monotonic_time()-spare.started<MAX_IDLE:
+                    session = spare
+                else:
+                    log("discarding spare session %s", spare)
+                    self.stop_session(spare)
+            if session:
+                self.hits += 1
+            else:
+                self.misses += 1
+        log("take(%s, %i, %i)=%s", username, uid, gid, session)
+        self.fill(username, uid, gid)
+        if not session:
+            return None
+        return session.proc, session.socket_path, session.display
+
+    def fill(self, username, uid, gid):
+        key = (uid, gid)
+        with self.lock:
+            if self.closed:
+                return
+            spares = self.spares.setdefault(key, [])
+            starting = self.starting.get(key, 0)
+            missing = self.size-len(spares)-starting
+            if missing<=0:
+                return
+            self.starting[key] = starting+missing
+        for _ in range(missing):
+            start_thread(self.start_spare, "start-spare-session(%s)" % username, True, (username, uid, gid))
+
+    def start_spare(self, username, uid, gid):
+        key = (uid, gid)
+        spare = None
+        try:
+            proc, socket_path, display = self.start_session(username, uid, gid)
+            if proc:
+                spare = SpareSession(proc, socket_path, display)
+        except Exception as e:
+            log("start_spare%s", (username, uid, gid), exc_info=True)
+            log.error("Error: failed to start a spare session for %s:", username)
+            log.error(" %s", e)
+        with self.lock:
+            self.starting[key] = self.starting.get(key, 1)-1
+            if not spare:
+                self.failures += 1
+            elif self.closed:
+                self.stop_session(spare)
+            else:
+                log("new spare session %s for %s", spare, username)
+                self.spares.setdefault(key, []).append(spare)
+
+    def stop_session(self, spare):
+        if spare.is_alive():
+            try:
+                spare.proc.terminate()
+            except OSError:
+                log("failed to terminate %s", spare, exc_info=True)
+
+    def cleanup(self):
+        with self.lock:
+            self.closed = True
+            spares = self.spares
+            self.spares = {}
+        for sessions in spares.values():
+            for spare in sessions:
+                self.stop_session(spare)
@@ -144,8 +144,7 @@ class ServerBase(ServerBaseClass):
         for c in SERVER_BASES:
             start = monotonic_time()
             c.init(self, opts)
-            end = monotonic_time()
-            log("%3ims in %s.init", 1000*(end-start), c)
+            self.record_startup_time("init.%s" % c.__name__, start)
         self.sharing = opts.sharing
         self.lock = opts.lock
         self.idle_timeout = opts.idle_timeout
@@ -156,18 +155,19 @@ class ServerBase(ServerBaseClass):
         for c in SERVER_BASES:
             start = monotonic_time()
             c.setup(self)
-            end = monotonic_time()
-            log("%3ims in %s.setup", 1000*(end-start), c)
+            self.record_startup_time("setup.%s" % c.__name__, start)
 
     def threaded_init(self):
         super().threaded_init()
         log("threaded_init() serverbase start")
         for c in SERVER_BASES:
             if c!=ServerCore:
+                start = monotonic_time()
                 try:
                     c.threaded_setup(self)
                 except Exception:
                     log.error("Error during threaded setup of %s", c, exc_info=True)
+                self.record_startup_time("threaded-setup.%s" % c.__name__, start)
         log("threaded_init() serverbase end")
 
 
@@ -473,6 +473,7 @@ class ServerBase(ServerBaseClass):
                  "sharing-toggle"               : self.sharing is None,
                  "lock"                         : self.lock is not False,
                  "lock-toggle"                  : self.lock is None,
+                 "info-snapshot"                : True,
                  "windows"                      : server_features.windows,
                  "keyboard"                     : server_features.input_devices,
                  "pointer"                      : server_features.input_devices,
@@ -547,11 +548,29 @@ class ServerBase(ServerBaseClass):
         #    uuid = packet[1]
         if len(packet)>=4:
             categories = tuple(bytestostr(x) for x in packet[3])
-        def info_callback(_proto, info):
-            assert proto==_proto
+        options = typedict()
+        if len(packet)>=5:
+            options = typedict(packet[4])
+        def filter_info(info):
             if categories:
                 info = dict((k,v) for k,v in info.items() if k in categories)
-            ss.send_info_response(info)
+            return info
+        if options.boolget("delta"):
+            #send the changes since the last snapshot this client received:
+            snapshot = self.get_info_snapshot()
+            def delta_callback(info):
+                changed, removed = snapshot.get_delta(proto, filter_info(info))
+                ss.send_info_response(changed, {"delta" : True, "removed" : removed})
+            snapshot.get(delta_callback)
+            return
+        if options.boolget("snapshot"):
+            def snapshot_callback(info):
+                ss.send_info_response(filter_info(info))
+            self.get_info_snapshot().get(snapshot_callback)
+            return
+        def info_callback(_proto, info):
+            assert proto==_proto
+            ss.send_info_response(filter_info(info))
         self.get_all_info(info_callback, proto, None)
 
     def send_hello_info(self, proto):
@@ -734,6 +753,13 @@ class ServerBase(ServerBaseClass):
         info["clients"] = len(self._server_sources)
         return info
 
+    def collect_metrics(self, metrics):
+        ServerCore.collect_metrics(self, metrics)
+        #pylint: disable=import-outside-toplevel
+        from xpra.server.metrics import add_client_metrics, add_encoder_metrics, get_encoder_totals
+        add_client_metrics(metrics, tuple(self._server_sources.values()))
+        add_encoder_metrics(metrics, get_encoder_totals())
+
     def get_http_scripts(self) -> dict:
         scripts = {}
         for c in SERVER_BASES:
@@ -768,6 +794,8 @@ class ServerBase(ServerBaseClass):
         except ValueError:
             pass
         source = self._server_sources.pop(protocol, None)
+        if self.info_snapshot:
+            self.info_snapshot.remove_subscriber(protocol)
         if source:
             self.cleanup_source(source)
             add_work_item(self.mdns_update)
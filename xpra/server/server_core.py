@@ -13,6 +13,7 @@ import socket
 import signal
 import platform
 import threading
+from copy import deepcopy
 from urllib.parse import urlparse, parse_qsl, unquote
 from weakref import WeakKeyDictionary
 from time import sleep, time
@@ -115,8 +116,17 @@ class ClientException(Exception):
     pass
 
 
-def get_server_info():
-    #this function is for non UI thread info
+#information which does not change for the lifetime of the process,
+#keyed by pid since the proxy instances are forked from the proxy server:
+static_info_cache = {}
+def get_static_info(name, collect_fn):
+    key = (os.getpid(), name)
+    info = static_info_cache.get(key)
+    if info is None:
+        info = static_info_cache[key] = collect_fn()
+    return info
+
+def collect_server_info():
     info = {
             "platform"  : get_platform_info(),
             "build"     : get_version_info_full(),
@@ -124,6 +134,15 @@ def get_server_info():
     info.update(get_host_info())
     return info
 
+def get_server_info():
+    #this function is for non UI thread info
+    #the caller may modify the dictionary, so it gets its own copy:
+    return deepcopy(get_static_info("server", collect_server_info))
+
+def get_flat_server_info():
+    #the flattened version used in hello packets, the values are not modified:
+    return get_static_info("server-flat", lambda: flatten_dict(get_server_info()))
+
 def get_thread_info(proto=None):
     #threads:
     if proto:
@@ -143,6 +162,8 @@ class ServerCore:
     def __init__(self):
         log("ServerCore.__init__()")
         self.start_time = time()
+        #how long each startup phase took, in milliseconds:
+        self.startup_timings = {}
         self.auth_classes = {}
         self._when_ready = []
         self.child_reaper = None
@@ -166,6 +187,11 @@ class ServerCore:
         self.ssl_mode = None
         self._html = False
         self._http_scripts = {}
+        self.metrics_exporter = None
+        #info requests waiting for a collection already in progress:
+        self._info_requests = {}
+        self._info_lock = Lock()
+        self.info_snapshot = None
         self._www_dir = None
         self._http_headers_dirs = ()
         self._aliases = {}
@@ -371,10 +397,12 @@ class ServerCore:
 
     def threaded_init(self):
         log("threaded_init() servercore start")
+        start = monotonic_time()
         #platform specific init:
         threaded_server_init()
         #populate the platform info cache:
         get_platform_info()
+        self.record_startup_time("threaded-setup.platform", start)
         #run the init callbacks:
         with self.init_thread_lock:
             for cb in self.init_thread_callbacks:
@@ -427,9 +455,17 @@ class ServerCore:
         return 0
 
     def server_is_ready(self):
+        self.startup_timings["ready"] = int(1000*(time()-self.start_time))
         log.info("xpra is ready.")
+        log("startup timings: %s", csv("%s=%ims" % (k, v) for k,v in sorted(
+            self.startup_timings.items(), key=lambda x : -x[1])))
         noerr(sys.stdout.flush)
 
+    def record_startup_time(self, phase, start):
+        elapsed = int(1000*(monotonic_time()-start))
+        self.startup_timings[phase] = elapsed
+        log("%3ims in %s", elapsed, phase)
+
     def do_run(self):
         raise NotImplementedError()
 
@@ -439,6 +475,9 @@ class ServerCore:
             p.quit()
         netlog("cleanup will disconnect: %s", self._potential_protocols)
         self.cancel_touch_timer()
+        if self.info_snapshot:
+            self.info_snapshot.cleanup()
+            self.info_snapshot = None
         if self.mdns_publishers:
             add_work_item(self.mdns_cleanup)
         if self._upgrading:
@@ -450,6 +489,8 @@ class ServerCore:
         self.do_cleanup()
         self.cleanup_protocols(protocols, reason, True)
         self._potential_protocols = []
+        from xpra.net.reactor import cleanup_reactor
+        cleanup_reactor()
         self.cleanup_udp_listeners()
         self.cleanup_sockets()
         self.cleanup_dbus_server()
@@ -613,6 +654,7 @@ class ServerCore:
             SCRIPT_OPTIONS = {
                 "/Status"           : self.http_status_request,
                 "/Info"             : self.http_info_request,
+                "/Metrics"          : self.http_metrics_request,
                 "/Sessions"         : self.http_sessions_request,
                 "/Displays"         : self.http_displays_request,
                 "/Menu"             : self.http_menu_request,
@@ -1577,6 +1619,21 @@ class ServerCore:
     def http_status_request(self, handler):
         return self.send_http_response(handler, "ready")
 
+    def http_metrics_request(self, handler):
+        from xpra.server.metrics import (   #pylint: disable=import-outside-toplevel
+            MetricsExporter, accepts_openmetrics,
+            OPENMETRICS_CONTENT_TYPE, PROMETHEUS_CONTENT_TYPE,
+            )
+        if not self.metrics_exporter:
+            self.metrics_exporter = MetricsExporter(self.collect_metrics)
+        openmetrics = accepts_openmetrics(handler.headers.get("Accept"))
+        content = self.metrics_exporter.get_metrics(openmetrics)
+        content_type = OPENMETRICS_CONTENT_TYPE if openmetrics else PROMETHEUS_CONTENT_TYPE
+        return self.send_http_response(handler, content, content_type)
+
+    def collect_metrics(self, metrics):
+        metrics.gauge("xpra_uptime_seconds", "Time since the server was started", int(time()-self.start_time))
+
     def send_http_response(self, handler, content, content_type="text/plain"):
         handler.send_response(200)
         headers = {
@@ -2078,7 +2135,7 @@ class ServerCore:
         now = time()
         capabilities = flatten_dict(get_network_caps())
         if source is None or source.wants_versions:
-            capabilities.update(flatten_dict(get_server_info()))
+            capabilities.update(get_flat_server_info())
         capabilities.update({
                         "version"               : XPRA_VERSION,
                         "start_time"            : int(self.start_time),
@@ -2137,14 +2194,38 @@ class ServerCore:
         proto.send_now(("hello", notypedict(info)))
 
     def get_all_info(self, callback, proto=None, *args):
+        """
+            The UI info is collected from an idle callback,
+            so the events already queued (ie: damage) are processed first,
+            the rest is collected in the "Info" thread.
+            Identical requests received while a collection is in progress
+            are given the same result.
+        """
+        key = (proto, args)
+        with self._info_lock:
+            callbacks = self._info_requests.get(key)
+            if callbacks is not None:
+                log("get_all_info%s already in progress", key)
+                callbacks.append(callback)
+                return
+            self._info_requests[key] = [callback]
+        self.idle_add(self._get_ui_info, key)
+
+    def _get_ui_info(self, key):
+        proto, args = key
         start = monotonic_time()
-        ui_info = self.get_ui_info(proto, *args)
+        try:
+            ui_info = self.get_ui_info(proto, *args)
+        except Exception:
+            log.error("Error during ui info collection using %s", self.get_ui_info, exc_info=True)
+            ui_info = {}
         end = monotonic_time()
         log("get_all_info: ui info collected in %ims", (end-start)*1000)
-        start_thread(self._get_info_in_thread, "Info", daemon=True, args=(callback, ui_info, proto, args))
+        start_thread(self._get_info_in_thread, "Info", daemon=True, args=(key, ui_info))
 
-    def _get_info_in_thread(self, callback, ui_info, proto, args):
-        log("get_info_in_thread%s", (callback, {}, proto, args))
+    def _get_info_in_thread(self, key, ui_info):
+        proto, args = key
+        log("get_info_in_thread%s", (proto, args))
         start = monotonic_time()
         #this runs in a non-UI thread
         try:
@@ -2154,12 +2235,39 @@ class ServerCore:
             log.error("Error during info collection using %s", self.get_info, exc_info=True)
         end = monotonic_time()
         log("get_all_info: non ui info collected in %ims", (end-start)*1000)
-        callback(proto, ui_info)
+        with self._info_lock:
+            callbacks = self._info_requests.pop(key, ())
+        for callback in callbacks:
+            try:
+                callback(proto, ui_info)
+            except Exception:
+                log.error("Error sending the info using %s", callback, exc_info=True)
 
     def get_ui_info(self, _proto, *_args) -> dict:
         #this function is for info which MUST be collected from the UI thread
         return {}
 
+    def get_info_snapshot(self):
+        snapshot = self.info_snapshot
+        if snapshot is None:
+            from xpra.server.info_snapshot import InfoSnapshot
+            snapshot = InfoSnapshot(self.idle_add)
+            for name, collect, ttl, ui in self.get_info_sections():
+                snapshot.add_section(name, collect, ttl, ui)
+            self.info_snapshot = snapshot
+        return snapshot
+
+    def get_info_sections(self):
+        """
+            The sections used by the info snapshot,
+            they are collected without a connection so they can be shared by all the requests.
+        """
+        from xpra.server.info_snapshot import INFO_TTL, INFO_UI_TTL
+        return (
+            ("ui", lambda : self.get_ui_info(None), INFO_UI_TTL, True),
+            ("info", lambda : self.get_info(None), INFO_TTL, False),
+            )
+
     def get_thread_info(self, proto) -> dict:
         return get_thread_info(proto)
 
@@ -2184,6 +2292,7 @@ class ServerCore:
         si.update(self.get_minimal_server_info())
         si.update(get_server_info())
         si.update({
+            "startup"           : self.startup_timings,
             "argv"              : sys.argv,
             "path"              : sys.path,
             "exec_prefix"       : sys.exec_prefix,
@@ -2215,8 +2324,10 @@ class ServerCore:
             info[prefix] = d
 
         si = self.get_server_info()
+        if self.info_snapshot:
+            si["info-snapshot"] = self.info_snapshot.get_info()
         if SYSCONFIG:
-            si["sysconfig"] = get_sysconfig_info()
+            si["sysconfig"] = deepcopy(get_static_info("sysconfig", get_sysconfig_info))
         up("server", si)
 
         ni = get_net_info()
@@ -2233,6 +2344,11 @@ class ServerCore:
                        },
                    "mdns"           : self.mdns,
                    })
+        if self._html:
+            from xpra.net.http_handler import compressed_cache
+            ni["www"]["cache"] = compressed_cache.get_info()
+        from xpra.net.reactor import get_reactor_info
+        ni["reactor"] = get_reactor_info()
         up("network", ni)
         up("threads",   self.get_thread_info(proto))
         from xpra.platform.info import get_sys_info
@@ -379,8 +379,11 @@ class ClientConnection(StubSourceMixin):
         return info
 
 
-    def send_info_response(self, info):
-        self.send_async("info-response", notypedict(info))
+    def send_info_response(self, info, options=None):
+        if options:
+            self.send_async("info-response", notypedict(info), options)
+        else:
+            self.send_async("info-response", notypedict(info))
 
 
     def send_setting_change(self, setting, value):
@@ -7,13 +7,11 @@
 # later version. See the file COPYING for details.
 
 from math import sqrt
-from collections import deque
 
 from xpra.server.cystats import (                                           #@UnresolvedImport
-    logp, calculate_time_weighted_average, calculate_size_weighted_average, #@UnresolvedImport
-    calculate_for_target, time_weighted_average, queue_inspect,             #@UnresolvedImport
+    logp, calculate_for_target, time_weighted_average, queue_inspect,       #@UnresolvedImport
+    TimeSeries,                                                             #@UnresolvedImport
     )
-from xpra.simple_stats import get_list_stats
 from xpra.os_util import monotonic_time
 from xpra.log import Logger
 
@@ -33,41 +31,41 @@ class GlobalPerformanceStatistics:
     DEFAULT_LATENCY = 0.1
 
     def reset(self, maxlen=NRECS):
-        def d(maxlen=maxlen):
-            return deque(maxlen=maxlen)
+        def d(*columns, maxlen=maxlen):
+            return TimeSeries(maxlen, columns)
         # mmap state:
         self.mmap_size = 0
         self.mmap_bytes_sent = 0
         self.mmap_free_size = 0                             #how much of the mmap space is left (may be negative if we failed to write the last chunk)
         # queue statistics:
-        self.compression_work_qsizes = d()                  #size of the compression_work_queue before we add a new record to it
-                                                            #(event_time, size)
-        self.packet_qsizes = d()                            #size of the packet_queue before we add a new packet to it
-                                                            #(event_time, size)
-        self.damage_packet_qpixels = d()                    #number of pixels waiting in the packet_queue for a specific window,
-                                                            #before we add a new packet to it
-                                                            #(event_time, wid, size)
-        self.damage_last_events = d()                       #records the x11 damage requests as they are received:
-                                                            #(wid, event time, no of pixels)
-        self.client_decode_time = d()                       #records how long it took the client to decode frames:
-                                                            #(wid, event_time, no of pixels, decoding_time*1000*1000)
-        self.client_latency = d()                           #how long it took for a packet to get to the client and get the echo back.
-                                                            #(wid, event_time, no of pixels, client_latency)
-        self.client_ping_latency = d()                      #time it took to get a ping_echo back from the client:
-                                                            #(event_time, elapsed_time_in_seconds)
-        self.server_ping_latency = d()                      #time it took for the client to get a ping_echo back from us:
-                                                            #(event_time, elapsed_time_in_seconds)
-        self.congestion_send_speed = d(NRECS//4)            #when we are being throttled, record what speed we are sending at
-                                                            #last NRECS: (event_time, lateness_pct, duration)
-        self.bytes_sent = d(NRECS//4)                       #how much bandwidth we are using
-                                                            #last NRECS: (sample_time, bytes)
-        self.quality = d()                                  #quality used for sending updates:
-                                                            #(event_time, no of pixels, quality)
-        self.speed = d()                                    #speed used for sending updates:
-                                                            #(event_time, no of pixels, speed)
-        self.frame_total_latency = d()                      #how long it takes from the time we get a damage event
-                                                            #until we get the ack back from the client
-                                                            #(wid, event_time, no_of_pixels, latency)
+        #size of the compression_work_queue before we add a new record to it:
+        self.compression_work_qsizes = d("time", "size")
+        #size of the packet_queue before we add a new packet to it:
+        self.packet_qsizes = d("time", "size")
+        #number of pixels waiting in the packet_queue for a specific window,
+        #before we add a new packet to it:
+        self.damage_packet_qpixels = d("time", "wid", "size")
+        #records the x11 damage requests as they are received:
+        self.damage_last_events = d("wid", "time", "pixels")
+        #records how long it took the client to decode frames (decoding_time*1000*1000):
+        self.client_decode_time = d("wid", "time", "pixels", "decode_time")
+        #how long it took for a packet to get to the client and get the echo back:
+        self.client_latency = d("wid", "time", "pixels", "latency")
+        #time it took to get a ping_echo back from the client (in seconds):
+        self.client_ping_latency = d("time", "latency")
+        #time it took for the client to get a ping_echo back from us (in seconds):
+        self.server_ping_latency = d("time", "latency")
+        #when we are being throttled, record what speed we are sending at:
+        self.congestion_send_speed = d("time", "late_pct", "speed", maxlen=NRECS//4)
+        #how much bandwidth we are using:
+        self.bytes_sent = d("time", "bytes", maxlen=NRECS//4)
+        #quality used for sending updates:
+        self.quality = d("time", "pixels", "quality")
+        #speed used for sending updates:
+        self.speed = d("time", "pixels", "speed")
+        #how long it takes from the time we get a damage event
+        #until we get the ack back from the client:
+        self.frame_total_latency = d("wid", "time", "pixels", "latency")
         self.client_load = None
         self.last_congestion_time = 0
         self.congestion_value = 0
@@ -102,36 +100,32 @@ class GlobalPerformanceStatistics:
 
     def get_damage_pixels(self, wid):
         """ returns the list of (event_time, pixelcount) for the given window id """
-        return [(event_time, value) for event_time, dwid, value in tuple(self.damage_packet_qpixels) if dwid==wid]
+        return self.damage_packet_qpixels.filter("wid", wid, "size")
 
     def update_averages(self):
-        def latency_averages(values):
-            avg, recent = calculate_time_weighted_average(values)
+        def latency_averages(series):
+            avg, recent = series.time_weighted_average("latency")
             return max(0.001, avg), max(0.001, recent)
-        client_latency = tuple(self.client_latency)
-        if client_latency:
-            data = tuple((when, latency) for _, when, _, latency in client_latency)
-            self.min_client_latency = min(x for _,x in data)
-            self.avg_client_latency, self.recent_client_latency = latency_averages(data)
+        if self.client_latency:
+            self.min_client_latency = self.client_latency.min("latency")
+            self.avg_client_latency, self.recent_client_latency = latency_averages(self.client_latency)
         #client ping latency: from ping packets
-        client_ping_latency = tuple(self.client_ping_latency)
-        if client_ping_latency:
-            self.min_client_ping_latency = min(x for _,x in client_ping_latency)
-            self.avg_client_ping_latency, self.recent_client_ping_latency = latency_averages(client_ping_latency)
+        if self.client_ping_latency:
+            self.min_client_ping_latency = self.client_ping_latency.min("latency")
+            self.avg_client_ping_latency, self.recent_client_ping_latency = latency_averages(self.client_ping_latency)
         #server ping latency: from ping packets
-        server_ping_latency = tuple(self.server_ping_latency)
-        if server_ping_latency:
-            self.min_server_ping_latency = min(x for _,x in server_ping_latency)
-            self.avg_server_ping_latency, self.recent_server_ping_latency = latency_averages(server_ping_latency)
+        if self.server_ping_latency:
+            self.min_server_ping_latency = self.server_ping_latency.min("latency")
+            self.avg_server_ping_latency, self.recent_server_ping_latency = latency_averages(self.server_ping_latency)
         #set to 0 if we have less than 2 events in the last 60 seconds:
         now = monotonic_time()
         min_time = now-60
-        css = tuple(x for x in tuple(self.congestion_send_speed) if x[0]>min_time)
+        css = self.congestion_send_speed
         acss = 0
-        if len(css)>=2:
+        if css.count_since(min_time)>=2:
             #weighted average of the send speed over the last minute:
-            acss = int(calculate_size_weighted_average(css)[0])
-            latest_ctime = self.congestion_send_speed[-1][0]
+            acss = int(css.size_weighted_average("late_pct", "speed", min_time)[0])
+            latest_ctime = css.last("time")
             elapsed = now-latest_ctime
             #require at least one recent event:
             if elapsed<30:
@@ -141,7 +135,7 @@ class GlobalPerformanceStatistics:
         #how often we get congestion events:
         #first chunk it into second intervals
         min_time = now-10
-        cst = tuple(x[0] for x in css)
+        cst = css.values("time", min_time)
         cps = []
         for t in range(10):
             etime = now-t
@@ -149,11 +143,8 @@ class GlobalPerformanceStatistics:
             cps.append((etime, sum(matches)))
         #log("cps(%s)=%s (now=%s)", cst, cps, now)
         self.congestion_value = time_weighted_average(cps)
-        ftl = tuple(self.frame_total_latency)
-        if ftl:
-            edata = tuple((event_time, pixels, latency) for _, event_time, pixels, latency in ftl)
-            #(wid, event_time, no_of_pixels, latency)
-            self.avg_frame_total_latency = int(calculate_size_weighted_average(edata)[1])
+        if self.frame_total_latency:
+            self.avg_frame_total_latency = int(self.frame_total_latency.size_weighted_average("pixels", "latency")[1])
 
     def get_factors(self, pixel_count):
         factors = []
@@ -182,8 +173,7 @@ class GlobalPerformanceStatistics:
         #packet queue size: (includes packets from all windows)
         mayaddfac(*queue_inspect("packet-queue-size", self.packet_qsizes, smoothing=sqrt))
         #packet queue pixels (global):
-        qpix_time_values = tuple((event_time, value) for event_time, _, value in tuple(self.damage_packet_qpixels))
-        mayaddfac(*queue_inspect("packet-queue-pixels", qpix_time_values, div=pixel_count, smoothing=sqrt))
+        mayaddfac(*queue_inspect("packet-queue-pixels", self.damage_packet_qpixels, div=pixel_count, smoothing=sqrt))
         #compression data queue: (This is an important metric
         #since each item will consume a fair amount of memory
         #and each will later on go through the other queues.)
@@ -198,16 +188,15 @@ class GlobalPerformanceStatistics:
         return factors
 
     def get_connection_info(self) -> dict:
-        latencies = tuple(int(x*1000) for (_, _, _, x) in tuple(self.client_latency))
         now = monotonic_time()
         info = {
             "mmap_bytecount"  : self.mmap_bytes_sent,
-            "latency"           : get_list_stats(latencies),
+            "latency"           : self.client_latency.list_stats("latency", 1000),
             "server"            : {
-                "ping_latency"   : get_list_stats(int(1000*x[1]) for x in tuple(self.server_ping_latency)),
+                "ping_latency"   : self.server_ping_latency.list_stats("latency", 1000),
                 },
             "client"            : {
-                "ping_latency"   : get_list_stats(int(1000*x[1]) for x in tuple(self.client_ping_latency)),
+                "ping_latency"   : self.client_ping_latency.list_stats("latency", 1000),
                 },
             "congestion" : {
                 "avg-send-speed"        : self.avg_congestion_send_speed,
@@ -220,8 +209,6 @@ class GlobalPerformanceStatistics:
 
 
     def get_info(self) -> dict:
-        cwqsizes = tuple(x[1] for x in tuple(self.compression_work_qsizes))
-        pqsizes = tuple(x[1] for x in tuple(self.packet_qsizes))
         now = monotonic_time()
         time_limit = now-60             #ignore old records (60s)
         client_latency = max(0, self.avg_frame_total_latency-
@@ -231,10 +218,10 @@ class GlobalPerformanceStatistics:
                 "events"        : self.damage_events_count,
                 "packets_sent"  : self.packet_count,
                 "data_queue"    : {
-                    "size"   : get_list_stats(cwqsizes),
+                    "size"   : self.compression_work_qsizes.list_stats("size"),
                     },
                 "packet_queue"  : {
-                    "size"   : get_list_stats(pqsizes),
+                    "size"   : self.packet_qsizes.list_stats("size"),
                     },
                 "frame-total-latency" : self.avg_frame_total_latency,
                 "client-latency"    : client_latency,
@@ -243,18 +230,16 @@ class GlobalPerformanceStatistics:
             "connection" : self.get_connection_info(),
             }
         if self.quality:
-            ql = tuple(quality for _,_,quality in self.quality)
-            info["encoding"]["quality"] = get_list_stats(ql)
+            info["encoding"]["quality"] = self.quality.list_stats("quality")
         if self.speed:
-            sl = tuple(speed for _,_,speed in self.speed)
-            info["encoding"]["speed"] = get_list_stats(sl)
+            info["encoding"]["speed"] = self.speed.list_stats("speed")
         #client pixels per second:
         #pixels per second: decode time and overall
         total_pixels = 0                #total number of pixels processed
         total_time = 0                  #total decoding time
         start_time = None               #when we start counting from (oldest record)
         region_sizes = []
-        for _, event_time, pixels, decode_time in tuple(self.client_decode_time):
+        for _, event_time, pixels, decode_time in self.client_decode_time.records(time_limit):
             #time filter and ignore failed decoding (decode_time==0)
             if event_time<time_limit or decode_time<=0:
                 continue
@@ -27,6 +27,8 @@ CONGESTION_WARNING_EVENT_COUNT = envint("XPRA_CONGESTION_WARNING_EVENT_COUNT", 1
 CONGESTION_REPEAT_DELAY = envint("XPRA_CONGESTION_REPEAT_DELAY", 60)
 SAVE_CURSORS = envbool("XPRA_SAVE_CURSORS", False)
 MIN_BANDWIDTH = envint("XPRA_MIN_BANDWIDTH", 5*1024*1024)
+#only send the metadata values which have changed since the last time we sent them:
+METADATA_DIFF = envbool("XPRA_METADATA_DIFF", True)
 
 PROPERTIES_DEBUG = [x.strip() for x in os.environ.get("XPRA_WINDOW_PROPERTIES_DEBUG", "").split(",")]
 
@@ -81,6 +83,9 @@ class WindowsMixin(StubSourceMixin):
         self.window_restack = False
         self.system_tray = False
         self.metadata_supported = ()
+        #the metadata values we have sent for each window:
+        self.window_metadata_sent = {}
+        self.metadata_counts = {"sent" : 0, "unchanged" : 0}
 
         self.cursor_timer = None
         self.last_cursor_sent = None
@@ -89,6 +94,7 @@ class WindowsMixin(StubSourceMixin):
         for window_source in self.all_window_sources():
             window_source.cleanup()
         self.window_sources = {}
+        self.window_metadata_sent = {}
         self.cancel_cursor_timer()
 
     def all_window_sources(self):
@@ -167,6 +173,7 @@ class WindowsMixin(StubSourceMixin):
             "bell"          : self.send_bell,
             "system-tray"   : self.system_tray,
             "suspended"     : self.suspended,
+            "metadata"      : dict(self.metadata_counts),
             }
         wsize = info.setdefault("window-size", {})
         wsize.update({
@@ -183,6 +190,8 @@ class WindowsMixin(StubSourceMixin):
             Adds encoding and window specific information
         """
         from xpra.simple_stats import get_list_stats
+        from xpra.server.cystats import LatencyHistogram   #@UnresolvedImport
+        from xpra.server.window.pipeline_trace import PIPELINE_STAGES
         pqpixels = [x[2] for x in tuple(self.packet_queue)]
         pqpi = get_list_stats(pqpixels)
         if pqpixels:
@@ -203,17 +212,21 @@ class WindowsMixin(StubSourceMixin):
             total_pixels = 0
             total_time = 0.0
             in_latencies, out_latencies = [], []
+            pipeline = dict((stage, LatencyHistogram()) for stage in PIPELINE_STAGES)
             winfo = {}
             for wid, ws in list(self.window_sources.items()):
                 #per-window source stats:
                 winfo[wid] = ws.get_info()
                 #collect stats for global averages:
-                for _, _, pixels, _, _, encoding_time in tuple(ws.statistics.encoding_stats):
-                    total_pixels += pixels
-                    total_time += encoding_time
-                in_latencies += [x*1000 for _, _, _, x in tuple(ws.statistics.damage_in_latency)]
-                out_latencies += [x*1000 for _, _, _, x in tuple(ws.statistics.damage_out_latency)]
+                total_pixels += ws.statistics.encoding_stats.sum("pixels")
+                total_time += ws.statistics.encoding_stats.sum("encoding_time")
+                in_latencies += [x*1000 for x in ws.statistics.damage_in_latency.values("latency")]
+                out_latencies += [x*1000 for x in ws.statistics.damage_out_latency.values("latency")]
+                for stage, h in ws.statistics.stage_latency.items():
+                    pipeline[stage].merge(h)
             info["window"] = winfo
+            #all windows combined, in microseconds:
+            info["pipeline"] = dict((stage, h.get_info()) for stage, h in pipeline.items())
             v = 0
             if total_time>0:
                 v = int(total_pixels / total_time)
@@ -374,9 +387,30 @@ class WindowsMixin(StubSourceMixin):
                 metalog.info("make_metadata(%s, %s, %s)=%s", wid, window, prop, metadata)
             else:
                 metalog("make_metadata(%s, %s, %s)=%s", wid, window, prop, metadata)
+            metadata = self.diff_metadata(wid, metadata)
             if metadata:
                 self.send("window-metadata", wid, metadata)
 
+    def diff_metadata(self, wid, metadata):
+        """
+            Removes the values which are the same as the ones we last sent for this window,
+            and records the new ones.
+        """
+        if not METADATA_DIFF or not metadata:
+            return metadata
+        sent = self.window_metadata_sent.setdefault(wid, {})
+        changed = {}
+        for k, v in metadata.items():
+            if k in sent and sent[k]==v:
+                self.metadata_counts["unchanged"] += 1
+                continue
+            changed[k] = v
+        if len(changed)<len(metadata):
+            metalog("diff_metadata(%s, %s) unchanged: %s", wid, metadata, tuple(k for k in metadata if k not in changed))
+        sent.update(changed)
+        self.metadata_counts["sent"] += len(changed)
+        return changed
+
 
     # Takes the name of a WindowModel property, and returns a dictionary of
     # xpra window metadata values that depend on that property
@@ -405,6 +439,7 @@ class WindowsMixin(StubSourceMixin):
         metadata = {}
         for propname in list(window.get_property_names()):
             metadata.update(self._make_metadata(window, propname, skip_defaults=True))
+        self.window_metadata_sent[wid] = dict(metadata)
         self.send_async("new-tray", wid, w, h, metadata)
 
     def new_window(self, ptype, wid, window, x, y, w, h, client_properties):
@@ -424,6 +459,8 @@ class WindowsMixin(StubSourceMixin):
             metadata.update(v)
         log("new_window(%s, %s, %s, %s, %s, %s, %s, %s) metadata(%s)=%s",
             ptype, window, wid, x, y, w, h, client_properties, send_props, metadata)
+        #the client starts from a clean slate:
+        self.window_metadata_sent[wid] = dict(metadata)
         self.send_async(ptype, wid, x, y, w, h, metadata, client_properties or {})
         if send_raw_icon:
             self.send_window_icon(wid, window)
@@ -501,6 +538,7 @@ class WindowsMixin(StubSourceMixin):
         ws = self.window_sources.pop(wid, None)
         if ws:
             ws.cleanup()
+        self.window_metadata_sent.pop(wid, None)
         self.calculate_window_pixels.pop(wid, None)
 
 
@@ -529,6 +567,12 @@ class WindowsMixin(StubSourceMixin):
         ws = self.make_window_source(wid, window)
         ws.set_client_properties(new_client_properties)
 
+    def set_window_visibility(self, wid, window, regions):
+        if not self.can_send_window(window):
+            return
+        ws = self.make_window_source(wid, window)
+        ws.set_visibility(regions)
+
 
     def get_window_source(self, wid):
         return self.window_sources.get(wid)
@@ -625,7 +669,7 @@ class WindowsMixin(StubSourceMixin):
             #enough congestion events?
             T = 10
             min_time = now-T
-            count = sum(int(x[0]>min_time) for x in gs.congestion_send_speed)
+            count = gs.congestion_send_speed.count_since(min_time)
             bandwidthlog("record_congestion_event: %i events in the last %i seconds (warnings after %i)",
                          count, T, CONGESTION_WARNING_EVENT_COUNT)
             if count>CONGESTION_WARNING_EVENT_COUNT:
@@ -174,12 +174,12 @@ def get_target_speed(window_dimensions, batch, global_statistics, statistics, ba
     #only count the last second's worth:
     now = monotonic_time()
     lim = now-1.0
-    lde = tuple(w*h for t,_,_,w,h in tuple(statistics.last_damage_events) if t>=lim)
-    pixels = sum(lde)
+    lde = statistics.last_damage_events
+    pixels = lde.sum_product("w", "h", lim)
     mpixels_per_s = pixels/(1024*1024)
     pps = 0.0
     pixel_rate_s = 100
-    if len(lde)>5 and mpixels_per_s>=1:
+    if lde.count_since(lim)>5 and mpixels_per_s>=1:
         #above 50 MPixels/s, we should reach 100% speed
         #(even x264 peaks at tens of MPixels/s)
         pps = sqrt(mpixels_per_s/50.0)
@@ -328,11 +328,10 @@ def get_target_quality(window_dimensions, batch,
     #raise the quality when there are not many recent damage events:
     ww, wh = window_dimensions
     if ww>0 and wh>0:
-        lde = tuple(statistics.last_damage_events)
+        lde = statistics.last_damage_events
         if lde:
             now = monotonic_time()
-            damage_pixel_count = tuple((lim, sum(w*h for t,_,_,w,h in lde if now-lim<=t<now-lim+1))
-                                       for lim in range(1,11))
+            damage_pixel_count = tuple(zip(range(1, 11), lde.sum_product_buckets("w", "h", now, 10)))
             pixl5 = sum(v for lim,v in damage_pixel_count if lim<=5)
             pixn5 = sum(v for lim,v in damage_pixel_count if lim>5)
             pctpixdamaged = pixl5/(ww*wh)
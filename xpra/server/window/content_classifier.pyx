@@ -0,0 +1,256 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+#cython: auto_pickle=False, boundscheck=False, wraparound=False, cdivision=True, language_level=3
+
+from libc.stdint cimport uint8_t, uint32_t     #pylint: disable=syntax-error
+from libc.stdlib cimport malloc, free
+from libc.string cimport memset
+
+from xpra.buffers.membuf cimport object_as_buffer
+
+
+#content classes:
+UNKNOWN = 0
+FLAT = 1
+TEXT = 2
+GRAPHICS = 3
+PHOTO = 4
+CLASS_NAMES = {
+    UNKNOWN     : "unknown",
+    FLAT        : "flat",
+    TEXT        : "text",
+    GRAPHICS    : "graphics",
+    PHOTO       : "photo",
+    }
+
+#we sample short horizontal runs of pixels spread over the image:
+cdef int SAMPLE_ROWS = 16
+cdef int SAMPLE_RUNS = 4
+cdef int RUN_LENGTH = 16
+#colour hash table (must be a power of 2 and larger than the number of samples):
+DEF HASH_SIZE = 2048
+#Knuth's multiplicative hash:
+cdef uint32_t HASH_MULTIPLIER = 2654435761
+#channel differences between neighbouring pixels:
+cdef int SMOOTH_DIFF = 24
+cdef int EDGE_DIFF = 64
+
+
+cdef inline int iabs(int v) nogil:
+    return v if v>=0 else -v
+
+cdef inline int imin(int a, int b) nogil:
+    return a if a<b else b
+
+cdef inline int imax(int a, int b) nogil:
+    return a if a>b else b
+
+cdef inline int pixel_diff(uint8_t *p1, uint8_t *p2) nogil:
+    return imax(iabs(p1[0]-p2[0]), imax(iabs(p1[1]-p2[1]), iabs(p1[2]-p2[2])))
+
+
+def classify(pixels, int width, int height, int rowstride, int bpp=4):
+    """
+        Samples at most SAMPLE_ROWS*SAMPLE_RUNS*RUN_LENGTH pixels
+        (so the cost does not depend on the size of the image)
+        and returns the content class with the statistics it is based on:
+        (class, distinct colours, equal %, smooth %, edge %)
+        The percentages are of the differences between horizontal neighbours:
+        * equal: identical pixels (flat areas and backgrounds)
+        * smooth: small differences (gradients, photos)
+        * edge: large differences (text, lines, borders)
+    """
+    assert bpp in (3, 4), "unsupported bytes per pixel: %i" % bpp
+    assert width>0 and height>0, "invalid dimensions %ix%i" % (width, height)
+    cdef uint8_t *buf = NULL
+    cdef Py_ssize_t buf_len = 0
+    assert object_as_buffer(pixels, <const void**> &buf, &buf_len)==0, "cannot get buffer from %s" % type(pixels)
+    assert buf_len>=(height-1)*rowstride+width*bpp, "buffer too small: %i bytes for %ix%i with rowstride=%i" % (
+        buf_len, width, height, rowstride)
+    cdef uint32_t table[HASH_SIZE]
+    memset(table, 0, sizeof(table))
+    cdef int rows = imin(height, SAMPLE_ROWS)
+    cdef int run = imin(width, RUN_LENGTH)
+    cdef int runs = imin(SAMPLE_RUNS, width//run)
+    cdef int colours = 0, samples = 0
+    cdef int equal = 0, smooth = 0, edge = 0, diffs = 0
+    cdef int r, i, j, d, x, y
+    cdef uint32_t key, h
+    cdef uint8_t *row
+    cdef uint8_t *p
+    with nogil:
+        for r in range(rows):
+            #spread the rows evenly, starting half a step down:
+            y = (2*r+1)*height//(2*rows)
+            row = buf+y*rowstride
+            for i in range(runs):
+                #stagger the runs on alternate rows:
+                x = ((2*i+1+(r&1))*width//(2*runs+1)) if runs>1 else 0
+                x = imin(x, width-run)
+                p = row+x*bpp
+                for j in range(run):
+                    key = (p[0] | (p[1]<<8) | (p[2]<<16)) + 1
+                    h = (key*HASH_MULTIPLIER) & (HASH_SIZE-1)
+                    while table[h]!=0 and table[h]!=key:
+                        h = (h+1) & (HASH_SIZE-1)
+                    if table[h]==0:
+                        table[h] = key
+                        colours += 1
+                    samples += 1
+                    if j>0:
+                        d = pixel_diff(p, p-bpp)
+                        diffs += 1
+                        if d==0:
+                            equal += 1
+                        elif d<=SMOOTH_DIFF:
+                            smooth += 1
+                        elif d>=EDGE_DIFF:
+                            edge += 1
+                    p += bpp
+    if diffs==0:
+        return UNKNOWN, colours, 0, 0, 0
+    cdef int equal_pct = equal*100//diffs
+    cdef int smooth_pct = smooth*100//diffs
+    cdef int edge_pct = edge*100//diffs
+    cdef int cls
+    if colours==1 or (equal_pct>=97 and edge_pct<=1):
+        cls = FLAT
+    elif colours*16<=samples and equal_pct>=50 and edge_pct>=5:
+        #few colours, mostly background with sharp transitions:
+        cls = TEXT
+    elif smooth_pct>=50 or colours*2>=samples or (colours*4>=samples and smooth_pct>=edge_pct):
+        #many colours or smooth transitions: natural images, gradients or noise,
+        #none of which compress well without loss
+        cls = PHOTO
+    else:
+        cls = GRAPHICS
+    return cls, colours, equal_pct, smooth_pct, edge_pct
+
+
+#cells are at least this many pixels wide and high:
+cdef int MIN_CELL_SIZE = 32
+cdef int MAX_CELLS = 1024
+#how many consistent classifications it takes to reach full confidence:
+cdef uint8_t MAX_CONFIDENCE = 8
+
+
+cdef class ContentModel:
+    """
+        Caches the content classes for a window on a coarse grid,
+        so that decisions can be made for areas of the window before capturing them.
+        Each cell keeps its current class and a confidence counter:
+        agreeing classifications raise it, conflicting ones lower it,
+        and the class only changes once the confidence has dropped to zero.
+    """
+    cdef readonly int width
+    cdef readonly int height
+    cdef readonly int cell_size
+    cdef readonly int cols
+    cdef readonly int rows
+    cdef readonly unsigned long updates
+    cdef uint8_t *classes
+    cdef uint8_t *confidence
+
+    def __cinit__(self, int width, int height):
+        assert width>0 and height>0, "invalid dimensions %ix%i" % (width, height)
+        self.width = width
+        self.height = height
+        self.cell_size = MIN_CELL_SIZE
+        while True:
+            self.cols = (width+self.cell_size-1)//self.cell_size
+            self.rows = (height+self.cell_size-1)//self.cell_size
+            if self.cols*self.rows<=MAX_CELLS:
+                break
+            self.cell_size *= 2
+        cdef int n = self.cols*self.rows
+        self.classes = <uint8_t*> malloc(n)
+        self.confidence = <uint8_t*> malloc(n)
+        if self.classes==NULL or self.confidence==NULL:
+            raise MemoryError()
+        self.reset()
+
+    def __dealloc__(self):
+        free(self.classes)
+        self.classes = NULL
+        free(self.confidence)
+        self.confidence = NULL
+
+    def __repr__(self):
+        return "ContentModel(%ix%i)" % (self.width, self.height)
+
+    def reset(self):
+        cdef int n = self.cols*self.rows
+        memset(self.classes, UNKNOWN, n)
+        memset(self.confidence, 0, n)
+        self.updates = 0
+
+    cdef int clip(self, int x, int y, int w, int h, int *cx0, int *cy0, int *cx1, int *cy1):
+        cdef int x0 = imax(0, x), y0 = imax(0, y)
+        cdef int x1 = imin(self.width, x+w), y1 = imin(self.height, y+h)
+        if x1<=x0 or y1<=y0:
+            return 0
+        cx0[0] = x0//self.cell_size
+        cy0[0] = y0//self.cell_size
+        cx1[0] = (x1-1)//self.cell_size
+        cy1[0] = (y1-1)//self.cell_size
+        return 1
+
+    def update(self, int x, int y, int w, int h, uint8_t cls):
+        """ record the class of the pixels in this area """
+        if cls==UNKNOWN:
+            return
+        cdef int cx0, cy0, cx1, cy1, cx, cy, i
+        if not self.clip(x, y, w, h, &cx0, &cy0, &cx1, &cy1):
+            return
+        for cy in range(cy0, cy1+1):
+            for cx in range(cx0, cx1+1):
+                i = cy*self.cols+cx
+                if self.classes[i]==cls:
+                    if self.confidence[i]<MAX_CONFIDENCE:
+                        self.confidence[i] += 1
+                elif self.confidence[i]>0:
+                    self.confidence[i] -= 1
+                else:
+                    self.classes[i] = cls
+                    self.confidence[i] = 1
+        self.updates += 1
+
+    def get_class(self, int x, int y, int w, int h, int min_confidence=2):
+        """
+            returns the class covering most of the cells in this area,
+            or UNKNOWN if no class covers at least half of them
+        """
+        cdef int cx0, cy0, cx1, cy1, cx, cy, i
+        if not self.clip(x, y, w, h, &cx0, &cy0, &cx1, &cy1):
+            return UNKNOWN
+        cdef int counts[5]
+        memset(counts, 0, sizeof(counts))
+        for cy in range(cy0, cy1+1):
+            for cx in range(cx0, cx1+1):
+                i = cy*self.cols+cx
+                if self.confidence[i]>=min_confidence:
+                    counts[self.classes[i]] += 1
+        cdef int total = (cx1-cx0+1)*(cy1-cy0+1)
+        for i in range(1, 5):
+            if counts[i]*2>=total:
+                return i
+        return UNKNOWN
+
+    def get_info(self) -> dict:
+        cdef int n = self.cols*self.rows
+        cdef int counts[5]
+        memset(counts, 0, sizeof(counts))
+        cdef int i
+        for i in range(n):
+            if self.confidence[i]>0:
+                counts[self.classes[i]] += 1
+        return {
+            "cell-size" : self.cell_size,
+            "grid"      : (self.cols, self.rows),
+            "updates"   : self.updates,
+            "cells"     : dict((CLASS_NAMES[i], counts[i]) for i in range(1, 5) if counts[i]),
+            }
@@ -0,0 +1,334 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+#cython: auto_pickle=False, boundscheck=False, wraparound=False, cdivision=True, language_level=3
+
+from libc.stdint cimport int32_t     #pylint: disable=syntax-error
+from libc.stdlib cimport malloc, free
+from libc.string cimport memset
+
+from xpra.rectangle import rectangle    #@UnresolvedImport
+
+cdef extern from "math.h":
+    double exp(double x)
+    double sqrt(double x)
+    double ceil(double x)
+
+#cells are at least this many pixels wide and high:
+cdef int MIN_CELL_SIZE = 16
+#the grid is made coarser for large windows, so that it never has more cells than this:
+cdef int MAX_CELLS = 4096
+#renormalize the accumulated values before they can overflow:
+cdef double MAX_EXPONENT = 20
+
+
+cdef inline int imin(int a, int b) nogil:
+    return a if a<b else b
+
+cdef inline int imax(int a, int b) nogil:
+    return a if a>b else b
+
+
+cdef class DamageHeatmap:
+    """
+        A coarse grid covering the window, each cell accumulates the damage events that touch it
+        with an exponential decay, so adding an event only costs the number of cells it covers
+        and the damage rates are available without walking the damage event history.
+        For each cell we record:
+        * the number of events that touched it (decayed)
+        * the proportion of the cell's pixels that got damaged (decayed)
+        * the exact bounds of the recent damage within the cell,
+          so the regions extracted are not rounded to the cell size.
+        Rather than decaying every cell on each update, new values are inflated
+        by exp((t-origin)/decay), and scaled back down when reading them.
+    """
+    cdef readonly int width
+    cdef readonly int height
+    cdef readonly int cell_size
+    cdef readonly int cols
+    cdef readonly int rows
+    cdef readonly double decay
+    cdef double origin
+    cdef double events
+    cdef double *touched
+    cdef double *damaged
+    cdef int32_t *bounds
+    cdef int32_t *labels
+    cdef int32_t *queue
+
+    def __cinit__(self, int width, int height, double decay=5):
+        assert width>0 and height>0, "invalid heatmap dimensions %ix%i" % (width, height)
+        assert decay>0, "invalid decay %f" % decay
+        self.width = width
+        self.height = height
+        self.decay = decay
+        self.cell_size = imax(MIN_CELL_SIZE, <int> ceil(sqrt(<double> width*height/MAX_CELLS)))
+        while True:
+            self.cols = (width+self.cell_size-1)//self.cell_size
+            self.rows = (height+self.cell_size-1)//self.cell_size
+            if self.cols*self.rows<=MAX_CELLS:
+                break
+            self.cell_size += 1
+        cdef int n = self.cols*self.rows
+        self.touched = <double*> malloc(n*sizeof(double))
+        self.damaged = <double*> malloc(n*sizeof(double))
+        self.bounds = <int32_t*> malloc(n*4*sizeof(int32_t))
+        self.labels = <int32_t*> malloc(n*sizeof(int32_t))
+        self.queue = <int32_t*> malloc(n*sizeof(int32_t))
+        assert self.touched!=NULL and self.damaged!=NULL and self.bounds!=NULL and \
+            self.labels!=NULL and self.queue!=NULL, "heatmap memory allocation failed"
+        self.reset()
+
+    def __dealloc__(self):
+        free(self.touched)
+        self.touched = NULL
+        free(self.damaged)
+        self.damaged = NULL
+        free(self.bounds)
+        self.bounds = NULL
+        free(self.labels)
+        self.labels = NULL
+        free(self.queue)
+        self.queue = NULL
+
+    def __repr__(self):
+        return "DamageHeatmap(%ix%i: %ix%i cells of %i pixels)" % (
+            self.width, self.height, self.cols, self.rows, self.cell_size)
+
+    def reset(self):
+        cdef int n = self.cols*self.rows
+        memset(self.touched, 0, n*sizeof(double))
+        memset(self.damaged, 0, n*sizeof(double))
+        memset(self.bounds, 0, n*4*sizeof(int32_t))
+        self.origin = 0
+        self.events = 0
+
+    cdef double scale(self, double now):
+        #multiply the stored values by this to get their decayed value at 'now':
+        return exp((self.origin-now)/self.decay)
+
+    cdef void renormalize(self, double t):
+        cdef double f = self.scale(t)
+        cdef int i
+        for i in range(self.cols*self.rows):
+            self.touched[i] *= f
+            self.damaged[i] *= f
+        self.events *= f
+        self.origin = t
+
+    def add(self, double t, int x, int y, int w, int h):
+        """ records a damage event, the rectangle is clipped to the window """
+        cdef int x2 = imin(self.width, x+w)
+        cdef int y2 = imin(self.height, y+h)
+        x = imax(0, x)
+        y = imax(0, y)
+        if x2<=x or y2<=y:
+            return
+        if self.origin==0 and self.events==0:
+            self.origin = t
+        elif (t-self.origin)/self.decay>MAX_EXPONENT:
+            self.renormalize(t)
+        cdef double inflate = exp((t-self.origin)/self.decay)
+        #a cell whose decayed value is below this has not been damaged recently:
+        cdef double stale = 0.5*inflate
+        cdef int cs = self.cell_size
+        cdef double cell_area = cs*cs
+        cdef int cx, cy, i, bx, by, bx2, by2
+        cdef int32_t *b
+        self.events += inflate
+        for cy in range(y//cs, (y2-1)//cs+1):
+            by = imax(y, cy*cs)
+            by2 = imin(y2, (cy+1)*cs)
+            for cx in range(x//cs, (x2-1)//cs+1):
+                bx = imax(x, cx*cs)
+                bx2 = imin(x2, (cx+1)*cs)
+                i = cy*self.cols+cx
+                b = self.bounds+i*4
+                if self.touched[i]<stale:
+                    b[0] = bx
+                    b[1] = by
+                    b[2] = bx2
+                    b[3] = by2
+                else:
+                    b[0] = imin(b[0], bx)
+                    b[1] = imin(b[1], by)
+                    b[2] = imax(b[2], bx2)
+                    b[3] = imax(b[3], by2)
+                self.touched[i] += inflate
+                self.damaged[i] += inflate*(bx2-bx)*(by2-by)/cell_area
+
+    def get_event_count(self, double now):
+        """ the decayed number of damage events """
+        return self.events*self.scale(now)
+
+    cdef double overlap(self, int i, int x, int y, int x2, int y2):
+        #proportion of the damaged area of cell 'i' within the rectangle x,y,x2,y2
+        cdef int32_t *b = self.bounds+i*4
+        cdef int area = (b[2]-b[0])*(b[3]-b[1])
+        cdef int ow = imin(x2, b[2])-imax(x, b[0])
+        cdef int oh = imin(y2, b[3])-imax(y, b[1])
+        if ow<=0 or oh<=0 or area<=0:
+            return 0
+        return <double> (ow*oh)/area
+
+    cdef double damaged_in(self, int x, int y, int x2, int y2):
+        #the sum of the stored damage values for the cells within x,y,x2,y2,
+        #weighted by how much of the damaged area of each cell is covered:
+        cdef int cs = self.cell_size
+        cdef double total = 0
+        cdef int cx, cy, i
+        x = imax(0, x)
+        y = imax(0, y)
+        x2 = imin(self.width, x2)
+        y2 = imin(self.height, y2)
+        if x2<=x or y2<=y:
+            return 0
+        for cy in range(y//cs, (y2-1)//cs+1):
+            for cx in range(x//cs, (x2-1)//cs+1):
+                i = cy*self.cols+cx
+                if self.damaged[i]>0:
+                    total += self.damaged[i]*self.overlap(i, x, y, x2, y2)
+        return total
+
+    def get_rate(self, double now, int x, int y, int w, int h):
+        """
+            the number of times per second that the area is being fully repainted,
+            (assuming the damage rate is stable: the decayed sum converges to rate*decay)
+        """
+        if w<=0 or h<=0:
+            return 0
+        cdef double cell_area = self.cell_size*self.cell_size
+        cdef double frames = self.damaged_in(x, y, x+w, y+h)*self.scale(now)*cell_area/(w*h)
+        return frames/self.decay
+
+    def get_in_out(self, double now, regions):
+        """
+            returns the number of damaged pixels (decayed) inside and outside the regions given
+        """
+        cdef int i, n = self.cols*self.rows
+        cdef double total = 0
+        for i in range(n):
+            total += self.damaged[i]
+        cdef double incount = 0
+        for r in regions:
+            incount += self.damaged_in(r.x, r.y, r.x+r.width, r.y+r.height)
+        cdef double f = self.scale(now)*self.cell_size*self.cell_size
+        incount = min(incount, total)
+        return int(incount*f), int((total-incount)*f)
+
+    def get_damaged_ratio(self, double now, int x, int y, int w, int h):
+        """ the proportion of the area that has been damaged recently """
+        cdef int cs = self.cell_size
+        cdef double threshold = 0.5/self.scale(now)
+        cdef int x2 = imin(self.width, x+w)
+        cdef int y2 = imin(self.height, y+h)
+        x = imax(0, x)
+        y = imax(0, y)
+        if x2<=x or y2<=y:
+            return 0
+        cdef int cx, cy, i, bx, by, bx2, by2
+        cdef int32_t *b
+        cdef long damaged = 0
+        for cy in range(y//cs, (y2-1)//cs+1):
+            for cx in range(x//cs, (x2-1)//cs+1):
+                i = cy*self.cols+cx
+                if self.touched[i]<threshold:
+                    continue
+                b = self.bounds+i*4
+                bx = imax(x, b[0])
+                by = imax(y, b[1])
+                bx2 = imin(x2, b[2])
+                by2 = imin(y2, b[3])
+                if bx2>bx and by2>by:
+                    damaged += (bx2-bx)*(by2-by)
+        return <double> damaged/((x2-x)*(y2-y))
+
+    def get_regions(self, double now, double min_rate=2, int hot_ratio=25,
+                    int min_w=0, int min_h=0, int merge_distance=64, int max_regions=4):
+        """
+            Returns the regions made of connected 'hot' cells, the most damaged regions first.
+            Cells are hot when they are touched by at least 'min_rate' events per second
+            and by at least 'hot_ratio' percent as many events as the hottest cell.
+            Regions separated by less than 'merge_distance' pixels are merged
+            if most of the combined area is hot.
+        """
+        cdef int n = self.cols*self.rows
+        cdef int i, j, k, cx, cy, head, tail, label = 0
+        cdef int nb[4]
+        cdef double hottest = 0
+        for i in range(n):
+            if self.touched[i]>hottest:
+                hottest = self.touched[i]
+        #the threshold, in the inflated units:
+        cdef double threshold = max(min_rate*self.decay/self.scale(now), hottest*hot_ratio/100.0)
+        if hottest<=0 or hottest<threshold:
+            return []
+        for i in range(n):
+            self.labels[i] = -1 if self.touched[i]>=threshold else 0
+        cdef int32_t *b
+        cdef int x1, y1, x2, y2
+        cdef long area
+        cdef double heat
+        components = []
+        for i in range(n):
+            if self.labels[i]!=-1:
+                continue
+            #flood fill this component:
+            label += 1
+            self.labels[i] = label
+            self.queue[0] = i
+            head, tail = 0, 1
+            x1, y1, x2, y2 = self.width, self.height, 0, 0
+            area = 0
+            heat = 0
+            while head<tail:
+                j = self.queue[head]
+                head += 1
+                b = self.bounds+j*4
+                x1 = imin(x1, b[0])
+                y1 = imin(y1, b[1])
+                x2 = imax(x2, b[2])
+                y2 = imax(y2, b[3])
+                area += (b[2]-b[0])*(b[3]-b[1])
+                heat += self.damaged[j]
+                cx = j%self.cols
+                cy = j//self.cols
+                nb[0] = j-1 if cx>0 else -1
+                nb[1] = j+1 if cx<self.cols-1 else -1
+                nb[2] = j-self.cols if cy>0 else -1
+                nb[3] = j+self.cols if cy<self.rows-1 else -1
+                for k in nb:
+                    if k>=0 and self.labels[k]==-1:
+                        self.labels[k] = label
+                        self.queue[tail] = k
+                        tail += 1
+            components.append([x1, y1, x2, y2, area, heat])
+        #merge the components that are close to each other,
+        #as long as most of the merged area is damaged:
+        merged = True
+        while merged and len(components)>1:
+            merged = False
+            for a in range(len(components)):
+                for c in range(a+1, len(components)):
+                    r1 = components[a]
+                    r2 = components[c]
+                    gap = max(r1[0]-r2[2], r2[0]-r1[2], r1[1]-r2[3], r2[1]-r1[3])
+                    if gap>merge_distance:
+                        continue
+                    mx1, my1 = min(r1[0], r2[0]), min(r1[1], r2[1])
+                    mx2, my2 = max(r1[2], r2[2]), max(r1[3], r2[3])
+                    if (r1[4]+r2[4])*10<(mx2-mx1)*(my2-my1)*6:
+                        continue
+                    components[a] = [mx1, my1, mx2, my2, r1[4]+r2[4], r1[5]+r2[5]]
+                    del components[c]
+                    merged = True
+                    break
+                if merged:
+                    break
+        regions = [(heat, rectangle(x1, y1, x2-x1, y2-y1)) for x1, y1, x2, y2, _, heat in components
+                   if x2-x1>=min_w and y2-y1>=min_h]
+        regions.sort(key=lambda v : -v[0])
+        return [r for _, r in regions[:max_regions]]
@@ -0,0 +1,214 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import zlib
+import struct
+from time import time
+from queue import Queue, Full
+
+from xpra.os_util import monotonic_time, strtobytes, bytestostr
+from xpra.util import envint
+from xpra.make_thread import start_thread
+from xpra.server.window.pipeline_trace import create_trace_file
+from xpra.log import Logger
+
+log = Logger("damage")
+
+MAX_SIZE = envint("XPRA_DAMAGE_TRACE_MAX_SIZE", 1024*1024*1024)
+PIXELS_COMPRESSION = envint("XPRA_DAMAGE_TRACE_COMPRESSION", 1)
+#records are dropped when the write thread falls this far behind:
+MAX_QUEUE = envint("XPRA_DAMAGE_TRACE_MAX_QUEUE", 256)
+
+#The trace file starts with a header:
+#  MAGIC, flags (u8), start time (double, seconds since the epoch)
+#followed by records, which all start with:
+#  record type (u8), wid (u32), time since the start of the trace (double)
+#and the record type specific fields:
+#  DAMAGE: x, y, w, h, window width, window height
+#  REGION: x, y, w, h, encoding (16 bytes)
+#  PIXELS: x, y, w, h, rowstride, pixel format (8 bytes), compressed size,
+#          followed by the zlib compressed pixel data
+MAGIC = b"XPRADMG1"
+HEADER = struct.Struct("<Bd")
+RECORD = struct.Struct("<BId")
+DAMAGE, REGION, PIXELS = 1, 2, 3
+FIELDS = {
+    DAMAGE  : struct.Struct("<iiIIII"),
+    REGION  : struct.Struct("<iiII16s"),
+    PIXELS  : struct.Struct("<iiIII8sI"),
+    }
+FLAG_PIXELS = 1
+
+
+class DamageTraceRecorder:
+    """
+        Records the damage events, the regions sent and (optionally) pixel snapshots.
+        The damage path only queues the records,
+        they are packed, compressed and written to disk from a separate thread.
+        When a window is shown by more than one client,
+        only the first window source records it.
+    """
+
+    def __init__(self):
+        self.recording = False
+        self.pixels = False
+        self.filename = None
+        self.start_time = 0
+        self.records = 0
+        self.dropped = 0
+        self.size = 0
+        self.queue = None
+        self.thread = None
+        self.owners = {}
+
+    def __repr__(self):
+        return "DamageTraceRecorder(%s)" % self.filename
+
+    def start(self, filename=None, pixels=False):
+        if self.recording:
+            raise Exception("a damage trace is already being recorded to '%s'" % self.filename)
+        filename, fd = create_trace_file(filename, "xpra-damage-%i-" % os.getpid(), ".trace")
+        f = os.fdopen(fd, "wb")
+        f.write(MAGIC+HEADER.pack(FLAG_PIXELS if pixels else 0, time()))
+        self.filename = filename
+        self.pixels = pixels
+        self.start_time = monotonic_time()
+        self.records = 0
+        self.dropped = 0
+        self.size = f.tell()
+        self.owners = {}
+        self.queue = Queue(maxsize=MAX_QUEUE)
+        self.thread = start_thread(self.write_loop, "damage-trace", daemon=True, args=(f, self.queue))
+        self.recording = True
+        log("damage trace started, saving to '%s'", filename)
+        return filename
+
+    def stop(self, wait=False):
+        if not self.recording:
+            return None
+        self.recording = False
+        self.queue.put(None)
+        log("damage trace stopped after %i records, %i dropped", self.records, self.dropped)
+        if wait:
+            self.thread.join()
+        return self.filename
+
+    def is_owner(self, source, wid) -> bool:
+        return self.owners.setdefault(wid, source) is source
+
+    def remove_source(self, source):
+        for wid, owner in tuple(self.owners.items()):
+            if owner is source:
+                self.owners.pop(wid, None)
+
+    def add(self, item) -> bool:
+        try:
+            self.queue.put_nowait(item)
+            return True
+        except Full:
+            self.dropped += 1
+            return False
+
+    def damage(self, source, wid, x, y, w, h, ww, wh):
+        if self.is_owner(source, wid):
+            self.add((DAMAGE, wid, monotonic_time()-self.start_time, (x, y, w, h, ww, wh), None))
+
+    def region(self, source, wid, x, y, w, h, coding, image):
+        if not self.is_owner(source, wid):
+            return
+        t = monotonic_time()-self.start_time
+        if not self.add((REGION, wid, t, (x, y, w, h, strtobytes(coding)), None)):
+            return
+        if self.pixels and image and image.get_planes()==0:
+            if self.queue.full():
+                self.dropped += 1
+                return
+            #copy the pixels now, the image may be freed before the write thread gets to them:
+            pixels = bytes(image.get_pixels())
+            pixel_format = strtobytes(image.get_pixel_format())
+            self.add((PIXELS, wid, t, (x, y, w, h, image.get_rowstride(), pixel_format), pixels))
+
+    def write_loop(self, f, queue):
+        try:
+            while True:
+                item = queue.get()
+                if item is None:
+                    break
+                rtype, wid, t, fields, pixels = item
+                if pixels is not None:
+                    pixels = zlib.compress(pixels, PIXELS_COMPRESSION)
+                    fields = fields+(len(pixels),)
+                data = RECORD.pack(rtype, wid, t)+FIELDS[rtype].pack(*fields)
+                f.write(data)
+                self.size += len(data)
+                if pixels is not None:
+                    f.write(pixels)
+                    self.size += len(pixels)
+                self.records += 1
+                if self.size>MAX_SIZE:
+                    log.warn("Warning: damage trace size limit reached, recording stopped")
+                    self.recording = False
+                    break
+        except Exception as e:
+            log("write_loop()", exc_info=True)
+            log.error("Error writing the damage trace to '%s':", self.filename)
+            log.error(" %s", e)
+            self.recording = False
+        finally:
+            f.close()
+        log.info("saved %i damage trace records to '%s'", self.records, self.filename)
+
+    def get_info(self) -> dict:
+        info = {"active" : self.recording}
+        if self.recording:
+            info.update({
+                "filename"  : self.filename,
+                "pixels"    : self.pixels,
+                "records"   : self.records,
+                "dropped"   : self.dropped,
+                "size"      : self.size,
+                })
+        return info
+
+
+damage_trace = DamageTraceRecorder()
+
+def get_damage_trace():
+    return damage_trace
+
+
+def read_trace(filename):
+    """
+        returns the trace flags and a generator for the records:
+        (record type, wid, time, fields, pixels)
+    """
+    f = open(filename, "rb")
+    header = f.read(len(MAGIC)+HEADER.size)
+    if header[:len(MAGIC)]!=MAGIC:
+        f.close()
+        raise ValueError("'%s' is not a damage trace file" % filename)
+    flags = HEADER.unpack(header[len(MAGIC):])[0]
+    def records():
+        with f:
+            while True:
+                data = f.read(RECORD.size)
+                if len(data)<RECORD.size:
+                    return
+                rtype, wid, t = RECORD.unpack(data)
+                fmt = FIELDS.get(rtype)
+                if not fmt:
+                    raise ValueError("invalid record type %i" % rtype)
+                fields = fmt.unpack(f.read(fmt.size))
+                pixels = None
+                if rtype==REGION:
+                    fields = fields[:4]+(bytestostr(fields[4].rstrip(b"\0")), )
+                elif rtype==PIXELS:
+                    pixels = zlib.decompress(f.read(fields[-1]))
+                    fields = fields[:5]+(bytestostr(fields[5].rstrip(b"\0")), )
+                yield rtype, wid, t, fields, pixels
+    return flags, records()
+
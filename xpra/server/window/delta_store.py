@@ -0,0 +1,93 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+from xpra.buffers.cyxor import xor_delta   #@UnresolvedImport
+from xpra.os_util import memoryview_to_bytes
+from xpra.log import Logger
+
+log = Logger("encoding", "delta")
+
+
+class DeltaStore:
+    """
+        The last pixels sent for the most recently updated regions of a window,
+        the client keeps the same number of buckets and updates them in the same order.
+        When a region is sent again with the same geometry and pixel format,
+        we can send the xor of the old and new pixels instead:
+        for windows where only a small part of each update changes,
+        the delta is mostly zeroes and it compresses much better.
+        Each stored buffer is identified by a unique number
+        which the client must have in the bucket to apply a delta,
+        so any divergence is detected and triggers a decoding error.
+        The buckets are only ever accessed from the 'encode' thread,
+        except for 'reset' which drops all of them.
+    """
+
+    def __init__(self, buckets, max_bytes, max_changed=50):
+        self.buckets = [None]*buckets
+        self.max_bytes = max_bytes
+        #don't use a delta if more than this percentage of the pixels have changed:
+        self.max_changed = max_changed
+        self.counter = 0
+        self.hits = 0
+        self.misses = 0
+        self.skipped = 0
+        self.resets = 0
+
+    def __repr__(self):
+        return "DeltaStore(%i)" % len(self.buckets)
+
+    def reset(self):
+        self.buckets = [None]*len(self.buckets)
+        self.resets += 1
+
+    def get_info(self) -> dict:
+        return {
+            "buckets"   : len(self.buckets),
+            "used"      : sum(1 for x in self.buckets if x),
+            "hits"      : self.hits,
+            "misses"    : self.misses,
+            "skipped"   : self.skipped,
+            "resets"    : self.resets,
+            }
+
+    def delta(self, key, pixels, max_changed=None):
+        """
+            Stores the pixels for the region identified by 'key',
+            returns the data to send (the xor delta or the pixels)
+            and the client options describing it.
+        """
+        if max_changed is None:
+            max_changed = self.max_changed
+        if len(pixels)>self.max_bytes:
+            return pixels, {}
+        buckets = self.buckets
+        self.counter += 1
+        index = -1
+        data = pixels
+        options = {}
+        for i, bucket in enumerate(buckets):
+            if bucket and bucket[0]==key:
+                index = i
+                _, store, ref, _ = bucket
+                delta, changed = xor_delta(pixels, ref)
+                if changed*100<=max_changed*(len(pixels)//8+1):
+                    data = delta
+                    options["delta"] = store
+                    self.hits += 1
+                else:
+                    self.skipped += 1
+                break
+        else:
+            self.misses += 1
+            #use a free bucket, or the least recently used one:
+            index = min(range(len(buckets)), key=lambda i : buckets[i][3] if buckets[i] else -1)
+        #we have to copy the pixels since the image may be freed:
+        buckets[index] = key, self.counter, memoryview_to_bytes(pixels), self.counter
+        options["store"] = self.counter
+        options["bucket"] = index
+        log("delta(%s, %i bytes)=%s", key, len(pixels), options)
+        return data, options
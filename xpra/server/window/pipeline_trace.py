@@ -0,0 +1,159 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+import os
+import json
+import tempfile
+from threading import Lock
+
+from xpra.os_util import monotonic_time, umask_context
+from xpra.util import envint
+from xpra.make_thread import start_thread
+from xpra.log import Logger
+
+log = Logger("stats")
+
+MAX_EVENTS = envint("XPRA_PIPELINE_TRACE_MAX_EVENTS", 1000*1000)
+
+#the stages of the damage pipeline, in the order they happen:
+PIPELINE_STAGES = (
+    "damage-capture",       #damage event received until the pixels are captured (includes batching)
+    "capture-encode",       #waiting in the encode queue
+    "encode",               #compression
+    "queue-send",           #waiting in the packet queue and writing to the socket
+    "send-ack",             #until the client acknowledges the frame (includes decoding)
+    )
+
+
+def create_trace_file(filename, prefix, suffix):
+    """
+        Creates a new file for writing a trace,
+        existing files and symlinks are never followed or overwritten.
+        Returns the absolute filename and the file descriptor.
+    """
+    if not filename:
+        fd, filename = tempfile.mkstemp(prefix=prefix, suffix=suffix)
+        return filename, fd
+    filename = os.path.abspath(os.path.expanduser(filename))
+    flags = os.O_CREAT | os.O_EXCL | os.O_WRONLY | getattr(os, "O_BINARY", 0)
+    with umask_context(0o177):
+        fd = os.open(filename, flags)
+    return filename, fd
+
+
+class PipelineTrace:
+    """
+        Records the damage pipeline stages of all the windows
+        for a limited amount of time,
+        and saves them in the Chrome trace event format
+        which can be loaded in chrome://tracing or https://ui.perfetto.dev
+    """
+
+    def __init__(self):
+        self.lock = Lock()
+        self.events = None
+        self.filename = None
+        self.fd = -1
+        self.start_time = 0
+        self.end_time = 0
+        self.dropped = 0
+
+    def __repr__(self):
+        return "PipelineTrace(%s)" % self.filename
+
+    def is_active(self) -> bool:
+        return self.events is not None
+
+    def start(self, duration=10, filename=None):
+        with self.lock:
+            if self.events is not None:
+                raise Exception("pipeline trace is already active, saving to '%s'" % self.filename)
+            self.filename, self.fd = create_trace_file(filename, "xpra-pipeline-%i-" % os.getpid(), ".json")
+            self.start_time = monotonic_time()
+            self.end_time = self.start_time+duration
+            self.dropped = 0
+            self.events = []
+        log("pipeline trace started for %i seconds, saving to '%s'", duration, self.filename)
+        return self.filename
+
+    def add(self, wid, stage, start, end, **args):
+        if self.events is None or end>self.end_time:
+            return
+        #"complete" event, with timestamps in microseconds:
+        event = {
+            "name"  : stage,
+            "cat"   : "damage",
+            "ph"    : "X",
+            "pid"   : 0,
+            "tid"   : wid,
+            "ts"    : int(start*1000*1000),
+            "dur"   : max(0, int((end-start)*1000*1000)),
+            "args"  : args,
+            }
+        with self.lock:
+            events = self.events
+            if events is None:
+                return
+            if len(events)>=MAX_EVENTS:
+                self.dropped += 1
+                return
+            events.append(event)
+
+    def stop(self, wait=False):
+        with self.lock:
+            events = self.events
+            self.events = None
+            fd = self.fd
+            self.fd = -1
+        if events is None:
+            return None
+        filename = self.filename
+        log("pipeline trace stopped, %i events (%i dropped)", len(events), self.dropped)
+        t = start_thread(self.save, "save-pipeline-trace", daemon=True, args=(filename, fd, events))
+        if wait:
+            t.join()
+        return filename
+
+    def save(self, filename, fd, events):
+        #name the "threads" after the window they represent:
+        wids = sorted(set(event["tid"] for event in events))
+        metadata = [{
+            "name"  : "thread_name",
+            "ph"    : "M",
+            "pid"   : 0,
+            "tid"   : wid,
+            "args"  : {"name" : "window %i" % wid},
+            } for wid in wids]
+        try:
+            with os.fdopen(fd, "w") as f:
+                json.dump({
+                    "traceEvents"       : metadata+events,
+                    "displayTimeUnit"   : "ms",
+                    }, f)
+        except Exception as e:
+            log("save(%s, %i events)", filename, len(events), exc_info=True)
+            log.error("Error saving the pipeline trace to '%s':", filename)
+            log.error(" %s", e)
+        else:
+            log.info("saved %i pipeline trace events to '%s'", len(events), filename)
+
+    def get_info(self) -> dict:
+        info = {"active" : self.is_active()}
+        events = self.events
+        if events is not None:
+            info.update({
+                "filename"  : self.filename,
+                "events"    : len(events),
+                "dropped"   : self.dropped,
+                "remaining" : max(0, int(self.end_time-monotonic_time())),
+                })
+        return info
+
+
+pipeline_trace = PipelineTrace()
+
+def get_pipeline_trace():
+    return pipeline_trace
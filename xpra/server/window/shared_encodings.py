@@ -0,0 +1,155 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+from collections import OrderedDict
+from threading import Lock, Event
+
+from xpra.util import envint
+from xpra.os_util import monotonic_time
+from xpra.log import Logger
+
+log = Logger("encoding")
+
+#how long the other clients have to use the compressed data (in milliseconds):
+TTL = envint("XPRA_SHARED_ENCODINGS_TTL", 2000)
+MAX_SIZE = envint("XPRA_SHARED_ENCODINGS_MAX_SIZE", 64)*1024*1024
+#how long to wait for another client's encoder (in milliseconds):
+WAIT = envint("XPRA_SHARED_ENCODINGS_WAIT", 1000)
+
+
+class SharedEntry:
+    __slots__ = ("event", "value", "size", "created", "elapsed")
+    def __init__(self):
+        self.event = Event()
+        self.value = None
+        self.size = 0
+        self.created = monotonic_time()
+        self.elapsed = 0
+
+
+class SharedEncodings:
+    """
+        When several clients show the same window (session sharing or read-only viewers),
+        each one has its own window source which encodes every frame.
+        Clients which end up encoding the same pixels with the same encoder parameters
+        can share the result: the first window source to request a frame encodes it,
+        and the others find it here - or wait for it if the encoding is still in progress.
+        The key must include everything that can change the encoder's output.
+        Each window source still runs its own batching and quality and speed tuning,
+        so slow clients simply end up using different keys, or dropping frames.
+        This is only used for windows that have more than one source.
+    """
+
+    def __init__(self, max_size=MAX_SIZE, ttl=TTL):
+        self.max_size = max_size
+        self.ttl = ttl/1000
+        self.lock = Lock()
+        self.entries = OrderedDict()
+        self.sources = {}
+        self.size = 0
+        self.hits = 0
+        self.misses = 0
+        self.waits = 0
+        self.saved_bytes = 0
+        self.saved_time = 0
+
+    def __repr__(self):
+        return "SharedEncodings(%i)" % len(self.entries)
+
+    def add_source(self, wid):
+        with self.lock:
+            self.sources[wid] = self.sources.get(wid, 0)+1
+
+    def remove_source(self, wid):
+        with self.lock:
+            count = self.sources.get(wid, 0)-1
+            if count>0:
+                self.sources[wid] = count
+                return
+            self.sources.pop(wid, None)
+            #no-one else can use those:
+            for key in tuple(k for k in self.entries if k[0]==wid):
+                self.drop(key)
+
+    def is_shared(self, wid) -> bool:
+        return self.sources.get(wid, 0)>1
+
+    def get(self, key):
+        """
+            Returns the encoder output for this key, or None.
+            When None is returned, the caller should encode the image
+            and it must then call 'set' - even if the encoding failed.
+        """
+        with self.lock:
+            self.expire()
+            entry = self.entries.get(key)
+            if entry is None:
+                self.entries[key] = SharedEntry()
+                self.misses += 1
+                return None
+            self.entries.move_to_end(key)
+        if not entry.event.is_set():
+            self.waits += 1
+            entry.event.wait(WAIT/1000)
+        value = entry.value
+        if value is None:
+            return None
+        self.hits += 1
+        self.saved_bytes += entry.size
+        self.saved_time += entry.elapsed
+        #the client options are modified by each window source:
+        return value[:2]+(dict(value[2]),)+value[3:]
+
+    def set(self, key, value):
+        with self.lock:
+            entry = self.entries.get(key)
+            if entry is None:
+                entry = self.entries[key] = SharedEntry()
+            if value:
+                size = len(value[1])
+                value = tuple(value)
+                entry.value = value[:2]+(dict(value[2]),)+value[3:]
+                entry.elapsed = monotonic_time()-entry.created
+                self.size += size-entry.size
+                entry.size = size
+            else:
+                #let the other window sources encode it themselves:
+                log("shared encoding failed for %s", key[:6])
+                self.entries.pop(key, None)
+            entry.event.set()
+            while self.size>self.max_size and self.entries:
+                self.drop(next(iter(self.entries)))
+
+    def expire(self):
+        """ the lock must be held """
+        limit = monotonic_time()-self.ttl
+        while self.entries:
+            key, entry = next(iter(self.entries.items()))
+            if entry.created>limit:
+                break
+            self.drop(key)
+
+    def drop(self, key):
+        """ the lock must be held """
+        entry = self.entries.pop(key)
+        self.size -= entry.size
+        entry.event.set()
+
+    def get_info(self) -> dict:
+        return {
+            "windows"       : sum(1 for count in self.sources.values() if count>1),
+            "entries"       : len(self.entries),
+            "size"          : self.size,
+            "max-size"      : self.max_size,
+            "hits"          : self.hits,
+            "misses"        : self.misses,
+            "waits"         : self.waits,
+            "saved-bytes"   : self.saved_bytes,
+            "saved-ms"      : int(self.saved_time*1000),
+            }
+
+
+shared_encodings = SharedEncodings()
@@ -0,0 +1,122 @@
+# -*- coding: utf-8 -*-
+# This file is part of Xpra.
+# Copyright (C) 2021 Antoine Martin <antoine@xpra.org>
+# Xpra is released under the terms of the GNU GPL v2, or, at your option, any
+# later version. See the file COPYING for details.
+
+from xpra.util import csv
+from xpra.log import Logger
+
+log = Logger("video", "subregion")
+
+
+class VideoStream:
+    """
+        The video pipeline (csc + encoder) for one of the secondary video regions of a window.
+        The main video region uses the pipeline attributes of the WindowVideoSource itself,
+        the extra ones are identified by their stream number which the client uses
+        to pick the matching decoder.
+        The pipeline objects are only ever accessed from the 'encode' thread.
+    """
+
+    def __init__(self, stream, rect):
+        self.stream = stream
+        self.rectangle = rect
+        self.csc_encoder = None
+        self.video_encoder = None
+        #safe defaults until we have a pipeline,
+        #all the video encoders can deal with even dimensions:
+        self.width_mask = 0xFFFE
+        self.height_mask = 0xFFFE
+        self.actual_scaling = (1, 1)
+        self.frames = 0
+
+    def __repr__(self):
+        return "VideoStream(%i : %s)" % (self.stream, self.rectangle)
+
+    def get_masked_rectangle(self):
+        r = self.rectangle
+        return r.x, r.y, r.width & self.width_mask, r.height & self.height_mask
+
+    def set_pipeline(self, csce, ve, scaling, width_mask, height_mask):
+        self.csc_encoder = csce
+        self.video_encoder = ve
+        self.actual_scaling = scaling
+        self.width_mask = width_mask
+        self.height_mask = height_mask
+        self.frames = 0
+
+    def check(self, encodings, width, height, src_format) -> bool:
+        """ is the current pipeline still valid for this input? """
+        ve = self.video_encoder
+        csce = self.csc_encoder
+        if ve is None or ve.is_closed():
+            return False
+        if ve.get_encoding() not in encodings:
+            log("%s: invalid encoding %s, expected one of: %s", self, ve.get_encoding(), csv(encodings))
+            return False
+        if csce:
+            if csce.is_closed() or csce.get_src_format()!=src_format:
+                return False
+            if csce.get_src_width()!=width or csce.get_src_height()!=height:
+                log("%s: csc dimensions have changed from %ix%i to %ix%i",
+                    self, csce.get_src_width(), csce.get_src_height(), width, height)
+                return False
+            return csce.get_dst_format()==ve.get_src_format() and \
+                ve.get_width()==csce.get_dst_width() and ve.get_height()==csce.get_dst_height()
+        if ve.get_src_format()!=src_format:
+            return False
+        return ve.get_width()==width and ve.get_height()==height
+
+    def compress(self, image, width, height, quality, speed, options):
+        """
+            converts and compresses the image,
+            returns the compressed data, client options and the encoded dimensions
+        """
+        csce = self.csc_encoder
+        ve = self.video_encoder
+        csc_image = image
+        enc_width, enc_height = width, height
+        if csce:
+            csc_image = csce.convert_image(image)
+            if not csc_image:
+                raise Exception("conversion of %s to %s failed" % (image, csce.get_dst_format()))
+            enc_width, enc_height = csce.get_dst_width(), csce.get_dst_height()
+        try:
+            ret = ve.compress_image(csc_image, quality, speed, options)
+        finally:
+            if csc_image is not image:
+                csc_image.free()
+        if not ret:
+            return None
+        data, client_options = ret
+        client_options["stream"] = self.stream
+        if csce and "scaled_size" not in client_options and (enc_width!=width or enc_height!=height):
+            client_options["scaled_size"] = enc_width, enc_height
+        self.frames += 1
+        return data, client_options
+
+    def clean(self):
+        csce = self.csc_encoder
+        ve = self.video_encoder
+        self.csc_encoder = None
+        self.video_encoder = None
+        if csce:
+            csce.clean()
+        if ve:
+            ve.clean()
+        return ve is not None
+
+    def get_info(self) -> dict:
+        r = self.rectangle
+        info = {
+            "rectangle" : (r.x, r.y, r.width, r.height),
+            "scaling"   : self.actual_scaling,
+            "frames"    : self.frames,
+            }
+        for prefix, x in (("csc", self.csc_encoder), ("encoder", self.video_encoder)):
+            if x:
+                i = x.get_info()
+                i[""] = x.get_type()
+                info[prefix] = i
+        return info
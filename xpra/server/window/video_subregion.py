@@ -8,7 +8,8 @@ import math
 
 from xpra.os_util import monotonic_time
 from xpra.util import envint, envbool
-from xpra.rectangle import rectangle, add_rectangle, remove_rectangle, merge_all    #@UnresolvedImport
+from xpra.rectangle import rectangle, add_rectangle, remove_rectangle    #@UnresolvedImport
+from xpra.server.window.damage_heatmap import DamageHeatmap   #@UnresolvedImport
 from xpra.log import Logger
 
 sslog = Logger("regiondetect")
@@ -24,6 +25,17 @@ MIN_H = envint("XPRA_VIDEO_DETECT_MIN_HEIGHT", 96)
 
 RATIO_WEIGHT = envint("XPRA_VIDEO_DETECT_RATIO_WEIGHT", 80)
 KEEP_SCORE = envint("XPRA_VIDEO_DETECT_KEEP_SCORE", 160)
+#how long it takes for the damage heatmap to forget an event (time constant, in milliseconds):
+DECAY = max(1, envint("XPRA_VIDEO_DETECT_DECAY", MAX_TIME*1000))
+#minimum number of updates per second for an area to be considered as video:
+MIN_FPS = envint("XPRA_VIDEO_DETECT_MIN_FPS", 2)
+#the hot cells are damaged at least this often, relative to the most damaged one (percentage):
+HOT_RATIO = envint("XPRA_VIDEO_DETECT_HOT_RATIO", 25)
+MAX_REGIONS = max(1, envint("XPRA_VIDEO_DETECT_MAX_REGIONS", 4))
+#regions closer than this are merged if most of the merged area is damaged:
+MERGE_DISTANCE = envint("XPRA_VIDEO_DETECT_MERGE_DISTANCE", 64)
+#keep the current region if the new one overlaps this much (percentage):
+KEEP_OVERLAP = envint("XPRA_VIDEO_DETECT_KEEP_OVERLAP", 80)
 
 
 def scoreinout(ww, wh, region, incount, outcount):
@@ -67,7 +79,10 @@ class VideoSubregion:
         self.init_vars()
 
     def init_vars(self):
-        self.rectangle = None
+        self.rectangle = None   #the main video region
+        self.rectangles = []    #all the video regions, starting with the main one
+        self.heatmap = None
+        self.fed_count = 0      #value of the "damage event count" when we last updated the heatmap
         self.inout = 0, 0       #number of damage pixels within / outside the region
         self.score = 0
         self.fps = 0
@@ -115,6 +130,7 @@ class VideoSubregion:
             self.novideoregion("empty")
         else:
             self.rectangle = rectangle(x, y, w, h)
+            self.rectangles = [self.rectangle]
 
     def set_exclusion_zones(self, zones):
         rects = []
@@ -153,6 +169,7 @@ class VideoSubregion:
                      "width"        : r.width,
                      "height"       : r.height,
                      "rectangle"    : (r.x, r.y, r.width, r.height),
+                     "rectangles"   : tuple(r.get_geometry() for r in self.rectangles),
                      "set-at"       : self.set_at,
                      "time"         : int(self.time),
                      "min-time"     : int(self.min_time),
@@ -188,31 +205,34 @@ class VideoSubregion:
 
 
     def add_video_refresh(self, region):
-        #called by add_refresh_region if the video region got painted on
+        #called by add_refresh_region if one of the video regions got painted on
         #Note: this does not run in the UI thread!
-        rect = self.rectangle
-        if not rect:
+        rects = tuple(self.rectangles)
+        if not rects:
             return
         #something in the video region is still refreshing,
         #so we re-schedule the subregion refresh:
         self.cancel_refresh_timer()
         #add the new region to what we already have:
         add_rectangle(self.refresh_regions, region)
-        #do refresh any regions which are now outside the current video region:
+        #do refresh any regions which are now outside the current video regions:
         #(this can happen when the region moves or changes size)
         nonvideo = []
         for r in self.refresh_regions:
-            if not rect.contains_rect(r):
-                nonvideo += r.substract_rect(rect)
+            if not any(rect.contains_rect(r) for rect in rects):
+                outside = [r]
+                for rect in rects:
+                    outside = [x for o in outside for x in o.substract_rect(rect)]
+                nonvideo += outside
         delay = max(150, self.auto_refresh_delay)
-        refreshlog("add_video_refresh(%s) rectangle=%s, delay=%ims", region, rect, delay)
+        refreshlog("add_video_refresh(%s) rectangles=%s, delay=%ims", region, rects, delay)
         self.nonvideo_regions += nonvideo
         if self.nonvideo_regions:
             if not self.nonvideo_refresh_timer:
                 #refresh via timeout_add so this will run in the UI thread:
                 self.nonvideo_refresh_timer = self.timeout_add(delay, self.nonvideo_refresh)
-            #only keep the regions still in the video region:
-            inrect = (rect.intersection_rect(r) for r in self.refresh_regions)
+            #only keep the regions still in the video regions:
+            inrect = (rect.intersection_rect(r) for rect in rects for r in self.refresh_regions)
             self.refresh_regions = [r for r in inrect if r is not None]
         #re-schedule the video region refresh (if we have regions to fresh):
         if self.refresh_regions:
@@ -243,13 +263,14 @@ class VideoSubregion:
         #runs via timeout_add, safe to call UI!
         self.refresh_timer = 0
         regions = self.refresh_regions
-        rect = self.rectangle
-        if rect and len(regions)>=2:
-            #figure out if it makes sense to refresh the whole area,
+        if len(regions)>=2:
+            #for each video region, figure out if it makes sense to refresh the whole area,
             #or if we just send the list of smaller rectangles:
-            pixels = sum(r.width*r.height for r in regions)
-            if pixels>=rect.width*rect.height//2:
-                regions = [rect]
+            for rect in tuple(self.rectangles):
+                inrect = [r for r in regions if rect.contains_rect(r)]
+                pixels = sum(r.width*r.height for r in inrect)
+                if len(inrect)>=2 and pixels>=rect.width*rect.height//2:
+                    regions = [r for r in regions if r not in inrect]+[rect]
         refreshlog("refresh() calling %s with regions=%s", self.refresh_cb, regions)
         if self.refresh_cb(regions):
             self.refresh_regions = []
@@ -261,6 +282,7 @@ class VideoSubregion:
     def novideoregion(self, msg, *args):
         sslog("novideoregion: "+msg, *args)
         self.rectangle = None
+        self.rectangles = []
         self.time = 0
         self.set_at = 0
         self.counter = 0
@@ -286,39 +308,53 @@ class VideoSubregion:
                 rects = new_rects
         return rects
 
+    def get_heatmap(self, ww, wh):
+        hm = self.heatmap
+        if not hm or hm.width!=ww or hm.height!=wh:
+            hm = self.heatmap = DamageHeatmap(ww, wh, DECAY/1000)
+            self.fed_count = 0
+        return hm
+
+    def update_heatmap(self, ww, wh, damage_events_count, last_damage_events, from_time):
+        #only feed the events we have not seen yet:
+        hm = self.get_heatmap(ww, wh)
+        if damage_events_count<self.fed_count:
+            #stats got reset
+            self.fed_count = 0
+        n = min(len(last_damage_events), damage_events_count-self.fed_count)
+        self.fed_count = damage_events_count
+        for i in range(-n, 0):
+            t, x, y, w, h = last_damage_events[i]
+            if t<from_time:
+                continue
+            if self.exclusion_zones:
+                for r in self.excluded_rectangles(rectangle(int(x), int(y), int(w), int(h)), ww, wh):
+                    hm.add(t, r.x, r.y, r.width, r.height)
+            else:
+                hm.add(t, int(x), int(y), int(w), int(h))
+        return hm
+
     def identify_video_subregion(self, ww, wh, damage_events_count, last_damage_events, starting_at=0, children=None):
         if not self.enabled or not self.supported:
             self.novideoregion("disabled")
             return
+        now = monotonic_time()
+        from_time = max(starting_at, now-MAX_TIME, self.min_time)
+        if ww<=0 or wh<=0:
+            return
+        hm = self.update_heatmap(ww, wh, damage_events_count, last_damage_events, from_time)
         if not self.detection:
             if not self.rectangle:
                 return
             #just update the fps:
-            from_time = max(starting_at, monotonic_time()-MAX_TIME, self.min_time)
-            self.time = monotonic_time()
-            lde = tuple(x for x in tuple(last_damage_events) if x[0]>=from_time)
-            incount = 0
-            for _,x,y,w,h in lde:
-                r = rectangle(x,y,w,h)
-                inregion = r.intersection_rect(self.rectangle)
-                if inregion:
-                    incount += inregion.width*inregion.height
-            elapsed = monotonic_time()-from_time
-            if elapsed<=0:
-                self.fps = 0
-            else:
-                self.fps = int(incount/(self.rectangle.width*self.rectangle.height) / elapsed)
+            self.time = now
+            r = self.rectangle
+            self.fps = int(hm.get_rate(now, r.x, r.y, r.width, r.height))
             return
         sslog("%s.identify_video_subregion(..)", self)
         sslog("identify_video_subregion%s",
               (ww, wh, damage_events_count, last_damage_events, starting_at, children))
 
-        children_rects = ()
-        if children:
-            children_rects = tuple(rectangle(x, y, w, h)
-                                   for _xid, x, y, w, h, _border, _depth in children
-                                   if w>=MIN_W and h>=MIN_H)
-
         if damage_events_count < self.set_at:
             #stats got reset
             self.set_at = 0
@@ -336,11 +372,11 @@ class VideoSubregion:
 
         def update_markers():
             self.counter = damage_events_count
-            self.time = monotonic_time()
+            self.time = now
 
         if self.counter+10>damage_events_count:
             #less than 10 events since last time we called update_markers:
-            elapsed = monotonic_time()-self.time
+            elapsed = now-self.time
             #how many damage events occurred since we chose this region:
             event_count = max(0, damage_events_count - self.set_at)
             #make the timeout longer when the region has worked longer:
@@ -353,241 +389,108 @@ class VideoSubregion:
                   event_count, self.counter, damage_events_count)
             return
 
-        from_time = max(starting_at, monotonic_time()-MAX_TIME, self.min_time)
-        #create a list (copy) to work on:
-        lde = tuple(x for x in tuple(last_damage_events) if x[0]>=from_time)
-        dc = len(lde)
+        update_markers()
+        dc = hm.get_event_count(now)
         if dc<=MIN_EVENTS:
-            self.novideoregion("not enough damage events yet (%s)", dc)
+            self.novideoregion("not enough damage events yet (%i)", dc)
             return
-        #structures for counting areas and sizes:
-        wc = {}
-        hc = {}
-        dec = {}
-        #count how many times we see each area, each width/height and where,
-        #after removing any exclusion zones:
-        for _,x,y,w,h in lde:
-            rects = self.excluded_rectangles(rectangle(x,y,w,h), ww, wh)
-            for r in rects:
-                dec[r] = dec.get(r, 0)+1
-                if w>=MIN_W:
-                    wc.setdefault(w, dict()).setdefault(x, set()).add(r)
-                if h>=MIN_H:
-                    hc.setdefault(h, dict()).setdefault(y, set()).add(r)
-        #we can shortcut the damaged ratio if the whole window got damaged at least once:
-        all_damaged = dec.get(rectangle(0, 0, ww, wh), 0) > 0
-
-        def inoutcount(region, ignore_size=0):
-            #count how many pixels are in or out if this region
-            incount, outcount = 0, 0
-            for r, count in dec.items():
-                inregion = r.intersection_rect(region)
-                if inregion:
-                    incount += inregion.width*inregion.height*int(count)
-                outregions = r.substract_rect(region)
-                for x in outregions:
-                    if ignore_size>0 and x.width*x.height<ignore_size:
-                        #skip small region outside rectangle
-                        continue
-                    outcount += x.width*x.height*int(count)
-            return incount, outcount
-
-        def damaged_ratio(rect):
-            if all_damaged:
-                return 1
-            rects = (rect, )
-            for _,x,y,w,h in lde:
-                r = rectangle(x,y,w,h)
-                new_rects = []
-                for cr in rects:
-                    new_rects += cr.substract_rect(r)
-                if not new_rects:
-                    #nothing left: damage covered the whole rect
-                    return 1.0
-                rects = new_rects
-            not_damaged_pixels = sum((r.width*r.height) for r in rects)
-            rect_pixels = rect.width*rect.height
-            #sslog("damaged_ratio: not damaged pixels(%s)=%i, rect pixels(%s)=%i",
-            #     rects, not_damaged_pixels, rect, rect_pixels)
-            return max(0, min(1, 1.0-not_damaged_pixels/rect_pixels))
-
-        scores = {None : 0}
-        def score_region(info, region, ignore_size=0, d_ratio=0):
-            score = scores.get(region)
-            if score is not None:
-                return score
-            #check if the region given is a good candidate, and if so we use it
-            #clamp it:
-            if region.width<MIN_W or region.height<MIN_H:
-                #too small, ignore it:
-                score = 0
-            #and make sure this does not end up much bigger than needed:
-            elif ww*wh<(region.width*region.height):
-                score = 0
-            incount, outcount = inoutcount(region, ignore_size)
-            total = incount+outcount
-            children_boost = 0
-            if total==0:
-                ipct = opct = score = 0
-            else:
-                ipct = 100*incount//total
-                opct = 100*outcount//total
-            if score is None:
-                score = scoreinout(ww, wh, region, incount, outcount)
-                #discount score if the region contains areas that were not damaged:
-                #(apply sqrt to limit the discount: 50% damaged -> multiply by 0.7)
-                if d_ratio==0:
-                    d_ratio = damaged_ratio(region)
-                score = int(score * math.sqrt(d_ratio))
-                children_boost = int(region in children_rects)*SUBWINDOW_REGION_BOOST
-            sslog("testing %12s video region %34s: %3i%% in, %3i%% out, %3i%% of window, damaged ratio=%.2f, children_boost=%i, score=%2i",
-                  info, region, ipct, opct, 100*region.width*region.height/ww/wh, d_ratio, children_boost, score)
-            scores[region] = score
-            return score
-
-        def updateregion(rect):
-            self.rectangle = rect
-            self.time = monotonic_time()
-            self.inout = inoutcount(rect)
-            self.score = scoreinout(ww, wh, rect, *self.inout)
-            elapsed = monotonic_time()-from_time
-            if elapsed<=0:
-                self.fps = 0
-            else:
-                self.fps = int(self.inout[0]/(rect.width*rect.height) / elapsed)
-            self.damaged = int(100*damaged_ratio(self.rectangle))
-            self.last_scores = scores
-            sslog("score(%s)=%s, damaged=%i%%", self.inout, self.score, self.damaged)
-
-        def setnewregion(rect, msg, *args):
-            rects = self.excluded_rectangles(rect, ww, wh)
-            if not rects:
-                self.novideoregion("no match after removing excluded regions")
-                return
-            if len(rects)==1:
-                rect = rects[0]
-            else:
-                #use the biggest one of what remains:
-                def get_rect_size(rect):
-                    return -rect.width * rect.height
-                biggest_rects = sorted(rects, key=get_rect_size)
-                rect = biggest_rects[0]
-                if rect.width<MIN_W or rect.height<MIN_H:
-                    self.novideoregion("match is too small after removing excluded regions")
-                    return
-            if not self.rectangle or self.rectangle!=rect:
-                sslog("setting new region %s: "+msg, rect, *args)
-                sslog(" is child window: %s", rect in children_rects)
-                self.set_at = damage_events_count
-                self.counter = damage_events_count
-            if not self.enabled:
-                #could have been disabled since we started this method!
-                self.novideoregion("disabled")
-                return
-            if not self.detection:
-                return
-            updateregion(rect)
 
-        update_markers()
+        #snap to child windows:
+        children_rects = ()
+        if children:
+            children_rects = tuple(rectangle(x, y, w, h)
+                                   for _xid, x, y, w, h, _border, _depth in children
+                                   if w>=MIN_W and h>=MIN_H)
 
-        if len(dec)==1:
-            rect, count = tuple(dec.items())[0]
-            setnewregion(rect, "only region damaged")
-            return
+        def score_region(info, region, outcount):
+            incount, _ = hm.get_in_out(now, (region, ))
+            if incount+outcount==0:
+                return 0
+            score = scoreinout(ww, wh, region, incount, outcount)
+            #discount score if the region contains areas that were not damaged:
+            #(apply sqrt to limit the discount: 50% damaged -> multiply by 0.7)
+            d_ratio = hm.get_damaged_ratio(now, region.x, region.y, region.width, region.height)
+            score = int(score*math.sqrt(d_ratio))
+            children_boost = int(region in children_rects)*SUBWINDOW_REGION_BOOST
+            score += children_boost
+            sslog("%8s video region %s: score=%i, damaged ratio=%.2f, children_boost=%i",
+                  info, region, score, d_ratio, children_boost)
+            return score
 
-        #see if we can keep the region we already have (if any):
-        cur_score = 0
+        #see if we can keep the regions we already have (if any):
         if rect:
-            cur_score = score_region("current", rect)
+            _, outcount = hm.get_in_out(now, self.rectangles or (rect, ))
+            cur_score = score_region("current", rect, outcount)
             if cur_score>=KEEP_SCORE:
                 sslog("keeping existing video region %s with score %s", rect, cur_score)
+                self.score = cur_score
+                self.fps = int(hm.get_rate(now, rect.x, rect.y, rect.width, rect.height))
                 return
 
-        #split the regions we really care about (enough pixels, big enough):
-        damage_count = {}
-        min_count = max(2, len(lde)/40)
-        for r, count in dec.items():
-            #ignore small regions:
-            if count>min_count and r.width>=MIN_W and r.height>=MIN_H:
-                damage_count[r] = count
-        c = sum(int(x) for x in damage_count.values())
-        most_damaged = -1
-        most_pct = 0
-        if c>0:
-            most_damaged = int(sorted(damage_count.values())[-1])
-            most_pct = 100*most_damaged/c
-            sslog("identify video: most=%s%% damage count=%s", most_pct, damage_count)
-            #is there a region that stands out?
-            #try to use the region which is responsible for most of the large damage requests:
-            most_damaged_regions = tuple(r for r,v in damage_count.items() if v==most_damaged)
-            if len(most_damaged_regions)==1:
-                r = most_damaged_regions[0]
-                score = score_region("most-damaged", r, d_ratio=1.0)
-                sslog("identify video: score most damaged area %s=%i%%", r, score)
-                if score>120:
-                    setnewregion(r, "%s%% of large damage requests, score=%s", most_pct, score)
-                    return
-                if score>=100:
-                    scores[r] = score
-
-        #try children windows:
-        for region in children_rects:
-            scores[region] = score_region("child-window", region, 48*48)
-
-        #try harder: try combining regions with the same width or height:
-        #(some video players update the video region in bands)
-        for w, d in wc.items():
-            for x,regions in d.items():
-                if len(regions)>=2:
-                    #merge regions of width w at x
-                    min_count = max(2, len(regions)//25)
-                    keep = tuple(r for r in regions if int(dec.get(r, 0))>=min_count)
-                    sslog("vertical regions of width %i at %i with at least %i hits: %s", w, x, min_count, keep)
-                    if keep:
-                        merged = merge_all(keep)
-                        scores[merged] = score_region("vertical", merged, 48*48)
-        for h, d in hc.items():
-            for y,regions in d.items():
-                if len(regions)>=2:
-                    #merge regions of height h at y
-                    min_count = max(2, len(regions)//25)
-                    keep = tuple(r for r in regions if int(dec.get(r, 0))>=min_count)
-                    sslog("horizontal regions of height %i at %i with at least %i hits: %s", h, y, min_count, keep)
-                    if keep:
-                        merged = merge_all(keep)
-                        scores[merged] = score_region("horizontal", merged, 48*48)
-
-        sslog("merged regions scores: %s", scores)
-        highscore = max(scores.values())
-        #a score of 100 is neutral
-        if highscore>=120:
-            region = next(iter(r for r,s in scores.items() if s==highscore))
-            setnewregion(region, "very high score: %s", highscore)
+        #the regions that are being damaged frequently:
+        candidates = hm.get_regions(now, MIN_FPS, HOT_RATIO, MIN_W, MIN_H, MERGE_DISTANCE, MAX_REGIONS)
+        sslog("identify video: %s candidates=%s", hm, candidates)
+        def snap(region):
+            for child in children_rects:
+                i = child.intersection_rect(region)
+                if i and i.width*i.height*10>=child.width*child.height*8 and \
+                    i.width*i.height*10>=region.width*region.height*8:
+                    return child
+            return region
+        #keep the existing regions if they still match,
+        #so that we don't re-initialize the video encoders for small variations:
+        def keep(region):
+            for r in self.rectangles:
+                i = r.intersection_rect(region)
+                if i and i.width*i.height*100>=max(r.width*r.height, region.width*region.height)*KEEP_OVERLAP:
+                    return r
+            return region
+        regions = []
+        for region in candidates:
+            region = keep(snap(region))
+            if region not in regions:
+                regions.append(region)
+        #damage outside all the candidate regions counts against them:
+        _, outcount = hm.get_in_out(now, regions)
+        scores = {}
+        accepted = []
+        for region in regions:
+            score = score_region("testing", region, outcount)
+            if score==0:
+                continue
+            scores[region] = score
+            if score>=100:
+                accepted.append(region)
+        self.last_scores = scores
+        if not accepted:
+            self.novideoregion("failed to identify a video region")
             return
-
-        #retry existing region, tolerate lower score:
-        if cur_score>=90 and (highscore<100 or cur_score>=highscore):
-            sslog("keeping existing video region %s with score %s", rect, cur_score)
-            setnewregion(self.rectangle, "existing region with score: %i" % cur_score)
+        #remove the exclusion zones:
+        rects = []
+        for region in accepted:
+            remaining = self.excluded_rectangles(region, ww, wh)
+            if remaining:
+                #use the biggest one of what remains:
+                r = max(remaining, key=lambda r : r.width*r.height)
+                if r.width>=MIN_W and r.height>=MIN_H:
+                    scores[r] = scores[region]
+                    rects.append(r)
+        if not rects:
+            self.novideoregion("no match after removing excluded regions")
             return
-
-        if highscore>=100:
-            region = next(iter(r for r,s in scores.items() if s==highscore))
-            setnewregion(region, "high score: %s", highscore)
+        if not self.enabled:
+            #could have been disabled since we started this method!
+            self.novideoregion("disabled")
             return
-
-        #could do:
-        # * re-add some scrolling detection: the region may have moved
-        # * re-try with a higher "from_time" and a higher score threshold
-
-        #try harder still: try combining all the regions we haven't discarded
-        #(flash player with firefox and youtube does stupid unnecessary repaints)
-        if len(damage_count)>=2:
-            merged = merge_all(tuple(damage_count.keys()))
-            score = score_region("merged", merged)
-            if score>=110:
-                setnewregion(merged, "merged all regions, score=%s", score)
-                return
-
-        self.novideoregion("failed to identify a video region")
-        self.last_scores = scores
+        rect = rects[0]
+        if self.rectangles!=rects:
+            sslog("setting new regions %s", rects)
+            sslog(" is child window: %s", rect in children_rects)
+            self.set_at = damage_events_count
+        self.rectangle = rect
+        self.rectangles = rects
+        self.inout = hm.get_in_out(now, (rect, ))
+        self.score = scores.get(rect, 0)
+        self.fps = int(hm.get_rate(now, rect.x, rect.y, rect.width, rect.height))
+        self.damaged = int(100*hm.get_damaged_ratio(now, rect.x, rect.y, rect.width, rect.height))
+        sslog("score(%s)=%s, damaged=%i%%, fps=%i", self.inout, self.score, self.damaged, self.fps)
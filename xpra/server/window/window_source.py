@@ -19,12 +19,21 @@ from xpra.server.window.windowicon_source import WindowIconSource
 from xpra.server.window.window_stats import WindowPerformanceStatistics
 from xpra.server.window.batch_config import DamageBatchConfig
 from xpra.server.window.batch_delay_calculator import calculate_batch_delay, get_target_speed, get_target_quality
+from xpra.server.window.damage_trace import get_damage_trace
+from xpra.server.metrics import get_encoder_totals
+from xpra.server.window.delta_store import DeltaStore
+from xpra.server.window.shared_encodings import shared_encodings
+from xpra.server.window.content_classifier import ( #@UnresolvedImport
+    classify, ContentModel, CLASS_NAMES, FLAT, TEXT, GRAPHICS, PHOTO,
+    )
+from xpra.server.window.damage_heatmap import DamageHeatmap   #@UnresolvedImport
 from xpra.server.cystats import time_weighted_average, logp #@UnresolvedImport
 from xpra.rectangle import rectangle, add_rectangle, remove_rectangle, merge_all   #@UnresolvedImport
-from xpra.server.picture_encode import rgb_encode, webp_encode, mmap_send
+from xpra.server.picture_encode import rgb_encode, webp_encode, palette_encode, mmap_send
+from xpra.buffers.membuf import xxh3_hash  #@UnresolvedImport
 from xpra.simple_stats import get_list_stats
 from xpra.codecs.argb.argb import argb_swap         #@UnresolvedImport
-from xpra.codecs.rgb_transform import rgb_reformat
+from xpra.codecs.rgb_transform import rgb_reformat, rgb_downscale
 from xpra.codecs.loader import get_codec
 from xpra.codecs.codec_constants import PREFERRED_ENCODING_ORDER, LOSSY_PIXEL_FORMATS
 from xpra.net.compression import use, Compressed
@@ -44,6 +53,16 @@ bandwidthlog = Logger("bandwidth")
 AUTO_REFRESH = envbool("XPRA_AUTO_REFRESH", True)
 AUTO_REFRESH_QUALITY = envint("XPRA_AUTO_REFRESH_QUALITY", 100)
 AUTO_REFRESH_SPEED = envint("XPRA_AUTO_REFRESH_SPEED", 50)
+#encode the refresh ahead of time once the window contents have settled for this long:
+SPECULATIVE_REFRESH = envbool("XPRA_SPECULATIVE_REFRESH", True)
+SPECULATIVE_REFRESH_DELAY = envint("XPRA_SPECULATIVE_REFRESH_DELAY", 50)
+#when the bandwidth is limited, send the refresh in layers:
+#first the most significant bits of each colour channel, then the residual
+PROGRESSIVE_REFRESH = envbool("XPRA_PROGRESSIVE_REFRESH", True)
+PROGRESSIVE_REFRESH_BITS = max(1, min(7, envint("XPRA_PROGRESSIVE_REFRESH_BITS", 5)))
+#the percentage of the bandwidth limit that the refresh layers can use:
+PROGRESSIVE_REFRESH_BUDGET = envint("XPRA_PROGRESSIVE_REFRESH_BUDGET", 50)
+REFINE_MASKS = ((0xff<<(8-PROGRESSIVE_REFRESH_BITS)) & 0xff, 0xff)
 
 INITIAL_QUALITY = envint("XPRA_INITIAL_QUALITY", 65)
 INITIAL_SPEED = envint("XPRA_INITIAL_SPEED", 40)
@@ -64,6 +83,10 @@ FORCE_BATCH = envint("XPRA_FORCE_BATCH", True)
 STRICT_MODE = envint("XPRA_ENCODING_STRICT_MODE", False)
 MERGE_REGIONS = envbool("XPRA_MERGE_REGIONS", True)
 DOWNSCALE_THRESHOLD = envint("XPRA_DOWNSCALE_THRESHOLD", 20)
+#downscale the pixels before encoding them if the client shows the window at a smaller size:
+DOWNSCALE = envbool("XPRA_DOWNSCALE", True)
+#(video encodings have their own scaling, see 'calculate_scaling')
+DOWNSCALE_ENCODINGS = ("rgb24", "rgb32", "png", "png/P", "png/L", "jpeg", "webp")
 INTEGRITY_HASH = envint("XPRA_INTEGRITY_HASH", False)
 MAX_SYNC_BUFFER_SIZE = envint("XPRA_MAX_SYNC_BUFFER_SIZE", 256)*1024*1024        #256MB
 AV_SYNC_RATE_CHANGE = envint("XPRA_AV_SYNC_RATE_CHANGE", 20)
@@ -72,6 +95,26 @@ SEND_TIMESTAMPS = envbool("XPRA_SEND_TIMESTAMPS", False)
 DAMAGE_STATISTICS = envbool("XPRA_DAMAGE_STATISTICS", False)
 
 SCROLL_ALL = envbool("XPRA_SCROLL_ALL", True)
+CONTENT_CLASSIFIER = envbool("XPRA_CONTENT_CLASSIFIER", True)
+#above this speed, low colour content is sent as rgb rather than png:
+CONTENT_LOSSLESS_SPEED = envint("XPRA_CONTENT_LOSSLESS_SPEED", 70)
+#graphics updated more often than this are left to lossy encodings:
+CONTENT_LOSSLESS_MAX_FPS = envint("XPRA_CONTENT_LOSSLESS_MAX_FPS", 5)
+#re-use the palette entries the client already has:
+PALETTE_PERSISTENT = envbool("XPRA_PALETTE_PERSISTENT", True)
+#send rgb updates as a delta against the previous pixels sent for the same region:
+DELTA = envbool("XPRA_DELTA", True)
+DELTA_BUCKETS = envint("XPRA_DELTA_BUCKETS", 5)
+DELTA_MAX_BYTES = envint("XPRA_DELTA_MAX_BYTES", 4*1024*1024)
+DELTA_MAX_CHANGED = envint("XPRA_DELTA_MAX_CHANGED", 50)
+#re-use the compressed pixels of other clients showing the same window:
+SHARED_ENCODINGS = envbool("XPRA_SHARED_ENCODINGS", True)
+#round the quality and speed so that more clients end up with the same settings:
+SHARED_QUALITY_STEP = envint("XPRA_SHARED_QUALITY_STEP", 10)
+SHARED_SPEED_STEP = envint("XPRA_SHARED_SPEED_STEP", 20)
+
+damage_trace = get_damage_trace()
+encoder_totals = get_encoder_totals()
 
 HARDCODED_ENCODING = os.environ.get("XPRA_HARDCODED_ENCODING")
 
@@ -87,6 +130,8 @@ def get_env_encodings(etype, valid_options=()):
 TRANSPARENCY_ENCODINGS = get_env_encodings("TRANSPARENCY", ("webp", "png", "rgb32"))
 LOSSLESS_ENCODINGS = get_env_encodings("LOSSLESS", ("rgb", "png", "png/P", "png/L"))
 REFRESH_ENCODINGS = get_env_encodings("REFRESH", ("webp", "png", "rgb24", "rgb32"))
+#only the stateless encoders can be shared, 'rgb' has delta buckets and 'palette' a persistent palette:
+SHARED_ENCODING_TYPES = get_env_encodings("SHARED", ("webp", "png", "png/P", "png/L", "jpeg", "jpega"))
 
 LOSSLESS_WINDOW_TYPES = set(os.environ.get("XPRA_LOSSLESS_WINDOW_TYPES",
                                        "DOCK,TOOLBAR,MENU,UTILITY,DROPDOWN_MENU,POPUP_MENU,TOOLTIP,NOTIFICATION,COMBO,DND").split(","))
@@ -106,6 +151,48 @@ class DelayedRegions:
             )
 
 
+class SpeculativeRefresh:
+    """
+        An auto-refresh encoded before the refresh timer fires.
+        The packets are only sent if there is no new damage in the meantime,
+        otherwise we just drop them.
+    """
+    __slots__ = ("lock", "regions", "start", "expected", "encoded", "items", "cancelled")
+    def __init__(self, regions):
+        self.lock = threading.Lock()
+        self.regions = regions
+        self.start = monotonic_time()
+        self.expected = -1
+        self.encoded = 0
+        self.items = []
+        self.cancelled = False
+
+    def __repr__(self):
+        return "SpeculativeRefresh(%i regions, %i/%i encoded, cancelled=%s)" % (
+            len(self.regions), self.encoded, self.expected, self.cancelled)
+
+    def set_expected(self, count) -> bool:
+        """ returns True if all the regions have already been encoded """
+        with self.lock:
+            self.expected = count
+            return self.encoded==count
+
+    def add(self, item) -> bool:
+        """ returns True once all the regions have been encoded """
+        with self.lock:
+            self.encoded += 1
+            if item:
+                self.items.append(item)
+            return self.encoded==self.expected
+
+    def is_complete(self) -> bool:
+        return not self.cancelled and len(self.items)==self.expected
+
+    def uses_client_references(self) -> bool:
+        #the delta buckets and the palette are updated when we encode:
+        return any(item[0][6] in ("rgb24", "rgb32", "palette") for item in tuple(self.items))
+
+
 def capr(v):
     return min(100, max(0, int(v)))
 
@@ -177,7 +264,15 @@ class WindowSource(WindowIconSource):
         self.rgb_zlib = use("zlib") and encoding_options.boolget("rgb_zlib", True)     #server and client support zlib pixel compression
         self.rgb_lz4 = use("lz4") and encoding_options.boolget("rgb_lz4", False)       #server and client support lz4 pixel compression
         self.rgb_lzo = use("lzo") and encoding_options.boolget("rgb_lzo", False)       #server and client support lzo pixel compression
+        delta_buckets = min(DELTA_BUCKETS, encoding_options.intget("delta_buckets", 0))
+        if DELTA and delta_buckets>0:
+            self.delta_store = DeltaStore(delta_buckets, DELTA_MAX_BYTES, DELTA_MAX_CHANGED)
+        if SHARED_ENCODINGS and mmap_size==0:
+            self.shared_encodings = shared_encodings
+            shared_encodings.add_source(wid)
         self.client_render_size = encoding_options.get("render-size")
+        self.client_display_size = encoding_options.intpair("display-size")
+        self.downscaled = 0
         self.client_bit_depth = encoding_options.intget("bit-depth", 24)
         self.supports_transparency = HAS_ALPHA and encoding_options.boolget("transparency")
         self.full_frames_only = self.is_tray or encoding_options.boolget("full_frames_only")
@@ -345,6 +440,9 @@ class WindowSource(WindowIconSource):
             self.enc_nvjpeg = get_codec("enc_nvjpeg")
             if self.enc_nvjpeg:
                 self.add_encoder("jpeg", self.nvjpeg_encode)
+        self.enc_palette = get_codec("enc_palette")
+        if "palette" in self.server_core_encodings and self.enc_palette:
+            self.add_encoder("palette", self.palette_encode)
         self.parse_csc_modes(self.encoding_options.dictget("full_csc_modes", default_value=None))
 
 
@@ -354,6 +452,14 @@ class WindowSource(WindowIconSource):
         self.encoding = None
         self.encodings = ()
         self.encoding_last_used = None
+        self.content_classification = False
+        self.content_model = None
+        self.content_rate = None
+        self.content_classes = {}
+        self.content_refined = 0
+        self.palette = None
+        self.delta_store = None
+        self.shared_encodings = None
         self.auto_refresh_encodings = ()
         self.core_encodings = ()
         self.rgb_formats = ()
@@ -366,6 +472,10 @@ class WindowSource(WindowIconSource):
         self.supports_transparency = False
         self.full_frames_only = False
         self.suspended = False
+        #the areas of the window the client can see, None if it does not tell us:
+        self.visible_regions = None
+        self.hidden_damage = []
+        self.hidden_counts = {"suppressed" : 0, "exposed" : 0}
         self.strict = STRICT_MODE
         self.decoder_speed = typedict()
         #
@@ -381,6 +491,15 @@ class WindowSource(WindowIconSource):
         self.refresh_target_time = 0
         self.refresh_timer = None
         self.refresh_regions = []
+        self.speculative_timer = None
+        self.speculative = None
+        self.speculative_counts = {"started" : 0, "sent" : 0, "cancelled" : 0}
+        self.refine_timer = None
+        self.refine_regions = []
+        self.refine_layer = 0
+        self.refine_start = 0
+        self.refine_bytes = 0
+        self.progressive_counts = {"started" : 0, "layers" : 0}
         self.timeout_timer = None
         self.expire_timer = None
         self.soft_timer = None
@@ -420,6 +539,11 @@ class WindowSource(WindowIconSource):
         self.cancel_damage(INFINITY)
         log("encoding_totals for wid=%s with primary encoding=%s : %s",
             self.wid, self.encoding, self.statistics.encoding_totals)
+        se = self.shared_encodings
+        if se:
+            se.remove_source(self.wid)
+        #another client showing this window can take over the recording:
+        damage_trace.remove_source(self)
         self.init_vars()
         self._mmap_size = 0
         self.batch_config.cleanup()
@@ -465,6 +589,23 @@ class WindowSource(WindowIconSource):
             einfo["selection"] = self.get_best_encoding.__name__.replace("get_", "")
         except AttributeError:
             pass
+        cinfo = {"enabled" : self.content_classification}
+        if self.content_classes:
+            cinfo["classes"] = dict((CLASS_NAMES.get(k, k), v) for k, v in self.content_classes.items())
+            cinfo["refined"] = self.content_refined
+        model = self.content_model
+        if model:
+            cinfo["model"] = model.get_info()
+        einfo["content-classifier"] = cinfo
+        palette = self.palette
+        if palette:
+            einfo["palette"] = palette.get_info()
+        ds = self.delta_store
+        if ds:
+            einfo["delta"] = ds.get_info()
+        se = self.shared_encodings
+        if se:
+            einfo["shared"] = se.is_shared(self.wid)
 
         #"encodings" info:
         esinfo = {
@@ -482,6 +623,8 @@ class WindowSource(WindowIconSource):
                 "min-delay"     : self.min_auto_refresh_delay,
                 "delay"         : self.auto_refresh_delay,
                 "base-delay"    : self.base_auto_refresh_delay,
+                "speculative"   : dict(self.speculative_counts),
+                "progressive"   : dict(self.progressive_counts),
                 "last-event"    : {
                     "elapsed"    : int(1000*(monotonic_time()-larm[0])),
                     "message"    : larm[1],
@@ -494,6 +637,7 @@ class WindowSource(WindowIconSource):
                 "idle"                  : self.is_idle,
                 "dimensions"            : self.window_dimensions,
                 "suspended"             : self.suspended or False,
+                "visibility"            : self.get_visibility_info(),
                 "bandwidth-limit"       : self.bandwidth_limit,
                 "av-sync"               : {
                                            "enabled"    : self.av_sync,
@@ -527,6 +671,13 @@ class WindowSource(WindowIconSource):
         crs = self.client_render_size
         if crs:
             info["render-size"] = crs
+        cds = self.client_display_size
+        if cds:
+            info["display-size"] = cds
+        info["downscale"] = {
+            "size"      : self.get_downscale_size() or (),
+            "frames"    : self.downscaled,
+            }
         info["damage.fps"] = int(self.get_damage_fps())
         if self.pixel_format:
             info["pixel-format"] = self.pixel_format
@@ -538,7 +689,7 @@ class WindowSource(WindowIconSource):
     def get_damage_fps(self):
         now = monotonic_time()
         cutoff = now-5
-        lde = tuple(x[0] for x in tuple(self.statistics.last_damage_events) if x[0]>=cutoff)
+        lde = self.statistics.last_damage_events.values("time", cutoff)
         fps = 0
         if len(lde)>=2:
             elapsed = now-min(lde)
@@ -618,6 +769,77 @@ class WindowSource(WindowIconSource):
         self.damage(0, 0, w, h, options)
 
 
+    def get_visibility_info(self) -> dict:
+        vr = self.visible_regions
+        info = dict(self.hidden_counts)
+        info["hidden-pixels"] = sum(r.width*r.height for r in self.hidden_damage)
+        if vr is not None:
+            info["regions"] = tuple(r.get_geometry() for r in vr)
+        return info
+
+    def set_visibility(self, regions):
+        """
+            The client tells us which parts of the window it can see,
+            in window coordinates, or None if the whole window is visible.
+            Updates for the hidden parts are recorded but not sent,
+            we send them when they become visible again.
+        """
+        assert self.ui_thread == threading.current_thread()
+        if regions is None:
+            visible = None
+        else:
+            #keep the rectangles disjoint so we never send the same pixels twice:
+            visible = []
+            for x, y, w, h in regions:
+                if w<=0 or h<=0:
+                    continue
+                pieces = [rectangle(x, y, w, h)]
+                for v in visible:
+                    pieces = [p for piece in pieces for p in piece.substract_rect(v)]
+                visible += pieces
+        damagelog("set_visibility(%s) wid=%i, hidden damage=%s", visible, self.wid, self.hidden_damage)
+        self.visible_regions = visible
+        if visible is not None and self.refresh_regions:
+            #don't refresh what the client can't see,
+            #it will get a new update when it becomes visible:
+            for r in tuple(self.refresh_regions):
+                for hidden in self.clip_hidden(r):
+                    add_rectangle(self.hidden_damage, hidden)
+                    remove_rectangle(self.refresh_regions, hidden)
+            if not self.refresh_regions:
+                self.cancel_refresh_timer()
+        hidden_damage = self.hidden_damage
+        if not hidden_damage:
+            return
+        self.hidden_damage = []
+        exposed = []
+        for r in hidden_damage:
+            hidden = self.clip_hidden(r)
+            for h in hidden:
+                add_rectangle(self.hidden_damage, h)
+            if hidden!=[r]:
+                self.hidden_counts["exposed"] += r.width*r.height-sum(h.width*h.height for h in hidden)
+                exposed.append(r)
+        if self.suspended or not exposed:
+            return
+        ww, wh = self.window.get_dimensions()
+        for r in exposed:
+            #the window may have been resized since,
+            #and 'damage' will record the parts that are still hidden:
+            r = r.intersection(0, 0, ww, wh)
+            if r:
+                self.damage(r.x, r.y, r.width, r.height)
+
+    def clip_hidden(self, rect):
+        """ returns the parts of this rectangle that the client cannot see """
+        if self.visible_regions is None:
+            return []
+        hidden = [rect]
+        for v in self.visible_regions:
+            hidden = [p for h in hidden for p in h.substract_rect(v)]
+        return hidden
+
+
     def set_scaling(self, scaling):
         scalinglog("set_scaling(%s)", scaling)
         self.scaling = scaling
@@ -690,6 +912,9 @@ class WindowSource(WindowIconSource):
     def do_set_client_properties(self, properties):
         self.maximized = properties.boolget("maximized", False)
         self.client_render_size = properties.intpair("encoding.render-size")
+        #clients can also tell us when they show the window at a smaller size than the backing,
+        #ie: as a thumbnail
+        self.client_display_size = properties.intpair("encoding.display-size")
         self.client_bit_depth = properties.intget("bit-depth", self.client_bit_depth)
         self.client_refresh_encodings = properties.strtupleget("encoding.auto_refresh_encodings", self.client_refresh_encodings)
         self.full_frames_only = self.is_tray or properties.boolget("encoding.full_frames_only", self.full_frames_only)
@@ -708,17 +933,13 @@ class WindowSource(WindowIconSource):
         #(in case pillow was selected previously and the client side scaling changed)
         for encoding, encoders in self._all_encoders.items():
             self._encoders[encoding] = encoders[0]
-        #we may now want to downscale server-side,
-        #or convert to grayscale,
+        #we may now want to convert to grayscale,
         #and for that we need to use the pillow encoder:
-        grayscale = self.encoding=="grayscale"
-        if self.enc_pillow and (self.client_render_size or grayscale):
-            crsw, crsh = self.client_render_size
-            ww, wh = self.window_dimensions
-            if grayscale or (ww-crsw>DOWNSCALE_THRESHOLD and wh-crsh>DOWNSCALE_THRESHOLD):
-                for x in self.enc_pillow.get_encodings():
-                    if x in self.server_core_encodings:
-                        self.add_encoder(x, self.pillow_encode)
+        #(downscaling is done before encoding, see 'downscale_image')
+        if self.enc_pillow and self.encoding=="grayscale":
+            for x in self.enc_pillow.get_encodings():
+                if x in self.server_core_encodings:
+                    self.add_encoder(x, self.pillow_encode)
         self.update_encoding_selection(self.encoding)
 
 
@@ -866,6 +1087,11 @@ class WindowSource(WindowIconSource):
 
     def assign_encoding_getter(self):
         self.get_best_encoding = self.get_best_encoding_impl()
+        #the content classifier only refines the encodings we choose automatically:
+        self.content_classification = CONTENT_CLASSIFIER and self.uses_auto_encoding()
+
+    def uses_auto_encoding(self):
+        return self.get_best_encoding==self.get_auto_encoding
 
     def get_best_encoding_impl(self):
         if HARDCODED_ENCODING:
@@ -1001,6 +1227,101 @@ class WindowSource(WindowIconSource):
             return "rgb24"
         return self.encoding
 
+    def get_content_class(self, x, y, w, h):
+        """ the content class cached for this area of the window, if known """
+        model = self.content_model
+        if not model:
+            return None
+        return model.get_class(x, y, w, h)
+
+    def select_encoding(self, get_best_encoding, x, y, w, h, speed, quality, coding, options):
+        """
+            Calls the encoding selection method,
+            then refines its choice using the content class recorded for this area of the window.
+        """
+        encoding = get_best_encoding(w, h, speed, quality, coding)
+        if not self.content_classification or options.get("encoding") or options.get("auto_refresh") or \
+            encoding not in ("rgb24", "png", "webp", "jpeg"):
+            return encoding
+        content_class = self.get_content_class(x, y, w, h)
+        if content_class is None:
+            #not classified yet
+            return encoding
+        if content_class==GRAPHICS and encoding in ("jpeg", "webp"):
+            if self.get_update_rate(x, y, w, h)>=CONTENT_LOSSLESS_MAX_FPS:
+                #animated graphics: the next update will replace this one soon enough
+                return encoding
+        refined = self.get_content_encoding(content_class, w, h, speed, quality, encoding)
+        if refined!=encoding:
+            self.content_refined += 1
+            log("select_encoding: %s content at %s: %s instead of %s",
+                CLASS_NAMES.get(content_class), (x, y, w, h), refined, encoding)
+        return refined
+
+    def classify_content(self, image, coding):
+        """
+            Samples the pixels captured and records their content class in the window's content model,
+            which is used by select_encoding() for the next updates of this area.
+            Runs in the encode thread.
+        """
+        if coding not in ("rgb24", "png", "webp", "jpeg") or image.get_planes()!=0:
+            return
+        bpp = len(image.get_pixel_format())
+        if bpp not in (3, 4):
+            return
+        w = image.get_width()
+        h = image.get_height()
+        content_class = classify(image.get_pixels(), w, h, image.get_rowstride(), bpp)[0]
+        self.content_classes[content_class] = self.content_classes.get(content_class, 0)+1
+        ww, wh = self.window_dimensions
+        model = self.content_model
+        if ww>0 and wh>0 and (not model or model.width!=ww or model.height!=wh):
+            model = self.content_model = ContentModel(ww, wh)
+        if model:
+            model.update(image.get_target_x(), image.get_target_y(), w, h, content_class)
+        log("classify_content(%s, %s) %s", image, coding, CLASS_NAMES.get(content_class))
+
+    def update_content_rate(self, now, x, y, w, h, ww, wh):
+        rate = self.content_rate
+        if not rate or rate.width!=ww or rate.height!=wh:
+            if ww<=0 or wh<=0:
+                return
+            rate = self.content_rate = DamageHeatmap(ww, wh, 1)
+        rate.add(now, x, y, w, h)
+
+    def get_update_rate(self, x, y, w, h):
+        """ the number of times per second that this area of the window is being repainted """
+        rate = self.content_rate
+        if not rate:
+            return 0
+        return rate.get_rate(monotonic_time(), x, y, w, h)
+
+    def get_content_encoding(self, content_class, w, h, speed, quality, coding):
+        co = self.common_encodings
+        pixel_count = w*h
+        rgb = "rgb24" in co and (pixel_count<self._rgb_auto_threshold or (self.rgb_lz4 and pixel_count<=MAX_RGB))
+        if content_class in (FLAT, TEXT, GRAPHICS) and "palette" in co and "palette" in self._encoders:
+            #lossless, and both faster and smaller than png for low colour content,
+            #falls back to png or rgb if there are too many colours:
+            return "palette"
+        if content_class==FLAT:
+            #lz4 compresses uniform areas to almost nothing, and quickly:
+            if rgb:
+                return "rgb24"
+            if "png" in co:
+                return "png"
+        elif content_class in (TEXT, GRAPHICS):
+            #lossy compression blurs the edges and would trigger an auto-refresh:
+            if rgb and speed>=CONTENT_LOSSLESS_SPEED:
+                return "rgb24"
+            if "png" in co:
+                return "png"
+        elif content_class==PHOTO and coding=="rgb24":
+            #don't send natural images uncompressed just because the region is small:
+            if pixel_count>=MAX_PIXELS_PREFER_RGB and quality<100 and w>=8 and h>=8 and "jpeg" in co:
+                return "jpeg"
+        return coding
+
 
     def map(self, mapped_at):
         self.mapped_at = mapped_at
@@ -1026,9 +1347,12 @@ class WindowSource(WindowIconSource):
         self.cancel_may_send_timer()
         self.cancel_soft_timer()
         self.cancel_refresh_timer()
+        self.cancel_progressive_refresh()
         self.cancel_timeout_timer()
         self.cancel_av_sync_timer()
         self.cancel_decode_error_refresh_timer()
+        #packets may be dropped:
+        self.reset_client_references()
         #if a region was delayed, we can just drop it now:
         self.refresh_regions = []
         self._damage_delayed = None
@@ -1057,6 +1381,11 @@ class WindowSource(WindowIconSource):
             self.source_remove(st)
 
     def cancel_refresh_timer(self):
+        st = self.speculative_timer
+        if st:
+            self.speculative_timer = None
+            self.source_remove(st)
+        self.cancel_speculative_refresh()
         rt = self.refresh_timer
         if rt:
             self.refresh_timer = None
@@ -1097,16 +1426,15 @@ class WindowSource(WindowIconSource):
                  self.wid, self.batch_config.delay, elapsed)
         if self.batch_config.delay<=2*DamageBatchConfig.START_DELAY and lr>0 and elapsed<60 and self.get_packets_backlog()==0:
             #delay is low-ish, figure out if we should bother updating it
-            lde = tuple(self.statistics.last_damage_events)
-            if not lde:
+            if not self.statistics.last_damage_events:
                 return      #things must have got reset anyway
-            since_last = tuple((pixels, compressed_size) for t, _, pixels, _, compressed_size, _
-                               in tuple(self.statistics.encoding_stats) if t>=lr)
-            if len(since_last)<=5:
+            estats = self.statistics.encoding_stats
+            since_last = estats.count_since(lr)
+            if since_last<=5:
                 statslog("calculate_batch_delay for wid=%i, skipping - only %i events since the last update",
-                         self.wid, len(since_last))
+                         self.wid, since_last)
                 return
-            pixel_count = sum(v[0] for v in since_last)
+            pixel_count = int(estats.sum("pixels", lr))
             ww, wh = self.window_dimensions
             if pixel_count<=ww*wh:
                 statslog("calculate_batch_delay for wid=%i, skipping - only %i pixels updated since the last update",
@@ -1116,7 +1444,7 @@ class WindowSource(WindowIconSource):
                 statslog("calculate_batch_delay for wid=%i, %i pixels updated since the last update",
                          self.wid, pixel_count)
                 #if pixel_count<8*ww*wh:
-                nbytes = sum(v[1] for v in since_last)
+                nbytes = estats.sum("compressed_size", lr)
                 #less than 16KB/s since last time? (or <=64KB)
                 max_bytes = max(4, int(elapsed))*16*1024
                 if nbytes<=max_bytes:
@@ -1356,12 +1684,16 @@ class WindowSource(WindowIconSource):
             #in which case the dimensions may be zero (if so configured by the client)
             return
         ww, wh = self.window.get_dimensions()
+        if damage_trace.recording:
+            damage_trace.damage(self, self.wid, x, y, w, h, ww, wh)
         now = monotonic_time()
         if options is None:
             options = {}
         if options.pop("damage", False):
             damagelog("damage%s wid=%i", (x, y, w, h, options), self.wid)
             self.statistics.last_damage_events.append((now, x,y,w,h))
+            if self.content_classification:
+                self.update_content_rate(now, x, y, w, h, ww, wh)
             self.global_statistics.damage_events_count += 1
             self.statistics.damage_events_count += 1
         if self.window_dimensions != (ww, wh):
@@ -1382,6 +1714,30 @@ class WindowSource(WindowIconSource):
             return
         if self.full_frames_only:
             x, y, w, h = 0, 0, ww, wh
+        #the window contents have changed, a refresh encoded ahead of time is now stale:
+        self.cancel_speculative_refresh()
+        rect = rectangle(x, y, w, h)
+        if self.refine_regions:
+            #this area will get its own refresh:
+            remove_rectangle(self.refine_regions, rect)
+        if self.visible_regions is not None:
+            hidden = self.clip_hidden(rect)
+            if hidden:
+                if self.full_frames_only and len(hidden)==1 and hidden[0]==rect:
+                    regions = []
+                elif self.full_frames_only:
+                    regions = [rect]
+                    hidden = []
+                else:
+                    regions = [r for r in (v.intersection_rect(rect) for v in self.visible_regions) if r]
+                for r in hidden:
+                    self.hidden_counts["suppressed"] += r.width*r.height
+                    add_rectangle(self.hidden_damage, r)
+                damagelog("damage%s wid=%i, visible: %s", (x, y, w, h), self.wid, regions)
+                for r in regions:
+                    self.do_damage(ww, wh, r.x, r.y, r.width, r.height, dict(options))
+                self.statistics.last_damage_event_time = now
+                return
         self.do_damage(ww, wh, x, y, w, h, options)
         self.statistics.last_damage_event_time = now
 
@@ -1447,7 +1803,7 @@ class WindowSource(WindowIconSource):
             if actual_encoding is None:
                 q = options.get("quality") or self._current_quality
                 s = options.get("speed") or self._current_speed
-                actual_encoding = self.get_best_encoding(w, h, s, q, self.encoding)
+                actual_encoding = self.select_encoding(self.get_best_encoding, x, y, w, h, s, q, self.encoding, options)
             if self.must_encode_full_frame(actual_encoding):
                 x, y = 0, 0
                 w, h = ww, wh
@@ -1528,12 +1884,11 @@ class WindowSource(WindowIconSource):
         #or too many pixels in those requests
         #for the last time_unit, and if so we force batching on
         event_min_time = now-self.batch_config.time_unit
-        all_pixels = tuple(pixels for _,event_time,pixels in self.global_statistics.damage_last_events
-                           if event_time>event_min_time)
-        eratio = len(all_pixels) / self.batch_config.max_events
+        damage_last_events = self.global_statistics.damage_last_events
+        eratio = damage_last_events.count_since(event_min_time) / self.batch_config.max_events
         if eratio>1.0:
             return True
-        pratio = sum(all_pixels) / self.batch_config.max_pixels
+        pratio = damage_last_events.sum("pixels", event_min_time) / self.batch_config.max_pixels
         if pratio>1.0:
             return True
         try:
@@ -1785,11 +2140,11 @@ class WindowSource(WindowIconSource):
         speed = options.get("speed") or self._current_speed
         quality = options.get("quality") or self._current_quality
         get_best_encoding = get_best_encoding or self.get_best_encoding
-        def get_encoding(w, h):
-            return get_best_encoding(w, h, speed, quality, coding)
+        def get_encoding(x, y, w, h):
+            return self.select_encoding(get_best_encoding, x, y, w, h, speed, quality, coding, options)
 
         def send_full_window_update(cause):
-            actual_encoding = get_encoding(ww, wh)
+            actual_encoding = get_encoding(0, 0, ww, wh)
             log("send_delayed_regions: using full window update %sx%s as %5s: %s, from %s",
                 ww, wh, actual_encoding, cause, get_best_encoding)
             assert actual_encoding is not None
@@ -1855,7 +2210,7 @@ class WindowSource(WindowIconSource):
         #and shortcut out if this needs to be a full window update:
         i_reg_enc = []
         for i,region in enumerate(regions):
-            actual_encoding = get_encoding(region.width, region.height)
+            actual_encoding = get_encoding(region.x, region.y, region.width, region.height)
             if self.must_encode_full_frame(actual_encoding):
                 log("send_delayed_regions: using full frame for %s encoding of %ix%i",
                     actual_encoding, region.width, region.height)
@@ -1923,6 +2278,8 @@ class WindowSource(WindowIconSource):
             return
         self.pixel_format = image.get_pixel_format()
         self.image_depth = image.get_depth()
+        if damage_trace.recording:
+            damage_trace.region(self, self.wid, x, y, w, h, coding, image)
 
         if self.send_window_size:
             options["window-size"] = self.window_dimensions
@@ -1938,7 +2295,14 @@ class WindowSource(WindowIconSource):
         """ This function is called from the damage data thread!
             Extra care must be taken to prevent access to X11 functions on window.
         """
+        speculative = options.get("speculative")
+        if speculative and speculative.cancelled:
+            #new damage arrived before we got to encode it:
+            self.free_image_wrapper(image)
+            speculative.add(None)
+            return
         self.statistics.encoding_pending[sequence] = (damage_time, w, h)
+        start = monotonic_time()
         try:
             packet = self.make_data_packet(damage_time, process_damage_time, image, coding, sequence, options, flush)
         except Exception as e:
@@ -1948,15 +2312,24 @@ class WindowSource(WindowIconSource):
                 log.error("Error: failed to create data packet")
                 log.error(" %s", e)
             packet = None
+            self.reset_client_references()
         finally:
             self.free_image_wrapper(image)
             del image
             #may have been cancelled whilst we processed it:
             self.statistics.encoding_pending.pop(sequence, None)
+        if speculative:
+            self.speculative_refresh_encoded(speculative, packet, damage_time, process_damage_time, options)
+            return
         #NOTE: we MUST send it (even if the window is cancelled by now..)
         #because the code may rely on the client having received this frame
         if not packet:
             return
+        end = monotonic_time()
+        record_stage = self.statistics.record_stage
+        record_stage(self.wid, "damage-capture", damage_time, process_damage_time, sequence=sequence)
+        record_stage(self.wid, "capture-encode", process_damage_time, start, sequence=sequence)
+        record_stage(self.wid, "encode", start, end, sequence=sequence, encoding=bytestostr(packet[6]), pixels=w*h)
         #queue packet for sending:
         self.queue_damage_packet(packet, damage_time, process_damage_time, options)
 
@@ -1973,7 +2346,8 @@ class WindowSource(WindowIconSource):
 
     def do_schedule_auto_refresh(self, encoding, data, region, client_options, options):
         assert data
-        if (encoding.startswith("png") and (self.image_depth<=24 or self.image_depth==32)) or encoding.startswith("rgb") or encoding=="mmap":
+        if (encoding.startswith("png") and (self.image_depth<=24 or self.image_depth==32)) or \
+            encoding.startswith("rgb") or encoding in ("mmap", "palette"):
             actual_quality = 100
             lossy = False
         else:
@@ -2034,6 +2408,8 @@ class WindowSource(WindowIconSource):
                 target_time = self.refresh_target_time
                 self.refresh_target_time = max(target_time, now + sched_delay/1000.0)
                 msg += ", re-scheduling refresh (due in %ims, %ims added - sched_delay=%s, pct=%i, batch=%i)" % (1000*(self.refresh_target_time-now), 1000*(self.refresh_target_time-target_time), sched_delay, pct, self.batch_config.delay)
+            if SPECULATIVE_REFRESH and not self.speculative_timer:
+                self.speculative_timer = self.timeout_add(SPECULATIVE_REFRESH_DELAY, self.speculative_refresh_timer_function)
         self.last_auto_refresh_message = now, msg
         refreshlog("auto refresh: %5s screen update (actual quality=%3i, lossy=%5s), %s (region=%s, refresh regions=%s)",
                    encoding, actual_quality, lossy, msg, region, self.refresh_regions)
@@ -2090,12 +2466,21 @@ class WindowSource(WindowIconSource):
         return False
 
     def timer_full_refresh(self):
+        spec = self.speculative
+        if spec and spec.is_complete():
+            #the refresh is already encoded:
+            self.send_speculative_refresh(spec)
+        else:
+            self.cancel_speculative_refresh()
         #copy event time and list of regions (which may get modified by another thread)
         ret = self.refresh_event_time
         self.refresh_event_time = 0
         regions = self.refresh_regions
         self.refresh_regions = []
         if self.can_refresh() and regions and ret>0:
+            if self.use_progressive_refresh(regions):
+                self.progressive_refresh(regions)
+                return False
             now = monotonic_time()
             options = self.get_refresh_options()
             refresh_exclude = self.get_refresh_exclude()    #pylint: disable=assignment-from-none
@@ -2104,6 +2489,179 @@ class WindowSource(WindowIconSource):
             WindowSource.do_send_delayed_regions(self, now, regions, self.auto_refresh_encodings[0], options, exclude_region=refresh_exclude, get_best_encoding=self.get_refresh_encoding)
         return False
 
+    def speculative_refresh_timer_function(self):
+        """
+            Encodes the auto-refresh ahead of time,
+            but only once the window contents have settled
+            and when the encode thread and the network connection are idle,
+            so this does not use any extra resources when they are busy.
+        """
+        self.speculative_timer = None
+        if not self.refresh_timer or self.speculative or not self.can_refresh():
+            return False
+        now = monotonic_time()
+        if self.refresh_target_time-now<SPECULATIVE_REFRESH_DELAY/1000:
+            #the refresh timer is due soon, leave it to do the work
+            return False
+        settle = max(SPECULATIVE_REFRESH_DELAY, self.batch_config.delay*2)/1000
+        delay = self.statistics.last_damage_event_time+settle-now
+        busy = bool(self._damage_delayed or self.encode_queue or self.statistics.encoding_pending or
+                    self.queue_size()>0 or self.get_packets_backlog()>0)
+        if delay>0 or busy:
+            delay = max(delay, settle)
+            self.speculative_timer = self.timeout_add(int(delay*1000), self.speculative_refresh_timer_function)
+            return False
+        regions = list(self.refresh_regions)
+        if not regions or self.use_progressive_refresh(regions):
+            return False
+        spec = SpeculativeRefresh(regions)
+        self.speculative = spec
+        self.speculative_counts["started"] += 1
+        options = self.get_refresh_options()
+        options["speculative"] = spec
+        refresh_exclude = self.get_refresh_exclude()    #pylint: disable=assignment-from-none
+        refreshlog("speculative refresh of %s, refresh due in %ims", regions, 1000*(self.refresh_target_time-now))
+        sequence = self._sequence
+        WindowSource.do_send_delayed_regions(self, now, regions, self.auto_refresh_encodings[0], options,
+                                             exclude_region=refresh_exclude, get_best_encoding=self.get_refresh_encoding)
+        if spec.set_expected(self._sequence-sequence):
+            self.speculative_refresh_ready(spec)
+        return False
+
+    def speculative_refresh_encoded(self, spec, packet, damage_time, process_damage_time, options):
+        #runs in the encode thread
+        item = None
+        if packet:
+            item = (packet, damage_time, process_damage_time, options)
+        done = spec.add(item)
+        if spec.cancelled:
+            if packet and spec.uses_client_references():
+                self.reset_client_references()
+        elif done:
+            self.idle_add(self.speculative_refresh_ready, spec)
+
+    def speculative_refresh_ready(self, spec):
+        if spec is not self.speculative or not self.refresh_timer:
+            return
+        refreshlog("speculative_refresh_ready(%s) after %ims", spec, 1000*(monotonic_time()-spec.start))
+        if not spec.is_complete():
+            #some regions were not encoded, the refresh timer will deal with it
+            self.cancel_speculative_refresh()
+            return
+        if self.get_packets_backlog()>0 or monotonic_time()-self.global_statistics.last_congestion_time<1:
+            #keep it until the refresh timer fires
+            return
+        self.send_speculative_refresh(spec)
+
+    def send_speculative_refresh(self, spec):
+        self.speculative = None
+        self.speculative_counts["sent"] += 1
+        for region in spec.regions:
+            self.remove_refresh_region(region)
+        if not self.refresh_regions:
+            self.cancel_refresh_timer()
+        #there has been no damage since we captured the pixels,
+        #so any newer frames will be queued after this one:
+        self.call_in_encode_thread(True, self.queue_speculative_refresh, spec)
+
+    def queue_speculative_refresh(self, spec):
+        for packet, damage_time, process_damage_time, options in spec.items:
+            self.queue_damage_packet(packet, damage_time, process_damage_time, options)
+
+    def cancel_speculative_refresh(self):
+        spec = self.speculative
+        if spec:
+            self.speculative = None
+            spec.cancelled = True
+            self.speculative_counts["cancelled"] += 1
+            if spec.uses_client_references():
+                self.call_in_encode_thread(False, self.reset_client_references)
+
+    def get_refine_budget(self) -> int:
+        #in bytes per second:
+        return (self.bandwidth_limit or 0)*PROGRESSIVE_REFRESH_BUDGET//100//8
+
+    def get_refine_encoding(self):
+        coding = "rgb32" if self.image_depth==32 else "rgb24"
+        if coding in self.common_encodings:
+            return coding
+        return None
+
+    def use_progressive_refresh(self, regions) -> bool:
+        """
+            The layers are applied by the client using the delta buckets,
+            so we need those and the rgb encoding.
+            Only worth doing if sending the refresh in one go
+            would use more than a second's worth of the bandwidth budget,
+            assuming around one byte per pixel for the lossless encoding.
+        """
+        if not PROGRESSIVE_REFRESH or not self.delta_store or self.refresh_quality<100:
+            return False
+        if self.get_downscale_size():
+            #the layers would be sent at full size:
+            return False
+        budget = self.get_refine_budget()
+        if budget<=0 or not self.get_refine_encoding():
+            return False
+        return sum(rect.width*rect.height for rect in regions)>budget
+
+    def progressive_refresh(self, regions, layer=0):
+        """
+            Sends one layer of the refresh,
+            the next layer is sent once the bandwidth budget allows it.
+        """
+        self.cancel_refine_timer()
+        if layer==0:
+            #an area that is still being refined needs to start again:
+            regions = list(regions)+self.refine_regions
+            self.progressive_counts["started"] += 1
+        self.progressive_counts["layers"] += 1
+        now = monotonic_time()
+        self.refine_layer = layer
+        self.refine_start = now
+        self.refine_bytes = 0
+        coding = self.get_refine_encoding()
+        options = self.get_refresh_options()
+        options["refine"] = layer
+        refresh_exclude = self.get_refresh_exclude()    #pylint: disable=assignment-from-none
+        refreshlog("progressive_refresh(%s, %i) using %s", regions, layer, coding)
+        def get_refine_encoding(*_args):
+            return coding
+        WindowSource.do_send_delayed_regions(self, now, regions, coding, options,
+                                             exclude_region=refresh_exclude, get_best_encoding=get_refine_encoding)
+        if layer+1<len(REFINE_MASKS):
+            self.refine_regions = list(regions)
+            self.refine_timer = self.timeout_add(self.batch_config.delay, self.refine_timer_function)
+        else:
+            self.refine_regions = []
+
+    def refine_timer_function(self):
+        self.refine_timer = None
+        regions = self.refine_regions
+        if not regions or not self.can_refresh():
+            self.refine_regions = []
+            return False
+        budget = max(1, self.get_refine_budget())
+        now = monotonic_time()
+        due = self.refine_start + self.refine_bytes/budget
+        busy = bool(self.statistics.encoding_pending or self.queue_size()>0 or self.get_packets_backlog()>0)
+        if due>now or busy:
+            delay = max(self.batch_config.delay, int(1000*(due-now)))
+            self.refine_timer = self.timeout_add(delay, self.refine_timer_function)
+            return False
+        self.progressive_refresh(regions, self.refine_layer+1)
+        return False
+
+    def cancel_refine_timer(self):
+        rt = self.refine_timer
+        if rt:
+            self.refine_timer = None
+            self.source_remove(rt)
+
+    def cancel_progressive_refresh(self):
+        self.cancel_refine_timer()
+        self.refine_regions = []
+
     def get_refresh_encoding(self, w, h, speed, quality, coding):
         refresh_encodings = self.auto_refresh_encodings
         encoding = refresh_encodings[0]
@@ -2132,6 +2690,8 @@ class WindowSource(WindowIconSource):
         if not self.auto_refresh_encodings or self.is_cancelled():
             #can happen during cleanup
             return
+        self.cancel_speculative_refresh()
+        self.cancel_progressive_refresh()
         refresh_regions = self.refresh_regions
         #since we're going to refresh the whole window,
         #we don't need to track what needs refreshing:
@@ -2175,10 +2735,13 @@ class WindowSource(WindowIconSource):
         def start_send(bytecount):
             ack_pending[0] = monotonic_time()
             ack_pending[2] = bytecount
+        queued_time = monotonic_time()
         def damage_packet_sent(bytecount):
             now = monotonic_time()
             ack_pending[3] = now
             ack_pending[4] = bytecount
+            statistics.record_stage(self.wid, "queue-send", queued_time, now,
+                                    packet_sequence=damage_packet_sequence, size=ldata)
             if process_damage_time>0:
                 statistics.damage_out_latency.append((now, width*height, actual_batch_delay, now-process_damage_time))
             elapsed_ms = int((now-ack_pending[0])*1000)
@@ -2296,6 +2859,8 @@ class WindowSource(WindowIconSource):
         #damage_packet_sent, so we must validate the data:
         if bytecount>0 and end_send_at>0:
             now = monotonic_time()
+            self.statistics.record_stage(self.wid, "send-ack", end_send_at, now,
+                                         packet_sequence=damage_packet_sequence, decode_time=decode_time)
             if decode_time>0:
                 latency = int(1000*(now-damage_time))
                 self.global_statistics.record_latency(self.wid, decode_time,
@@ -2344,6 +2909,16 @@ class WindowSource(WindowIconSource):
             log("ack with expired delayed region: %s", damage_delayed)
             self.idle_add(call_may_send_delayed)
 
+    def reset_client_references(self):
+        """
+            The palette and the delta buckets must match the client's copy exactly,
+            start again from scratch when packets may have been lost.
+        """
+        self.palette = None
+        ds = self.delta_store
+        if ds:
+            ds.reset()
+
     def client_decode_error(self, error, message):
         #don't print error code -1, which is just a generic code for error
         emsg = {-1 : ""}.get(error, error)
@@ -2360,6 +2935,7 @@ class WindowSource(WindowIconSource):
         else:
             log.warn(" unknown cause")
         self.global_statistics.decode_errors += 1
+        self.reset_client_references()
         if self.window:
             delay = min(1000, 250+self.global_statistics.decode_errors*100)
             self.decode_error_refresh_timer = self.timeout_add(delay, self.decode_error_refresh)
@@ -2411,6 +2987,9 @@ class WindowSource(WindowIconSource):
         log("make_data_packet: image=%s, damage data: %s", image, (self.wid, x, y, w, h, coding))
         start = monotonic_time()
 
+        if self.content_classification and not options.get("encoding") and not options.get("auto_refresh"):
+            self.classify_content(image, coding)
+
         #by default, don't set rowstride (the container format will take care of providing it):
         encoder = self._encoders.get(coding)
         if encoder is None:
@@ -2418,7 +2997,15 @@ class WindowSource(WindowIconSource):
                 log("make_data_packet: skipped, sequence no %i is cancelled", sequence)
                 return None
             raise Exception("BUG: no encoder not found for %s" % coding)
-        ret = encoder(coding, image, options)
+        scaled = False
+        if coding in DOWNSCALE_ENCODINGS and not options.get("full-size"):
+            image = self.downscale_image(image)
+            scaled = image.get_width()!=w or image.get_height()!=h
+        se = self.shared_encodings
+        if se and coding in SHARED_ENCODING_TYPES and se.is_shared(self.wid):
+            ret = self.shared_encode(se, encoder, coding, image, options)
+        else:
+            ret = encoder(coding, image, options)
         if ret is None:
             log("%s%s returned None", encoder, (coding, image, options))
             #something went wrong.. nothing we can do about it here!
@@ -2426,12 +3013,21 @@ class WindowSource(WindowIconSource):
 
         coding, data, client_options, outw, outh, outstride, bpp = ret
         coding = bytestostr(coding)
+        if scaled:
+            #the client will upscale the pixels to the full size:
+            if coding in ("rgb24", "rgb32"):
+                client_options["scaled-size"] = outw, outh
+            outw, outh = w, h
         #check cancellation list again since the code above may take some time:
         #but always send mmap data so we can reclaim the space!
         if coding!="mmap" and (self.is_cancelled(sequence) or self.suspended):
             log("make_data_packet: dropping data packet for window %s with sequence=%s", self.wid, sequence)
+            #the client will never see the palette entries or pixels we have just stored:
+            self.reset_client_references()
             return None
         csize = len(data)
+        if options.get("refine") is not None:
+            self.refine_bytes += csize
         if INTEGRITY_HASH and coding!="mmap":
             #could be a compressed wrapper or just raw bytes:
             try:
@@ -2457,6 +3053,73 @@ class WindowSource(WindowIconSource):
         self.statistics.encoding_stats.append((end, coding, w*h, bpp, csize, end-start))
         return self.make_draw_packet(x, y, outw, outh, coding, data, outstride, client_options, options)
 
+    def get_downscale_size(self):
+        """
+            The size the client shows this window at,
+            if it is small enough to make it worth downscaling the pixels before encoding them.
+        """
+        if not DOWNSCALE:
+            return None
+        size = self.client_display_size or self.client_render_size
+        if not size:
+            return None
+        dw, dh = size
+        ww, wh = self.window_dimensions
+        if dw<=0 or dh<=0 or ww-dw<=DOWNSCALE_THRESHOLD or wh-dh<=DOWNSCALE_THRESHOLD:
+            return None
+        return dw, dh
+
+    def downscale_image(self, image):
+        """
+            Uses area averaging to preserve as much detail as possible,
+            the lossless refresh will then also be sent at the smaller size,
+            the client can request a "full-size" refresh if it needs one.
+        """
+        size = self.get_downscale_size()
+        if not size:
+            return image
+        dw, dh = size
+        ww, wh = self.window_dimensions
+        w, h = image.get_width(), image.get_height()
+        #keep the same proportions:
+        sw = min(w, max(1, w*dw//ww))
+        sh = min(h, max(1, h*dh//wh))
+        if sw==w and sh==h:
+            return image
+        scaled = rgb_downscale(image, sw, sh)
+        if not scaled:
+            return image
+        self.downscaled += 1
+        return scaled
+
+    def shared_encode(self, se, encoder, coding, image, options):
+        """
+            Other clients are showing this window,
+            so we may be able to use the pixels they have already compressed (or vice versa).
+            The key identifies the pixels and all the settings the encoders use,
+            each window source captures the pixels separately so they are identified by a fast hash.
+        """
+        def rounded(v, step):
+            return min(100, max(step, (v+step//2)//step*step))
+        options = options.copy()
+        options["quality"] = rounded(options.get("quality") or self.get_quality(coding), SHARED_QUALITY_STEP)
+        options["speed"] = rounded(options.get("speed") or self.get_speed(coding), SHARED_SPEED_STEP)
+        key = (self.wid, image.get_target_x(), image.get_target_y(), image.get_width(), image.get_height(),
+               image.get_pixel_format(), image.get_rowstride(), coding, encoder.__name__,
+               options["quality"], options["speed"], options.get("transparency", True),
+               self.supports_transparency, self.encoding=="grayscale", self.content_type,
+               tuple(self.window_dimensions), tuple(self.client_render_size or ()), self.full_csc_modes.strtupleget(coding),
+               xxh3_hash(image.get_pixels()))
+        ret = se.get(key)
+        if ret:
+            compresslog("shared encoding: re-using %i bytes of %s", len(ret[1]), coding)
+            return ret
+        try:
+            ret = encoder(coding, image, options)
+        finally:
+            se.set(key, ret)
+        return ret
+
     def make_draw_packet(self, x, y, outw, outh, coding, data, outstride, client_options, options):
         if self.send_window_size:
             ws = options.get("window-size")
@@ -2466,10 +3129,13 @@ class WindowSource(WindowIconSource):
         self.global_statistics.packet_count += 1
         self.statistics.packet_count += 1
         self._damage_packet_sequence += 1
-        #record number of frames and pixels:
-        totals = self.statistics.encoding_totals.setdefault(coding, [0, 0])
+        #record number of frames, pixels, compressed and uncompressed bytes:
+        totals = self.statistics.encoding_totals.setdefault(coding, [0, 0, 0, 0])
         totals[0] = totals[0] + 1
         totals[1] = totals[1] + outw*outh
+        totals[2] = totals[2] + len(data)
+        totals[3] = totals[3] + outw*outh*4
+        encoder_totals.add(coding, outw*outh, len(data))
         self.encoding_last_used = coding
         #log("make_data_packet: returning packet=%s", packet[:7]+[".."]+packet[8:])
         return packet
@@ -2491,8 +3157,34 @@ class WindowSource(WindowIconSource):
 
     def rgb_encode(self, coding, image, options):
         s = options.get("speed") or self._current_speed
-        return rgb_encode(coding, image, self.rgb_formats, self.supports_transparency, s,
-                          self.rgb_zlib, self.rgb_lz4, self.rgb_lzo)
+        layer = options.get("refine")
+        refine_mask = None
+        lz4 = self.rgb_lz4
+        if layer is not None:
+            refine_mask = REFINE_MASKS[layer]
+            #the bandwidth is limited, zlib compresses the layers much better:
+            lz4 = lz4 and not self.rgb_zlib
+        ret = rgb_encode(coding, image, self.rgb_formats, self.supports_transparency, s,
+                         self.rgb_zlib, lz4, self.rgb_lzo, self.delta_store, refine_mask)
+        if ret and layer is not None:
+            #let the client know how many more layers are coming:
+            ret[2]["refine"] = len(REFINE_MASKS)-1-layer
+        return ret
+
+    def palette_encode(self, coding, image, options):
+        palette = None
+        if PALETTE_PERSISTENT:
+            palette = self.palette
+            if palette is None:
+                palette = self.palette = self.enc_palette.Palette()
+        ret = palette_encode(image, palette, self.rgb_formats, self.supports_transparency, self.rgb_lz4)
+        if ret:
+            return ret
+        #too many colours:
+        for fallback in ("png", "rgb24"):
+            if fallback in self.common_encodings and fallback in self._encoders:
+                return self._encoders[fallback](fallback, image, options)
+        raise Exception("no fallback encoding for palette")
 
     def no_r210(self, image, rgb_formats):
         rgb_format = image.get_pixel_format()
@@ -2552,17 +3244,7 @@ class WindowSource(WindowIconSource):
         s = options.get("speed") or self.get_speed(coding)
         transparency = self.supports_transparency and options.get("transparency", True)
         grayscale = self.encoding=="grayscale"
-        resize = None
-        w, h = image.get_width(), image.get_height()
-        ww, wh = self.window_dimensions
-        crs = self.client_render_size
-        if crs:
-            crsw, crsh = crs
-            #resize if the render size is smaller
-            if ww-crsw>DOWNSCALE_THRESHOLD and wh-crsh>DOWNSCALE_THRESHOLD:
-                #keep the same proportions:
-                resize = w*crsw//ww, h*crsh//wh
-        return self.enc_pillow.encode(coding, image, q, s, transparency, grayscale, resize)
+        return self.enc_pillow.encode(coding, image, q, s, transparency, grayscale)
 
     def mmap_encode(self, coding, image, _options):
         assert coding=="mmap"
@@ -8,16 +8,14 @@
 
 from math import sqrt
 
-from collections import deque
-from xpra.simple_stats import get_list_stats, get_weighted_list_stats
+from xpra.simple_stats import get_weighted_list_stats
 from xpra.os_util import monotonic_time
 from xpra.util import engs, csv, envint
 from xpra.server.cystats import (logp,      #@UnresolvedImport
-    calculate_time_weighted_average,        #@UnresolvedImport
-    calculate_size_weighted_average,        #@UnresolvedImport
-    calculate_timesize_weighted_average,    #@UnresolvedImport
     calculate_for_average,                  #@UnresolvedImport
+    TimeSeries, LatencyHistogram,           #@UnresolvedImport
     )
+from xpra.server.window.pipeline_trace import PIPELINE_STAGES, get_pipeline_trace
 
 from xpra.log import Logger
 log = Logger("stats")
@@ -44,21 +42,26 @@ class WindowPerformanceStatistics:
 
     def reset(self):
         self.init_time = monotonic_time()
-        self.client_decode_time = deque(maxlen=NRECS)       #records how long it took the client to decode frames:
-                                                            #(ack_time, no of pixels, decoding_time*1000*1000)
-        self.encoding_stats = deque(maxlen=NRECS)           #encoding: (time, coding, pixels, bpp, compressed_size, encoding_time)
+        #latency of each stage of the damage pipeline:
+        self.stage_latency = dict((stage, LatencyHistogram()) for stage in PIPELINE_STAGES)
+        #records how long it took the client to decode frames (decoding_time*1000*1000):
+        self.client_decode_time = TimeSeries(NRECS, ("time", "pixels", "decode_time"))
+        #encoding:
+        self.encoding_stats = TimeSeries(NRECS, ("time", "coding", "pixels", "bpp", "compressed_size", "encoding_time"),
+                                         labels=("coding", ))
         # statistics:
-        self.damage_in_latency = deque(maxlen=NRECS)        #records how long it took for a damage request to be sent
-                                                            #last NRECS: (sent_time, no of pixels, actual batch delay, damage_latency)
-        self.damage_out_latency = deque(maxlen=NRECS)       #records how long it took for a damage request to be processed
-                                                            #last NRECS: (processed_time, no of pixels, actual batch delay, damage_latency)
+        #records how long it took for a damage request to be sent:
+        self.damage_in_latency = TimeSeries(NRECS, ("time", "pixels", "batch_delay", "latency"))
+        #records how long it took for a damage request to be processed:
+        self.damage_out_latency = TimeSeries(NRECS, ("time", "pixels", "batch_delay", "latency"))
         self.damage_ack_pending = {}                        #records when damage packets are sent
                                                             #so we can calculate the "client_latency" when the client sends
                                                             #the corresponding ack ("damage-sequence" packet - see "client_ack_damage")
-        self.encoding_totals = {}                           #for each encoding, how many frames we sent and how many pixels in total
+        self.encoding_totals = {}                           #for each encoding, how many frames, pixels, compressed and uncompressed bytes we sent
         self.encoding_pending = {}                          #damage regions waiting to be picked up by the encoding thread:
                                                             #for each sequence no: (damage_time, w, h)
-        self.last_damage_events = deque(maxlen=4*NRECS)     #every time we get a damage event, we record: time,x,y,w,h
+        #every time we get a damage event, we record:
+        self.last_damage_events = TimeSeries(4*NRECS, ("time", "x", "y", "w", "h"))
         self.last_damage_event_time = 0
         self.last_recalculate = 0
         self.damage_events_count = 0
@@ -81,24 +84,31 @@ class WindowPerformanceStatistics:
         #this should be a last resort..
         self.damage_ack_pending = {}
 
+    def record_stage(self, wid, stage, start, end, **args):
+        """
+            Records the time spent in one of the PIPELINE_STAGES,
+            and adds it to the pipeline trace if one is active.
+        """
+        self.stage_latency[stage].record(end-start)
+        pipeline_trace = get_pipeline_trace()
+        if pipeline_trace.is_active():
+            pipeline_trace.add(wid, stage, start, end, **args)
+
 
     def update_averages(self):
         #damage "in" latency: (the time it takes for damage requests to be processed only)
-        dil = tuple(self.damage_in_latency)
+        dil = self.damage_in_latency
         if dil:
-            data = tuple((when, latency) for when, _, _, latency in dil)
-            self.avg_damage_in_latency, self.recent_damage_in_latency =  calculate_time_weighted_average(data)
+            self.avg_damage_in_latency, self.recent_damage_in_latency = dil.time_weighted_average("latency")
         #damage "out" latency: (the time it takes for damage requests to be processed and sent out)
-        dol = tuple(self.damage_out_latency)
+        dol = self.damage_out_latency
         if dol:
-            data = tuple((when, latency) for when, _, _, latency in dol)
-            self.avg_damage_out_latency, self.recent_damage_out_latency = calculate_time_weighted_average(data)
+            self.avg_damage_out_latency, self.recent_damage_out_latency = dol.time_weighted_average("latency")
         #client decode speed:
-        cdt = tuple(self.client_decode_time)
+        cdt = self.client_decode_time
         if cdt:
             #the elapsed time recorded is in microseconds:
-            decode_speed = tuple((event_time, size, int(size*1000*1000/elapsed)) for event_time, size, elapsed in cdt)
-            r = calculate_size_weighted_average(decode_speed)
+            r = cdt.size_weighted_speed("pixels", "decode_time", 1000*1000)
             self.avg_decode_speed = int(r[0])
             self.recent_decode_speed = int(r[1])
         #network send speed:
@@ -149,9 +159,8 @@ class WindowPerformanceStatistics:
             mayaddfac(metric, info, target, weight)
         if bandwidth_limit>0:
             #calculate how much bandwith we have used in the last second (in bps):
-            #encoding_stats.append((end, coding, w*h, bpp, len(data), end-start))
             cutoff = monotonic_time()-1
-            used = sum(v[4] for v in tuple(self.encoding_stats) if v[0]>cutoff) * 8
+            used = self.encoding_stats.sum("compressed_size", cutoff) * 8
             info = {
                 "budget"  : bandwidth_limit,
                 "used"    : used,
@@ -200,10 +209,10 @@ class WindowPerformanceStatistics:
                 add_compression_stats(enc_stats, encoding)
 
         dinfo = info.setdefault("damage", {})
-        latencies = tuple(x[-1]*1000 for x in tuple(self.damage_in_latency))
-        dinfo["in_latency"]  = get_list_stats(latencies, show_percentile=[9])
-        latencies = tuple(x[-1]*1000 for x in tuple(self.damage_out_latency))
-        dinfo["out_latency"] = get_list_stats(latencies, show_percentile=[9])
+        dinfo["in_latency"]  = self.damage_in_latency.list_stats("latency", 1000, show_percentile=[9])
+        dinfo["out_latency"] = self.damage_out_latency.list_stats("latency", 1000, show_percentile=[9])
+        #per stage latency, in microseconds:
+        info["pipeline"] = dict((stage, h.get_info()) for stage, h in self.stage_latency.items())
         #per encoding totals:
         if self.encoding_totals:
             tf = info.setdefault("total_frames", {})
@@ -221,9 +230,9 @@ class WindowPerformanceStatistics:
             Then we add the average decoding latency.
             """
         decoding_latency = 0.010
-        cdt = tuple(self.client_decode_time)
+        cdt = self.client_decode_time
         if cdt:
-            decoding_latency = calculate_timesize_weighted_average(cdt)[0]/1000.0
+            decoding_latency = cdt.size_weighted_rate("pixels", "decode_time")[0]/1000.0
         min_latency = max(abs_min, min_client_latency or abs_min)*1.2
         avg_latency = max(min_latency, avg_client_latency or abs_min)
         max_latency = min(avg_latency, 4.0*min_latency+0.100)
@@ -281,15 +290,15 @@ class WindowPerformanceStatistics:
 
     def get_bitrate(self, max_elapsed=1):
         cutoff = monotonic_time()-max_elapsed
-        recs = tuple((v[0], v[4]) for v in tuple(self.encoding_stats) if v[0]>=cutoff)
-        if len(recs)<2:
+        times = self.encoding_stats.values("time", cutoff)
+        if len(times)<2:
             return 0
-        bits = sum(v[1] for v in recs) * 8
-        elapsed = recs[-1][0]-recs[0][0]
+        bits = self.encoding_stats.sum("compressed_size", cutoff) * 8
+        elapsed = times[-1]-times[0]
         if elapsed==0:
             return 0
         return int(bits/elapsed)
 
     def get_damage_pixels(self, elapsed=1):
         cutoff = monotonic_time()-elapsed
-        return sum(v[3]*v[4] for v in tuple(self.last_damage_events) if v[0]>cutoff)
+        return int(self.last_damage_events.sum_product("w", "h", cutoff))
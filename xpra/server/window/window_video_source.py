@@ -17,11 +17,14 @@ from xpra.server.window.window_source import (
     WindowSource, DelayedRegions,
     STRICT_MODE, AUTO_REFRESH_SPEED, AUTO_REFRESH_QUALITY, MAX_RGB, LOSSLESS_WINDOW_TYPES,
     DOWNSCALE_THRESHOLD,
+    damage_trace,
     )
 from xpra.rectangle import rectangle, merge_all          #@UnresolvedImport
 from xpra.server.window.motion import ScrollData                    #@UnresolvedImport
 from xpra.server.window.video_subregion import VideoSubregion, VIDEO_SUBREGION
+from xpra.server.window.video_stream import VideoStream
 from xpra.server.window.video_scoring import get_pipeline_score
+from xpra.server.window.content_classifier import TEXT   #@UnresolvedImport
 from xpra.codecs.codec_constants import PREFERRED_ENCODING_ORDER, EDGE_ENCODING_ORDER
 from xpra.codecs.loader import has_codec
 from xpra.util import parse_scaling_value, engs, envint, envbool, csv, roundup, print_nested_dict, first_time, typedict
@@ -48,6 +51,8 @@ MIN_VIDEO_EVENTS = envint("XPRA_MIN_VIDEO_EVENTS", 20)
 ENCODE_QUEUE_MIN_GAP = envint("XPRA_ENCODE_QUEUE_MIN_GAP", 5)
 
 VIDEO_TIMEOUT = envint("XPRA_VIDEO_TIMEOUT", 10)
+#maximum number of video regions encoded concurrently for each window:
+MAX_VIDEO_STREAMS = max(1, envint("XPRA_VIDEO_STREAMS", 4))
 VIDEO_NODETECT_TIMEOUT = envint("XPRA_VIDEO_NODETECT_TIMEOUT", 10*60)
 
 FORCE_CSC_MODE = os.environ.get("XPRA_FORCE_CSC_MODE", "")   #ie: "YUV444P"
@@ -122,6 +127,8 @@ class WindowVideoSource(WindowSource):
         self.scroll_min_percent = self.encoding_options.intget("scrolling.min-percent", SCROLL_MIN_PERCENT)
         self.supports_video_b_frames = self.encoding_options.strtupleget("video_b_frames", ())
         self.video_max_size = self.encoding_options.inttupleget("video_max_size", (8192, 8192), 2, 2)
+        #older clients only have one video decoder per window:
+        self.max_video_streams = max(1, min(MAX_VIDEO_STREAMS, self.encoding_options.intget("video_streams", 1)))
         self.video_subregion = VideoSubregion(self.timeout_add, self.source_remove, self.refresh_subregion, self.auto_refresh_delay)
         self.video_stream_file = None
 
@@ -184,6 +191,10 @@ class WindowVideoSource(WindowSource):
         self.encode_from_queue_due = 0
         self.scroll_data = None
         self.last_scroll_time = 0
+        #the secondary video regions, indexed by stream number:
+        self.video_streams = {}
+        #stream numbers are never re-used, so stale frames cannot reach a new stream:
+        self.video_stream_counter = 0
 
     def do_set_auto_refresh_delay(self, min_delay, delay):
         super().do_set_auto_refresh_delay(min_delay, delay)
@@ -235,6 +246,9 @@ class WindowVideoSource(WindowSource):
                 log.error("Error collecting codec information from %s", x, exc_info=True)
         addcinfo("csc", self._csc_encoder)
         addcinfo("encoder", self._video_encoder)
+        streams = dict(self.video_streams)
+        if streams:
+            info["video-streams"] = dict((sid, stream.get_info()) for sid, stream in streams.items())
         info.setdefault("encodings", {}).update({
                                                  "non-video"    : self.non_video_encodings,
                                                  "video"        : self.common_video_encodings,
@@ -321,6 +335,8 @@ class WindowVideoSource(WindowSource):
         """ Calls clean() from the encode thread """
         csce = self._csc_encoder
         ve = self._video_encoder
+        for stream in tuple(self.video_streams.values()):
+            self.call_in_encode_thread(False, self.video_stream_clean, stream)
         if csce or ve:
             if DEBUG_VIDEO_CLEAN:
                 log.warn("video_context_clean() for wid %i: %s and %s", self.wid, csce, ve)
@@ -352,6 +368,41 @@ class WindowVideoSource(WindowSource):
             if SAVE_VIDEO_STREAMS:
                 self.close_video_stream_file()
 
+    def video_stream_clean(self, stream):
+        #runs in the encode thread
+        if stream.clean() and self.supports_eos:
+            log("sending eos for wid %i, stream %i", self.wid, stream.stream)
+            self.queue_packet(("eos", self.wid, stream.stream))
+
+    def update_video_streams(self, rects):
+        """
+            Ensures that we have a video stream for each of the secondary video regions,
+            the streams of regions that have gone away are cleaned up and their area refreshed.
+        """
+        rects = list(rects)[:self.max_video_streams-1]
+        for sid, stream in tuple(self.video_streams.items()):
+            if stream.rectangle in rects:
+                rects.remove(stream.rectangle)
+                continue
+            videolog("video stream %s is no longer needed", stream)
+            del self.video_streams[sid]
+            self.call_in_encode_thread(False, self.video_stream_clean, stream)
+            super().add_refresh_region(stream.rectangle)
+        for rect in rects:
+            self.video_stream_counter += 1
+            sid = self.video_stream_counter
+            stream = self.video_streams[sid] = VideoStream(sid, rect)
+            videolog("new video stream %s", stream)
+            super().remove_refresh_region(rect)
+        if not self.refresh_regions:
+            self.cancel_refresh_timer()
+
+    def get_video_stream(self, options):
+        sid = options.get("video-stream", 0)
+        if not sid:
+            return None
+        return self.video_streams.get(sid)
+
     def close_video_stream_file(self):
         vsf = self.video_stream_file
         if vsf:
@@ -424,6 +475,9 @@ class WindowVideoSource(WindowSource):
                 return self.get_best_encoding_video
         return super().get_best_encoding_impl_default()
 
+    def uses_auto_encoding(self):
+        return self.get_best_encoding==self.get_best_encoding_video or super().uses_auto_encoding()
+
 
     def get_best_encoding_video(self, ww, wh, speed, quality, current_encoding):
         """
@@ -453,7 +507,14 @@ class WindowVideoSource(WindowSource):
             return nonvideo(info="no common video encodings")
         if self.is_tray:
             return nonvideo(100, "system tray")
+        sr = self.video_subregion.rectangle
         text_hint = self.content_type=="text"
+        if not text_hint and not self.content_type:
+            #the content classifier may have found text in the area we would send as video:
+            if sr:
+                text_hint = self.get_content_class(sr.x, sr.y, sr.width, sr.height)==TEXT
+            else:
+                text_hint = self.get_content_class(0, 0, *self.window_dimensions)==TEXT
         if text_hint and not TEXT_USE_VIDEO:
             return nonvideo(info="text content-type")
 
@@ -464,7 +525,6 @@ class WindowVideoSource(WindowSource):
 
         rgbmax = self._rgb_auto_threshold
         videomin = cww*cwh // (1+video_hint*2)
-        sr = self.video_subregion.rectangle
         if sr:
             videomin = min(videomin, sr.width * sr.height)
             rgbmax = min(rgbmax, sr.width*sr.height//2)
@@ -498,9 +558,8 @@ class WindowVideoSource(WindowSource):
 
         if not video_hint and not self.is_shadow:
             if now-self.global_statistics.last_congestion_time>5:
-                lde = tuple(self.statistics.last_damage_events)
                 lim = now-4
-                pixels_last_4secs = sum(w*h for when,_,_,w,h in lde if when>lim)
+                pixels_last_4secs = self.statistics.last_damage_events.sum_product("w", "h", lim)
                 if pixels_last_4secs<((3+text_hint*6)*videomin):
                     return nonvideo(quality+30, "not enough frames")
                 lim = now-1
@@ -571,8 +630,7 @@ class WindowVideoSource(WindowSource):
     def do_damage(self, ww, wh, x, y, w, h, options):
         vs = self.video_subregion
         if vs:
-            r = vs.rectangle
-            if r and r.intersects(x, y, w, h):
+            if any(r.intersects(x, y, w, h) for r in tuple(vs.rectangles)):
                 #the damage will take care of scheduling it again
                 vs.cancel_refresh_timer()
         super().do_damage(ww, wh, x, y, w, h, options)
@@ -690,23 +748,26 @@ class WindowVideoSource(WindowSource):
         #don't refresh the video region as part of normal refresh,
         #use subregion refresh for that
         sarr = super().add_refresh_region
-        vr = self.video_subregion.rectangle
-        if vr is None:
+        vs = self.video_subregion
+        rects = tuple(vs.rectangles)
+        if not rects:
             #no video region, normal code path:
             return sarr(region)
-        if vr.contains_rect(region):
-            #all of it is in the video region:
-            self.video_subregion.add_video_refresh(region)
-            return 0
-        ir = vr.intersection_rect(region)
-        if ir is None:
-            #region is outside video region, normal code path:
-            return sarr(region)
-        #add intersection (rectangle in video region) to video refresh:
-        self.video_subregion.add_video_refresh(ir)
-        #add any rectangles not in the video region
+        outside = [region]
+        for vr in rects:
+            if vr.contains_rect(region):
+                #all of it is in this video region:
+                vs.add_video_refresh(region)
+                return 0
+            ir = vr.intersection_rect(region)
+            if ir is None:
+                continue
+            #add intersection (rectangle in video region) to video refresh:
+            vs.add_video_refresh(ir)
+            outside = [r for o in outside for r in o.substract_rect(vr)]
+        #add any rectangles not in the video regions
         #(if any: keep track if we actually added anything)
-        return sum(sarr(r) for r in region.substract_rect(vr))
+        return sum(sarr(r) for r in outside)
 
     def matches_video_subregion(self, width, height):
         vr = self.video_subregion.rectangle
@@ -718,6 +779,13 @@ class WindowVideoSource(WindowSource):
             return None
         return vr
 
+    def matches_video_stream(self, width, height):
+        for stream in tuple(self.video_streams.values()):
+            x, y, w, h = stream.get_masked_rectangle()
+            if w==width and h==height:
+                return stream
+        return None
+
     def subregion_is_video(self):
         vs = self.video_subregion
         if not vs:
@@ -773,37 +841,7 @@ class WindowVideoSource(WindowSource):
             return
         assert not self.full_frames_only
 
-        actual_vr = None
-        if vr in regions:
-            #found the video region the easy way: exact match in list
-            actual_vr = vr
-        else:
-            #find how many pixels are within the region (roughly):
-            #find all unique regions that intersect with it:
-            inter = tuple(x for x in (vr.intersection_rect(r) for r in regions) if x is not None)
-            if inter:
-                #merge all regions into one:
-                in_region = merge_all(inter)
-                pixels_in_region = vr.width*vr.height
-                pixels_intersect = in_region.width*in_region.height
-                if pixels_intersect>=pixels_in_region*40/100:
-                    #we have at least 40% of the video region
-                    #that needs refreshing, do it:
-                    actual_vr = vr
-
-            #still no luck?
-            if actual_vr is None:
-                #try to find one that has the same dimensions:
-                same_d = tuple(r for r in regions if r.width==vr.width and r.height==vr.height)
-                if len(same_d)==1:
-                    #probably right..
-                    actual_vr = same_d[0]
-                elif len(same_d)>1:
-                    #find one that shares at least one coordinate:
-                    same_c = tuple(r for r in same_d if r.x==vr.x or r.y==vr.y)
-                    if len(same_c)==1:
-                        actual_vr = same_c[0]
-
+        actual_vr = self.find_video_region(vr, regions)
         if actual_vr is None:
             sublog("do_send_delayed_regions: video region %s not found in: %s", vr, regions)
         else:
@@ -829,6 +867,26 @@ class WindowVideoSource(WindowSource):
             sublog("do_send_delayed_regions: subtracted %s from %s gives us %s", actual_vr, regions, trimmed)
             regions = trimmed
 
+        #the secondary video regions each have their own video stream:
+        for sid, stream in tuple(self.video_streams.items()):
+            if self.find_video_region(stream.rectangle, regions) is not stream.rectangle:
+                continue
+            ww, wh = self.window.get_dimensions()
+            x, y, w, h = stream.get_masked_rectangle()
+            if w<=0 or h<=0 or x+w>ww or y+h>wh:
+                continue
+            stream_options = options.copy()
+            stream_options["av-sync"] = True
+            stream_options["video-stream"] = sid
+            self.process_damage_region(damage_time, x, y, w, h, coding, stream_options, 0)
+            trimmed = []
+            for r in regions:
+                trimmed += r.substract(x, y, w, h)
+            sublog("do_send_delayed_regions: sent %s as video stream %i, remaining: %s", (x, y, w, h), sid, trimmed)
+            regions = trimmed
+            if not regions:
+                return
+
         #merge existing damage delayed region if there is one:
         #(this codepath can fire from a video region refresh callback)
         dr = self._damage_delayed
@@ -855,6 +913,39 @@ class WindowVideoSource(WindowSource):
             sublog("do_send_delayed_regions: delaying non video regions %s some more by %ims", regions, delay)
             self.expire_timer = self.timeout_add(delay, self.expire_delayed_region)
 
+    def find_video_region(self, vr, regions):
+        """
+            returns the region to send using the video encoder
+            if the damaged regions cover enough of the video region 'vr'
+        """
+        if vr in regions:
+            #found the video region the easy way: exact match in list
+            return vr
+        #find how many pixels are within the region (roughly):
+        #find all unique regions that intersect with it:
+        inter = tuple(x for x in (vr.intersection_rect(r) for r in regions) if x is not None)
+        if inter:
+            #merge all regions into one:
+            in_region = merge_all(inter)
+            pixels_in_region = vr.width*vr.height
+            pixels_intersect = in_region.width*in_region.height
+            if pixels_intersect>=pixels_in_region*40/100:
+                #we have at least 40% of the video region
+                #that needs refreshing, do it:
+                return vr
+        #still no luck?
+        #try to find one that has the same dimensions:
+        same_d = tuple(r for r in regions if r.width==vr.width and r.height==vr.height)
+        if len(same_d)==1:
+            #probably right..
+            return same_d[0]
+        if len(same_d)>1:
+            #find one that shares at least one coordinate:
+            same_c = tuple(r for r in same_d if r.x==vr.x or r.y==vr.y)
+            if len(same_c)==1:
+                return same_c[0]
+        return None
+
     def must_encode_full_frame(self, encoding):
         return self.full_frames_only or (encoding in self.video_encodings) or not self.non_video_encodings
 
@@ -899,6 +990,8 @@ class WindowVideoSource(WindowSource):
         #image may have been clipped to the new window size during resize:
         w = image.get_width()
         h = image.get_height()
+        if damage_trace.recording:
+            damage_trace.region(self, self.wid, x, y, w, h, coding, image)
         if self.send_window_size:
             options["window-size"] = self.window_dimensions
 
@@ -933,16 +1026,17 @@ class WindowVideoSource(WindowSource):
                 self.schedule_encode_from_queue(av_delay)
         #now figure out if we need to send edges separately:
         if video_mode and self.edge_encoding:
-            dw = w - (w & self.width_mask)
-            dh = h - (h & self.height_mask)
+            stream = self.get_video_stream(options) or self
+            dw = w - (w & stream.width_mask)
+            dh = h - (h & stream.height_mask)
             if dw>0 and h>0:
                 sub = image.get_sub_image(w-dw, 0, dw, h)
                 call_encode(dw, h, sub, self.edge_encoding, flush+1+int(dh>0))
-                w = w & self.width_mask
+                w = w & stream.width_mask
             if dh>0 and w>0:
                 sub = image.get_sub_image(0, h-dh, w, dh)
                 call_encode(dw, h, sub, self.edge_encoding, flush+1)
-                h = h & self.height_mask
+                h = h & stream.height_mask
         #the main area:
         if w>0 and h>0:
             call_encode(w, h, image, coding, flush)
@@ -1083,6 +1177,7 @@ class WindowVideoSource(WindowSource):
                 #cannot use video subregions
                 #FIXME: small race if a refresh timer is due when we change encoding - meh
                 vs.reset()
+                self.update_video_streams(())
             else:
                 old = vs.rectangle
                 ww, wh = self.window_dimensions
@@ -1127,6 +1222,7 @@ class WindowVideoSource(WindowSource):
                     refreshlog("video region cleared, scheduling refresh of old region: %s", old)
                     self.add_refresh_region(old)
                     vs.cancel_refresh_timer()
+                self.update_video_streams(vs.rectangles[1:])
         if force_reload:
             self.cleanup_codecs()
         self.check_pipeline_score(force_reload)
@@ -1378,6 +1474,11 @@ class WindowVideoSource(WindowSource):
             #matches the video subregion,
             #for which we have the fps already:
             return self.video_subregion.fps
+        stream = self.matches_video_stream(width, height)
+        hm = vs.heatmap if vs else None
+        if stream and hm:
+            r = stream.rectangle
+            return int(hm.get_rate(monotonic_time(), r.x, r.y, r.width, r.height))
         return self.do_get_video_fps(width, height)
 
     def do_get_video_fps(self, width, height):
@@ -1399,7 +1500,7 @@ class WindowVideoSource(WindowSource):
         q = self._current_quality
         s = self._current_speed
         now = monotonic_time()
-        crs = self.client_render_size
+        crs = self.client_display_size or self.client_render_size
         def get_min_required_scaling(default_value=(1, 1)):
             mw = max_w
             mh = max_h
@@ -1669,13 +1770,15 @@ class WindowVideoSource(WindowSource):
         return True
 
 
-    def setup_pipeline(self, scores, width, height, src_format):
+    def setup_pipeline(self, scores, width, height, src_format, stream=None):
         """
             Given a list of pipeline options ordered by their score
             and an input format (width, height and source pixel format),
             we try to create a working video pipeline (csc + encoder),
             trying each option until one succeeds.
             (some may not be suitable because of scaling?)
+            The pipeline is created for the main video region,
+            or for the secondary video 'stream' given.
 
             Runs in the 'encode' thread.
         """
@@ -1690,7 +1793,7 @@ class WindowVideoSource(WindowSource):
         for option in scores:
             try:
                 videolog("setup_pipeline: trying %s", option)
-                if self.setup_pipeline_option(width, height, src_format, *option):
+                if self.setup_pipeline_option(width, height, src_format, *option, stream=stream):
                     #success!
                     return True
                 #skip cleanup below
@@ -1707,8 +1810,11 @@ class WindowVideoSource(WindowSource):
                     return False
                 videolog.warn("Warning: failed to setup video pipeline %s", option, exc_info=True)
             #we're here because an exception occurred, cleanup before trying again:
-            self.csc_clean(self._csc_encoder)
-            self.ve_clean(self._video_encoder)
+            if stream:
+                stream.clean()
+            else:
+                self.csc_clean(self._csc_encoder)
+                self.ve_clean(self._video_encoder)
         end = monotonic_time()
         if not self.is_cancelled():
             videolog("setup_pipeline(..) failed! took %.2fms", (end-start)*1000.0)
@@ -1720,7 +1826,7 @@ class WindowVideoSource(WindowSource):
 
     def setup_pipeline_option(self, width, height, src_format,
                       _score, scaling, _csc_scaling, csc_width, csc_height, csc_spec,
-                      enc_in_format, encoder_scaling, enc_width, enc_height, encoder_spec):
+                      enc_in_format, encoder_scaling, enc_width, enc_height, encoder_spec, stream=None):
         speed = self._current_speed
         quality = self._current_quality
         min_w = 1
@@ -1758,16 +1864,25 @@ class WindowVideoSource(WindowSource):
             if encoder_scaling!=(1,1) and not encoder_spec.can_scale:
                 videolog("scaling is now enabled, so skipping %s", encoder_spec)
                 return False
-        self._csc_encoder = csce
+        if stream:
+            stream.csc_encoder = csce
+        else:
+            self._csc_encoder = csce
         enc_start = monotonic_time()
         #FIXME: filter dst_formats to only contain formats the encoder knows about?
         dst_formats = tuple(bytestostr(x) for x in self.full_csc_modes.strtupleget(encoder_spec.encoding))
         ve = encoder_spec.make_instance()
         options = typedict(self.encoding_options)
-        options.update(self.get_video_encoder_options(encoder_spec.encoding, width, height))
+        options.update(self.get_video_encoder_options(encoder_spec.encoding, width, height, stream))
         ve.init_context(enc_width, enc_height, enc_in_format,
                         dst_formats, encoder_spec.encoding,
                         quality, speed, encoder_scaling, options)
+        if stream:
+            #the limits of the main video pipeline are unchanged:
+            stream.set_pipeline(csce, ve, scaling, width_mask, height_mask)
+            videolog("setup_pipeline: %s csc=%s, video encoder=%s, setup took %.2fms",
+                     stream, csce, ve, (monotonic_time()-enc_start)*1000.0)
+            return True
         #record new actual limits:
         self.actual_scaling = scaling
         self.width_mask = width_mask
@@ -1784,13 +1899,18 @@ class WindowVideoSource(WindowSource):
         scalinglog("setup_pipeline: scaling=%s, encoder_scaling=%s", scaling, encoder_scaling)
         return True
 
-    def get_video_encoder_options(self, encoding, width, height):
+    def get_video_encoder_options(self, encoding, width, height, stream=None):
         #tweaks for "real" video:
         opts = {}
         if not self._fixed_quality and not self._fixed_speed and self._fixed_min_quality<50:
             #only allow bandwidth to drive video encoders
             #when we don't have strict quality or speed requirements:
             opts["bandwidth-limit"] = self.bandwidth_limit
+        if stream:
+            #secondary video regions are only created for actual video content,
+            #we don't flush delayed frames for those, so no b-frames:
+            opts["content-type"] = "video"
+            return opts
         if self.content_type:
             content_type = self.content_type
         elif self.matches_video_subregion(width, height) and self.subregion_is_video() and (monotonic_time()-self.last_scroll_time)>5:
@@ -2162,6 +2282,15 @@ class WindowVideoSource(WindowSource):
             videolog("do_video_encode: saving %4ix%-4i pixels, %7i bytes to %s", w, h, (stride*h), filename)
             img.save(filename, SAVE_VIDEO_FRAMES, **kwargs)
 
+        if options.get("video-stream", 0):
+            stream = self.get_video_stream(options)
+            if not stream:
+                #the stream was removed after this frame was queued,
+                #don't let the main video encoder deal with it:
+                videolog("do_video_encode: video stream %s is gone", options.get("video-stream"))
+                return self.video_fallback(image, options)
+            return self.video_stream_encode(stream, encoding, image, options)
+
         if self.may_use_scrolling(image, options):
             #scroll encoding has dealt with this image
             return None
@@ -2318,6 +2447,61 @@ class WindowVideoSource(WindowSource):
                             (enc_width*enc_height/(end-start+0.000001)/1024.0/1024.0), client_options)
         return actual_encoding, Compressed(actual_encoding, data), client_options, width, height, 0, 24
 
+    def video_stream_encode(self, stream, encoding, image, options : dict):
+        """
+            Encodes a frame for one of the secondary video regions,
+            using the stream's own pipeline.
+
+            Runs in the 'encode' thread.
+        """
+        if not self.common_video_encodings or self.image_depth not in (24, 30, 32) or self.encoding=="grayscale":
+            return self.video_fallback(image, options)
+        w, h = image.get_width(), image.get_height()
+        src_format = image.get_pixel_format()
+        width = w & stream.width_mask
+        height = h & stream.height_mask
+        if width<=0 or height<=0:
+            return self.video_fallback(image, options)
+        if encoding in ("auto", "grayscale"):
+            encodings = self.common_video_encodings
+        else:
+            encodings = [encoding]
+        if not stream.check(encodings, width, height, src_format):
+            stream.clean()
+            scores = self.get_video_pipeline_options(encodings, width, height, src_format)
+            if not self.setup_pipeline(scores, width, height, src_format, stream):
+                return self.video_fallback(image, options)
+            if (width & stream.width_mask)!=width or (height & stream.height_mask)!=height:
+                #the new pipeline needs different dimensions,
+                #we'll use those for the next frame:
+                return self.video_fallback(image, options)
+        ve = stream.video_encoder
+        if not ve.is_ready():
+            return self.video_fallback(image, options, order=FAST_ORDER)
+        quality = max(0, min(100, self._current_quality))
+        speed = max(0, min(100, self._current_speed))
+        options.update(self.get_video_encoder_options(ve.get_encoding(), width, height, stream))
+        try:
+            ret = stream.compress(image, width, height, quality, speed, options)
+        except Exception as e:
+            videolog("%s.compress%s", stream, (image, width, height, quality, speed, options), exc_info=True)
+            if self.is_cancelled():
+                return None
+            videolog.error("Error: failed to encode %s video frame for %s:", ve.get_encoding(), stream)
+            videolog.error(" %s", e)
+            stream.clean()
+            return None
+        if ret is None:
+            return None
+        data, client_options = ret
+        if not data:
+            #no b-frames, so this should not happen:
+            return self.video_fallback(image, options, order=FAST_ORDER)
+        actual_encoding = ve.get_encoding()
+        videolog("video_stream_encode %s %s: %4ix%-4i result is %7i bytes, client options=%s",
+                 stream, actual_encoding, width, height, len(data), client_options)
+        return actual_encoding, Compressed(actual_encoding, data), client_options, width, height, 0, 24
+
     def cancel_video_encoder_flush(self):
         self.cancel_video_encoder_flush_timer()
         self.b_frame_flush_data = None
@@ -510,6 +510,7 @@ class XpraDesktopServer(DesktopServerBaseClass):
         pass
 
     def _contents_changed(self, window, event):
+        self.record_input_damage()
         log("contents changed on %s: %s", window, event)
         self.refresh_window_area(window, event.x, event.y, event.width, event.height)
 
@@ -577,6 +578,8 @@ class XpraDesktopServer(DesktopServerBaseClass):
             pwid = packet[10]
             pointer = packet[11]
             modifiers = packet[12]
+            #the pending motion must not override this position:
+            self.flush_pointer_motion()
             if self._process_mouse_common(proto, pwid, pointer):
                 self._update_modifiers(proto, wid, modifiers)
         #some "configure-window" packets are only meant for metadata updates:
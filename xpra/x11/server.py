@@ -800,6 +800,7 @@ class XpraServer(GObject.GObject, X11ServerBase):
             self.repaint_root_overlay()
 
     def _contents_changed(self, window, event):
+        self.record_input_damage()
         if window.is_OR() or window.is_tray() or self._desktop_manager.visible(window):
             self.refresh_window_area(window, event.x, event.y, event.width, event.height, options={"damage" : True})
 
@@ -1011,6 +1012,8 @@ class XpraServer(GObject.GObject, X11ServerBase):
                     #this causes focus issues (see #1999)
                     pwid = -1
                 mouselog("configure pointer data: %s", (pwid, pointer, modifiers))
+                #the pending motion must not override this position:
+                self.flush_pointer_motion()
                 if self._process_mouse_common(proto, pwid, pointer):
                     #only update modifiers if the window is in focus:
                     if self._has_focus==wid:
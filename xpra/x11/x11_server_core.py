@@ -888,9 +888,8 @@ class X11ServerCore(GTKServerBase):
                 self.pointer_device_map[deviceid] = self.touchpad_device
 
 
-    def _process_wheel_motion(self, proto, packet):
+    def do_process_wheel_motion(self, proto, wid, button, distance, pointer, modifiers, _buttons):
         assert self.pointer_device.has_precise_wheel()
-        wid, button, distance, pointer, modifiers, _buttons = packet[1:7]
         with xsync:
             if self.do_process_mouse_common(proto, wid, pointer):
                 self._update_modifiers(proto, wid, modifiers)
@@ -950,6 +949,12 @@ class X11ServerCore(GTKServerBase):
                 self._move_pointer(wid, pointer, deviceid, *args)
         return pointer
 
+    def inject_pointer_motion(self, events):
+        #nested error traps do not flush,
+        #so the whole batch is sent to the X11 server in one go:
+        with xlog:
+            super().inject_pointer_motion(events)
+
     def _update_modifiers(self, proto, wid, modifiers):
         if self.readonly:
             return